@@ -15,9 +15,40 @@ cbuffer BasicPixelConstantBuffer : register(b0)
     Light light[MAX_LIGHTS];
 };
 
-static float3 DecodeNormalDX(float3 n)
+// Point and spot lights listed per cluster, see LightClusters. A spot
+// power of zero marks a point light.
+StructuredBuffer<Light> clusterLights : register(t4);
+StructuredBuffer<uint2> clusterRanges : register(t5);
+StructuredBuffer<uint> clusterLightIndices : register(t6);
+
+cbuffer ClusterConstantBuffer : register(b1)
+{
+    float4 viewDepth;
+    float2 viewportOrigin;
+    float2 tileScale;
+    float sliceScale;
+    float sliceBias;
+    uint clustersX;
+    uint clustersY;
+    uint clustersZ;
+    float nearZ;
+};
+
+static uint ClusterIndex(float2 pixel, float3 posWorld)
+{
+    float z = max(dot(float4(posWorld, 1.0f), viewDepth), nearZ);
+    uint slice = min(uint(max(log(z) * sliceScale + sliceBias, 0.0f)), clustersZ - 1);
+    uint2 tile = min(uint2(max(pixel - viewportOrigin, 0.0f) * tileScale),
+                     uint2(clustersX - 1, clustersY - 1));
+    return (slice * clustersY + tile.y) * clustersX + tile.x;
+}
+
+// Tangent space normals point out of the surface, so z follows from x and
+// y. BC5 normal maps only store those two.
+static float3 DecodeNormalDX(float2 n)
 {
-    return normalize(n * 2.0f - 1.0f);
+    float2 xy = n * 2.0f - 1.0f;
+    return normalize(float3(xy, sqrt(saturate(1.0f - dot(xy, xy)))));
 }
 
 float4 main(PixelShaderInput input) : SV_TARGET
@@ -34,7 +65,7 @@ float4 main(PixelShaderInput input) : SV_TARGET
 
         baseColor = baseColorTex.Sample(samp, input.texcoord).rgb;
 
-        float3 normalSample = normalTex.Sample(samp, input.texcoord).rgb;
+        float2 normalSample = normalTex.Sample(samp, input.texcoord).rg;
 
         float3 nTS = DecodeNormalDX(normalSample);
         float3x3 TBN = float3x3(normalize(input.tangentWorld), normalize(input.bitangentWorld), N);
@@ -57,8 +88,20 @@ float4 main(PixelShaderInput input) : SV_TARGET
 
     float3 color = 0.0f;
     color += ComputeDirectionalLight(light[0], mat, N, toEye);
-    color += ComputePointLight(light[1], mat, input.posWorld, N, toEye);
-    color += ComputeSpotLight(light[2], mat, input.posWorld, N, toEye);
+
+    // The ambient term comes once, with the directional light, however
+    // many clustered lights overlap.
+    Material clusterMat = mat;
+    clusterMat.ambient = 0.0f;
+    uint2 range = clusterRanges[ClusterIndex(input.posProj.xy, input.posWorld)];
+    for (uint i = 0; i < range.y; i++)
+    {
+        Light L = clusterLights[clusterLightIndices[range.x + i]];
+        if (L.spotPower > 0.0f)
+            color += ComputeSpotLight(L, clusterMat, input.posWorld, N, toEye);
+        else
+            color += ComputePointLight(L, clusterMat, input.posWorld, N, toEye);
+    }
 
     return float4(pow(max(color, 0.0f), 1.0 / 2.2), 1.0f);
 }
\ No newline at end of file
@@ -8,11 +8,30 @@ cbuffer BasicVertexConstantBuffer : register(b0)
     matrix projection;
 };
 
-PixelShaderInput main(VertexShaderInput input)
+// The world matrices of the instance, root included. model and
+// invTranspose above are the root alone, for the normal lines shader.
+struct InstanceInput
 {
+    float4 world0 : WORLD0;
+    float4 world1 : WORLD1;
+    float4 world2 : WORLD2;
+    float4 world3 : WORLD3;
+    float4 invTranspose0 : INVTRANSPOSE0;
+    float4 invTranspose1 : INVTRANSPOSE1;
+    float4 invTranspose2 : INVTRANSPOSE2;
+};
+
+PixelShaderInput main(VertexShaderInput input, InstanceInput instance)
+{
+    float4x4 world = float4x4(instance.world0, instance.world1,
+                              instance.world2, instance.world3);
+    float3x3 normalMatrix = float3x3(instance.invTranspose0.xyz,
+                                     instance.invTranspose1.xyz,
+                                     instance.invTranspose2.xyz);
+
     PixelShaderInput output;
     float4 pos = float4(input.posModel, 1.0f);
-    pos = mul(pos, model);
+    pos = mul(pos, world);
 
     output.posWorld = pos.xyz;
     
@@ -23,15 +42,11 @@ PixelShaderInput main(VertexShaderInput input)
     output.texcoord = input.texcoord;
     output.color = float3(0.0f, 0.0f, 0.0f);
     
-    float4 normal = float4(input.normalModel, 0.0f);
-    output.normalWorld = mul(normal, invTranspose).xyz;
+    output.normalWorld = mul(input.normalModel, normalMatrix);
     output.normalWorld = normalize(output.normalWorld);
     
-    float4 t = float4(input.tangentModel, 0.0f);
-    float4 b = float4(input.bitangentModel, 0.0f);
-    
-    output.tangentWorld = normalize(mul(t, invTranspose).xyz);
-    output.bitangentWorld = normalize(mul(b, invTranspose).xyz);
+    output.tangentWorld = normalize(mul(input.tangentModel, normalMatrix));
+    output.bitangentWorld = normalize(mul(input.bitangentModel, normalMatrix));
     
     return output;
 }
\ No newline at end of file
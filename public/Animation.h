@@ -0,0 +1,44 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SceneGraph.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Quaternion;
+	using DirectX::SimpleMath::Vector3;
+
+	struct VectorKey {
+        float time = 0.0f; // seconds
+        Vector3 value;
+	};
+
+    struct RotationKey {
+        float time = 0.0f;
+        Quaternion value;
+    };
+
+    // Keyframes of one node. Every list has at least one key; components
+    // the source didn't animate hold the node's bind pose.
+    struct NodeChannel {
+        uint32_t node = 0; // in the SceneGraph the clip was imported for
+        std::vector<VectorKey> positions;
+        std::vector<RotationKey> rotations;
+        std::vector<VectorKey> scales;
+    };
+
+    struct AnimationClip {
+        std::string name;
+        float duration = 0.0f; // seconds
+        std::vector<NodeChannel> channels;
+    };
+
+    // Sets the local matrix of every animated node to the clip's pose at
+    // time, wrapped into the clip. Keys are interpolated linearly, with
+    // slerp for rotations. Call SceneGraph::UpdateTransforms afterwards.
+    void SampleClip(const AnimationClip &clip, float time, SceneGraph &graph);
+}
@@ -10,6 +10,11 @@
 #include <windows.h>
 #include <wrl.h>
 
+#include "CacheFormats.h"
+#include "Logger.h"
+#include "PerfStats.h"
+#include "ShaderCache.h"
+
 namespace hlab {
 
 using Microsoft::WRL::ComPtr;
@@ -43,10 +48,26 @@ class AppBase {
     bool InitMainWindow();
     bool InitDirect3D();
     bool InitGUI();
+    void UpdateStatsGUI();
 
     void SetViewport();
     bool CreateRenderTargetView();
     bool CreateDepthBuffer();
+    // Shaders are built in batches. Queue* records a shader and where its
+    // objects go, CreateQueuedShaders takes the bytecode of each from the
+    // asset cache or compiles it, the misses in parallel, and creates the
+    // shader objects and input layouts once all are done. The Create*
+    // functions build a batch of one. inputElements must stay valid until
+    // the batch is created.
+    void QueueVertexShader(const wstring &filename,
+                           const vector<D3D11_INPUT_ELEMENT_DESC> &inputElements,
+                           ComPtr<ID3D11VertexShader> &vertexShader,
+                           ComPtr<ID3D11InputLayout> &inputLayout,
+                           const ShaderDefines &defines = {});
+    void QueuePixelShader(const wstring &filename,
+                          ComPtr<ID3D11PixelShader> &pixelShader,
+                          const ShaderDefines &defines = {});
+    void CreateQueuedShaders();
     void CreateVertexShaderAndInputLayout(
         const wstring &filename,
         const vector<D3D11_INPUT_ELEMENT_DESC> &inputElements,
@@ -59,14 +80,15 @@ class AppBase {
 
     template <typename T_VERTEX> 
     void CreateVertexBuffer(const vector<T_VERTEX>& vertices,
-        ComPtr<ID3D11Buffer>& vertexBuffer) {
+        ComPtr<ID3D11Buffer>& vertexBuffer, bool dynamic = false) {
 
+        // Dynamic buffers are rewritten with Map(WRITE_DISCARD).
         D3D11_BUFFER_DESC bufferDesc;
         ZeroMemory(&bufferDesc, sizeof(bufferDesc));
-        bufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+        bufferDesc.Usage = dynamic ? D3D11_USAGE_DYNAMIC : D3D11_USAGE_IMMUTABLE;
         bufferDesc.ByteWidth = UINT(sizeof(T_VERTEX) * vertices.size());
         bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-        bufferDesc.CPUAccessFlags = 0;
+        bufferDesc.CPUAccessFlags = dynamic ? D3D11_CPU_ACCESS_WRITE : 0;
         bufferDesc.StructureByteStride = sizeof(T_VERTEX);
 
         D3D11_SUBRESOURCE_DATA vertexBufferData = {0};
@@ -80,7 +102,10 @@ class AppBase {
         if (FAILED(hr)) {
             std::cout << "CreateBuffer() failed." << std::hex << hr
                       << std::endl;
+            return;
         };
+
+        m_gpuMemory.vertexBytes += bufferDesc.ByteWidth;
     }
 
     template <typename T_CONSTANT> 
@@ -104,7 +129,10 @@ class AppBase {
                                          constantBuffer.GetAddressOf());
         if (FAILED(hr)) {
             std::cout << "CreateConstantBuffer() falied()." << std::endl;
+            return;
         }
+
+        m_gpuMemory.constantBytes += cbDesc.ByteWidth;
     }
 
     template <typename T_DATA> 
@@ -121,9 +149,77 @@ class AppBase {
         m_context->Unmap(buffer.Get(), NULL);
     }
 
+    // Dynamic structured buffer of count elements for shaders to read
+    // through srv. Replaces whatever buffer was there.
+    template <typename T_ELEMENT>
+    void CreateStructuredBuffer(UINT count, ComPtr<ID3D11Buffer> &buffer,
+                                ComPtr<ID3D11ShaderResourceView> &srv) {
+
+        if (buffer) {
+            D3D11_BUFFER_DESC oldDesc;
+            buffer->GetDesc(&oldDesc);
+            m_gpuMemory.structuredBytes -= oldDesc.ByteWidth;
+        }
+        buffer.Reset();
+        srv.Reset();
+
+        D3D11_BUFFER_DESC bufferDesc;
+        ZeroMemory(&bufferDesc, sizeof(bufferDesc));
+        bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+        bufferDesc.ByteWidth = UINT(sizeof(T_ELEMENT)) * count;
+        bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+        bufferDesc.StructureByteStride = sizeof(T_ELEMENT);
+
+        HRESULT hr = m_device->CreateBuffer(&bufferDesc, nullptr,
+                                            buffer.GetAddressOf());
+        if (FAILED(hr)) {
+            std::cout << "CreateStructuredBuffer() failed." << std::hex << hr
+                      << std::endl;
+            return;
+        }
+
+        D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+        ZeroMemory(&srvDesc, sizeof(srvDesc));
+        srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+        srvDesc.Buffer.NumElements = count;
+        hr = m_device->CreateShaderResourceView(buffer.Get(), &srvDesc,
+                                                srv.GetAddressOf());
+        if (FAILED(hr)) {
+            std::cout << "CreateShaderResourceView() failed." << std::hex
+                      << hr << std::endl;
+        }
+
+        m_gpuMemory.structuredBytes += bufferDesc.ByteWidth;
+    }
+
+    // elements must fit the buffer.
+    template <typename T_ELEMENT>
+    void UpdateStructuredBuffer(const vector<T_ELEMENT> &elements,
+                                ComPtr<ID3D11Buffer> &buffer) {
+
+        D3D11_MAPPED_SUBRESOURCE ms;
+        if (FAILED(m_context->Map(buffer.Get(), NULL, D3D11_MAP_WRITE_DISCARD,
+                                  NULL, &ms)))
+            return;
+        memcpy(ms.pData, elements.data(), sizeof(T_ELEMENT) * elements.size());
+        m_context->Unmap(buffer.Get(), NULL);
+    }
+
     void CreateTexture(const std::string filename,
                        ComPtr<ID3D11Texture2D> &texture,
                        ComPtr<ID3D11ShaderResourceView> &textureResourceView, 
+                       bool useSRGB, bool normalMap = false);
+    // For images decoded in memory. name is only used in log messages.
+    void CreateTexture(const ImageData &image, const std::string &name,
+                       ComPtr<ID3D11Texture2D> &texture,
+                       ComPtr<ID3D11ShaderResourceView> &textureResourceView,
+                       bool useSRGB, bool normalMap = false);
+    void UploadTexture(const CachedTexture &cached, const std::string &name,
+                       ComPtr<ID3D11Texture2D> &texture,
+                       ComPtr<ID3D11ShaderResourceView> &textureResourceView,
                        bool useSRGB);
 
     public:
@@ -148,7 +244,22 @@ class AppBase {
 
     D3D11_VIEWPORT m_screenViewport;
 
+    FrameStats m_frameStats;
+    RenderCounters m_renderCounters;
+    GpuMemoryCounters m_gpuMemory;
+    LoaderTimings m_lastLoadTimings;
+
     private:
+    struct QueuedShader {
+        ShaderDesc desc;
+        wstring filename;
+        const vector<D3D11_INPUT_ELEMENT_DESC> *inputElements = nullptr;
+        ComPtr<ID3D11VertexShader> *vertexShader = nullptr;
+        ComPtr<ID3D11InputLayout> *inputLayout = nullptr;
+        ComPtr<ID3D11PixelShader> *pixelShader = nullptr;
+    };
+    vector<QueuedShader> m_queuedShaders;
+
     bool m_imguiWin32Inited = false;
     bool m_imguiDx11Inited = false;
     bool m_imguiContextCreated = false;
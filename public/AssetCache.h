@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CacheFormats.h"
+#include "MeshData.h"
+
+namespace hlab {
+
+	// Processed meshes, textures and shaders on disk, keyed by the XXH64 of
+	// the source bytes and everything that affects the result. The app and
+	// the tools share one directory: HLAB_ASSET_CACHE, or hlab_asset_cache in
+	// the temp directory. HLAB_ASSET_CACHE=off disables it, and
+	// HLAB_ASSET_CACHE_MB sets the size limit (4096 by default).
+	//
+	// Entries are written atomically, so other processes using the same
+	// directory only ever see complete files. Reads refresh the file time
+	// and the oldest files are evicted once the limit is exceeded.
+	class AssetCache {
+      public:
+        static AssetCache &Get();
+
+        bool Enabled() const { return !m_directory.empty(); }
+        const std::filesystem::path &Directory() const { return m_directory; }
+        // An empty path disables the cache.
+        void SetDirectory(const std::filesystem::path &directory);
+        void SetMaxBytes(uint64_t bytes) { m_maxBytes = bytes; }
+
+        bool LoadMeshes(uint64_t key, std::vector<MeshData> &meshes);
+        void StoreMeshes(uint64_t key, const std::vector<MeshData> &meshes);
+
+        // Where a streamed model's chunk file goes. MeshStreamer writes it
+        // directly, the next scan counts it toward the limit.
+        std::filesystem::path ChunkFilePath(uint64_t key) const {
+            return EntryPath(key, ".hlchunks");
+        }
+
+        // Decodes, mips and compresses the image on a miss. baseColor and
+        // other non-normal maps become BC1, normal maps stay uncompressed
+        // RGBA8, unless AssetBuild stored them as BC5. Returns false only if
+        // the source can't be decoded.
+        bool LoadTexture(const std::string &filename, bool srgb, bool normalMap,
+                         CachedTexture &texture);
+        // The same for an image decoded in memory, keyed by its pixels.
+        bool LoadTexture(const ImageData &image, bool srgb, bool normalMap,
+                         CachedTexture &texture);
+
+        // Where LoadTexture and LoadMeshes look, so AssetBuild can write
+        // entries the app hits. sourceHash is the HashFile of a texture
+        // file or the ImageHash of a decoded image, key the cacheKey of a
+        // ModelLoader.
+        std::filesystem::path TexturePath(uint64_t sourceHash, bool srgb,
+                                          bool normalMap) const {
+            return EntryPath(TextureKey(sourceHash, srgb, normalMap), ".hltx");
+        }
+        std::filesystem::path MeshesPath(uint64_t key) const {
+            return EntryPath(key, ".hlmesh");
+        }
+        static uint64_t ImageHash(const ImageData &image);
+
+        // Compiled shader bytecode, keyed by ShaderCacheKey.
+        bool LoadShader(uint64_t key, std::vector<uint8_t> &bytecode);
+        void StoreShader(uint64_t key, const std::vector<uint8_t> &bytecode);
+
+        // Removes the least recently used files until the directory is
+        // below 90% of the limit.
+        void Trim();
+
+      private:
+        AssetCache();
+
+        std::filesystem::path EntryPath(uint64_t key, const char *extension) const;
+        uint64_t TextureKey(uint64_t sourceHash, bool srgb, bool normalMap) const;
+        // Stores the result under key unless it is 0.
+        void BuildTexture(const ImageData &image, bool srgb, bool normalMap,
+                          uint64_t key, CachedTexture &texture);
+        bool Read(const std::filesystem::path &path, std::vector<uint8_t> &bytes);
+        void Write(const std::filesystem::path &path,
+                   const std::vector<uint8_t> &bytes);
+
+        std::filesystem::path m_directory;
+        uint64_t m_maxBytes = 4096ull << 20;
+
+        // Bytes in the directory as of the last scan plus what this process
+        // wrote since. Other processes' writes are found by the next scan.
+        std::atomic<uint64_t> m_approxBytes{0};
+        std::atomic<bool> m_scanned{false};
+        std::mutex m_trimMutex;
+	};
+}
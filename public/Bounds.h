@@ -0,0 +1,27 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <vector>
+
+#include "Vertex.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+	using DirectX::SimpleMath::Vector3;
+
+	struct MeshBounds {
+        Vector3 aabbMin = Vector3(0.0f);
+        Vector3 aabbMax = Vector3(0.0f);
+        Vector3 center = Vector3(0.0f);
+        float radius = 0.0f;
+
+        void Merge(const MeshBounds &other);
+
+        // Bounds of this volume after an affine transform. The sphere
+        // radius is scaled by the largest axis scale of m.
+        MeshBounds Transformed(const Matrix &m) const;
+	};
+
+    MeshBounds ComputeBounds(const std::vector<Vertex> &vertices);
+}
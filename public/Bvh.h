@@ -0,0 +1,231 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include <xmmintrin.h>
+
+#include "MeshData.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Vector3;
+
+	struct Aabb {
+        Vector3 min = Vector3(FLT_MAX);
+        Vector3 max = Vector3(-FLT_MAX);
+
+        void Grow(const Vector3 &p) {
+            min = Vector3::Min(min, p);
+            max = Vector3::Max(max, p);
+        }
+        void Grow(const Aabb &b) {
+            min = Vector3::Min(min, b.min);
+            max = Vector3::Max(max, b.max);
+        }
+        Vector3 Center() const { return (min + max) * 0.5f; }
+        float HalfArea() const {
+            const Vector3 e = max - min;
+            return e.x < 0.0f ? 0.0f : e.x * e.y + e.y * e.z + e.z * e.x;
+        }
+	};
+
+    struct Ray {
+        Vector3 origin;
+        Vector3 direction; // need not be normalized, t is in its units
+        float tMax = FLT_MAX;
+    };
+
+    struct RayHit {
+        bool hit = false;
+        float t = FLT_MAX;
+        uint32_t mesh = 0;
+        uint32_t triangle = 0;
+        float u = 0.0f; // barycentric weight of the triangle's second vertex
+        float v = 0.0f; // barycentric weight of the third vertex
+    };
+
+    // Four-wide BVH. A binary tree is built with binned SAH and collapsed
+    // so every traversal step tests four child boxes at once with SSE.
+    class Bvh4 {
+      public:
+        static const uint32_t kInvalid = 0xffffffffu;
+
+        struct Node {
+            float minX[4], minY[4], minZ[4];
+            float maxX[4], maxY[4], maxZ[4];
+            uint32_t child[4]; // node index, or first primitive for leaves
+            uint32_t count[4]; // 0 for inner children
+        };
+
+        // Traversal keeps this many entries on the stack before it
+        // switches to a heap one.
+        static const uint32_t kInlineStack = 64;
+
+        void Build(const std::vector<Aabb> &primBounds);
+        // Recomputes the node boxes for moved primitives. The tree keeps
+        // the shape Build gave it, so it stays correct but gets slower to
+        // traverse the further the primitives move.
+        void Refit(const std::vector<Aabb> &primBounds);
+
+        bool Empty() const { return m_nodes.empty(); }
+        const std::vector<uint32_t> &PrimIndices() const { return m_primIndices; }
+        // Levels of nodes, 1 for a lone root. SAH splits can be lopsided,
+        // so this is not bounded by the primitive count's logarithm.
+        uint32_t Depth() const { return m_depth; }
+
+        // leaf(primIndex, tMax) tests one primitive and shrinks tMax on a
+        // hit. Children are visited near to far.
+        template <typename LeafFn>
+        void Traverse(const Ray &ray, float &tMax, LeafFn &&leaf) const;
+
+      private:
+        std::vector<Node> m_nodes;
+        std::vector<uint32_t> m_primIndices;
+        uint32_t m_depth = 0;
+    };
+
+    struct TriangleMeshBvh {
+        Aabb bounds;
+        std::vector<Vector3> positions;
+        std::vector<uint32_t> indices;
+        Bvh4 bvh;
+
+        void Build(const MeshData &mesh);
+        // vertices must be the mesh's, moved.
+        void Refit(const std::vector<Vertex> &vertices);
+        bool Intersect(const Ray &ray, float &tMax, RayHit &hit) const;
+
+      private:
+        std::vector<Aabb> TriangleBounds() const;
+    };
+
+    class ScenePicker {
+      public:
+        // Per-mesh BVHs are built in parallel, then a top-level BVH over
+        // the mesh bounds.
+        void Build(const std::vector<MeshData> &meshes);
+
+        RayHit Intersect(const Ray &ray) const;
+        // Tests one mesh with the ray in that mesh's model space. On a hit
+        // closer than tMax, fills hit, shrinks tMax and returns true.
+        bool IntersectMesh(uint32_t mesh, const Ray &ray, float &tMax,
+                           RayHit &hit) const;
+        size_t MeshCount() const { return m_meshes.size(); }
+
+        // For skinned and morphed meshes, whose vertices move after Build.
+        void RefitMesh(uint32_t mesh, const std::vector<Vertex> &vertices);
+
+        // Places instances of the meshes in the world for
+        // IntersectInstances. The BVH over their world boxes is rebuilt
+        // when the count changes and refit otherwise.
+        void SetInstances(const std::vector<uint32_t> &meshes,
+                          const std::vector<Matrix> &worlds,
+                          const std::vector<MeshBounds> &worldBounds);
+        // Nearest hit of a world space ray. The ray is moved into the model
+        // space of every instance whose box it crosses, so t stays in the
+        // units of ray.direction. Sets instance on a hit.
+        RayHit IntersectInstances(const Ray &ray, uint32_t &instance) const;
+
+      private:
+        std::vector<TriangleMeshBvh> m_meshes;
+        Bvh4 m_top;
+
+        std::vector<uint32_t> m_instanceMeshes;
+        std::vector<Matrix> m_instanceWorlds;
+        Bvh4 m_instanceTop;
+    };
+
+    template <typename LeafFn>
+    void Bvh4::Traverse(const Ray &ray, float &tMax, LeafFn &&leaf) const {
+        if (m_nodes.empty())
+            return;
+
+        const float ix = 1.0f / ray.direction.x;
+        const float iy = 1.0f / ray.direction.y;
+        const float iz = 1.0f / ray.direction.z;
+
+        const __m128 ox = _mm_set1_ps(ray.origin.x);
+        const __m128 oy = _mm_set1_ps(ray.origin.y);
+        const __m128 oz = _mm_set1_ps(ray.origin.z);
+        const __m128 idx = _mm_set1_ps(ix);
+        const __m128 idy = _mm_set1_ps(iy);
+        const __m128 idz = _mm_set1_ps(iz);
+
+        struct Entry {
+            uint32_t node;
+            float tNear;
+        };
+        // Every level pops one node and pushes at most four inner
+        // children, so 3 * depth + 1 entries always suffice.
+        const uint32_t stackSize = 3 * m_depth + 1;
+        Entry inlineStack[kInlineStack];
+        std::vector<Entry> heapStack;
+        Entry *stack = inlineStack;
+        if (stackSize > kInlineStack) {
+            heapStack.resize(stackSize);
+            stack = heapStack.data();
+        }
+        uint32_t top = 0;
+        stack[top++] = {0, 0.0f};
+
+        while (top > 0) {
+            const Entry e = stack[--top];
+            if (e.tNear > tMax)
+                continue;
+
+            const Node &n = m_nodes[e.node];
+
+            const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.minX), ox), idx);
+            const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.maxX), ox), idx);
+            const __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.minY), oy), idy);
+            const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.maxY), oy), idy);
+            const __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.minZ), oz), idz);
+            const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.maxZ), oz), idz);
+
+            __m128 tNear = _mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1));
+            tNear = _mm_max_ps(tNear, _mm_min_ps(tz0, tz1));
+            tNear = _mm_max_ps(tNear, _mm_setzero_ps());
+            __m128 tFar = _mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1));
+            tFar = _mm_min_ps(tFar, _mm_max_ps(tz0, tz1));
+            tFar = _mm_min_ps(tFar, _mm_set1_ps(tMax));
+
+            const int mask = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+            if (!mask)
+                continue;
+
+            alignas(16) float nearDist[4];
+            _mm_store_ps(nearDist, tNear);
+
+            // Push far children first so the nearest is popped next.
+            int order[4];
+            int hits = 0;
+            for (int i = 0; i < 4; i++) {
+                if ((mask & (1 << i)) && n.child[i] != kInvalid)
+                    order[hits++] = i;
+            }
+            for (int a = 1; a < hits; a++) {
+                const int key = order[a];
+                int b = a - 1;
+                while (b >= 0 && nearDist[order[b]] < nearDist[key]) {
+                    order[b + 1] = order[b];
+                    b--;
+                }
+                order[b + 1] = key;
+            }
+
+            for (int h = 0; h < hits; h++) {
+                const int i = order[h];
+                if (n.count[i] == 0) {
+                    stack[top++] = {n.child[i], nearDist[i]};
+                } else {
+                    // Leaves are tested right away so a hit tightens tMax
+                    // before the pushed inner nodes are popped.
+                    for (uint32_t p = 0; p < n.count[i]; p++)
+                        leaf(m_primIndices[n.child[i] + p], tMax);
+                }
+            }
+        }
+    }
+}
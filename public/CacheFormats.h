@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+namespace hlab {
+
+	// Binary formats written by the asset build and the asset cache. All
+	// values are little-endian. A version bump invalidates old files.
+	const uint32_t kMeshCacheVersion = 2;
+	const uint32_t kTextureCacheVersion = 1;
+    // Chunk files of streamed models, see MeshStreamer.
+    const uint32_t kChunkFileVersion = 2;
+    // Shader bytecode is stored as D3DCompile returned it.
+    const uint32_t kShaderCacheVersion = 1;
+
+    enum class TextureFormat : uint32_t { RGBA8 = 0, BC1 = 1, BC5 = 2 };
+
+    struct TextureMip {
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> data;
+    };
+
+    struct CachedTexture {
+        TextureFormat format = TextureFormat::RGBA8;
+        bool srgb = false;
+        std::vector<TextureMip> mips;
+    };
+
+    // Vertices, indices, meshlets, bounds and texture paths of every mesh.
+    void SerializeMeshes(const std::vector<MeshData> &meshes,
+                         std::vector<uint8_t> &out);
+    bool DeserializeMeshes(const uint8_t *data, size_t size,
+                           std::vector<MeshData> &meshes);
+
+    void SerializeTexture(const CachedTexture &texture,
+                          std::vector<uint8_t> &out);
+    bool DeserializeTexture(const uint8_t *data, size_t size,
+                            CachedTexture &texture);
+
+    bool ReadFileBytes(const std::string &filename, std::vector<uint8_t> &data);
+
+    // Writes to a unique temporary file next to the target and renames it
+    // over the target, so readers never see a partial file.
+    bool WriteFileAtomic(const std::string &filename, const void *data,
+                         size_t size);
+}
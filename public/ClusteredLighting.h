@@ -0,0 +1,111 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+#include <vector>
+
+#include "Bvh.h"
+#include "ConstantBuffers.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+	using DirectX::SimpleMath::Vector3;
+
+	// Clustered forward lighting. The view volume is split into
+	// kClustersX x kClustersY screen tiles and kClustersZ depth slices that
+	// grow exponentially from near to far, and every light is listed in the
+	// clusters its range reaches. The pixel shader finds its cluster from
+	// its screen position and view depth and shades only those lights.
+	//
+	// Lights use the Light layout of the constant buffer, in world space.
+	// A spotPower of zero marks a point light. A spot light is also tested
+	// against the cone outside which pow(cos, spotPower) drops below
+	// kSpotCutoff.
+	class LightClusters {
+      public:
+        static const uint32_t kClustersX = 16;
+        static const uint32_t kClustersY = 9;
+        static const uint32_t kClustersZ = 24;
+        static const uint32_t kClusterCount = kClustersX * kClustersY * kClustersZ;
+        static const float kSpotCutoff;
+
+        // Lights of a cluster are LightIndices()[offset, offset + count).
+        struct Range {
+            uint32_t offset = 0;
+            uint32_t count = 0;
+        };
+
+        // projection uses the row-vector convention, the viewport is in
+        // render target pixels. Cluster bounds are only recomputed when one
+        // of them changed.
+        void SetProjection(const Matrix &projection, float nearZ, float farZ,
+                           float viewportX, float viewportY, float width,
+                           float height);
+
+        // Rebuilds the light lists for the camera view. Rows of clusters
+        // are filled in parallel.
+        void Assign(const std::vector<Light> &lights, const Matrix &view);
+
+        static uint32_t Index(uint32_t x, uint32_t y, uint32_t z) {
+            return (z * kClustersY + y) * kClustersX + x;
+        }
+        const std::vector<Range> &Ranges() const { return m_ranges; }
+        const std::vector<uint32_t> &LightIndices() const { return m_indices; }
+        // View space box of a cluster.
+        const Aabb &Bounds(uint32_t cluster) const { return m_bounds[cluster]; }
+        // For the shader; viewDepth follows the last Assign.
+        const ClusterConstantBuffer &Constants() const { return m_constants; }
+
+      private:
+        // A light moved to view space, with the sine and cosine of its
+        // cone's half angle. Point lights have cosAngle -1.
+        struct ViewLight {
+            Vector3 position;
+            float range;
+            Vector3 direction;
+            float cosAngle;
+            float sinAngle;
+        };
+
+        // Cluster boxes of a row in SoA form, for the per-light test.
+        struct RowBounds {
+            Aabb box;
+            float minX[kClustersX], minY[kClustersX], minZ[kClustersX];
+            float maxX[kClustersX], maxY[kClustersX], maxZ[kClustersX];
+        };
+
+        // A row of clusters across the screen in one slice, with its
+        // scratch lists kept between frames.
+        struct Row {
+            RowBounds bounds;
+            std::vector<uint32_t> hitLights;
+            std::vector<uint32_t> hitMasks; // bit x for cluster x
+            std::vector<uint32_t> indices;
+        };
+
+        // Per slice, the lights whose depth range reaches it. Spheres are
+        // in SoA form padded to four lanes.
+        struct SliceLights {
+            std::vector<uint32_t> ids;
+            std::vector<float> x, y, z, r;
+        };
+
+        void BuildBounds();
+        uint32_t Slice(float depth) const;
+        void AssignRow(uint32_t row);
+
+        Matrix m_projection;
+        float m_nearZ = 0.0f;
+        float m_farZ = 0.0f;
+        float m_viewport[4] = {};
+        std::vector<Aabb> m_bounds; // per cluster
+        std::vector<Row> m_rows;    // slice * kClustersY + y
+
+        std::vector<ViewLight> m_viewLights;
+        std::vector<SliceLights> m_sliceLights;
+        std::vector<Range> m_ranges;
+        std::vector<uint32_t> m_indices;
+        ClusterConstantBuffer m_constants = {};
+	};
+}
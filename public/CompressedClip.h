@@ -0,0 +1,69 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Animation.h"
+#include "SceneGraph.h"
+
+namespace hlab {
+
+	struct ClipCompression {
+        // Largest position error of a joint from dropping keys, as a
+        // fraction of the skeleton's size. Rotation and scale keys of a
+        // bone get the tolerance that keeps the joints below it within
+        // that distance. Quantization adds about 2e-5 radians per bone.
+        float precision = 1e-4f;
+        // Length of the blocks keys are grouped in.
+        float segmentDuration = 0.5f;
+	};
+
+    // An AnimationClip with redundant keys removed and the rest quantized:
+    // rotations as the smallest three components at 15 bits, positions
+    // and scales at 16 bits over the range of their track. Every key,
+    // time included, takes 8 bytes.
+    //
+    // Keys are grouped into segments of segmentDuration, each holding its
+    // own first and last key, so a pose reads one contiguous block: the
+    // segments in time order, in each the channels in order, and per
+    // channel the position, rotation and scale keys.
+    struct CompressedClip {
+        struct Range {
+            Vector3 min;
+            Vector3 scale; // per quantization step
+        };
+
+        std::string name;
+        float duration = 0.0f;
+        float segmentDuration = 0.0f;
+        std::vector<uint32_t> nodes; // per channel
+        std::vector<Range> positionRanges;
+        std::vector<Range> scaleRanges;
+        // Segment s is data[segmentOffsets[s], segmentOffsets[s + 1]),
+        // starting with 3 key counts per channel.
+        std::vector<uint32_t> segmentOffsets;
+        std::vector<uint16_t> data;
+
+        size_t SizeBytes() const;
+    };
+
+    // graph is the one the clip was imported for, in its bind pose with
+    // world matrices up to date.
+    CompressedClip CompressClip(const AnimationClip &clip, const SceneGraph &graph,
+                                const ClipCompression &settings = ClipCompression());
+
+    size_t ClipSizeBytes(const AnimationClip &clip);
+
+    // Writes the local matrix of every channel at time, wrapped into the
+    // clip, to locals[channel]. Rotations are blended with normalized
+    // lerp, four components at a time with SSE.
+    void SampleCompressedClip(const CompressedClip &clip, float time,
+                              Matrix *locals);
+
+    // The same, applied to the clip's nodes in graph. scratch avoids
+    // allocating per call.
+    void SampleCompressedClip(const CompressedClip &clip, float time,
+                              SceneGraph &graph, std::vector<Matrix> &scratch);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+
+#include "Material.h"
+
+// Shared by the D3D11 app and the software renderer, so this header must
+// stay free of D3D types.
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+	using DirectX::SimpleMath::Vector2;
+	using DirectX::SimpleMath::Vector3;
+	using DirectX::SimpleMath::Vector4;
+
+	struct Light {
+        Vector3 strength = Vector3(1.0f);
+        float fallOffStart = 0.0f;
+        Vector3 direction = Vector3(0.0f, 0.0f, 1.0f);
+        float fallOffEnd = 10.0f;
+        Vector3 position = Vector3(0.0f, 0.0f, -2.0f);
+        float spotPower = 1.0f;
+	};
+
+    struct BasicVertexConstantBuffer {
+        Matrix model;
+        Matrix invTranspose;
+        Matrix view;
+        Matrix projection;
+    };
+
+    static_assert((sizeof(BasicVertexConstantBuffer) % 16) == 0, 
+        "Constant Buffer size is 16-byte aligned");
+    
+    #define MAX_LIGHTS 3
+
+    struct BasicPixelConstantBuffer {
+        Vector3 eyeWorld;
+        int useTexture;
+        Material material;
+        Light lights[MAX_LIGHTS];
+    };
+
+     static_assert((sizeof(BasicPixelConstantBuffer) % 16) == 0,
+                  "Constant Buffer size is 16-byte aligned");
+
+     // Finds the cluster of a pixel, see LightClusters.
+     struct ClusterConstantBuffer {
+         Vector4 viewDepth; // view z = dot(float4(posWorld, 1), viewDepth)
+         Vector2 viewportOrigin;
+         Vector2 tileScale; // tiles per pixel
+         float sliceScale;  // slice = log(z) * sliceScale + sliceBias
+         float sliceBias;
+         uint32_t clustersX;
+         uint32_t clustersY;
+         uint32_t clustersZ;
+         float nearZ;
+         float dummy[2];
+     };
+
+     static_assert((sizeof(ClusterConstantBuffer) % 16) == 0,
+                   "Constant Buffer size is 16-byte aligned");
+
+     struct NormalVertexConstantBuffer {
+         float scale = 0.1f;
+         float dummy[3];
+     };
+}
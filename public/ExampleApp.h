@@ -5,8 +5,18 @@
 #include <memory>
 
 #include "AppBase.h"
+#include "Bvh.h"
+#include "ClusteredLighting.h"
+#include "CompressedClip.h"
+#include "ConstantBuffers.h"
+#include "FrustumCulling.h"
 #include "GeometryGenerator.h"
-#include "Material.h"
+#include "InstanceStore.h"
+#include "Mesh.h"
+#include "Morphing.h"
+#include "OcclusionCulling.h"
+#include "Skinning.h"
+#include "SpatialGrid.h"
 
 namespace hlab {
 
@@ -15,42 +25,6 @@ namespace hlab {
 	using DirectX::SimpleMath::Vector3;
 	using DirectX::SimpleMath::Vector4;
 
-	struct Light {
-        Vector3 strength = Vector3(1.0f);
-        float fallOffStart = 0.0f;
-        Vector3 direction = Vector3(0.0f, 0.0f, 1.0f);
-        float fallOffEnd = 10.0f;
-        Vector3 position = Vector3(0.0f, 0.0f, -2.0f);
-        float spotPower = 1.0f;
-	};
-
-    struct BasicVertexConstantBuffer {
-        Matrix model;
-        Matrix invTranspose;
-        Matrix view;
-        Matrix projection;
-    };
-
-    static_assert((sizeof(BasicVertexConstantBuffer) % 16) == 0, 
-        "Constant Buffer size is 16-byte aligned");
-    
-    #define MAX_LIGHTS 3
-
-    struct BasicPixelConstantBuffer {
-        Vector3 eyeWorld;
-        int useTexture;
-        Material material;
-        Light lights[MAX_LIGHTS];
-    };
-
-     static_assert((sizeof(BasicPixelConstantBuffer) % 16) == 0,
-                  "Constant Buffer size is 16-byte aligned");
-
-     struct NormalVertexConstantBuffer {
-         float scale = 0.1f;
-         float dummy[3];
-     };
-
      class ExampleApp : public AppBase {
        public:
          ExampleApp();
@@ -60,12 +34,119 @@ namespace hlab {
          virtual void Update(float dt) override;
          virtual void Render() override;
 
+         virtual void OnMouseDown(WPARAM btnState, int x, int y) override;
+
          protected:
          ComPtr<ID3D11VertexShader> m_basicVertexShader;
          ComPtr<ID3D11PixelShader> m_basicPixelShader;
          ComPtr<ID3D11InputLayout> m_basicInputLayout;
 
+         ComPtr<ID3D11InputLayout> m_normalInputLayout;
+
+         void SelectOccluders(const vector<MeshData> &meshes);
+         void PlaceInstances();
+         void CullInstances(const Matrix &viewProj);
+         void UpdateInstanceBuffer();
+         void PlaceLights();
+         void UpdateLightClusters(const Matrix &root);
+         void UpdateDeformedMeshes(float dt);
+         void UpdatePicker();
+
+         // Mesh and material handles of m_instances index these.
          std::vector<shared_ptr<Mesh>> m_meshes;
+         struct MaterialBinding {
+             ID3D11ShaderResourceView *srvs[3] = {};
+         };
+         std::vector<MaterialBinding> m_materials;
+         std::vector<uint32_t> m_meshMaterials; // per mesh
+
+         // Per-instance vertex stream of the basic shader, row-vector
+         // matrices as in the store. The normal matrix only needs three
+         // rows.
+         struct InstanceVertex {
+             Matrix world;
+             Vector4 normalRows[3];
+         };
+         InstanceStore m_instances;
+         int m_instanceGrid = 1; // copies of the model per side
+         ComPtr<ID3D11Buffer> m_instanceBuffer; // one slot per instance
+         double m_instanceUpdateMs = 0.0;
+         double m_cullMs = 0.0;
+
+         // Over the world bounds of m_instances, for region queries.
+         SpatialGrid m_spatialIndex;
+         size_t m_litInstances = 0;
+         double m_lightQueryUs = 0.0;
+
+         // Point and spot lights shaded per cluster. The GUI light comes
+         // first when it is a point or spot light, then m_gridLights,
+         // whose positions are in grid space like instance transforms.
+         int m_clusteredLightCount = 256;
+         std::vector<Light> m_gridLights;
+         std::vector<Light> m_sceneLights; // world space, as uploaded
+         LightClusters m_lightClusters;
+         double m_lightAssignMs = 0.0;
+         ComPtr<ID3D11Buffer> m_clusterConstantBuffer;
+         ComPtr<ID3D11Buffer> m_lightBuffer;
+         ComPtr<ID3D11ShaderResourceView> m_lightSRV;
+         ComPtr<ID3D11Buffer> m_clusterRangeBuffer;
+         ComPtr<ID3D11ShaderResourceView> m_clusterRangeSRV;
+         ComPtr<ID3D11Buffer> m_lightIndexBuffer;
+         ComPtr<ID3D11ShaderResourceView> m_lightIndexSRV;
+         UINT m_lightCapacity = 0;
+         UINT m_lightIndexCapacity = 0;
+
+         // In submission order. Slot i of the instance buffer holds
+         // m_visibleInstances[i].
+         bool m_useFrustumCulling = true;
+         std::vector<uint32_t> m_visibleInstances;
+
+         bool m_useOcclusionCulling = true;
+         OcclusionBuffer m_occlusionBuffer;
+         std::vector<OccluderMesh> m_occluders;
+         size_t m_occludedInstances = 0;
+         double m_occlusionMs = 0.0;
+
+         // Per visible instance, what Render draws of it.
+         bool m_useMeshletCulling = true;
+         bool m_useMeshletBackfaceCulling = true;
+         std::vector<std::vector<IndexRange>> m_drawRanges;
+         size_t m_visibleMeshlets = 0;
+         size_t m_totalMeshlets = 0;
+
+         // Skinned and morphed meshes keep their base vertices on the CPU
+         // and are rewritten into a dynamic vertex buffer when they change,
+         // skinned ones every frame.
+         struct DeformedMesh {
+             uint32_t mesh = 0; // into m_meshes
+             MeshData data;
+             std::vector<Matrix> joints;
+             std::vector<float> morphWeights; // per target
+             std::vector<VertexRange> morphRanges;
+             std::vector<Vertex> morphed; // data with morphWeights applied
+             MeshBounds morphedBounds;
+             bool morphsChanged = true;
+             bool pickStale = false; // moved since m_picker was refit
+         };
+         ModelAnimation m_animation;
+         // Replace m_animation.clips, whose raw keys are dropped after
+         // compression.
+         std::vector<CompressedClip> m_clips;
+         std::vector<Matrix> m_pose;
+         size_t m_rawClipBytes = 0;
+         size_t m_clipBytes = 0;
+         std::vector<DeformedMesh> m_deformedMeshes;
+         bool m_playAnimation = true;
+         float m_animationTime = 0.0f;
+         double m_deformMs = 0.0;
+
+         ScenePicker m_picker;
+         // Instances moved since m_picker's instances were set.
+         bool m_pickInstancesStale = true;
+         std::vector<Vertex> m_pickVertices; // skinned for the picker
+         RayHit m_lastPick;
+         uint32_t m_lastPickInstance = 0;
+         double m_lastPickUs = 0.0;
 
          ComPtr<ID3D11SamplerState> m_samplerState;
 
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+namespace hlab {
+
+	// Static meshes straight from binary FBX 7.x, without Assimp. The
+	// output follows what ModelLoader builds from Assimp with kImportFlags:
+	// one mesh per model and material, triangulated, identical vertices
+	// joined, node transforms applied, left-handed with flipped V.
+	// Triangles and quads split exactly like Assimp; larger polygons are
+	// ear clipped too but may pick different diagonals.
+	//
+	// Load returns false for content it doesn't cover (ASCII files,
+	// skinning, blend shapes, animation, unusual layer mappings) so the
+	// caller can fall back to Assimp.
+	class FbxLoader {
+      public:
+        bool Load(const std::string &filename);
+
+        std::vector<MeshData> meshes;
+        std::vector<int> meshMaterials; // index into materialNames, or -1
+        std::vector<std::string> materialNames;
+	};
+}
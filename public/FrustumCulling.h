@@ -0,0 +1,60 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+#include <vector>
+
+#include "Bounds.h"
+#include "MeshData.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+	using DirectX::SimpleMath::Vector3;
+	using DirectX::SimpleMath::Vector4;
+
+	struct Frustum {
+        // Normalized planes, inside where dot(n, p) + d >= 0.
+        Vector4 planes[6];
+
+        // viewProj uses the row-vector convention (not transposed for HLSL).
+        static Frustum FromViewProjection(const Matrix &viewProj);
+	};
+
+    // Bounding spheres in structure-of-arrays form, padded to a multiple
+    // of four so the culler can always load full SIMD lanes.
+    struct SphereSoA {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> r;
+        size_t count = 0;
+
+        void Resize(size_t n);
+        void Set(size_t i, const Vector3 &center, float radius);
+    };
+
+    // Appends the indices of spheres intersecting the frustum to visible.
+    void CullSpheres(const Frustum &frustum, const SphereSoA &spheres,
+                     std::vector<uint32_t> &visible);
+    // The same over the lanes [begin, end), begin a multiple of four.
+    void CullSpheres(const Frustum &frustum, const SphereSoA &spheres,
+                     size_t begin, size_t end, std::vector<uint32_t> &visible);
+
+    struct IndexRange {
+        uint32_t offset = 0;
+        uint32_t count = 0;
+    };
+
+    // Index ranges covering the meshlets that pass the frustum and, with
+    // cullBackfaces, face the eye, in index buffer order. Ranges less than
+    // kMaxRangeGap indices apart are merged, drawing a few hidden triangles
+    // to save a draw call. frustum and eye are in the mesh's model space;
+    // spheres holds the meshlet spheres. visible is scratch.
+    const uint32_t kMaxRangeGap = 3 * 256;
+    void CullMeshlets(const Frustum &frustum, const Vector3 &eye,
+                      const std::vector<Meshlet> &meshlets,
+                      const SphereSoA &spheres, bool cullBackfaces,
+                      std::vector<uint32_t> &visible,
+                      std::vector<IndexRange> &ranges);
+}
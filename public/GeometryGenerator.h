@@ -6,13 +6,18 @@
 
 #include "Vertex.h"
 #include "MeshData.h"
+#include "PerfStats.h"
+#include "Skinning.h"
 
 namespace hlab {
 
 	class GeometryGenerator {
 		public:
+        // animation receives the skeleton and clips of skinned models,
+        // with root undoing the normalization applied to the vertices.
         static vector<MeshData> ReadFromFile(std::string basePath, 
-            std::string filename);
+            std::string filename, LoaderTimings *timings = nullptr,
+            ModelAnimation *animation = nullptr);
         static MeshData MakeSquare();
         static MeshData MakeBox();
         static MeshData MakeCylinder(const float bottomRadius,
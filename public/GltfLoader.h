@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+namespace hlab {
+
+	// glTF 2.0 (.glb and .gltf) without Assimp. Accessors are read in
+	// place from the mapped file, and the output matches ModelLoader's
+	// Assimp path with kImportFlags: one mesh per primitive, node
+	// transforms applied, left-handed with flipped winding.
+	//
+	// Materials map to the engine's slots: baseColorTexture, normalTexture
+	// and metallicRoughnessTexture as the ORM map. Images stored in the
+	// file and every metallic-roughness image are decoded in parallel into
+	// MeshData's images; other external images are passed as filenames.
+	//
+	// Load returns false for content it doesn't cover (skins, morph
+	// targets, animations, sparse accessors, required extensions) so the
+	// caller can fall back to Assimp.
+	class GltfLoader {
+      public:
+        bool Load(const std::string &filename);
+
+        std::vector<MeshData> meshes;
+        std::vector<int> meshMaterials; // index into materialNames, or -1
+        std::vector<std::string> materialNames;
+	};
+}
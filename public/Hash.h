@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace hlab {
+
+	// Streaming XXH64. Output matches the reference implementation, so
+	// keys stay stable across platforms and releases.
+	class Hasher64 {
+      public:
+        explicit Hasher64(uint64_t seed = 0);
+
+        void Update(const void *data, size_t size);
+        void Update(const std::string &s) { Update(s.data(), s.size()); }
+        template <typename T> void UpdateValue(const T &value) {
+            Update(&value, sizeof(T));
+        }
+
+        uint64_t Digest() const;
+
+      private:
+        uint64_t m_acc[4];
+        uint64_t m_seed;
+        uint64_t m_total = 0;
+        uint8_t m_buffer[32];
+        size_t m_buffered = 0;
+	};
+
+    uint64_t HashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+    // Streams the file through the hasher. Returns false if it can't be read.
+    bool HashFile(const std::string &filename, uint64_t &hash);
+
+    // 16 lowercase hex digits, used for cache file names.
+    std::string HashToString(uint64_t hash);
+}
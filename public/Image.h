@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace hlab {
+
+	struct ImageData {
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> pixels; // RGBA8, row-major, tightly packed
+	};
+
+    bool LoadImageRGBA(const std::string &filename, ImageData &image);
+    bool LoadImageRGBAFromMemory(const uint8_t *data, size_t size,
+                                 ImageData &image);
+
+    // Writes an 8-bit RGBA PNG. The zlib stream uses stored blocks, trading
+    // file size for a writer with no dependencies.
+    bool WritePng(const std::string &filename, const ImageData &image);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+#include <vector>
+
+#include "Bounds.h"
+#include "FrustumCulling.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+
+	// Placed objects in structure-of-arrays form. An instance is a mesh
+	// handle, a material handle and a transform. Handles index whatever
+	// tables the renderer keeps, so the store holds no GPU objects.
+	//
+	// world = transform * root. SetTransform, SetRoot and SetMeshBounds
+	// only mark instances dirty; Update recomputes the world matrices and
+	// bounds of dirty instances in parallel. Remove moves the last
+	// instance into the freed slot, so indices change.
+	class InstanceStore {
+      public:
+        uint32_t Add(uint32_t mesh, uint32_t material, const Matrix &transform);
+        void Remove(uint32_t instance);
+        void Clear();
+        void Reserve(size_t count);
+
+        size_t Count() const { return m_meshes.size(); }
+        uint32_t Mesh(uint32_t instance) const { return m_meshes[instance]; }
+        uint32_t Material(uint32_t instance) const { return m_materials[instance]; }
+        const Matrix &Transform(uint32_t instance) const { return m_transforms[instance]; }
+        // Valid after Update.
+        const Matrix &World(uint32_t instance) const { return m_worlds[instance]; }
+        const std::vector<MeshBounds> &WorldBounds() const { return m_worldBounds; }
+        // Whether the last Update recomputed the instance.
+        bool Moved(uint32_t instance) const { return m_moved[instance] != 0; }
+
+        void SetTransform(uint32_t instance, const Matrix &transform);
+        void SetRoot(const Matrix &root);
+        // Model space bounds of a mesh handle. Instances of meshes without
+        // bounds get empty ones.
+        void SetMeshBounds(uint32_t mesh, const MeshBounds &bounds);
+
+        // Returns the number of instances recomputed.
+        size_t Update();
+
+        // Appends the instances whose world sphere intersects the frustum
+        // to visible, in index order. Blocks of instances are tested in
+        // parallel.
+        void Cull(const Frustum &frustum, std::vector<uint32_t> &visible) const;
+
+        // Orders visible by material, then mesh, then index, so that
+        // submission binds each material and mesh once and instances of a
+        // mesh are adjacent.
+        void SortForSubmission(std::vector<uint32_t> &visible) const;
+
+      private:
+        std::vector<uint32_t> m_meshes;
+        std::vector<uint32_t> m_materials;
+        std::vector<Matrix> m_transforms;
+        std::vector<Matrix> m_worlds;
+        std::vector<MeshBounds> m_worldBounds;
+        SphereSoA m_worldSpheres;
+        std::vector<uint8_t> m_dirty;
+        std::vector<uint8_t> m_moved;
+        size_t m_dirtyCount = 0;
+        bool m_allDirty = false;
+
+        Matrix m_root;
+        std::vector<MeshBounds> m_meshBounds; // per mesh handle
+        std::vector<uint8_t> m_meshChanged;
+        bool m_anyMeshChanged = false;
+
+        mutable std::vector<std::vector<uint32_t>> m_blockVisible;
+	};
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Messages below HLAB_LOG_LEVEL are removed at compile time.
+// 0 Trace, 1 Debug, 2 Info, 3 Warning, 4 Error
+#ifndef HLAB_LOG_LEVEL
+#if defined(DEBUG) || defined(_DEBUG)
+#define HLAB_LOG_LEVEL 1
+#else
+#define HLAB_LOG_LEVEL 2
+#endif
+#endif
+
+namespace hlab {
+
+	enum class LogLevel : uint8_t { Trace = 0, Debug, Info, Warning, Error };
+
+    enum class LogCategory : uint8_t {
+        General = 0,
+        Input,
+        Loader,
+        Texture,
+        Render,
+        Count
+    };
+
+    class Logger {
+      public:
+        static Logger &Get();
+
+        void Write(LogLevel level, LogCategory category, const char *format,
+                   ...);
+
+        // 0 disables the limit for the category.
+        void SetRateLimit(LogCategory category, uint32_t maxPerSecond);
+
+        // Returns once every message written before the call is out. The
+        // calling thread drains the queue itself, so this works whether or
+        // not the sink thread is running.
+        void Flush();
+
+        uint64_t DroppedCount() const {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+      private:
+        Logger();
+        ~Logger();
+        Logger(const Logger &) = delete;
+        Logger &operator=(const Logger &) = delete;
+
+        static const size_t kCapacity = 4096;
+        static const size_t kMaxMessage = 240;
+
+        struct Entry {
+            std::atomic<size_t> sequence;
+            LogLevel level;
+            LogCategory category;
+            char text[kMaxMessage];
+        };
+
+        struct RateState {
+            std::atomic<uint32_t> maxPerSecond{0};
+            std::atomic<uint64_t> window{0};
+            std::atomic<uint64_t> suppressed{0};
+        };
+
+        bool AcquireRate(LogCategory category);
+        bool Drain();
+        void SinkLoop();
+
+        Entry m_entries[kCapacity];
+        alignas(64) std::atomic<size_t> m_enqueuePos{0};
+        alignas(64) std::atomic<size_t> m_dequeuePos{0};
+
+        RateState m_rates[size_t(LogCategory::Count)];
+        std::atomic<uint64_t> m_dropped{0};
+
+        // Drain is single-consumer; the sink and Flush take turns.
+        std::mutex m_drainMutex;
+        std::atomic<bool> m_running{true};
+        std::thread m_sink;
+    };
+}
+
+#define HLAB_LOG(level, category, ...)                                         \
+    ::hlab::Logger::Get().Write(level, category, __VA_ARGS__)
+
+#if HLAB_LOG_LEVEL <= 0
+#define LOG_TRACE(category, ...)                                               \
+    HLAB_LOG(::hlab::LogLevel::Trace, category, __VA_ARGS__)
+#else
+#define LOG_TRACE(category, ...) ((void)0)
+#endif
+
+#if HLAB_LOG_LEVEL <= 1
+#define LOG_DEBUG(category, ...)                                               \
+    HLAB_LOG(::hlab::LogLevel::Debug, category, __VA_ARGS__)
+#else
+#define LOG_DEBUG(category, ...) ((void)0)
+#endif
+
+#if HLAB_LOG_LEVEL <= 2
+#define LOG_INFO(category, ...)                                                \
+    HLAB_LOG(::hlab::LogLevel::Info, category, __VA_ARGS__)
+#else
+#define LOG_INFO(category, ...) ((void)0)
+#endif
+
+#if HLAB_LOG_LEVEL <= 3
+#define LOG_WARN(category, ...)                                                \
+    HLAB_LOG(::hlab::LogLevel::Warning, category, __VA_ARGS__)
+#else
+#define LOG_WARN(category, ...) ((void)0)
+#endif
+
+#define LOG_ERROR(category, ...)                                               \
+    HLAB_LOG(::hlab::LogLevel::Error, category, __VA_ARGS__)
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace hlab {
+
+	// Read-only Assimp stream over a memory-mapped file. Reads copy
+	// straight from the page cache, with no stdio buffer in between and no
+	// read call per chunk.
+	class MappedIOStream : public Assimp::IOStream {
+      public:
+        ~MappedIOStream() override;
+
+        size_t Read(void *buffer, size_t size, size_t count) override;
+        size_t Write(const void *buffer, size_t size, size_t count) override;
+        aiReturn Seek(size_t offset, aiOrigin origin) override;
+        size_t Tell() const override { return m_position; }
+        size_t FileSize() const override { return m_size; }
+        void Flush() override {}
+
+        // The whole file, valid while the stream is open.
+        const uint8_t *Data() const { return m_data; }
+
+      private:
+        friend class MappedIOSystem;
+
+        bool Open(const std::string &filename);
+
+        const uint8_t *m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_position = 0;
+        bool m_mapped = false;
+        std::vector<uint8_t> m_copy; // used when the file can't be mapped
+	};
+
+    // Installed with Importer::SetIOHandler, which takes ownership. Only
+    // read modes are supported, the importer never writes.
+    class MappedIOSystem : public Assimp::IOSystem {
+      public:
+        bool Exists(const char *file) const override;
+        char getOsSeparator() const override;
+        Assimp::IOStream *Open(const char *file, const char *mode = "rb") override;
+        void Close(Assimp::IOStream *file) override;
+
+        // Starts reading the file into the page cache in the background,
+        // for files that will be opened soon.
+        static void Prefetch(const std::string &filename);
+    };
+}
@@ -1,11 +1,6 @@
 #pragma once
 
-#include <d3d11.h>
-#include <d3dcompiler.h>
 #include <directxtk/SimpleMath.h>
-#include <memory>
-
-#include "Mesh.h"
 
 namespace hlab {
 
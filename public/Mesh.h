@@ -8,6 +8,9 @@
 #include <windows.h>
 #include <wrl.h>
 
+#include "Bounds.h"
+#include "FrustumCulling.h"
+
 namespace hlab {
 
 	using Microsoft::WRL::ComPtr;
@@ -31,5 +34,10 @@ namespace hlab {
         ComPtr<ID3D11ShaderResourceView> ormSRV;
 
         UINT m_indexCount = 0;
+
+        MeshBounds bounds;
+
+        std::vector<Meshlet> meshlets;
+        SphereSoA meshletSpheres;
 	};
     }
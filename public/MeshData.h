@@ -1,29 +1,91 @@
 #pragma once
 
-#include <d3d11.h>
-#include <wrl/client.h>
 #include <directxtk/SimpleMath.h>
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#ifdef _WIN32
+#include <d3d11.h>
+#include <wrl/client.h>
+#endif
+
+#include "Bounds.h"
+#include "Image.h"
 #include "Vertex.h"
 
 namespace hlab {
 
 	using std::vector;
+#ifdef _WIN32
     using Microsoft::WRL::ComPtr;
+#endif
+
+    // A cluster of at most kMaxMeshletVertices vertices and
+    // kMaxMeshletTriangles triangles that is culled on its own. Its
+    // triangles are contiguous in MeshData::indices.
+    struct Meshlet {
+        Vector3 center;
+        float radius = 0.0f;
+        // Normal cone, see CullMeshlets. A cutoff above 1 never culls.
+        Vector3 coneAxis;
+        float coneCutoff = 2.0f;
+        uint32_t indexOffset = 0;
+        uint32_t triangleCount = 0;
+        uint32_t vertexCount = 0;
+    };
+
+    const int kMaxInfluences = 4;
+
+    // The strongest kMaxInfluences joints of a vertex, weights summing to
+    // one. Unused slots have weight 0.
+    struct VertexWeights {
+        uint16_t joints[kMaxInfluences] = {};
+        float weights[kMaxInfluences] = {};
+    };
+
+    struct MeshSkin {
+        std::vector<VertexWeights> weights; // one per vertex
+        std::vector<std::string> jointNames;
+        // Nodes of ModelLoader::sceneGraph driving each joint.
+        std::vector<uint32_t> jointNodes;
+        // From the space the vertices are stored in to the joint's space
+        // in the bind pose.
+        std::vector<DirectX::SimpleMath::Matrix> inverseBind;
+    };
+
+    // A blend shape, stored for the vertices it moves only. Each delta is
+    // the difference to the base vertex, with a zero texcoord.
+    struct MorphTarget {
+        std::string name;
+        std::vector<uint32_t> vertices; // ascending
+        std::vector<Vertex> deltas;
+    };
 	
 	struct MeshData {
         std::vector<Vertex> vertices;
         std::vector<uint32_t> indices;
 
+        MeshBounds bounds;
+        std::vector<Meshlet> meshlets; // empty if not built
+        MeshSkin skin;                 // empty if not skinned
+        std::vector<MorphTarget> morphTargets;
+
         std::string baseColorFilename;
         std::string normalFilename;
         std::string ormFilename;
 
+        // Decoded textures that have no file of their own, such as images
+        // embedded in a GLB. They take precedence over the filenames and
+        // are not kept by the mesh cache.
+        std::shared_ptr<const ImageData> baseColorImage;
+        std::shared_ptr<const ImageData> normalImage;
+        std::shared_ptr<const ImageData> ormImage;
+
        //std::string textureFilename;
 
+#ifdef _WIN32
         ComPtr<ID3D11ShaderResourceView> baseColorSRV;
         ComPtr<ID3D11ShaderResourceView> normalSRV;
         ComPtr<ID3D11ShaderResourceView> emissiveSRV;
@@ -32,6 +94,7 @@ namespace hlab {
         ComPtr<ID3D11Texture2D> baseColorTex;
         ComPtr<ID3D11Texture2D> normalTex;
         ComPtr<ID3D11Texture2D> ormTex;
+#endif
 
 	};
 
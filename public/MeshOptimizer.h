@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "MeshData.h"
+
+namespace hlab {
+
+	// Reorders triangles for the post-transform vertex cache using Tom
+	// Forsyth's linear-speed algorithm.
+	void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+    // Renumbers vertices in first-use order so vertex fetch walks memory
+    // forward. Unreferenced vertices are dropped.
+    void OptimizeVertexFetch(MeshData &mesh);
+
+    // Average vertex shader invocations per triangle with a FIFO cache.
+    float AverageCacheMissRatio(const std::vector<uint32_t> &indices,
+                                size_t vertexCount, int cacheSize = 16);
+
+    // Assimp's CalcTangentSpace: per-face tangents from mesh.indices, made
+    // orthogonal to the vertex normal and averaged. Run it on converted
+    // (left-handed, V-flipped) data so the bitangent sign matches.
+    void ComputeTangents(MeshData &mesh);
+
+    const uint32_t kMaxMeshletVertices = 64;
+    const uint32_t kMaxMeshletTriangles = 124;
+
+    // Splits the mesh into meshlets, reordering mesh.indices so each one
+    // is contiguous. Meshlets grow across shared vertices, preferring
+    // triangles that add the fewest new ones, so run it after
+    // OptimizeVertexCache; the order within a meshlet stays cache friendly.
+    void BuildMeshlets(MeshData &mesh);
+}
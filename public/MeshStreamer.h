@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MeshData.h"
+
+namespace hlab {
+
+	// A triangle corner as MeshStreamer spills it, already converted like
+	// the rest of ModelLoader's output. A zero normal means the source had
+	// none.
+	struct StreamCorner {
+        Vector3 position;
+        Vector3 normal;
+        Vector2 texcoord;
+	};
+
+    struct MeshPart {
+        std::string material;
+        std::string baseColorFilename;
+        std::string normalFilename;
+        std::string ormFilename;
+        bool hasTexcoords = false;
+    };
+
+    struct ChunkInfo {
+        MeshBounds bounds;
+        uint64_t offset = 0;
+        uint32_t vertexCount = 0;
+        uint32_t indexCount = 0;
+        uint32_t meshletCount = 0;
+        uint32_t part = 0;
+    };
+
+    // Turns geometry that doesn't fit in memory into a chunk file.
+    // Triangles are binned into a uniform grid over bounds given up front,
+    // and the bins are appended to a temporary file whenever they hold more
+    // than a quarter of the budget. Finish welds every bin into chunks of
+    // bounded size in parallel, generates smooth normals where the source
+    // had none and tangents for parts with texcoords.
+    class MeshStreamer {
+      public:
+        MeshStreamer(const MeshBounds &bounds, uint64_t triangleHint,
+                     uint64_t memoryBudget);
+        ~MeshStreamer();
+        MeshStreamer(const MeshStreamer &) = delete;
+        MeshStreamer &operator=(const MeshStreamer &) = delete;
+
+        uint32_t AddPart(const MeshPart &part);
+
+        // Thread-safe.
+        void AddTriangles(uint32_t part, const StreamCorner *corners,
+                          size_t triangleCount);
+        void AddMesh(uint32_t part, const MeshData &mesh);
+
+        bool Finish(const std::string &filename);
+
+      private:
+        struct Block {
+            uint64_t bin;
+            uint64_t offset; // in corners
+            uint64_t count;
+        };
+
+        uint32_t CellOf(const StreamCorner *triangle) const;
+        void Spill();
+
+        Vector3 m_origin;
+        Vector3 m_inverseCellSize;
+        uint32_t m_dims[3] = {1, 1, 1};
+        uint64_t m_budget;
+        size_t m_chunkTriangles;
+
+        std::vector<MeshPart> m_parts;
+
+        std::mutex m_mutex;
+        std::unordered_map<uint64_t, std::vector<StreamCorner>> m_bins;
+        uint64_t m_bufferedBytes = 0;
+        std::vector<Block> m_blocks;
+        std::string m_spillPath;
+        std::ofstream m_spill;
+        uint64_t m_spilledCorners = 0;
+        bool m_failed = false;
+    };
+
+    // A unique name in the temp directory for spill files.
+    std::string TemporaryPath(const std::string &tag);
+
+    // Reads a file written by MeshStreamer one chunk at a time.
+    class ChunkFile {
+      public:
+        bool Open(const std::string &filename);
+
+        const std::string &Filename() const { return m_filename; }
+        const std::vector<ChunkInfo> &Chunks() const { return m_chunks; }
+        const std::vector<MeshPart> &Parts() const { return m_parts; }
+
+        // Thread-safe, each call reads through its own stream. Fills the
+        // texture filenames from the chunk's part.
+        bool LoadChunk(size_t index, MeshData &mesh) const;
+
+      private:
+        std::string m_filename;
+        std::vector<ChunkInfo> m_chunks;
+        std::vector<MeshPart> m_parts;
+    };
+}
@@ -2,30 +2,116 @@
 
 
 #include <filesystem>
-#include <assimp\Importer.hpp>
-#include <assimp\postprocess.h>
-#include <assimp\scene.h>
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
 #include <iostream>
 #include <string>
 #include <vector>
 
+#include "Animation.h"
 #include "MeshData.h"
+#include "MeshStreamer.h"
+#include "PerfStats.h"
+#include "SceneGraph.h"
 #include "Vertex.h"
 
 namespace hlab {
 	class ModelLoader {
   public:
+        // Part of every cache key that depends on the import result.
+        static const unsigned int kImportFlags =
+            aiProcess_Triangulate | aiProcess_ConvertToLeftHanded |
+            aiProcess_FlipUVs | aiProcess_GenSmoothNormals |
+            aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices;
+
         void Load(std::string basePath, std::string filename);
 
         void ProcessNode(aiNode *node, const aiScene *scene,
-                         DirectX::SimpleMath::Matrix tr);
+                         DirectX::SimpleMath::Matrix tr,
+                         uint32_t parent = SceneGraph::kNoParent);
 
         MeshData ProcessMesh(aiMesh *mesh, const aiScene *scene);
 
+        bool LoadWithAssimp(const std::string &path);
+        void ImportAnimations(const aiScene *scene, size_t firstMesh,
+                              size_t firstNode);
+        bool LoadNativeFbx(const std::string &path);
+        bool LoadNativeGltf(const std::string &path);
+        bool LoadNativeObj(const std::string &path);
+        bool LoadStreamed(const std::string &path, uint64_t cacheKey);
+        bool SpillToChunks(size_t firstMesh, uint64_t cacheKey);
+        void PageInChunks(uint64_t budget);
+        void AddNativeMeshes(std::vector<MeshData> &loaded,
+                             const std::vector<int> &materials,
+                             const std::vector<std::string> &materialNames);
+        void ResolveMaterialTextures(unsigned int materialIndex,
+                                     const std::string &materialName,
+                                     MeshData &mesh);
+
         public:
         std::string basePath;
         std::vector<MeshData> meshes;
         std::filesystem::path modelFullPath;
         std::string FindBaseColorTexture;
+        LoaderTimings timings;
+        bool useCache = true; // AssetCache, if it is enabled
+        // The AssetCache entry of the meshes from the last Load, 0 when they
+        // are not cached: deformed, with decoded images, or streamed.
+        uint64_t cacheKey = 0;
+
+        // Keep Assimp's node hierarchy in sceneGraph instead of baking the
+        // node transforms into the vertices, which then stay in the space
+        // of their node. Such loads bypass the native loaders, the mesh
+        // cache and streaming, which all work on flattened meshes.
+        bool keepHierarchy = false;
+        SceneGraph sceneGraph;
+
+        // Clips of animated models, for the nodes in sceneGraph. Models with
+        // clips or skinned meshes always fill sceneGraph, even when the
+        // meshes are flattened, and skip the mesh cache and streaming.
+        std::vector<AnimationClip> clips;
+        bool recordNodes = false; // set by LoadWithAssimp for such models
+
+        // Read sources through MappedIOSystem instead of Assimp's stdio
+        // streams. Global so benchmarks can switch every loader.
+        static bool useMappedIO;
+
+        // Binary FBX files with only static meshes go through FbxLoader,
+        // anything else falls back to Assimp.
+        static bool useFbxFastPath;
+        // The same for .glb and .gltf through GltfLoader.
+        static bool useGltfFastPath;
+        // And for .obj through ObjLoader.
+        static bool useObjFastPath;
+
+        // Bytes of geometry Load keeps in memory. OBJ files that would need
+        // more are streamed into a chunk file, and meshes from the other
+        // importers, which hold the whole scene anyway, are moved into one
+        // after the import. Only the leading chunks that fit are loaded;
+        // PageInChunks brings in more.
+        static uint64_t memoryBudget;
+
+        // The chunk file of a streamed model. Chunks [0, residentChunks)
+        // are in meshes, PageInChunks appends the following ones that fit
+        // in budget more bytes and warns about any left out.
+        ChunkFile chunkFile;
+        size_t residentChunks = 0;
+
+        struct TextureCandidate {
+            std::string lowerName;
+            std::string path;
+        };
+
+        struct MaterialTextures {
+            bool resolved = false;
+            std::string baseColor;
+            std::string normal;
+            std::string orm;
+        };
+
+        // Scanned once per Load instead of once per texture lookup.
+        std::vector<TextureCandidate> textureCandidates;
+        std::vector<MaterialTextures> materialTextures;
     };
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Bounds.h"
+#include "MeshData.h"
+
+namespace hlab {
+
+	struct VertexRange {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+	};
+
+    // The vertices any morph target of the mesh moves, as ascending
+    // ranges. Ranges less than gap vertices apart are merged.
+    std::vector<VertexRange> MorphedRanges(const MeshData &mesh,
+                                           uint32_t gap = 64);
+
+    // Rebuilds the vertices in ranges of out from the base mesh plus the
+    // weighted deltas of every target with a nonzero weight, one weight
+    // per target, and renormalizes their frames. The rest of out is left
+    // alone, so a full copy of the mesh kept in out stays current across
+    // calls. Batches of vertices are evaluated in parallel, the deltas
+    // added with SSE. Returns the bounds of the vertices in ranges.
+    MeshBounds ApplyMorphTargets(const MeshData &mesh, const float *weights,
+                                 const std::vector<VertexRange> &ranges,
+                                 Vertex *out);
+}
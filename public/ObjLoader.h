@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+namespace hlab {
+
+	// Wavefront OBJ/MTL without Assimp, for scans too large for its
+	// single-threaded importer. The mapped file is cut into line-aligned
+	// chunks that are parsed in parallel, then each mesh is welded and
+	// triangulated in parallel. The output matches ModelLoader's Assimp
+	// path with kImportFlags: one mesh per object, group and material run,
+	// left-handed with flipped V and winding.
+	//
+	// Textures come from the MTL maps: map_Kd as base color, norm or
+	// map_Bump as normal map and map_Pr as the roughness (ORM) map.
+	class ObjLoader {
+      public:
+        bool Load(const std::string &filename);
+
+        // For files too large to hold: writes a chunk file (see
+        // MeshStreamer) within memoryBudget bytes instead of filling meshes.
+        // The attributes are spilled to temporary files that are mapped
+        // back while the faces are read in batches.
+        bool Stream(const std::string &filename, const std::string &chunkFile,
+                    uint64_t memoryBudget);
+
+        std::vector<MeshData> meshes;
+        std::vector<int> meshMaterials; // index into materialNames, or -1
+        std::vector<std::string> materialNames;
+	};
+}
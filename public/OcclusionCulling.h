@@ -0,0 +1,71 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+#include <vector>
+
+#include "Bounds.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+	using DirectX::SimpleMath::Vector3;
+
+	struct OccluderMesh {
+        std::vector<Vector3> positions;
+        std::vector<uint32_t> indices;
+	};
+
+    // Low resolution depth-only software rasterizer. Occluders are binned
+    // into screen tiles that are rasterized in parallel with SSE, and each
+    // tile keeps a max-depth HiZ level so most bounds tests stop early.
+    // Depth follows D3D: 0 near, 1 far.
+    class OcclusionBuffer {
+      public:
+        static const int kTileWidth = 64;
+        static const int kTileHeight = 32;
+        static const int kBlockSize = 8;
+
+        // Rounded up to whole tiles.
+        void Resize(int width, int height);
+
+        int Width() const { return m_width; }
+        int Height() const { return m_height; }
+        const std::vector<float> &Depth() const { return m_depth; }
+        size_t TriangleCount() const { return m_triangles.size(); }
+
+        // mvp maps occluder positions to clip space, row-vector convention.
+        void Rasterize(const std::vector<OccluderMesh> &occluders,
+                       const Matrix &mvp);
+
+        // False only when the whole box is behind rasterized depth.
+        bool IsVisible(const MeshBounds &bounds, const Matrix &mvp) const;
+
+        // Removes occluded entries from visible, which indexes into bounds.
+        void Cull(const std::vector<MeshBounds> &bounds, const Matrix &mvp,
+                  std::vector<uint32_t> &visible) const;
+
+      private:
+        struct ScreenTriangle {
+            float x[3];
+            float y[3];
+            float z[3];
+        };
+
+        void RasterizeTile(int tile);
+
+        int m_width = 0;
+        int m_height = 0;
+        int m_tilesX = 0;
+        int m_tilesY = 0;
+        int m_blocksX = 0;
+
+        std::vector<float> m_depth;
+        std::vector<float> m_hiz;
+
+        std::vector<float> m_clip; // xyzw per occluder vertex
+        std::vector<ScreenTriangle> m_triangles;
+        std::vector<std::vector<uint32_t>> m_bins;
+        mutable std::vector<uint8_t> m_flags;
+    };
+}
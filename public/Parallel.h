@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hlab {
+
+	// Persistent worker pool. The calling thread always works on its own
+	// job, so ParallelFor may be nested from inside a running chunk.
+	class ThreadPool {
+      public:
+        using RangeFn = std::function<void(size_t begin, size_t end)>;
+
+        static ThreadPool &Get();
+
+        // Includes the calling thread.
+        unsigned ThreadCount() const { return unsigned(m_threads.size()) + 1; }
+
+        void ParallelFor(size_t count, size_t grain, const RangeFn &fn);
+
+      private:
+        struct Job {
+            const RangeFn *fn = nullptr;
+            size_t count = 0;
+            size_t grain = 1;
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> done{0};
+            std::atomic<int> users{0};
+        };
+
+        ThreadPool();
+        ~ThreadPool();
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        static bool RunChunk(Job &job);
+        void WorkerLoop();
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::deque<Job *> m_jobs;
+        std::vector<std::thread> m_threads;
+        bool m_stop = false;
+	};
+
+    // Calls fn(begin, end) over [0, count) in chunks of grain items.
+    template <typename F>
+    void ParallelFor(size_t count, size_t grain, F &&fn) {
+        if (count == 0)
+            return;
+        if (grain == 0)
+            grain = 1;
+        if (count <= grain) {
+            fn(size_t(0), count);
+            return;
+        }
+        const ThreadPool::RangeFn range = std::forward<F>(fn);
+        ThreadPool::Get().ParallelFor(count, grain, range);
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace hlab {
+
+	struct RenderCounters {
+        uint32_t drawCalls = 0;
+        uint64_t triangles = 0;
+        uint32_t stateChanges = 0;
+
+        void Reset() {
+            drawCalls = 0;
+            triangles = 0;
+            stateChanges = 0;
+        }
+	};
+
+    struct GpuMemoryCounters {
+        uint64_t vertexBytes = 0;
+        uint64_t indexBytes = 0;
+        uint64_t textureBytes = 0;
+        uint64_t constantBytes = 0;
+        uint64_t structuredBytes = 0;
+
+        uint64_t Total() const {
+            return vertexBytes + indexBytes + textureBytes + constantBytes +
+                   structuredBytes;
+        }
+    };
+
+    struct LoaderTimings {
+        double readFileMs = 0.0;
+        double processNodeMs = 0.0;
+        double normalsMs = 0.0;
+        double normalizeMs = 0.0;
+        double meshletsMs = 0.0;
+        double totalMs = 0.0;
+
+        uint64_t readFileAllocs = 0;
+        uint64_t processNodeAllocs = 0;
+        uint64_t normalsAllocs = 0;
+        uint64_t normalizeAllocs = 0;
+        uint64_t meshletsAllocs = 0;
+
+        size_t meshCount = 0;
+        size_t vertexCount = 0;
+        size_t indexCount = 0;
+
+        // readFileMs is the cache read when set.
+        bool cacheHit = false;
+        // Loaded by FbxLoader, GltfLoader or ObjLoader instead of Assimp.
+        bool nativeFbx = false;
+        bool nativeGltf = false;
+        bool nativeObj = false;
+        // Written to or read from a chunk file, chunkCount chunks of which
+        // meshCount are resident.
+        bool streamed = false;
+        size_t chunkCount = 0;
+    };
+
+    // Tools that replace operator new can install a counter so stage
+    // timers also report how many allocations a stage made.
+    using AllocationCounter = uint64_t (*)();
+    void SetAllocationCounter(AllocationCounter counter);
+    uint64_t CurrentAllocationCount();
+
+    class CpuTimer {
+      public:
+        CpuTimer()
+            : m_start(std::chrono::steady_clock::now()),
+              m_allocations(CurrentAllocationCount()) {}
+
+        double ElapsedMs() const {
+            return std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - m_start)
+                .count();
+        }
+
+        uint64_t Allocations() const {
+            return CurrentAllocationCount() - m_allocations;
+        }
+
+      private:
+        std::chrono::steady_clock::time_point m_start;
+        uint64_t m_allocations;
+    };
+
+    class FrameStats {
+      public:
+        static const int kHistorySize = 240;
+
+        void AddFrame(float frameMs, float updateMs, float renderMs);
+
+        // p in [0, 100], computed over the frames currently in the history.
+        float Percentile(float p) const;
+
+        const float *FrameHistory() const { return m_frameMs.data(); }
+        int HistoryOffset() const { return m_next; }
+        int HistoryCount() const { return m_count; }
+
+        float LastUpdateMs() const { return m_updateMs; }
+        float LastRenderMs() const { return m_renderMs; }
+
+      private:
+        std::array<float, kHistorySize> m_frameMs = {};
+        int m_next = 0;
+        int m_count = 0;
+
+        float m_updateMs = 0.0f;
+        float m_renderMs = 0.0f;
+
+        mutable std::vector<float> m_scratch;
+    };
+}
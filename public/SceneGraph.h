@@ -0,0 +1,70 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+
+	// Node hierarchy in structure-of-arrays form. Nodes are stored in
+	// topological order, every parent before its children, and matrices
+	// use the row-vector convention: world = local * parent world.
+	//
+	// SetLocal only marks the node dirty. UpdateTransforms recomputes the
+	// world matrices of dirty nodes and everything below them, one depth
+	// level at a time with the nodes of a level in parallel.
+	class SceneGraph {
+      public:
+        static const uint32_t kNoParent = 0xffffffffu;
+
+        // parent must already exist or be kNoParent.
+        uint32_t AddNode(const std::string &name, uint32_t parent,
+                         const Matrix &local);
+        void Clear();
+
+        size_t NodeCount() const { return m_parents.size(); }
+        uint32_t Parent(uint32_t node) const { return m_parents[node]; }
+        uint32_t Depth(uint32_t node) const { return m_depths[node]; }
+        const std::string &Name(uint32_t node) const { return m_names[node]; }
+        const Matrix &Local(uint32_t node) const { return m_locals[node]; }
+        // Valid after UpdateTransforms.
+        const Matrix &World(uint32_t node) const { return m_worlds[node]; }
+        // Whether the last UpdateTransforms moved the node.
+        bool Moved(uint32_t node) const { return m_moved[node] != 0; }
+
+        // kNoParent if there is no node with that name.
+        uint32_t Find(const std::string &name) const;
+
+        void SetLocal(uint32_t node, const Matrix &local);
+
+        // Returns the number of world matrices recomputed.
+        size_t UpdateTransforms();
+
+        // Node of each mesh, parallel to ModelLoader::meshes. Meshes whose
+        // vertices are already in model space have kNoParent.
+        std::vector<uint32_t> meshNodes;
+
+      private:
+        void BuildLevels();
+
+        std::vector<uint32_t> m_parents;
+        std::vector<uint32_t> m_depths;
+        std::vector<std::string> m_names;
+        std::vector<Matrix> m_locals;
+        std::vector<Matrix> m_worlds;
+        std::vector<uint8_t> m_dirty;
+        std::vector<uint8_t> m_moved;
+
+        // Node indices grouped by depth, levels[d] in
+        // m_levelNodes[m_levelOffsets[d], m_levelOffsets[d + 1]).
+        std::vector<uint32_t> m_levelNodes;
+        std::vector<uint32_t> m_levelOffsets;
+        bool m_levelsValid = false;
+
+        size_t m_dirtyCount = 0;
+        uint32_t m_minDirtyDepth = 0;
+	};
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hlab {
+
+	using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
+
+	// Everything that decides the bytecode of a shader.
+	struct ShaderDesc {
+        std::string filename;
+        std::string entry = "main";
+        std::string target; // vs_5_0, ps_5_0, ...
+        uint32_t flags = 0; // D3DCOMPILE_*
+        ShaderDefines defines;
+	};
+
+    // Asset cache key of a shader: the XXH64 of its source, of every file
+    // it pulls in with #include, recursively, and of the defines, entry,
+    // target and flags. Includes are found next to the including file,
+    // then next to the shader, like D3D_COMPILE_STANDARD_FILE_INCLUDE
+    // does. Every #include line counts, even in disabled #if blocks, so
+    // a key can only change too often, never too rarely. Returns false if
+    // a file can't be read; such shaders are compiled without the cache.
+    bool ShaderCacheKey(const ShaderDesc &desc, uint64_t &key);
+
+    // True if bytes look like DXBC bytecode, to reject damaged entries.
+    bool IsShaderBytecode(const std::vector<uint8_t> &bytes);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <vector>
+
+#include "Animation.h"
+#include "Bounds.h"
+#include "MeshData.h"
+#include "SceneGraph.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+
+	// The skeleton and clips of a model with skinned meshes.
+	struct ModelAnimation {
+        SceneGraph graph;
+        std::vector<AnimationClip> clips;
+        // Applied after the joints, such as the normalization done by
+        // GeometryGenerator::ReadFromFile.
+        Matrix root;
+	};
+
+    // Per joint: inverse bind, the joint node's world matrix, then root.
+    // Joints without a node keep the bind pose.
+    void ComputeJointMatrices(const MeshSkin &skin, const SceneGraph &graph,
+                              const Matrix &root, std::vector<Matrix> &joints);
+
+    // Blends the joint matrices of each vertex and transforms position,
+    // normal, tangent and bitangent with SSE. out is written front to back
+    // and never read, so it can be a mapped D3D11_USAGE_DYNAMIC buffer.
+    // Returns the bounds of the skinned positions.
+    MeshBounds SkinVertices(const Vertex *in, const VertexWeights *weights,
+                            size_t count, const Matrix *joints, Vertex *out);
+
+    // SkinVertices over the whole mesh, in parallel batches. source
+    // replaces the mesh's vertices, such as with morph targets applied.
+    MeshBounds SkinMesh(const MeshData &mesh, const std::vector<Matrix> &joints,
+                        Vertex *out, const Vertex *source = nullptr);
+}
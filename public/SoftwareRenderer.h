@@ -0,0 +1,115 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ConstantBuffers.h"
+#include "Image.h"
+#include "MeshData.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Vector2;
+	using DirectX::SimpleMath::Vector3;
+	using DirectX::SimpleMath::Vector4;
+
+	// Textures bound to BasicPixelShader's t0..t2. Missing ones fall back
+	// to the same 1x1 defaults ExampleApp binds.
+	struct SoftwareMaterial {
+        const ImageData *baseColor = nullptr; // sRGB
+        const ImageData *normal = nullptr;
+        const ImageData *orm = nullptr;
+	};
+
+    // CPU implementation of BasicVertexShader/BasicPixelShader for
+    // reference images and thumbnails. Draws are queued, then Flush bins
+    // the triangles into screen tiles and shades the tiles in parallel.
+    // Constant buffers are taken exactly as uploaded to the GPU, with
+    // transposed matrices. Like the shader, only lights[0] of the pixel
+    // constants is used, as the directional light; point and spot lights
+    // come from SetLights.
+    class SoftwareRenderer {
+      public:
+        static const int kTileSize = 32;
+
+        void Resize(int width, int height);
+        void Clear(const Vector4 &color);
+
+        // World space point and spot lights, the list ExampleApp hands to
+        // LightClusters::Assign. A spotPower of zero marks a point light.
+        // Every pixel shades all of them; the cluster lists only leave out
+        // lights that can't reach a pixel. Used by the next Flush.
+        void SetLights(const std::vector<Light> &lights) { m_lights = lights; }
+
+        void Draw(const MeshData &mesh, const SoftwareMaterial &material,
+                  const BasicVertexConstantBuffer &vsConstants,
+                  const BasicPixelConstantBuffer &psConstants);
+        void Flush();
+
+        // Valid after Flush.
+        const ImageData &Target() const { return m_target; }
+
+      private:
+        // Vertex shader output. attr holds posWorld, normalWorld, texcoord,
+        // tangentWorld and bitangentWorld in that order.
+        static const int kAttributes = 14;
+        struct ShadedVertex {
+            float clip[4];
+            float attr[kAttributes];
+        };
+
+        struct ScreenTriangle {
+            float x[3];
+            float y[3];
+            float z[3];
+            float invW[3];
+            const ShadedVertex *v[3];
+            uint32_t draw;
+        };
+
+        struct DrawState {
+            std::vector<ShadedVertex> vertices;
+            const std::vector<uint32_t> *indices = nullptr;
+            SoftwareMaterial material;
+            BasicPixelConstantBuffer constants;
+        };
+
+        // Triangle setup runs in parallel chunks, each binning its own
+        // triangles. Tiles walk the chunks in submission order, so the
+        // result does not depend on the thread count.
+        struct Chunk {
+            uint32_t draw = 0;
+            size_t first = 0;
+            size_t count = 0;
+            std::vector<ScreenTriangle> triangles;
+            std::vector<ShadedVertex> clipped;
+            std::vector<std::vector<uint32_t>> bins;
+        };
+
+        void SetupChunk(Chunk &chunk);
+        void EmitTriangle(Chunk &chunk, const ShadedVertex *a,
+                          const ShadedVertex *b, const ShadedVertex *c);
+        void RasterizeTile(int tile);
+        uint32_t ShadePixel(const DrawState &draw, const float *attr) const;
+
+        int m_width = 0;
+        int m_height = 0;
+        int m_stride = 0; // padded to whole tiles
+        int m_tilesX = 0;
+        int m_tilesY = 0;
+
+        std::vector<float> m_depth;
+        std::vector<uint32_t> m_color;
+        uint32_t m_clearColor = 0;
+        ImageData m_target;
+
+        std::vector<Light> m_lights;
+
+        std::vector<std::unique_ptr<DrawState>> m_draws;
+        size_t m_drawCount = 0;
+        std::vector<std::unique_ptr<Chunk>> m_chunks;
+        size_t m_chunkCount = 0;
+    };
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "Bounds.h"
+#include "Bvh.h"
+#include "FrustumCulling.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Vector3;
+
+	// Hierarchical loose grid over object boxes. Level l has cubic cells
+	// of cellSize * 2^l. An object lives in exactly one cell: the one
+	// holding its box center, on the finest level whose cells are at least
+	// as large as the box. Everything in a cell therefore stays within the
+	// cell grown by the largest half extent stored on its level, and that
+	// loose box is what queries test.
+	//
+	// Ids are the caller's, for example InstanceStore indices; storage
+	// grows with the largest id. Cells are found through a hash of their
+	// coordinates, so the grid is unbounded and only occupied cells cost
+	// memory. Each cell keeps the boxes of its objects next to their ids,
+	// so a query reads a cell's contents in one sweep. Queries call fn(id)
+	// for every object whose box overlaps the region and allocate nothing.
+	class SpatialGrid {
+      public:
+        static const uint32_t kMaxLevels = 16;
+        static const uint32_t kNone = 0xffffffffu;
+
+        // A cellSize of zero picks one at every Build, from the median
+        // object size and the density of the objects.
+        explicit SpatialGrid(float cellSize = 0.0f);
+
+        // Replaces the contents with bounds[id] for every id. The cells of
+        // the objects are computed in parallel.
+        void Build(const std::vector<MeshBounds> &bounds);
+        void Clear();
+
+        void Insert(uint32_t id, const MeshBounds &bounds);
+        // A move that stays in the same cell only stores the new box.
+        void Update(uint32_t id, const MeshBounds &bounds);
+        void Remove(uint32_t id);
+
+        bool Contains(uint32_t id) const {
+            return id < m_objectCells.size() && m_objectCells[id] != kNone;
+        }
+        size_t Count() const { return m_count; }
+        size_t CellCount() const { return m_cells.size() - m_freeCells.size(); }
+        float CellSize() const { return m_levels[0].size; }
+
+        template <typename Fn> void QueryAabb(const Aabb &box, Fn &&fn) const;
+        template <typename Fn>
+        void QuerySphere(const Vector3 &center, float radius, Fn &&fn) const;
+        // Reports the objects whose box is on the inner side of every plane
+        // and overlaps the box around the frustum. Cells entirely inside
+        // the frustum report their objects without testing them.
+        template <typename Fn>
+        void QueryFrustum(const Frustum &frustum, Fn &&fn) const;
+
+        // Box around the eight corners of the frustum.
+        static Aabb FrustumBounds(const Frustum &frustum);
+
+      private:
+        struct Entry {
+            Aabb box;
+            uint32_t id;
+        };
+
+        struct Cell {
+            int x = 0, y = 0, z = 0;
+            uint32_t level = 0;
+            uint32_t slot = 0; // in m_levels[level].cells
+            std::vector<Entry> entries;
+        };
+
+        struct Level {
+            float size = 0.0f;
+            float margin = 0.0f; // largest half extent of its objects
+            std::vector<uint32_t> cells;
+        };
+
+        struct Placement {
+            uint32_t level;
+            int x, y, z;
+        };
+
+        enum CellOverlap { kOutside, kPartial, kInside };
+
+        Placement Place(const Aabb &box) const;
+        static uint64_t Key(const Placement &p);
+        void Link(uint32_t id, const Placement &p, const Aabb &box);
+        void Unlink(uint32_t id);
+        void Reserve(uint32_t id);
+        void SetCellSize(float cellSize);
+
+        template <typename CellTest, typename ObjectTest, typename Fn>
+        void Visit(const Aabb &region, CellTest &&cellTest,
+                   ObjectTest &&objectTest, Fn &&fn) const;
+
+        bool m_autoCellSize;
+        Level m_levels[kMaxLevels];
+        std::vector<Cell> m_cells;
+        std::vector<uint32_t> m_freeCells;
+        std::unordered_map<uint64_t, uint32_t> m_cellMap;
+
+        // Per id, where its entry is.
+        std::vector<uint32_t> m_objectCells;
+        std::vector<uint32_t> m_objectEntries;
+        size_t m_count = 0;
+	};
+
+    template <typename CellTest, typename ObjectTest, typename Fn>
+    void SpatialGrid::Visit(const Aabb &region, CellTest &&cellTest,
+                            ObjectTest &&objectTest, Fn &&fn) const {
+        for (uint32_t l = 0; l < kMaxLevels; l++) {
+            const Level &level = m_levels[l];
+            if (level.cells.empty())
+                continue;
+
+            // Cells whose loose box can reach the region.
+            const float inv = 1.0f / level.size;
+            const auto cellRange = [&](float lo, float hi, int &first, int &last) {
+                first = int(std::max(std::floor((lo - level.margin) * inv), -524288.0f));
+                last = int(std::min(std::floor((hi + level.margin) * inv), 524287.0f));
+            };
+            int x0, x1, y0, y1, z0, z1;
+            cellRange(region.min.x, region.max.x, x0, x1);
+            cellRange(region.min.y, region.max.y, y0, y1);
+            cellRange(region.min.z, region.max.z, z0, z1);
+            if (x0 > x1 || y0 > y1 || z0 > z1)
+                continue;
+
+            // The loose box is tested before the cell is looked up, so
+            // empty cells outside the region cost no hash probe.
+            const auto cellOverlap = [&](int x, int y, int z) {
+                Aabb loose;
+                loose.min = Vector3(x * level.size - level.margin,
+                                    y * level.size - level.margin,
+                                    z * level.size - level.margin);
+                loose.max = Vector3((x + 1) * level.size + level.margin,
+                                    (y + 1) * level.size + level.margin,
+                                    (z + 1) * level.size + level.margin);
+                return cellTest(loose);
+            };
+            const auto visitCell = [&](const Cell &cell, CellOverlap overlap) {
+                for (const Entry &entry : cell.entries) {
+                    if (overlap == kInside || objectTest(entry.box))
+                        fn(entry.id);
+                }
+            };
+
+            // Probe the hash for every cell in range, or walk the level's
+            // cells when there are fewer of them.
+            const double span = double(x1 - x0 + 1) * double(y1 - y0 + 1) *
+                                double(z1 - z0 + 1);
+            if (span > double(level.cells.size())) {
+                for (uint32_t c : level.cells) {
+                    const Cell &cell = m_cells[c];
+                    if (cell.x < x0 || cell.x > x1 || cell.y < y0 ||
+                        cell.y > y1 || cell.z < z0 || cell.z > z1)
+                        continue;
+                    const CellOverlap overlap = cellOverlap(cell.x, cell.y, cell.z);
+                    if (overlap != kOutside)
+                        visitCell(cell, overlap);
+                }
+            } else {
+                for (int z = z0; z <= z1; z++) {
+                    for (int y = y0; y <= y1; y++) {
+                        for (int x = x0; x <= x1; x++) {
+                            const CellOverlap overlap = cellOverlap(x, y, z);
+                            if (overlap == kOutside)
+                                continue;
+                            const auto it = m_cellMap.find(Key({l, x, y, z}));
+                            if (it != m_cellMap.end())
+                                visitCell(m_cells[it->second], overlap);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename Fn>
+    void SpatialGrid::QueryAabb(const Aabb &box, Fn &&fn) const {
+        const auto overlaps = [&](const Aabb &b) {
+            return b.min.x <= box.max.x && b.max.x >= box.min.x &&
+                   b.min.y <= box.max.y && b.max.y >= box.min.y &&
+                   b.min.z <= box.max.z && b.max.z >= box.min.z;
+        };
+        Visit(
+            box,
+            [&](const Aabb &cell) {
+                if (!overlaps(cell))
+                    return kOutside;
+                const bool inside = cell.min.x >= box.min.x && cell.max.x <= box.max.x &&
+                                    cell.min.y >= box.min.y && cell.max.y <= box.max.y &&
+                                    cell.min.z >= box.min.z && cell.max.z <= box.max.z;
+                return inside ? kInside : kPartial;
+            },
+            overlaps, fn);
+    }
+
+    template <typename Fn>
+    void SpatialGrid::QuerySphere(const Vector3 &center, float radius,
+                                  Fn &&fn) const {
+        const float radiusSq = radius * radius;
+        const auto distanceSq = [&](const Aabb &b) {
+            const Vector3 p = Vector3::Max(b.min, Vector3::Min(center, b.max));
+            return (p - center).LengthSquared();
+        };
+        Aabb region;
+        region.min = center - Vector3(radius);
+        region.max = center + Vector3(radius);
+        Visit(
+            region,
+            [&](const Aabb &cell) {
+                if (distanceSq(cell) > radiusSq)
+                    return kOutside;
+                // Inside when the farthest corner is.
+                const Vector3 far = Vector3::Max(center - cell.min, cell.max - center);
+                return far.LengthSquared() <= radiusSq ? kInside : kPartial;
+            },
+            [&](const Aabb &b) { return distanceSq(b) <= radiusSq; }, fn);
+    }
+
+    template <typename Fn>
+    void SpatialGrid::QueryFrustum(const Frustum &frustum, Fn &&fn) const {
+        // The corner farthest along each plane normal decides whether a
+        // box is outside, the nearest whether it is inside.
+        const auto classify = [&](const Aabb &b) {
+            CellOverlap overlap = kInside;
+            for (const auto &p : frustum.planes) {
+                const float far = p.x * (p.x >= 0.0f ? b.max.x : b.min.x) +
+                                  p.y * (p.y >= 0.0f ? b.max.y : b.min.y) +
+                                  p.z * (p.z >= 0.0f ? b.max.z : b.min.z) + p.w;
+                if (far < 0.0f)
+                    return kOutside;
+                const float nearest = p.x * (p.x >= 0.0f ? b.min.x : b.max.x) +
+                                      p.y * (p.y >= 0.0f ? b.min.y : b.max.y) +
+                                      p.z * (p.z >= 0.0f ? b.min.z : b.max.z) + p.w;
+                if (nearest < 0.0f)
+                    overlap = kPartial;
+            }
+            return overlap;
+        };
+        const Aabb region = FrustumBounds(frustum);
+        Visit(region, classify,
+              [&](const Aabb &b) {
+                  return b.min.x <= region.max.x && b.max.x >= region.min.x &&
+                         b.min.y <= region.max.y && b.max.y >= region.min.y &&
+                         b.min.z <= region.max.z && b.max.z >= region.min.z &&
+                         classify(b) != kOutside;
+              },
+              fn);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <directxtk/SimpleMath.h>
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+namespace hlab {
+
+	using DirectX::SimpleMath::Matrix;
+
+	struct StressSceneDesc {
+        uint32_t seed = 1;
+
+        int meshCount = 1000;    // placed objects
+        int materialCount = 16;
+
+        // Per-mesh triangle counts are drawn log-uniformly from this range.
+        uint32_t minTriangles = 12;
+        uint32_t maxTriangles = 20000;
+
+        // Fraction of placed objects that reuse an existing geometry.
+        float instancingRatio = 0.0f;
+
+        float extent = 50.0f;
+	};
+
+    struct StressInstance {
+        uint32_t geometry = 0;
+        uint32_t material = 0;
+        Matrix transform;
+    };
+
+    struct StressScene {
+        std::vector<MeshData> geometries;
+        std::vector<StressInstance> instances;
+        int materialCount = 0;
+
+        size_t TriangleCount() const;
+    };
+
+    class StressSceneGenerator {
+      public:
+        static StressScene Generate(const StressSceneDesc &desc);
+
+        // One MeshData per instance with the transform baked in, the same
+        // shape ModelLoader produces.
+        static std::vector<MeshData> Flatten(const StressScene &scene);
+
+        // formatId is an Assimp exporter id: "obj", "fbx", "gltf2", "glb2".
+        static bool Export(const StressScene &scene, const std::string &path,
+                           const std::string &formatId);
+
+        static std::string FormatIdFromExtension(const std::string &path);
+    };
+}
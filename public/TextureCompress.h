@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Image.h"
+
+namespace hlab {
+
+	// Box-filtered mip chain down to 1x1, level 0 being a copy of image.
+	// sRGB images are filtered in linear space.
+	std::vector<ImageData> GenerateMips(const ImageData &image, bool srgb);
+
+    // Block compression in 4x4 blocks. Edge blocks replicate the last
+    // row and column, so any size is accepted.
+    // BC1: RGB, 8 bytes per block.
+    std::vector<uint8_t> CompressBC1(const ImageData &image);
+    // BC5: red and green as two BC4 blocks, 16 bytes per block. Used for
+    // normal maps; DecodeNormalDX in BasicPixelShader rebuilds z.
+    std::vector<uint8_t> CompressBC5(const ImageData &image);
+}
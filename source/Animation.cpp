@@ -0,0 +1,67 @@
+#include "Animation.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace hlab {
+
+	namespace {
+
+    template <typename Key> float Blend(const std::vector<Key> &keys, float time,
+                                        size_t &index) {
+        // The first key after time; before the first or after the last key
+        // the pose holds.
+        const auto next = std::upper_bound(
+            keys.begin(), keys.end(), time,
+            [](float t, const Key &key) { return t < key.time; });
+        if (next == keys.begin()) {
+            index = 0;
+            return 0.0f;
+        }
+        if (next == keys.end()) {
+            index = keys.size() - 1;
+            return 0.0f;
+        }
+        index = size_t(next - keys.begin()) - 1;
+        const float span = next->time - keys[index].time;
+        return span > 0.0f ? (time - keys[index].time) / span : 0.0f;
+    }
+
+    Vector3 SampleVector(const std::vector<VectorKey> &keys, float time) {
+        size_t i;
+        const float t = Blend(keys, time, i);
+        if (t == 0.0f)
+            return keys[i].value;
+        return Vector3::Lerp(keys[i].value, keys[i + 1].value, t);
+    }
+
+    Quaternion SampleRotation(const std::vector<RotationKey> &keys, float time) {
+        size_t i;
+        const float t = Blend(keys, time, i);
+        if (t == 0.0f)
+            return keys[i].value;
+        return Quaternion::Slerp(keys[i].value, keys[i + 1].value, t);
+    }
+	}
+
+    void SampleClip(const AnimationClip &clip, float time, SceneGraph &graph) {
+        if (clip.duration > 0.0f) {
+            time = std::fmod(time, clip.duration);
+            if (time < 0.0f)
+                time += clip.duration;
+        }
+
+        for (const NodeChannel &channel : clip.channels) {
+            if (channel.node >= graph.NodeCount() || channel.positions.empty() ||
+                channel.rotations.empty() || channel.scales.empty())
+                continue;
+            // Row vectors: scale, then rotate, then translate.
+            graph.SetLocal(channel.node,
+                           Matrix::CreateScale(SampleVector(channel.scales, time)) *
+                               Matrix::CreateFromQuaternion(
+                                   SampleRotation(channel.rotations, time)) *
+                               Matrix::CreateTranslation(
+                                   SampleVector(channel.positions, time)));
+        }
+    }
+}
@@ -1,10 +1,11 @@
 #include "AppBase.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "AssetCache.h"
+#include "Parallel.h"
 
 #include <dxgi.h>
 #include <dxgi1_4.h>
+#include <windowsx.h>
 
 extern IMGUI_IMPL_API LRESULT ImGui_ImplWin32_WndProcHandler(HWND hWnd,
                                                              UINT msg,
@@ -60,6 +61,7 @@ namespace hlab {
                  ImGui::Begin("Scene Control");
 
                  UpdateGUI();
+                 UpdateStatsGUI();
 
                  ImGui::SetWindowPos(ImVec2(0.0f, 0.0f));
 
@@ -68,13 +70,24 @@ namespace hlab {
                  ImGui::End();
                  ImGui::Render();
 
-                 Update(ImGui::GetIO().DeltaTime);
+                 const float dt = ImGui::GetIO().DeltaTime;
 
+                 CpuTimer updateTimer;
+                 Update(dt);
+                 const double updateMs = updateTimer.ElapsedMs();
+
+                 m_renderCounters.Reset();
+
+                 CpuTimer renderTimer;
                  Render();
+                 const double renderMs = renderTimer.ElapsedMs();
 
                  ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
 
                  m_swapChain->Present(1, 0);
+
+                 m_frameStats.AddFrame(dt * 1000.0f, float(updateMs),
+                                       float(renderMs));
             }
         }
 
@@ -127,17 +140,21 @@ namespace hlab {
                 return 0;
             break;
         case WM_MOUSEMOVE:
-            cout << "Mouse " << LOWORD(lParam) << " " << HIWORD(lParam) <<
-            endl;
+            LOG_TRACE(LogCategory::Input, "Mouse %d %d", int(LOWORD(lParam)),
+                      int(HIWORD(lParam)));
+            break;
+        case WM_LBUTTONDOWN:
+            if (!ImGui::GetIO().WantCaptureMouse)
+                OnMouseDown(wParam, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
             break;
         case WM_LBUTTONUP:
-            cout << "WM_LBUTTONUP Left mouse button" << endl;
+            LOG_DEBUG(LogCategory::Input, "WM_LBUTTONUP Left mouse button");
             break;
         case WM_RBUTTONUP:
-            cout << "WM_RBUTTONUP Right mouse button" << endl;
+            LOG_DEBUG(LogCategory::Input, "WM_RBUTTONUP Right mouse button");
             break;
         case WM_KEYDOWN:
-            cout << "WM_KEYDOWN " << (int)wParam << endl;
+            LOG_DEBUG(LogCategory::Input, "WM_KEYDOWN %d", (int)wParam);
             break;
         case WM_DESTROY:
             ::PostQuitMessage(0);
@@ -366,6 +383,53 @@ namespace hlab {
          return true;
     }
 
+    void AppBase::UpdateStatsGUI() {
+        if (!ImGui::CollapsingHeader("Performance"))
+            return;
+
+        const float toMB = 1.0f / (1024.0f * 1024.0f);
+
+        // Only the filled part of the history, oldest frame first.
+        ImGui::PlotLines("Frame (ms)", m_frameStats.FrameHistory(),
+                         m_frameStats.HistoryCount(),
+                         m_frameStats.HistoryOffset(), nullptr, 0.0f, 50.0f,
+                         ImVec2(0.0f, 60.0f));
+        ImGui::Text("p50 %.2f ms  p95 %.2f ms  p99 %.2f ms",
+                    m_frameStats.Percentile(50.0f),
+                    m_frameStats.Percentile(95.0f),
+                    m_frameStats.Percentile(99.0f));
+        ImGui::Text("CPU Update %.3f ms  Render %.3f ms",
+                    m_frameStats.LastUpdateMs(), m_frameStats.LastRenderMs());
+
+        ImGui::Separator();
+        ImGui::Text("Draw calls %u", m_renderCounters.drawCalls);
+        ImGui::Text("Triangles %llu",
+                    (unsigned long long)m_renderCounters.triangles);
+        ImGui::Text("State changes %u", m_renderCounters.stateChanges);
+
+        ImGui::Separator();
+        ImGui::Text("GPU vertex   %.2f MB", m_gpuMemory.vertexBytes * toMB);
+        ImGui::Text("GPU index    %.2f MB", m_gpuMemory.indexBytes * toMB);
+        ImGui::Text("GPU texture  %.2f MB", m_gpuMemory.textureBytes * toMB);
+        ImGui::Text("GPU constant %.2f KB",
+                    m_gpuMemory.constantBytes / 1024.0f);
+        ImGui::Text("GPU structured %.2f KB",
+                    m_gpuMemory.structuredBytes / 1024.0f);
+        ImGui::Text("GPU total    %.2f MB", m_gpuMemory.Total() * toMB);
+
+        ImGui::Separator();
+        ImGui::Text("Last Load %.2f ms (%zu meshes, %zu verts, %zu indices)",
+                    m_lastLoadTimings.totalMs, m_lastLoadTimings.meshCount,
+                    m_lastLoadTimings.vertexCount,
+                    m_lastLoadTimings.indexCount);
+        ImGui::Text("  ReadFile %.2f  ProcessNode %.2f",
+                    m_lastLoadTimings.readFileMs,
+                    m_lastLoadTimings.processNodeMs);
+        ImGui::Text("  Normals %.2f  Normalize %.2f  Meshlets %.2f",
+                    m_lastLoadTimings.normalsMs, m_lastLoadTimings.normalizeMs,
+                    m_lastLoadTimings.meshletsMs);
+    }
+
     void AppBase::SetViewport() { 
         static int previousGuiWidth = m_guiWidth;
 
@@ -443,58 +507,132 @@ namespace hlab {
         }
     }
 
-    void AppBase::CreateVertexShaderAndInputLayout(
-        const wstring &filename,
-        const vector<D3D11_INPUT_ELEMENT_DESC> &inputElements,
-        ComPtr<ID3D11VertexShader> &vertexShader,
-        ComPtr<ID3D11InputLayout> &inputLayout) {
-
-        ComPtr<ID3DBlob> shaderBlob;
-        ComPtr<ID3DBlob> errorBlob;
-
+    static UINT ShaderCompileFlags() {
         UINT compileFlags = 0;
 #if defined(DEBUG) || defined(_DEBUG)
         compileFlags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
 #endif
+        return compileFlags;
+    }
 
-        HRESULT hr = D3DCompileFromFile(
-            filename.c_str(), 0, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main",
-            "vs_5_0", compileFlags, 0, &shaderBlob, &errorBlob);
-
-        CheckResult(hr, errorBlob.Get());
-
-        m_device->CreateVertexShader(shaderBlob->GetBufferPointer(),
-                                     shaderBlob->GetBufferSize(), NULL,
-                                     &vertexShader);
+    void AppBase::QueueVertexShader(
+        const wstring &filename,
+        const vector<D3D11_INPUT_ELEMENT_DESC> &inputElements,
+        ComPtr<ID3D11VertexShader> &vertexShader,
+        ComPtr<ID3D11InputLayout> &inputLayout, const ShaderDefines &defines) {
+
+        QueuedShader shader;
+        shader.desc.filename = filesystem::path(filename).string();
+        shader.desc.target = "vs_5_0";
+        shader.desc.flags = ShaderCompileFlags();
+        shader.desc.defines = defines;
+        shader.filename = filename;
+        shader.inputElements = &inputElements;
+        shader.vertexShader = &vertexShader;
+        shader.inputLayout = &inputLayout;
+        m_queuedShaders.push_back(std::move(shader));
+    }
 
-        m_device->CreateInputLayout(inputElements.data(),
-                                    UINT(inputElements.size()),
-                                    shaderBlob->GetBufferPointer(),
-                                    shaderBlob->GetBufferSize(), &inputLayout);
+    void AppBase::QueuePixelShader(const wstring &filename,
+                                   ComPtr<ID3D11PixelShader> &pixelShader,
+                                   const ShaderDefines &defines) {
+
+        QueuedShader shader;
+        shader.desc.filename = filesystem::path(filename).string();
+        shader.desc.target = "ps_5_0";
+        shader.desc.flags = ShaderCompileFlags();
+        shader.desc.defines = defines;
+        shader.filename = filename;
+        shader.pixelShader = &pixelShader;
+        m_queuedShaders.push_back(std::move(shader));
     }
 
-        void AppBase::CreatePixelShader(const wstring &filename, 
-            ComPtr<ID3D11PixelShader> &pixelShader) {
+    void AppBase::CreateQueuedShaders() {
+        CpuTimer timer;
+        const size_t count = m_queuedShaders.size();
+        vector<uint64_t> keys(count, 0);
+        vector<vector<uint8_t>> bytecode(count);
+        vector<size_t> misses;
+
+        AssetCache &cache = AssetCache::Get();
+        for (size_t i = 0; i < count; i++) {
+            if (cache.Enabled() && ShaderCacheKey(m_queuedShaders[i].desc, keys[i]) &&
+                cache.LoadShader(keys[i], bytecode[i]))
+                continue;
+            misses.push_back(i);
+        }
 
-            ComPtr<ID3DBlob> shaderBlob;
-            ComPtr<ID3DBlob> errorBlob;
+        // D3DCompile is thread-safe, so each miss compiles on a worker.
+        vector<HRESULT> results(misses.size(), S_OK);
+        vector<ComPtr<ID3DBlob>> errors(misses.size());
+        ParallelFor(misses.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t m = begin; m < end; m++) {
+                const size_t i = misses[m];
+                const QueuedShader &shader = m_queuedShaders[i];
+
+                vector<D3D_SHADER_MACRO> macros;
+                for (const auto &define : shader.desc.defines)
+                    macros.push_back({define.first.c_str(), define.second.c_str()});
+                macros.push_back({nullptr, nullptr});
+
+                ComPtr<ID3DBlob> shaderBlob;
+                results[m] = D3DCompileFromFile(
+                    shader.filename.c_str(), macros.data(),
+                    D3D_COMPILE_STANDARD_FILE_INCLUDE, shader.desc.entry.c_str(),
+                    shader.desc.target.c_str(), shader.desc.flags, 0, &shaderBlob,
+                    &errors[m]);
+                if (FAILED(results[m]))
+                    continue;
+
+                const uint8_t *data =
+                    static_cast<const uint8_t *>(shaderBlob->GetBufferPointer());
+                bytecode[i].assign(data, data + shaderBlob->GetBufferSize());
+                if (keys[i] != 0)
+                    cache.StoreShader(keys[i], bytecode[i]);
+            }
+        });
+        for (size_t m = 0; m < misses.size(); m++)
+            CheckResult(results[m], errors[m].Get());
+
+        for (size_t i = 0; i < count; i++) {
+            const QueuedShader &shader = m_queuedShaders[i];
+            const vector<uint8_t> &code = bytecode[i];
+            if (code.empty())
+                continue;
+
+            if (shader.vertexShader) {
+                m_device->CreateVertexShader(code.data(), code.size(), NULL,
+                                             shader.vertexShader->ReleaseAndGetAddressOf());
+                m_device->CreateInputLayout(
+                    shader.inputElements->data(), UINT(shader.inputElements->size()),
+                    code.data(), code.size(), shader.inputLayout->ReleaseAndGetAddressOf());
+            } else {
+                m_device->CreatePixelShader(code.data(), code.size(), NULL,
+                                            shader.pixelShader->ReleaseAndGetAddressOf());
+            }
+        }
 
-            UINT compileFlags = 0;
+        LOG_INFO(LogCategory::Render, "%zu shaders, %zu compiled, in %.1f ms", count,
+                 misses.size(), timer.ElapsedMs());
+        m_queuedShaders.clear();
+    }
 
-    #if defined(DEBUG) || defined(_DEBUG)
-         compileFlags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
-    #endif
+    void AppBase::CreateVertexShaderAndInputLayout(
+        const wstring &filename,
+        const vector<D3D11_INPUT_ELEMENT_DESC> &inputElements,
+        ComPtr<ID3D11VertexShader> &vertexShader,
+        ComPtr<ID3D11InputLayout> &inputLayout) {
 
-            HRESULT hr = D3DCompileFromFile(
-                filename.c_str(), 0, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main",
-                "ps_5_0", compileFlags, 0, &shaderBlob, &errorBlob);
+        QueueVertexShader(filename, inputElements, vertexShader, inputLayout);
+        CreateQueuedShaders();
+    }
 
-            CheckResult(hr, errorBlob.Get());
+    void AppBase::CreatePixelShader(const wstring &filename,
+                                    ComPtr<ID3D11PixelShader> &pixelShader) {
 
-            m_device->CreatePixelShader(shaderBlob->GetBufferPointer(),
-                                        shaderBlob->GetBufferSize(), NULL,
-                                        &pixelShader);
-        }
+        QueuePixelShader(filename, pixelShader);
+        CreateQueuedShaders();
+    }
 
         void AppBase::CreateIndexBuffer(const std::vector<uint32_t> &indices,
                                         ComPtr<ID3D11Buffer> &indexBuffer) {
@@ -510,71 +648,111 @@ namespace hlab {
             indexBufferData.SysMemPitch = 0;
             indexBufferData.SysMemSlicePitch = 0;
 
-            m_device->CreateBuffer(&bufferDesc, &indexBufferData,
-                                   indexBuffer.GetAddressOf());
+            if (SUCCEEDED(m_device->CreateBuffer(&bufferDesc, &indexBufferData,
+                                                 indexBuffer.GetAddressOf()))) {
+                m_gpuMemory.indexBytes += bufferDesc.ByteWidth;
+            }
         }
         ///
 
         void AppBase::CreateTexture(const std::string filename,
                               ComPtr<ID3D11Texture2D> &texture,
                               ComPtr<ID3D11ShaderResourceView> &textureResourceView,
-                              bool useSRGB) {
+                              bool useSRGB, bool normalMap) {
             
             if (!m_device) {
-                std::cout << "[Texture] m_device is NULL! file=" << filename
-                          << "\n";
+                LOG_ERROR(LogCategory::Texture, "m_device is NULL! file=%s",
+                          filename.c_str());
                 return;
             }
 
-            int width = 0, height = 0, channelsInFile = 0;
+            // Mips and block compression come from the asset cache, so only
+            // the first run pays for them.
+            CachedTexture cached;
+            if (!AssetCache::Get().LoadTexture(filename, useSRGB, normalMap,
+                                               cached))
+                return;
+            UploadTexture(cached, filename, texture, textureResourceView, useSRGB);
+        }
 
-            unsigned char *img = stbi_load(filename.c_str(), &width, &height,
-                                           &channelsInFile, 4);
-            if (!img) {
-                std::cout << "[Texture] stbi_load FAIL: " << filename << "\n";
-                std::cout << "[Texture] reason: " << stbi_failure_reason()
-                          << "\n";
+        void AppBase::CreateTexture(const ImageData &image, const std::string &name,
+                              ComPtr<ID3D11Texture2D> &texture,
+                              ComPtr<ID3D11ShaderResourceView> &textureResourceView,
+                              bool useSRGB, bool normalMap) {
+            if (!m_device) {
+                LOG_ERROR(LogCategory::Texture, "m_device is NULL! image=%s",
+                          name.c_str());
                 return;
             }
 
+            CachedTexture cached;
+            if (!AssetCache::Get().LoadTexture(image, useSRGB, normalMap, cached))
+                return;
+            UploadTexture(cached, name, texture, textureResourceView, useSRGB);
+        }
+
+        void AppBase::UploadTexture(const CachedTexture &cached, const std::string &filename,
+                              ComPtr<ID3D11Texture2D> &texture,
+                              ComPtr<ID3D11ShaderResourceView> &textureResourceView,
+                              bool useSRGB) {
+            if (cached.mips.empty())
+                return;
+
             texture.Reset();
             textureResourceView.Reset();
 
+            DXGI_FORMAT format = useSRGB ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+                                         : DXGI_FORMAT_R8G8B8A8_UNORM;
+            UINT blockBytes = 0;
+            if (cached.format == TextureFormat::BC1) {
+                format = useSRGB ? DXGI_FORMAT_BC1_UNORM_SRGB
+                                 : DXGI_FORMAT_BC1_UNORM;
+                blockBytes = 8;
+            } else if (cached.format == TextureFormat::BC5) {
+                format = DXGI_FORMAT_BC5_UNORM;
+                blockBytes = 16;
+            }
+
             D3D11_TEXTURE2D_DESC desc = {};
-            desc.Width = (UINT)width;
-            desc.Height = (UINT)height;
-            desc.MipLevels = 1;
+            desc.Width = (UINT)cached.mips[0].width;
+            desc.Height = (UINT)cached.mips[0].height;
+            desc.MipLevels = (UINT)cached.mips.size();
             desc.ArraySize = 1;
-            desc.Format = useSRGB ? 
-                DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
-                : DXGI_FORMAT_R8G8B8A8_UNORM;  
+            desc.Format = format;
             desc.SampleDesc.Count = 1;
             desc.Usage = D3D11_USAGE_IMMUTABLE;
             desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 
-            D3D11_SUBRESOURCE_DATA init = {};
-            init.pSysMem = img;
-            init.SysMemPitch = (UINT)(width * 4); // RGBA
+            std::vector<D3D11_SUBRESOURCE_DATA> init(cached.mips.size());
+            uint64_t bytes = 0;
+            for (size_t i = 0; i < cached.mips.size(); i++) {
+                const TextureMip &mip = cached.mips[i];
+                init[i].pSysMem = mip.data.data();
+                init[i].SysMemPitch =
+                    blockBytes ? UINT((mip.width + 3) / 4) * blockBytes
+                               : UINT(mip.width * 4); // RGBA
+                bytes += mip.data.size();
+            }
 
             HRESULT hr =
-                m_device->CreateTexture2D(&desc, &init, texture.GetAddressOf());
+                m_device->CreateTexture2D(&desc, init.data(), texture.GetAddressOf());
             if (FAILED(hr)) {
-                std::cout << "[Texture] CreateTexture2D FAIL hr=0x" << std::hex
-                          << hr << std::dec << " file=" << filename << "\n";
-                stbi_image_free(img);
+                LOG_ERROR(LogCategory::Texture,
+                          "CreateTexture2D FAIL hr=0x%08lx file=%s",
+                          (unsigned long)hr, filename.c_str());
                 return;
             }
 
             hr = m_device->CreateShaderResourceView(
                 texture.Get(), nullptr, textureResourceView.GetAddressOf());
             if (FAILED(hr)) {
-                std::cout << "[Texture] CreateSRV FAIL hr=0x" << std::hex << hr
-                          << std::dec << " file=" << filename << "\n";
-                stbi_image_free(img);
+                LOG_ERROR(LogCategory::Texture,
+                          "CreateSRV FAIL hr=0x%08lx file=%s",
+                          (unsigned long)hr, filename.c_str());
                 return;
             }
 
-            stbi_image_free(img);
+            m_gpuMemory.textureBytes += bytes;
         }
       
     }
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "AssetCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+#include "Hash.h"
+#include "Image.h"
+#include "Logger.h"
+#include "ShaderCache.h"
+#include "TextureCompress.h"
+
+namespace hlab {
+
+	namespace fs = std::filesystem;
+
+    AssetCache &AssetCache::Get() {
+        static AssetCache cache;
+        return cache;
+    }
+
+    AssetCache::AssetCache() {
+        if (const char *mb = getenv("HLAB_ASSET_CACHE_MB"))
+            m_maxBytes = uint64_t(std::max(1ll, atoll(mb))) << 20;
+
+        const char *dir = getenv("HLAB_ASSET_CACHE");
+        if (dir && std::string(dir) == "off")
+            return;
+
+        std::error_code ec;
+        SetDirectory(dir && *dir ? fs::path(dir)
+                                 : fs::temp_directory_path(ec) / "hlab_asset_cache");
+    }
+
+    void AssetCache::SetDirectory(const fs::path &directory) {
+        std::lock_guard<std::mutex> lock(m_trimMutex);
+        m_directory = directory;
+        m_scanned = false;
+        m_approxBytes = 0;
+
+        if (!m_directory.empty()) {
+            std::error_code ec;
+            fs::create_directories(m_directory, ec);
+            if (ec) {
+                LOG_WARN(LogCategory::General, "Asset cache disabled, cannot create %s",
+                         m_directory.string().c_str());
+                m_directory.clear();
+            }
+        }
+    }
+
+    fs::path AssetCache::EntryPath(uint64_t key, const char *extension) const {
+        return m_directory / (HashToString(key) + extension);
+    }
+
+    bool AssetCache::Read(const fs::path &path, std::vector<uint8_t> &bytes) {
+        if (!ReadFileBytes(path.string(), bytes))
+            return false;
+
+        // The file time is the LRU timestamp.
+        std::error_code ec;
+        fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    void AssetCache::Write(const fs::path &path,
+                           const std::vector<uint8_t> &bytes) {
+        if (!WriteFileAtomic(path.string(), bytes.data(), bytes.size()))
+            return;
+
+        const uint64_t total = m_approxBytes += bytes.size();
+        if (!m_scanned || total > m_maxBytes)
+            Trim();
+    }
+
+    bool AssetCache::LoadMeshes(uint64_t key, std::vector<MeshData> &meshes) {
+        if (!Enabled())
+            return false;
+
+        std::vector<uint8_t> bytes;
+        const fs::path path = EntryPath(key, ".hlmesh");
+        if (!Read(path, bytes))
+            return false;
+
+        std::vector<MeshData> cached;
+        if (!DeserializeMeshes(bytes.data(), bytes.size(), cached)) {
+            LOG_WARN(LogCategory::Loader, "Ignoring invalid cache entry %s",
+                     path.string().c_str());
+            return false;
+        }
+
+        for (auto &mesh : cached)
+            meshes.push_back(std::move(mesh));
+        return true;
+    }
+
+    void AssetCache::StoreMeshes(uint64_t key, const std::vector<MeshData> &meshes) {
+        if (!Enabled())
+            return;
+
+        std::vector<uint8_t> bytes;
+        SerializeMeshes(meshes, bytes);
+        Write(EntryPath(key, ".hlmesh"), bytes);
+    }
+
+    bool AssetCache::LoadTexture(const std::string &filename, bool srgb,
+                                 bool normalMap, CachedTexture &texture) {
+        uint64_t key = 0;
+        if (Enabled()) {
+            uint64_t sourceHash = 0;
+            if (HashFile(filename, sourceHash)) {
+                key = TextureKey(sourceHash, srgb, normalMap);
+
+                std::vector<uint8_t> bytes;
+                if (Read(EntryPath(key, ".hltx"), bytes) &&
+                    DeserializeTexture(bytes.data(), bytes.size(), texture))
+                    return true;
+            }
+        }
+
+        ImageData image;
+        if (!LoadImageRGBA(filename, image))
+            return false;
+
+        BuildTexture(image, srgb, normalMap, key, texture);
+        return true;
+    }
+
+    bool AssetCache::LoadTexture(const ImageData &image, bool srgb,
+                                 bool normalMap, CachedTexture &texture) {
+        if (image.pixels.empty())
+            return false;
+
+        uint64_t key = 0;
+        if (Enabled()) {
+            key = TextureKey(ImageHash(image), srgb, normalMap);
+
+            std::vector<uint8_t> bytes;
+            if (Read(EntryPath(key, ".hltx"), bytes) &&
+                DeserializeTexture(bytes.data(), bytes.size(), texture))
+                return true;
+        }
+
+        BuildTexture(image, srgb, normalMap, key, texture);
+        return true;
+    }
+
+    uint64_t AssetCache::ImageHash(const ImageData &image) {
+        Hasher64 hasher;
+        hasher.UpdateValue(image.width);
+        hasher.UpdateValue(image.height);
+        hasher.Update(image.pixels.data(), image.pixels.size());
+        return hasher.Digest();
+    }
+
+    uint64_t AssetCache::TextureKey(uint64_t sourceHash, bool srgb,
+                                    bool normalMap) const {
+        Hasher64 hasher;
+        hasher.UpdateValue(kTextureCacheVersion);
+        hasher.UpdateValue(sourceHash);
+        hasher.UpdateValue(srgb);
+        hasher.UpdateValue(normalMap);
+        return hasher.Digest();
+    }
+
+    void AssetCache::BuildTexture(const ImageData &image, bool srgb, bool normalMap,
+                                  uint64_t key, CachedTexture &texture) {
+        // D3D11 needs block-compressed top levels in whole blocks.
+        const bool compress =
+            !normalMap && image.width % 4 == 0 && image.height % 4 == 0;
+
+        texture.format = compress ? TextureFormat::BC1 : TextureFormat::RGBA8;
+        texture.srgb = srgb;
+        texture.mips.clear();
+        for (auto &mip : GenerateMips(image, srgb)) {
+            TextureMip out;
+            out.width = mip.width;
+            out.height = mip.height;
+            out.data = compress ? CompressBC1(mip) : std::move(mip.pixels);
+            texture.mips.push_back(std::move(out));
+        }
+
+        if (key != 0) {
+            std::vector<uint8_t> bytes;
+            SerializeTexture(texture, bytes);
+            Write(EntryPath(key, ".hltx"), bytes);
+        }
+    }
+
+    bool AssetCache::LoadShader(uint64_t key, std::vector<uint8_t> &bytecode) {
+        if (!Enabled())
+            return false;
+
+        const fs::path path = EntryPath(key, ".hlshader");
+        if (!Read(path, bytecode))
+            return false;
+        if (!IsShaderBytecode(bytecode)) {
+            LOG_WARN(LogCategory::Render, "Ignoring invalid cache entry %s",
+                     path.string().c_str());
+            bytecode.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void AssetCache::StoreShader(uint64_t key, const std::vector<uint8_t> &bytecode) {
+        if (Enabled())
+            Write(EntryPath(key, ".hlshader"), bytecode);
+    }
+
+    void AssetCache::Trim() {
+        std::lock_guard<std::mutex> lock(m_trimMutex);
+        if (m_directory.empty())
+            return;
+
+        struct Entry {
+            fs::path path;
+            fs::file_time_type time;
+            uint64_t size;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+
+        const auto now = fs::file_time_type::clock::now();
+        std::error_code ec;
+        for (auto it = fs::directory_iterator(m_directory, ec);
+             it != fs::directory_iterator(); it.increment(ec)) {
+            if (ec)
+                break;
+            if (!it->is_regular_file(ec))
+                continue;
+
+            Entry entry{it->path(), it->last_write_time(ec), it->file_size(ec)};
+            if (ec)
+                continue;
+
+            // Temporaries left behind by a writer that crashed.
+            if (entry.path.filename().string().find(".tmp") != std::string::npos) {
+                if (now - entry.time > std::chrono::hours(1))
+                    fs::remove(entry.path, ec);
+                continue;
+            }
+
+            total += entry.size;
+            entries.push_back(std::move(entry));
+        }
+
+        if (total > m_maxBytes) {
+            std::sort(entries.begin(), entries.end(),
+                      [](const Entry &a, const Entry &b) { return a.time < b.time; });
+
+            const uint64_t target = m_maxBytes / 10 * 9;
+            size_t removed = 0;
+            for (const auto &entry : entries) {
+                if (total <= target)
+                    break;
+                // Fails for files another process has open, those stay.
+                if (fs::remove(entry.path, ec)) {
+                    total -= entry.size;
+                    removed++;
+                }
+            }
+            LOG_INFO(LogCategory::General, "Asset cache evicted %zu files, %llu MB left",
+                     removed, (unsigned long long)(total >> 20));
+        }
+
+        m_approxBytes = total;
+        m_scanned = true;
+    }
+}
@@ -0,0 +1,110 @@
+#include "Bounds.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <emmintrin.h>
+
+namespace hlab {
+
+	void MeshBounds::Merge(const MeshBounds &other) {
+        aabbMin = Vector3::Min(aabbMin, other.aabbMin);
+        aabbMax = Vector3::Max(aabbMax, other.aabbMax);
+
+        const Vector3 d = other.center - center;
+        const float dist = d.Length();
+        if (dist + other.radius <= radius)
+            return;
+        if (dist + radius <= other.radius) {
+            center = other.center;
+            radius = other.radius;
+            return;
+        }
+
+        const float newRadius = (dist + radius + other.radius) * 0.5f;
+        center = center + d * ((newRadius - radius) / dist);
+        radius = newRadius;
+	}
+
+    MeshBounds MeshBounds::Transformed(const Matrix &m) const {
+        MeshBounds out;
+
+        // Arvo's method: transform the center and extents separately.
+        const Vector3 c = (aabbMin + aabbMax) * 0.5f;
+        const Vector3 e = (aabbMax - aabbMin) * 0.5f;
+        const Vector3 tc = Vector3::Transform(c, m);
+        const Vector3 te(
+            std::fabs(m._11) * e.x + std::fabs(m._21) * e.y + std::fabs(m._31) * e.z,
+            std::fabs(m._12) * e.x + std::fabs(m._22) * e.y + std::fabs(m._32) * e.z,
+            std::fabs(m._13) * e.x + std::fabs(m._23) * e.y + std::fabs(m._33) * e.z);
+        out.aabbMin = tc - te;
+        out.aabbMax = tc + te;
+
+        const float sx = Vector3(m._11, m._12, m._13).Length();
+        const float sy = Vector3(m._21, m._22, m._23).Length();
+        const float sz = Vector3(m._31, m._32, m._33).Length();
+        out.center = Vector3::Transform(center, m);
+        out.radius = radius * std::max(sx, std::max(sy, sz));
+        return out;
+    }
+
+    MeshBounds ComputeBounds(const std::vector<Vertex> &vertices) {
+        MeshBounds b;
+        if (vertices.empty())
+            return b;
+
+        static_assert(offsetof(Vertex, position) + sizeof(float) * 4 <=
+                          sizeof(Vertex),
+                      "position is loaded as four floats");
+
+        // The fourth lane picks up normal.x and is ignored.
+        const float *base = &vertices[0].position.x;
+        const size_t stride = sizeof(Vertex) / sizeof(float);
+        const size_t count = vertices.size();
+
+        __m128 vmin0 = _mm_loadu_ps(base);
+        __m128 vmax0 = vmin0;
+        __m128 vmin1 = vmin0;
+        __m128 vmax1 = vmin0;
+
+        size_t i = 1;
+        for (; i + 1 < count; i += 2) {
+            const __m128 p0 = _mm_loadu_ps(base + i * stride);
+            const __m128 p1 = _mm_loadu_ps(base + (i + 1) * stride);
+            vmin0 = _mm_min_ps(vmin0, p0);
+            vmax0 = _mm_max_ps(vmax0, p0);
+            vmin1 = _mm_min_ps(vmin1, p1);
+            vmax1 = _mm_max_ps(vmax1, p1);
+        }
+        if (i < count) {
+            const __m128 p = _mm_loadu_ps(base + i * stride);
+            vmin0 = _mm_min_ps(vmin0, p);
+            vmax0 = _mm_max_ps(vmax0, p);
+        }
+
+        alignas(16) float mn[4];
+        alignas(16) float mx[4];
+        _mm_store_ps(mn, _mm_min_ps(vmin0, vmin1));
+        _mm_store_ps(mx, _mm_max_ps(vmax0, vmax1));
+
+        b.aabbMin = Vector3(mn[0], mn[1], mn[2]);
+        b.aabbMax = Vector3(mx[0], mx[1], mx[2]);
+        b.center = (b.aabbMin + b.aabbMax) * 0.5f;
+
+        const __m128 c = _mm_setr_ps(b.center.x, b.center.y, b.center.z, 0.0f);
+        const __m128 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+        __m128 maxDist = _mm_setzero_ps();
+        for (size_t j = 0; j < count; j++) {
+            __m128 d = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(base + j * stride), c),
+                                  mask);
+            maxDist = _mm_max_ps(maxDist, _mm_mul_ps(d, d));
+        }
+
+        // Per-axis maxima give a slightly conservative sphere without a
+        // horizontal add per vertex.
+        alignas(16) float md[4];
+        _mm_store_ps(md, maxDist);
+        b.radius = std::sqrt(md[0] + md[1] + md[2]);
+        return b;
+    }
+}
@@ -0,0 +1,467 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    const int kBins = 16;
+    const uint32_t kMinLeafSize = 4;
+    const uint32_t kMaxLeafSize = 16;
+    const uint32_t kParallelSubtree = 4096;
+    const size_t kParallelBinning = 1 << 16;
+
+    struct BuildNode {
+        Aabb bounds;
+        uint32_t left = 0; // right child is left + 1
+        uint32_t first = 0;
+        uint32_t count = 0; // > 0 for leaves
+    };
+
+    struct Bin {
+        Aabb bounds;
+        uint32_t count = 0;
+    };
+
+    struct BuildContext {
+        const std::vector<Aabb> *prims = nullptr;
+        std::vector<Vector3> centroids;
+        std::vector<uint32_t> *indices = nullptr;
+        std::vector<BuildNode> nodes;
+        std::atomic<uint32_t> nodeCount{0};
+    };
+
+    float Axis(const Vector3 &v, int axis) {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    int BinIndex(float c, float lo, float scale) {
+        return std::min(kBins - 1, std::max(0, int((c - lo) * scale)));
+    }
+
+    void BinRange(const BuildContext &ctx, uint32_t first, uint32_t count,
+                  int axis, float lo, float scale, Bin *bins) {
+        const auto &indices = *ctx.indices;
+        for (uint32_t i = first; i < first + count; i++) {
+            const uint32_t prim = indices[i];
+            Bin &bin =
+                bins[BinIndex(Axis(ctx.centroids[prim], axis), lo, scale)];
+            bin.bounds.Grow((*ctx.prims)[prim]);
+            bin.count++;
+        }
+    }
+
+    void Subdivide(BuildContext &ctx, uint32_t nodeIndex) {
+        BuildNode &node = ctx.nodes[nodeIndex];
+        auto &indices = *ctx.indices;
+
+        Aabb centroidBounds;
+        node.bounds = Aabb();
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            node.bounds.Grow((*ctx.prims)[indices[i]]);
+            centroidBounds.Grow(ctx.centroids[indices[i]]);
+        }
+
+        if (node.count <= kMinLeafSize)
+            return;
+
+        const Vector3 extent = centroidBounds.max - centroidBounds.min;
+        int axis = 0;
+        if (extent.y > extent.x)
+            axis = 1;
+        if (extent.z > Axis(extent, axis))
+            axis = 2;
+
+        const float lo = Axis(centroidBounds.min, axis);
+        const float span = Axis(extent, axis);
+
+        uint32_t mid = node.first;
+        if (span <= 1e-12f) {
+            // All centroids coincide; split by count when too big for a leaf.
+            if (node.count <= kMaxLeafSize)
+                return;
+            mid = node.first + node.count / 2;
+        } else {
+            const float scale = float(kBins) / span * 0.9999f;
+
+            Bin bins[kBins];
+            if (node.count >= kParallelBinning) {
+                const size_t chunk = 1 << 14;
+                const size_t chunks = (node.count + chunk - 1) / chunk;
+                std::vector<Bin> partial(chunks * kBins);
+                ParallelFor(chunks, 1, [&](size_t begin, size_t end) {
+                    for (size_t c = begin; c < end; c++) {
+                        const uint32_t first = node.first + uint32_t(c * chunk);
+                        const uint32_t count = uint32_t(std::min<size_t>(
+                            chunk, node.first + node.count - first));
+                        BinRange(ctx, first, count, axis, lo, scale,
+                                 &partial[c * kBins]);
+                    }
+                });
+                for (size_t c = 0; c < chunks; c++) {
+                    for (int b = 0; b < kBins; b++) {
+                        bins[b].bounds.Grow(partial[c * kBins + b].bounds);
+                        bins[b].count += partial[c * kBins + b].count;
+                    }
+                }
+            } else {
+                BinRange(ctx, node.first, node.count, axis, lo, scale, bins);
+            }
+
+            // Sweep from both sides to get the SAH cost of every plane.
+            float rightArea[kBins];
+            uint32_t rightCount[kBins];
+            Aabb acc;
+            uint32_t n = 0;
+            for (int b = kBins - 1; b > 0; b--) {
+                acc.Grow(bins[b].bounds);
+                n += bins[b].count;
+                rightArea[b] = acc.HalfArea();
+                rightCount[b] = n;
+            }
+
+            float bestCost = FLT_MAX;
+            int bestSplit = -1;
+            acc = Aabb();
+            n = 0;
+            for (int b = 0; b < kBins - 1; b++) {
+                acc.Grow(bins[b].bounds);
+                n += bins[b].count;
+                if (n == 0 || rightCount[b + 1] == 0)
+                    continue;
+                const float cost =
+                    acc.HalfArea() * n + rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = b;
+                }
+            }
+
+            const float leafCost = node.bounds.HalfArea() * node.count;
+            if (bestSplit < 0 ||
+                (bestCost >= leafCost && node.count <= kMaxLeafSize)) {
+                if (node.count <= kMaxLeafSize)
+                    return;
+                mid = node.first + node.count / 2;
+            } else {
+                auto begin = indices.begin() + node.first;
+                auto split = std::partition(
+                    begin, begin + node.count, [&](uint32_t prim) {
+                        return BinIndex(Axis(ctx.centroids[prim], axis), lo,
+                                        scale) <= bestSplit;
+                    });
+                mid = uint32_t(split - indices.begin());
+            }
+        }
+
+        if (mid == node.first || mid == node.first + node.count)
+            mid = node.first + node.count / 2;
+
+        const uint32_t left = ctx.nodeCount.fetch_add(2);
+        ctx.nodes[left].first = node.first;
+        ctx.nodes[left].count = mid - node.first;
+        ctx.nodes[left + 1].first = mid;
+        ctx.nodes[left + 1].count = node.first + node.count - mid;
+        node.left = left;
+        const uint32_t count = node.count;
+        node.count = 0;
+
+        if (count >= kParallelSubtree) {
+            ParallelFor(2, 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    Subdivide(ctx, left + uint32_t(i));
+            });
+        } else {
+            Subdivide(ctx, left);
+            Subdivide(ctx, left + 1);
+        }
+    }
+    }
+
+    static uint32_t Collapse(const std::vector<BuildNode> &binary,
+                             uint32_t binaryIndex, uint32_t depth,
+                             std::vector<Bvh4::Node> &nodes, uint32_t &maxDepth) {
+        maxDepth = std::max(maxDepth, depth);
+        uint32_t children[4];
+        int childCount = 0;
+
+        const BuildNode &root = binary[binaryIndex];
+        if (root.count > 0) {
+            children[childCount++] = binaryIndex;
+        } else {
+            children[childCount++] = root.left;
+            children[childCount++] = root.left + 1;
+        }
+
+        // Open the largest inner child until four slots are used.
+        while (childCount < 4) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < childCount; i++) {
+                const BuildNode &c = binary[children[i]];
+                if (c.count == 0 && c.bounds.HalfArea() > bestArea) {
+                    bestArea = c.bounds.HalfArea();
+                    best = i;
+                }
+            }
+            if (best < 0)
+                break;
+            const uint32_t opened = children[best];
+            children[best] = binary[opened].left;
+            children[childCount++] = binary[opened].left + 1;
+        }
+
+        const uint32_t index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        for (int i = 0; i < 4; i++) {
+            Bvh4::Node &n = nodes[index];
+            if (i >= childCount) {
+                n.minX[i] = n.minY[i] = n.minZ[i] = FLT_MAX;
+                n.maxX[i] = n.maxY[i] = n.maxZ[i] = -FLT_MAX;
+                n.child[i] = Bvh4::kInvalid;
+                n.count[i] = 0;
+                continue;
+            }
+
+            const BuildNode &c = binary[children[i]];
+            n.minX[i] = c.bounds.min.x;
+            n.minY[i] = c.bounds.min.y;
+            n.minZ[i] = c.bounds.min.z;
+            n.maxX[i] = c.bounds.max.x;
+            n.maxY[i] = c.bounds.max.y;
+            n.maxZ[i] = c.bounds.max.z;
+
+            if (c.count > 0) {
+                n.child[i] = c.first;
+                n.count[i] = c.count;
+            } else {
+                // nodes may reallocate during the recursive call.
+                const uint32_t child =
+                    Collapse(binary, children[i], depth + 1, nodes, maxDepth);
+                nodes[index].child[i] = child;
+                nodes[index].count[i] = 0;
+            }
+        }
+        return index;
+    }
+
+    void Bvh4::Build(const std::vector<Aabb> &primBounds) {
+        m_nodes.clear();
+        m_depth = 0;
+        m_primIndices.resize(primBounds.size());
+        if (primBounds.empty())
+            return;
+
+        for (uint32_t i = 0; i < uint32_t(primBounds.size()); i++)
+            m_primIndices[i] = i;
+
+        BuildContext ctx;
+        ctx.prims = &primBounds;
+        ctx.indices = &m_primIndices;
+        ctx.centroids.resize(primBounds.size());
+        ParallelFor(primBounds.size(), 1 << 14, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                ctx.centroids[i] = primBounds[i].Center();
+        });
+
+        ctx.nodes.resize(primBounds.size() * 2);
+        ctx.nodes[0].first = 0;
+        ctx.nodes[0].count = uint32_t(primBounds.size());
+        ctx.nodeCount = 1;
+        Subdivide(ctx, 0);
+
+        ctx.nodes.resize(ctx.nodeCount.load());
+        m_nodes.reserve(ctx.nodes.size() / 2 + 1);
+        Collapse(ctx.nodes, 0, 1, m_nodes, m_depth);
+    }
+
+    void Bvh4::Refit(const std::vector<Aabb> &primBounds) {
+        // Collapse adds a node before its children, so walking backwards
+        // refits every child before the slot that points at it.
+        std::vector<Aabb> nodeBounds(m_nodes.size());
+        for (size_t i = m_nodes.size(); i-- > 0;) {
+            Node &n = m_nodes[i];
+            for (int c = 0; c < 4; c++) {
+                if (n.child[c] == kInvalid)
+                    continue;
+
+                Aabb b;
+                if (n.count[c] == 0) {
+                    b = nodeBounds[n.child[c]];
+                } else {
+                    for (uint32_t p = 0; p < n.count[c]; p++)
+                        b.Grow(primBounds[m_primIndices[n.child[c] + p]]);
+                }
+                n.minX[c] = b.min.x;
+                n.minY[c] = b.min.y;
+                n.minZ[c] = b.min.z;
+                n.maxX[c] = b.max.x;
+                n.maxY[c] = b.max.y;
+                n.maxZ[c] = b.max.z;
+                nodeBounds[i].Grow(b);
+            }
+        }
+    }
+
+    void TriangleMeshBvh::Build(const MeshData &mesh) {
+        positions.resize(mesh.vertices.size());
+        bounds = Aabb();
+        for (size_t i = 0; i < mesh.vertices.size(); i++) {
+            positions[i] = mesh.vertices[i].position;
+            bounds.Grow(positions[i]);
+        }
+        indices = mesh.indices;
+
+        bvh.Build(TriangleBounds());
+    }
+
+    void TriangleMeshBvh::Refit(const std::vector<Vertex> &vertices) {
+        if (vertices.size() != positions.size())
+            return;
+
+        bounds = Aabb();
+        for (size_t i = 0; i < vertices.size(); i++) {
+            positions[i] = vertices[i].position;
+            bounds.Grow(positions[i]);
+        }
+
+        bvh.Refit(TriangleBounds());
+    }
+
+    std::vector<Aabb> TriangleMeshBvh::TriangleBounds() const {
+        const size_t triangles = indices.size() / 3;
+        std::vector<Aabb> primBounds(triangles);
+        ParallelFor(triangles, 1 << 14, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; t++) {
+                Aabb b;
+                b.Grow(positions[indices[t * 3]]);
+                b.Grow(positions[indices[t * 3 + 1]]);
+                b.Grow(positions[indices[t * 3 + 2]]);
+                primBounds[t] = b;
+            }
+        });
+        return primBounds;
+    }
+
+    bool TriangleMeshBvh::Intersect(const Ray &ray, float &tMax,
+                                    RayHit &hit) const {
+        bool found = false;
+
+        bvh.Traverse(ray, tMax, [&](uint32_t tri, float &tLimit) {
+            // Moller-Trumbore, two-sided.
+            const Vector3 &p0 = positions[indices[tri * 3]];
+            const Vector3 &p1 = positions[indices[tri * 3 + 1]];
+            const Vector3 &p2 = positions[indices[tri * 3 + 2]];
+
+            const Vector3 e1 = p1 - p0;
+            const Vector3 e2 = p2 - p0;
+            const Vector3 pv = ray.direction.Cross(e2);
+            const float det = e1.Dot(pv);
+            if (std::fabs(det) < 1e-12f)
+                return;
+
+            const float invDet = 1.0f / det;
+            const Vector3 tv = ray.origin - p0;
+            const float u = tv.Dot(pv) * invDet;
+            if (u < 0.0f || u > 1.0f)
+                return;
+
+            const Vector3 qv = tv.Cross(e1);
+            const float v = ray.direction.Dot(qv) * invDet;
+            if (v < 0.0f || u + v > 1.0f)
+                return;
+
+            const float t = e2.Dot(qv) * invDet;
+            if (t < 0.0f || t >= tLimit)
+                return;
+
+            tLimit = t;
+            hit.hit = true;
+            hit.t = t;
+            hit.triangle = tri;
+            hit.u = u;
+            hit.v = v;
+            found = true;
+        });
+
+        return found;
+    }
+
+    void ScenePicker::Build(const std::vector<MeshData> &meshes) {
+        m_meshes.clear();
+        m_meshes.resize(meshes.size());
+
+        ParallelFor(meshes.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                m_meshes[i].Build(meshes[i]);
+        });
+
+        std::vector<Aabb> meshBounds(m_meshes.size());
+        for (size_t i = 0; i < m_meshes.size(); i++)
+            meshBounds[i] = m_meshes[i].bounds;
+        m_top.Build(meshBounds);
+    }
+
+    RayHit ScenePicker::Intersect(const Ray &ray) const {
+        RayHit hit;
+        float tMax = ray.tMax;
+
+        m_top.Traverse(ray, tMax, [&](uint32_t mesh, float &tLimit) {
+            IntersectMesh(mesh, ray, tLimit, hit);
+        });
+
+        return hit;
+    }
+
+    bool ScenePicker::IntersectMesh(uint32_t mesh, const Ray &ray, float &tMax,
+                                    RayHit &hit) const {
+        if (mesh >= m_meshes.size() || !m_meshes[mesh].Intersect(ray, tMax, hit))
+            return false;
+        hit.mesh = mesh;
+        return true;
+    }
+
+    void ScenePicker::RefitMesh(uint32_t mesh, const std::vector<Vertex> &vertices) {
+        if (mesh < m_meshes.size())
+            m_meshes[mesh].Refit(vertices);
+    }
+
+    void ScenePicker::SetInstances(const std::vector<uint32_t> &meshes,
+                                   const std::vector<Matrix> &worlds,
+                                   const std::vector<MeshBounds> &worldBounds) {
+        std::vector<Aabb> boxes(worldBounds.size());
+        for (size_t i = 0; i < worldBounds.size(); i++) {
+            boxes[i].min = worldBounds[i].aabbMin;
+            boxes[i].max = worldBounds[i].aabbMax;
+        }
+
+        if (boxes.size() == m_instanceMeshes.size() && !m_instanceTop.Empty())
+            m_instanceTop.Refit(boxes);
+        else
+            m_instanceTop.Build(boxes);
+        m_instanceMeshes = meshes;
+        m_instanceWorlds = worlds;
+    }
+
+    RayHit ScenePicker::IntersectInstances(const Ray &ray, uint32_t &instance) const {
+        RayHit hit;
+        float tMax = ray.tMax;
+
+        m_instanceTop.Traverse(ray, tMax, [&](uint32_t i, float &tLimit) {
+            const Matrix toModel = m_instanceWorlds[i].Invert();
+            Ray local;
+            local.origin = Vector3::Transform(ray.origin, toModel);
+            local.direction = Vector3::TransformNormal(ray.direction, toModel);
+            if (IntersectMesh(m_instanceMeshes[i], local, tLimit, hit))
+                instance = i;
+        });
+
+        return hit;
+    }
+}
@@ -0,0 +1,237 @@
+#include "CacheFormats.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Logger.h"
+
+namespace hlab {
+
+	namespace {
+
+    const uint32_t kMeshMagic = 0x434d4c48;    // "HLMC"
+    const uint32_t kTextureMagic = 0x58544c48; // "HLTX"
+
+    class Writer {
+      public:
+        explicit Writer(std::vector<uint8_t> &out) : m_out(out) {}
+
+        void Bytes(const void *data, size_t size) {
+            const uint8_t *p = static_cast<const uint8_t *>(data);
+            m_out.insert(m_out.end(), p, p + size);
+        }
+        void U32(uint32_t v) { Bytes(&v, 4); }
+        void U64(uint64_t v) { Bytes(&v, 8); }
+        void String(const std::string &s) {
+            U32(uint32_t(s.size()));
+            Bytes(s.data(), s.size());
+        }
+
+      private:
+        std::vector<uint8_t> &m_out;
+    };
+
+    class Reader {
+      public:
+        Reader(const uint8_t *data, size_t size) : m_p(data), m_end(data + size) {}
+
+        bool Bytes(void *out, size_t size) {
+            if (size_t(m_end - m_p) < size)
+                return false;
+            std::memcpy(out, m_p, size);
+            m_p += size;
+            return true;
+        }
+        bool U32(uint32_t &v) { return Bytes(&v, 4); }
+        bool U64(uint64_t &v) { return Bytes(&v, 8); }
+        bool String(std::string &s) {
+            uint32_t size;
+            if (!U32(size) || size_t(m_end - m_p) < size)
+                return false;
+            s.assign(reinterpret_cast<const char *>(m_p), size);
+            m_p += size;
+            return true;
+        }
+        // Count of elementSize-byte items, checked against what is left.
+        bool Count(uint64_t &count, size_t elementSize) {
+            return U64(count) && count <= size_t(m_end - m_p) / elementSize;
+        }
+
+      private:
+        const uint8_t *m_p;
+        const uint8_t *m_end;
+    };
+    }
+
+    void SerializeMeshes(const std::vector<MeshData> &meshes,
+                         std::vector<uint8_t> &out) {
+        Writer w(out);
+        w.U32(kMeshMagic);
+        w.U32(kMeshCacheVersion);
+        w.U32(uint32_t(sizeof(Vertex)));
+        w.U32(uint32_t(meshes.size()));
+
+        for (const auto &mesh : meshes) {
+            w.Bytes(&mesh.bounds, sizeof(MeshBounds));
+            w.String(mesh.baseColorFilename);
+            w.String(mesh.normalFilename);
+            w.String(mesh.ormFilename);
+            w.U64(mesh.vertices.size());
+            w.Bytes(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+            w.U64(mesh.indices.size());
+            w.Bytes(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+            w.U64(mesh.meshlets.size());
+            w.Bytes(mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet));
+        }
+    }
+
+    bool DeserializeMeshes(const uint8_t *data, size_t size,
+                           std::vector<MeshData> &meshes) {
+        Reader r(data, size);
+        uint32_t magic, version, vertexSize, count;
+        if (!r.U32(magic) || magic != kMeshMagic || !r.U32(version) ||
+            version != kMeshCacheVersion || !r.U32(vertexSize) ||
+            vertexSize != sizeof(Vertex) || !r.U32(count))
+            return false;
+
+        meshes.clear();
+        meshes.resize(count);
+        for (auto &mesh : meshes) {
+            uint64_t vertexCount, indexCount, meshletCount;
+            if (!r.Bytes(&mesh.bounds, sizeof(MeshBounds)) ||
+                !r.String(mesh.baseColorFilename) ||
+                !r.String(mesh.normalFilename) || !r.String(mesh.ormFilename) ||
+                !r.Count(vertexCount, sizeof(Vertex)))
+                return false;
+            mesh.vertices.resize(vertexCount);
+            if (!r.Bytes(mesh.vertices.data(), vertexCount * sizeof(Vertex)) ||
+                !r.Count(indexCount, sizeof(uint32_t)))
+                return false;
+            mesh.indices.resize(indexCount);
+            if (!r.Bytes(mesh.indices.data(), indexCount * sizeof(uint32_t)) ||
+                !r.Count(meshletCount, sizeof(Meshlet)))
+                return false;
+            mesh.meshlets.resize(meshletCount);
+            if (!r.Bytes(mesh.meshlets.data(), meshletCount * sizeof(Meshlet)))
+                return false;
+            for (const Meshlet &m : mesh.meshlets) {
+                if (uint64_t(m.indexOffset) + uint64_t(m.triangleCount) * 3 > indexCount)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    void SerializeTexture(const CachedTexture &texture,
+                          std::vector<uint8_t> &out) {
+        Writer w(out);
+        w.U32(kTextureMagic);
+        w.U32(kTextureCacheVersion);
+        w.U32(uint32_t(texture.format));
+        w.U32(texture.srgb ? 1 : 0);
+        w.U32(uint32_t(texture.mips.size()));
+        for (const auto &mip : texture.mips) {
+            w.U32(uint32_t(mip.width));
+            w.U32(uint32_t(mip.height));
+            w.U64(mip.data.size());
+            w.Bytes(mip.data.data(), mip.data.size());
+        }
+    }
+
+    bool DeserializeTexture(const uint8_t *data, size_t size,
+                            CachedTexture &texture) {
+        Reader r(data, size);
+        uint32_t magic, version, format, srgb, mipCount;
+        if (!r.U32(magic) || magic != kTextureMagic || !r.U32(version) ||
+            version != kTextureCacheVersion || !r.U32(format) ||
+            format > uint32_t(TextureFormat::BC5) || !r.U32(srgb) ||
+            !r.U32(mipCount))
+            return false;
+
+        texture.format = TextureFormat(format);
+        texture.srgb = srgb != 0;
+        texture.mips.clear();
+        texture.mips.resize(mipCount);
+        for (auto &mip : texture.mips) {
+            uint32_t width, height;
+            uint64_t bytes;
+            if (!r.U32(width) || !r.U32(height) || !r.Count(bytes, 1))
+                return false;
+            mip.width = int(width);
+            mip.height = int(height);
+            mip.data.resize(bytes);
+            if (!r.Bytes(mip.data.data(), bytes))
+                return false;
+        }
+        return true;
+    }
+
+    bool ReadFileBytes(const std::string &filename, std::vector<uint8_t> &data) {
+        FILE *file = fopen(filename.c_str(), "rb");
+        if (!file)
+            return false;
+
+        fseek(file, 0, SEEK_END);
+        const long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        bool ok = size >= 0;
+        if (ok) {
+            data.resize(size_t(size));
+            ok = fread(data.data(), 1, data.size(), file) == data.size();
+        }
+        fclose(file);
+        return ok;
+    }
+
+    bool WriteFileAtomic(const std::string &filename, const void *data,
+                         size_t size) {
+        namespace fs = std::filesystem;
+        static std::atomic<uint64_t> counter{0};
+
+        const fs::path target(filename);
+        std::error_code ec;
+        if (target.has_parent_path())
+            fs::create_directories(target.parent_path(), ec);
+
+        // Unique per process, thread and call so concurrent writers of the
+        // same target never share a temporary.
+#ifdef _WIN32
+        const long long pid = _getpid();
+#else
+        const long long pid = getpid();
+#endif
+        const std::string temp =
+            filename + ".tmp" + std::to_string(pid) + "_" +
+            std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+            "_" + std::to_string(counter.fetch_add(1));
+
+        FILE *file = fopen(temp.c_str(), "wb");
+        if (!file) {
+            LOG_ERROR(LogCategory::General, "Cannot create %s", temp.c_str());
+            return false;
+        }
+        bool ok = fwrite(data, 1, size, file) == size;
+        ok = fclose(file) == 0 && ok;
+
+        if (ok) {
+            // rename replaces the target atomically on POSIX and NTFS.
+            fs::rename(temp, target, ec);
+            ok = !ec;
+        }
+        if (!ok) {
+            LOG_ERROR(LogCategory::General, "Cannot write %s", filename.c_str());
+            fs::remove(temp, ec);
+        }
+        return ok;
+    }
+}
@@ -0,0 +1,284 @@
+#include "ClusteredLighting.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cmath>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    const float kPaddingRadius = -1.0f;
+
+    // Squared distances from four spheres to a box, or from a sphere to
+    // four boxes, whichever side is broadcast.
+    __m128 DistanceSq(__m128 x, __m128 y, __m128 z, __m128 minX, __m128 minY,
+                      __m128 minZ, __m128 maxX, __m128 maxY, __m128 maxZ) {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+        const __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+        const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                          _mm_mul_ps(dz, dz));
+    }
+	}
+
+    const uint32_t LightClusters::kClustersX;
+    const uint32_t LightClusters::kClustersY;
+    const uint32_t LightClusters::kClustersZ;
+    const uint32_t LightClusters::kClusterCount;
+    const float LightClusters::kSpotCutoff = 1.0f / 256.0f;
+
+    static_assert(LightClusters::kClustersX % 4 == 0 && LightClusters::kClustersX <= 32,
+                  "Rows are tested four clusters at a time into a 32-bit mask");
+
+    void LightClusters::SetProjection(const Matrix &projection, float nearZ,
+                                      float farZ, float viewportX,
+                                      float viewportY, float width,
+                                      float height) {
+        const float viewport[4] = {viewportX, viewportY, width, height};
+        if (!m_bounds.empty() && projection == m_projection && nearZ == m_nearZ &&
+            farZ == m_farZ && std::equal(viewport, viewport + 4, m_viewport))
+            return;
+
+        m_projection = projection;
+        m_nearZ = nearZ;
+        m_farZ = farZ;
+        std::copy(viewport, viewport + 4, m_viewport);
+
+        ClusterConstantBuffer &c = m_constants;
+        c.viewportOrigin = Vector2(viewportX, viewportY);
+        c.tileScale = Vector2(kClustersX / std::max(width, 1.0f),
+                              kClustersY / std::max(height, 1.0f));
+        c.sliceScale = kClustersZ / std::log(farZ / nearZ);
+        c.sliceBias = -std::log(nearZ) * c.sliceScale;
+        c.clustersX = kClustersX;
+        c.clustersY = kClustersY;
+        c.clustersZ = kClustersZ;
+        c.nearZ = nearZ;
+
+        BuildBounds();
+    }
+
+    void LightClusters::BuildBounds() {
+        m_bounds.assign(kClusterCount, Aabb());
+        m_rows.resize(kClustersZ * kClustersY);
+
+        // Every pixel lies on the segment between its points on the near
+        // and far planes, for parallel projections too.
+        const Matrix inverse = m_projection.Invert();
+        Vector3 nearPoints[kClustersX + 1][kClustersY + 1];
+        Vector3 farPoints[kClustersX + 1][kClustersY + 1];
+        for (uint32_t y = 0; y <= kClustersY; y++) {
+            for (uint32_t x = 0; x <= kClustersX; x++) {
+                // Tile rows go down the screen.
+                const float nx = -1.0f + 2.0f * x / kClustersX;
+                const float ny = 1.0f - 2.0f * y / kClustersY;
+                nearPoints[x][y] = Vector3::Transform(Vector3(nx, ny, 0.0f), inverse);
+                farPoints[x][y] = Vector3::Transform(Vector3(nx, ny, 1.0f), inverse);
+            }
+        }
+        const auto atDepth = [&](uint32_t x, uint32_t y, float depth) {
+            const Vector3 &a = nearPoints[x][y];
+            const Vector3 &b = farPoints[x][y];
+            return a + (b - a) * ((depth - a.z) / (b.z - a.z));
+        };
+
+        for (uint32_t z = 0; z < kClustersZ; z++) {
+            const float ratio = m_farZ / m_nearZ;
+            const float depth0 = m_nearZ * std::pow(ratio, float(z) / kClustersZ);
+            const float depth1 = m_nearZ * std::pow(ratio, float(z + 1) / kClustersZ);
+            for (uint32_t y = 0; y < kClustersY; y++) {
+                RowBounds &row = m_rows[z * kClustersY + y].bounds;
+                row.box = Aabb();
+                for (uint32_t x = 0; x < kClustersX; x++) {
+                    Aabb &box = m_bounds[Index(x, y, z)];
+                    for (uint32_t corner = 0; corner < 4; corner++) {
+                        const uint32_t cx = x + (corner & 1);
+                        const uint32_t cy = y + (corner >> 1);
+                        box.Grow(atDepth(cx, cy, depth0));
+                        box.Grow(atDepth(cx, cy, depth1));
+                    }
+                    row.box.Grow(box);
+                    row.minX[x] = box.min.x;
+                    row.minY[x] = box.min.y;
+                    row.minZ[x] = box.min.z;
+                    row.maxX[x] = box.max.x;
+                    row.maxY[x] = box.max.y;
+                    row.maxZ[x] = box.max.z;
+                }
+            }
+        }
+    }
+
+    uint32_t LightClusters::Slice(float depth) const {
+        const float s = std::floor(std::log(std::max(depth, m_nearZ)) *
+                                       m_constants.sliceScale +
+                                   m_constants.sliceBias);
+        return uint32_t(std::min(std::max(s, 0.0f), float(kClustersZ - 1)));
+    }
+
+    void LightClusters::Assign(const std::vector<Light> &lights,
+                               const Matrix &view) {
+        m_constants.viewDepth = Vector4(view._13, view._23, view._33, view._43);
+        m_ranges.assign(kClusterCount, Range());
+        m_indices.clear();
+        if (m_bounds.empty())
+            return;
+
+        // Move the lights to view space and bucket them by the slices
+        // their depth range covers.
+        m_viewLights.resize(lights.size());
+        m_sliceLights.resize(kClustersZ);
+        for (SliceLights &slice : m_sliceLights) {
+            slice.ids.clear();
+            slice.x.clear();
+            slice.y.clear();
+            slice.z.clear();
+            slice.r.clear();
+        }
+        for (uint32_t i = 0; i < uint32_t(lights.size()); i++) {
+            const Light &light = lights[i];
+            ViewLight &v = m_viewLights[i];
+            v.position = Vector3::Transform(light.position, view);
+            v.range = light.fallOffEnd;
+            v.direction = Vector3::TransformNormal(light.direction, view);
+            v.direction.Normalize();
+            v.cosAngle = -1.0f;
+            v.sinAngle = 0.0f;
+            if (light.spotPower > 0.0f) {
+                const float cosAngle = std::pow(kSpotCutoff, 1.0f / light.spotPower);
+                // Cones of 90 degrees or more only get the sphere test.
+                if (cosAngle > 0.0f) {
+                    v.cosAngle = cosAngle;
+                    v.sinAngle = std::sqrt(1.0f - cosAngle * cosAngle);
+                }
+            }
+
+            if (v.range <= 0.0f || v.position.z + v.range < m_nearZ ||
+                v.position.z - v.range > m_farZ)
+                continue;
+            const uint32_t first = Slice(v.position.z - v.range);
+            const uint32_t last = Slice(v.position.z + v.range);
+            for (uint32_t z = first; z <= last; z++) {
+                SliceLights &slice = m_sliceLights[z];
+                slice.ids.push_back(i);
+                slice.x.push_back(v.position.x);
+                slice.y.push_back(v.position.y);
+                slice.z.push_back(v.position.z);
+                slice.r.push_back(v.range);
+            }
+        }
+        for (SliceLights &slice : m_sliceLights) {
+            const size_t padded = (slice.ids.size() + 3) & ~size_t(3);
+            slice.x.resize(padded, 0.0f);
+            slice.y.resize(padded, 0.0f);
+            slice.z.resize(padded, 0.0f);
+            slice.r.resize(padded, kPaddingRadius);
+        }
+
+        ParallelFor(m_rows.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++)
+                AssignRow(uint32_t(r));
+        });
+
+        // Rows are in cluster order, so their lists concatenate into the
+        // final one.
+        size_t total = 0;
+        for (const Row &row : m_rows)
+            total += row.indices.size();
+        m_indices.reserve(total);
+        for (uint32_t r = 0; r < uint32_t(m_rows.size()); r++) {
+            const uint32_t base = uint32_t(m_indices.size());
+            for (uint32_t x = 0; x < kClustersX; x++)
+                m_ranges[r * kClustersX + x].offset += base;
+            m_indices.insert(m_indices.end(), m_rows[r].indices.begin(),
+                             m_rows[r].indices.end());
+        }
+    }
+
+    void LightClusters::AssignRow(uint32_t r) {
+        Row &row = m_rows[r];
+        row.hitLights.clear();
+        row.hitMasks.clear();
+        row.indices.clear();
+        const SliceLights &slice = m_sliceLights[r / kClustersY];
+        const RowBounds &bounds = row.bounds;
+
+        // Lights reaching the row, four at a time.
+        const __m128 rowMinX = _mm_set1_ps(bounds.box.min.x);
+        const __m128 rowMinY = _mm_set1_ps(bounds.box.min.y);
+        const __m128 rowMinZ = _mm_set1_ps(bounds.box.min.z);
+        const __m128 rowMaxX = _mm_set1_ps(bounds.box.max.x);
+        const __m128 rowMaxY = _mm_set1_ps(bounds.box.max.y);
+        const __m128 rowMaxZ = _mm_set1_ps(bounds.box.max.z);
+        for (size_t i = 0; i < slice.x.size(); i += 4) {
+            const __m128 radius = _mm_loadu_ps(&slice.r[i]);
+            const __m128 d = DistanceSq(_mm_loadu_ps(&slice.x[i]), _mm_loadu_ps(&slice.y[i]),
+                                        _mm_loadu_ps(&slice.z[i]), rowMinX, rowMinY,
+                                        rowMinZ, rowMaxX, rowMaxY, rowMaxZ);
+            const __m128 hit = _mm_and_ps(_mm_cmpge_ps(radius, _mm_setzero_ps()),
+                                          _mm_cmple_ps(d, _mm_mul_ps(radius, radius)));
+            int mask = _mm_movemask_ps(hit);
+            while (mask) {
+                const int lane = mask & -mask;
+                mask &= mask - 1;
+                const size_t k = i + (lane == 1 ? 0 : lane == 2 ? 1 : lane == 4 ? 2 : 3);
+                row.hitLights.push_back(slice.ids[k]);
+            }
+        }
+
+        // Clusters of the row each light reaches, four at a time, then the
+        // cone test against the cluster's bounding sphere for spot lights.
+        for (uint32_t id : row.hitLights) {
+            const ViewLight &light = m_viewLights[id];
+            const __m128 x = _mm_set1_ps(light.position.x);
+            const __m128 y = _mm_set1_ps(light.position.y);
+            const __m128 z = _mm_set1_ps(light.position.z);
+            const __m128 rangeSq = _mm_set1_ps(light.range * light.range);
+            uint32_t mask = 0;
+            for (uint32_t c = 0; c < kClustersX; c += 4) {
+                const __m128 d = DistanceSq(
+                    x, y, z, _mm_loadu_ps(&bounds.minX[c]), _mm_loadu_ps(&bounds.minY[c]),
+                    _mm_loadu_ps(&bounds.minZ[c]), _mm_loadu_ps(&bounds.maxX[c]),
+                    _mm_loadu_ps(&bounds.maxY[c]), _mm_loadu_ps(&bounds.maxZ[c]));
+                mask |= uint32_t(_mm_movemask_ps(_mm_cmple_ps(d, rangeSq))) << c;
+            }
+            if (mask && light.cosAngle > 0.0f) {
+                for (uint32_t c = 0; c < kClustersX; c++) {
+                    if (!(mask & (1u << c)))
+                        continue;
+                    const Vector3 min(bounds.minX[c], bounds.minY[c], bounds.minZ[c]);
+                    const Vector3 max(bounds.maxX[c], bounds.maxY[c], bounds.maxZ[c]);
+                    const float radius = 0.5f * (max - min).Length();
+                    const Vector3 v = (min + max) * 0.5f - light.position;
+                    const float along = v.Dot(light.direction);
+                    const float across =
+                        std::sqrt(std::max(v.LengthSquared() - along * along, 0.0f));
+                    const float distance = light.cosAngle * across - along * light.sinAngle;
+                    if (distance > radius || along > radius + light.range ||
+                        along < -radius)
+                        mask &= ~(1u << c);
+                }
+            }
+            if (mask) {
+                row.hitLights[row.hitMasks.size()] = id;
+                row.hitMasks.push_back(mask);
+            }
+        }
+
+        // Offsets are relative to the row until Assign adds the rows up.
+        const uint32_t first = r * kClustersX;
+        for (uint32_t c = 0; c < kClustersX; c++) {
+            Range &range = m_ranges[first + c];
+            range.offset = uint32_t(row.indices.size());
+            for (size_t h = 0; h < row.hitMasks.size(); h++) {
+                if (row.hitMasks[h] & (1u << c))
+                    row.indices.push_back(row.hitLights[h]);
+            }
+            range.count = uint32_t(row.indices.size()) - range.offset;
+        }
+    }
+}
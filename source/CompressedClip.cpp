@@ -0,0 +1,429 @@
+#include "CompressedClip.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <emmintrin.h>
+
+namespace hlab {
+
+	namespace {
+
+    const float kRotationRange = 0.70710678f; // the smallest three are within it
+    const uint32_t kKeySize = 4;               // time and three values
+
+    // Twice the chord between the unit quaternions, which is the angle
+    // between the rotations for small angles. acos of the dot product
+    // loses them to rounding.
+    float Angle(const Quaternion &a, const Quaternion &b) {
+        const float sign = a.Dot(b) < 0.0f ? -1.0f : 1.0f;
+        const float dx = a.x - b.x * sign, dy = a.y - b.y * sign,
+                    dz = a.z - b.z * sign, dw = a.w - b.w * sign;
+        return 2.0f * std::sqrt(dx * dx + dy * dy + dz * dz + dw * dw);
+    }
+
+    Vector3 Interpolate(const VectorKey &a, const VectorKey &b, float time) {
+        const float span = b.time - a.time;
+        return span > 0.0f ? Vector3::Lerp(a.value, b.value, (time - a.time) / span)
+                           : a.value;
+    }
+
+    Quaternion Interpolate(const RotationKey &a, const RotationKey &b, float time) {
+        const float span = b.time - a.time;
+        // Normalized lerp, like the sampler.
+        return span > 0.0f
+                   ? Quaternion::Lerp(a.value, b.value, (time - a.time) / span)
+                   : a.value;
+    }
+
+    float Error(const Vector3 &a, const Vector3 &b) { return (a - b).Length(); }
+    float Error(const Quaternion &a, const Quaternion &b) { return Angle(a, b); }
+
+    // Keeps the keys that interpolation between the kept neighbours can't
+    // reproduce within tolerance.
+    template <typename Key>
+    std::vector<Key> Reduce(const std::vector<Key> &keys, float tolerance) {
+        if (keys.size() <= 2)
+            return keys;
+
+        std::vector<Key> kept;
+        kept.push_back(keys[0]);
+        size_t from = 0;
+        while (from + 1 < keys.size()) {
+            size_t to = from + 1;
+            while (to + 1 < keys.size()) {
+                bool fits = true;
+                for (size_t k = from + 1; k <= to && fits; k++) {
+                    fits = Error(Interpolate(keys[from], keys[to + 1], keys[k].time),
+                                 keys[k].value) <= tolerance;
+                }
+                if (!fits)
+                    break;
+                to++;
+            }
+            kept.push_back(keys[to]);
+            from = to;
+        }
+        return kept;
+    }
+
+    // The reduced track at time, holding the end keys outside of it.
+    template <typename Key>
+    decltype(Key::value) Evaluate(const std::vector<Key> &keys, float time) {
+        const auto next = std::upper_bound(
+            keys.begin(), keys.end(), time,
+            [](float t, const Key &key) { return t < key.time; });
+        if (next == keys.begin())
+            return keys.front().value;
+        if (next == keys.end())
+            return keys.back().value;
+        return Interpolate(*(next - 1), *next, time);
+    }
+
+    void Quantize(const Vector3 &v, const CompressedClip::Range &range, uint16_t *out) {
+        const float values[3] = {v.x, v.y, v.z};
+        const float mins[3] = {range.min.x, range.min.y, range.min.z};
+        const float steps[3] = {range.scale.x, range.scale.y, range.scale.z};
+        for (int i = 0; i < 3; i++) {
+            const float q = steps[i] > 0.0f ? (values[i] - mins[i]) / steps[i] : 0.0f;
+            out[i] = uint16_t(std::clamp(std::lround(q), 0l, 65535l));
+        }
+    }
+
+    // Smallest three: the index of the largest component goes into the
+    // top bits of the first two values, and the largest is rebuilt from
+    // the unit length after flipping the sign to make it positive.
+    void Quantize(Quaternion q, uint16_t *out) {
+        q.Normalize();
+        float c[4] = {q.x, q.y, q.z, q.w};
+        int largest = 0;
+        for (int i = 1; i < 4; i++) {
+            if (std::fabs(c[i]) > std::fabs(c[largest]))
+                largest = i;
+        }
+        const float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+        int n = 0;
+        for (int i = 0; i < 4; i++) {
+            if (i == largest)
+                continue;
+            const float unit = (c[i] * sign + kRotationRange) / (2.0f * kRotationRange);
+            out[n++] = uint16_t(std::clamp(std::lround(unit * 32767.0f), 0l, 32767l));
+        }
+        out[0] |= uint16_t((largest & 1) << 15);
+        out[1] |= uint16_t((largest >> 1) << 15);
+    }
+
+    CompressedClip::Range RangeOf(const std::vector<VectorKey> &keys) {
+        Vector3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (const VectorKey &key : keys) {
+            lo = Vector3::Min(lo, key.value);
+            hi = Vector3::Max(hi, key.value);
+        }
+        return {lo, (hi - lo) / 65535.0f};
+    }
+
+    // Appends the keys of one track within [start, start + length]: the
+    // track's values at both ends and the keys in between, or a single
+    // key where the track holds still.
+    template <typename Key, typename QuantizeFn>
+    void AppendSegment(const std::vector<Key> &keys, float start, float length,
+                       QuantizeFn quantize, std::vector<uint16_t> &data,
+                       uint16_t &count) {
+        const size_t first = data.size();
+        auto append = [&](float time, const auto &value) {
+            uint16_t key[kKeySize];
+            const float unit = (time - start) / length;
+            key[0] = uint16_t(std::clamp(std::lround(unit * 65535.0f), 0l, 65535l));
+            quantize(value, key + 1);
+            // Keys closer than one time step keep the later value.
+            if (data.size() > first && data[data.size() - kKeySize] == key[0])
+                data.resize(data.size() - kKeySize);
+            data.insert(data.end(), key, key + kKeySize);
+        };
+
+        append(start, Evaluate(keys, start));
+        for (const Key &key : keys) {
+            if (key.time > start && key.time < start + length)
+                append(key.time, key.value);
+        }
+        append(start + length, Evaluate(keys, start + length));
+
+        const size_t last = data.size() - kKeySize;
+        if (last - first == kKeySize &&
+            std::equal(data.begin() + first + 1, data.begin() + first + kKeySize,
+                       data.begin() + last + 1))
+            data.resize(last);
+        count = uint16_t(std::min<size_t>((data.size() - first) / kKeySize, 65535));
+    }
+
+    // Returns the key before time and the blend factor towards the next.
+    inline const uint16_t *FindKey(const uint16_t *keys, uint32_t count, float time,
+                                   float &alpha) {
+        uint32_t next = 1;
+        while (next < count && float(keys[next * kKeySize]) <= time)
+            next++;
+        alpha = 0.0f;
+        if (next >= count)
+            return keys + (count - 1) * kKeySize;
+
+        const uint16_t *key = keys + (next - 1) * kKeySize;
+        const float span = float(keys[next * kKeySize]) - float(key[0]);
+        if (span > 0.0f)
+            alpha = std::clamp((time - float(key[0])) / span, 0.0f, 1.0f);
+        return key;
+    }
+
+    // The key as floats: time, then the three values.
+    inline __m128 LoadKey(const uint16_t *key) {
+        const __m128i raw = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(key));
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, _mm_setzero_si128()));
+    }
+
+    inline __m128 LerpKeys(const uint16_t *key, float alpha) {
+        const __m128 a = LoadKey(key);
+        if (alpha == 0.0f)
+            return a;
+        const __m128 b = LoadKey(key + kKeySize);
+        return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(alpha)));
+    }
+
+    // Returns x, y, z in lanes 1 to 3.
+    inline __m128 SampleVector(const uint16_t *keys, uint32_t count, float time,
+                               const CompressedClip::Range &range) {
+        float alpha;
+        const uint16_t *key = FindKey(keys, count, time, alpha);
+        const __m128 q = LerpKeys(key, alpha);
+        const __m128 scale = _mm_set_ps(range.scale.z, range.scale.y, range.scale.x, 0.0f);
+        const __m128 offset = _mm_set_ps(range.min.z, range.min.y, range.min.x, 0.0f);
+        return _mm_add_ps(_mm_mul_ps(q, scale), offset);
+    }
+
+    inline float Dot4(__m128 a, __m128 b) {
+        const __m128 m = _mm_mul_ps(a, b);
+        const __m128 s = _mm_add_ps(m, _mm_movehl_ps(m, m));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+
+    inline __m128 DecodeRotation(const uint16_t *key) {
+        const __m128i raw = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(key));
+        const __m128i bits = _mm_and_si128(raw, _mm_set1_epi16(0x7fff));
+        __m128 c = _mm_cvtepi32_ps(_mm_unpacklo_epi16(bits, _mm_setzero_si128()));
+        c = _mm_sub_ps(_mm_mul_ps(c, _mm_set1_ps(2.0f * kRotationRange / 32767.0f)),
+                       _mm_set1_ps(kRotationRange));
+        // Lane 0 held the time and becomes the largest component.
+        c = _mm_move_ss(c, _mm_setzero_ps());
+        const float w = std::sqrt(std::max(0.0f, 1.0f - Dot4(c, c)));
+        c = _mm_move_ss(c, _mm_set_ss(w));
+
+        switch ((key[1] >> 15) | ((key[2] >> 15) << 1)) {
+        case 0:
+            return c;
+        case 1:
+            return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 2, 0, 1));
+        case 2:
+            return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+        default:
+            return _mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 3, 2, 1));
+        }
+    }
+
+    inline __m128 SampleRotation(const uint16_t *keys, uint32_t count, float time) {
+        float alpha;
+        const uint16_t *key = FindKey(keys, count, time, alpha);
+        const __m128 a = DecodeRotation(key);
+        if (alpha == 0.0f)
+            return a;
+        __m128 b = DecodeRotation(key + kKeySize);
+        if (Dot4(a, b) < 0.0f)
+            b = _mm_sub_ps(_mm_setzero_ps(), b);
+        const __m128 q = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(alpha)));
+        return _mm_div_ps(q, _mm_set1_ps(std::sqrt(Dot4(q, q))));
+    }
+
+    // Scale, rotation, then translation, for row vectors.
+    inline void Compose(__m128 position, __m128 rotation, __m128 scale, Matrix &m) {
+        alignas(16) float p[4], q[4], s[4];
+        _mm_store_ps(p, position);
+        _mm_store_ps(q, rotation);
+        _mm_store_ps(s, scale);
+        const float x = q[0], y = q[1], z = q[2], w = q[3];
+        m._11 = (1.0f - 2.0f * (y * y + z * z)) * s[1];
+        m._12 = 2.0f * (x * y + z * w) * s[1];
+        m._13 = 2.0f * (x * z - y * w) * s[1];
+        m._14 = 0.0f;
+        m._21 = 2.0f * (x * y - z * w) * s[2];
+        m._22 = (1.0f - 2.0f * (x * x + z * z)) * s[2];
+        m._23 = 2.0f * (y * z + x * w) * s[2];
+        m._24 = 0.0f;
+        m._31 = 2.0f * (x * z + y * w) * s[3];
+        m._32 = 2.0f * (y * z - x * w) * s[3];
+        m._33 = (1.0f - 2.0f * (x * x + y * y)) * s[3];
+        m._34 = 0.0f;
+        m._41 = p[1];
+        m._42 = p[2];
+        m._43 = p[3];
+        m._44 = 1.0f;
+    }
+
+    uint32_t HeaderSize(size_t channels) {
+        return uint32_t((channels * 3 + kKeySize - 1) / kKeySize * kKeySize);
+    }
+	}
+
+    size_t CompressedClip::SizeBytes() const {
+        return sizeof(*this) + name.size() + nodes.size() * sizeof(uint32_t) +
+               (positionRanges.size() + scaleRanges.size()) * sizeof(Range) +
+               segmentOffsets.size() * sizeof(uint32_t) +
+               data.size() * sizeof(uint16_t);
+    }
+
+    size_t ClipSizeBytes(const AnimationClip &clip) {
+        size_t bytes = sizeof(clip) + clip.name.size() +
+                       clip.channels.size() * sizeof(NodeChannel);
+        for (const NodeChannel &channel : clip.channels) {
+            bytes += (channel.positions.size() + channel.scales.size()) *
+                         sizeof(VectorKey) +
+                     channel.rotations.size() * sizeof(RotationKey);
+        }
+        return bytes;
+    }
+
+    CompressedClip CompressClip(const AnimationClip &clip, const SceneGraph &graph,
+                                const ClipCompression &settings) {
+        // How far each node's subtree reaches in the bind pose, which is
+        // how far an error in its rotation or scale carries.
+        const size_t nodeCount = graph.NodeCount();
+        std::vector<float> reach(nodeCount, 0.0f);
+        Vector3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (uint32_t n = 0; n < nodeCount; n++) {
+            const Vector3 p = graph.World(n).Translation();
+            lo = Vector3::Min(lo, p);
+            hi = Vector3::Max(hi, p);
+            for (uint32_t a = graph.Parent(n); a != SceneGraph::kNoParent;
+                 a = graph.Parent(a))
+                reach[a] = std::max(reach[a], (p - graph.World(a).Translation()).Length());
+        }
+        float size = nodeCount > 0 ? (hi - lo).Length() : 0.0f;
+        if (!(size > 1e-6f))
+            size = 1.0f;
+        const float positionTolerance = settings.precision * size;
+        // Leaves still carry the vertices around them.
+        const float minReach = 0.05f * size;
+
+        CompressedClip out;
+        out.name = clip.name;
+        out.duration = clip.duration;
+        const size_t segments =
+            clip.duration > 0.0f && settings.segmentDuration > 0.0f
+                ? std::max<size_t>(1, size_t(std::ceil(clip.duration /
+                                                       settings.segmentDuration)))
+                : 1;
+        out.segmentDuration = clip.duration > 0.0f ? clip.duration / segments : 1.0f;
+
+        struct Tracks {
+            std::vector<VectorKey> positions;
+            std::vector<RotationKey> rotations;
+            std::vector<VectorKey> scales;
+        };
+        std::vector<Tracks> tracks;
+        for (const NodeChannel &channel : clip.channels) {
+            if (channel.positions.empty() || channel.rotations.empty() ||
+                channel.scales.empty())
+                continue;
+            const float channelReach = std::max(
+                channel.node < nodeCount ? reach[channel.node] : 0.0f, minReach);
+            const float angleTolerance = positionTolerance / channelReach;
+
+            Tracks t;
+            t.positions = Reduce(channel.positions, positionTolerance);
+            t.rotations = Reduce(channel.rotations, angleTolerance);
+            t.scales = Reduce(channel.scales, angleTolerance);
+            out.nodes.push_back(channel.node);
+            out.positionRanges.push_back(RangeOf(t.positions));
+            out.scaleRanges.push_back(RangeOf(t.scales));
+            tracks.push_back(std::move(t));
+        }
+
+        const uint32_t header = HeaderSize(tracks.size());
+        for (size_t s = 0; s < segments; s++) {
+            const size_t begin = out.data.size();
+            out.segmentOffsets.push_back(uint32_t(begin));
+            out.data.resize(begin + header, 0);
+
+            const float start = float(s) * out.segmentDuration;
+            for (size_t c = 0; c < tracks.size(); c++) {
+                uint16_t count;
+                AppendSegment(
+                    tracks[c].positions, start, out.segmentDuration,
+                    [&](const Vector3 &v, uint16_t *q) {
+                        Quantize(v, out.positionRanges[c], q);
+                    },
+                    out.data, count);
+                out.data[begin + c * 3] = count;
+                AppendSegment(
+                    tracks[c].rotations, start, out.segmentDuration,
+                    [](const Quaternion &r, uint16_t *q) { Quantize(r, q); },
+                    out.data, count);
+                out.data[begin + c * 3 + 1] = count;
+                AppendSegment(
+                    tracks[c].scales, start, out.segmentDuration,
+                    [&](const Vector3 &v, uint16_t *q) {
+                        Quantize(v, out.scaleRanges[c], q);
+                    },
+                    out.data, count);
+                out.data[begin + c * 3 + 2] = count;
+            }
+        }
+        out.segmentOffsets.push_back(uint32_t(out.data.size()));
+        out.data.shrink_to_fit();
+        return out;
+    }
+
+    void SampleCompressedClip(const CompressedClip &clip, float time,
+                              Matrix *locals) {
+        if (clip.nodes.empty())
+            return;
+
+        if (clip.duration > 0.0f) {
+            time = std::fmod(time, clip.duration);
+            if (time < 0.0f)
+                time += clip.duration;
+        }
+
+        const size_t segments = clip.segmentOffsets.size() - 1;
+        const size_t segment =
+            std::min(segments - 1, size_t(std::max(0.0f, time / clip.segmentDuration)));
+        const float local = std::clamp(
+            (time - float(segment) * clip.segmentDuration) / clip.segmentDuration *
+                65535.0f,
+            0.0f, 65535.0f);
+
+        const uint16_t *counts = clip.data.data() + clip.segmentOffsets[segment];
+        const uint16_t *keys = counts + HeaderSize(clip.nodes.size());
+        for (size_t c = 0; c < clip.nodes.size(); c++) {
+            const uint32_t positionCount = counts[c * 3];
+            const uint32_t rotationCount = counts[c * 3 + 1];
+            const uint32_t scaleCount = counts[c * 3 + 2];
+
+            const __m128 position =
+                SampleVector(keys, positionCount, local, clip.positionRanges[c]);
+            keys += positionCount * kKeySize;
+            const __m128 rotation = SampleRotation(keys, rotationCount, local);
+            keys += rotationCount * kKeySize;
+            const __m128 scale = SampleVector(keys, scaleCount, local, clip.scaleRanges[c]);
+            keys += scaleCount * kKeySize;
+
+            Compose(position, rotation, scale, locals[c]);
+        }
+    }
+
+    void SampleCompressedClip(const CompressedClip &clip, float time,
+                              SceneGraph &graph, std::vector<Matrix> &scratch) {
+        scratch.resize(clip.nodes.size());
+        SampleCompressedClip(clip, time, scratch.data());
+        for (size_t c = 0; c < clip.nodes.size(); c++) {
+            if (clip.nodes[c] < graph.NodeCount())
+                graph.SetLocal(clip.nodes[c], scratch[c]);
+        }
+    }
+}
@@ -1,12 +1,17 @@
 #include "ExampleApp.h"
 
 #include <fstream> 
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <cstddef>
+#include <cstring>
+#include <random>
 #include <tuple>
 #include <vector>
 
 #include "GeometryGenerator.h"
+#include "Parallel.h"
 
 namespace hlab {
 
@@ -69,7 +74,24 @@ namespace hlab {
         m_device->CreateSamplerState(&sampDesc, m_samplerState.GetAddressOf());
 
         auto meshes = GeometryGenerator::ReadFromFile(
-            "C:\\Temp\\Shield\\", "shield_l.fbx");
+            "C:\\Temp\\Shield\\", "shield_l.fbx", &m_lastLoadTimings,
+            &m_animation);
+
+        for (const auto &clip : m_animation.clips) {
+            m_clips.push_back(CompressClip(clip, m_animation.graph));
+            m_rawClipBytes += ClipSizeBytes(clip);
+            m_clipBytes += m_clips.back().SizeBytes();
+        }
+        m_animation.clips = {};
+
+        {
+            CpuTimer timer;
+            m_picker.Build(meshes);
+            LOG_DEBUG(LogCategory::Loader, "Picking BVH built in %.2f ms",
+                      timer.ElapsedMs());
+        }
+
+        SelectOccluders(meshes);
 
         m_BasicVertexConstantBufferData.model = Matrix();
         m_BasicVertexConstantBufferData.view = Matrix();
@@ -83,20 +105,49 @@ namespace hlab {
 
         for (const auto &meshData : meshes) {
             auto newMesh = std::make_shared<Mesh>();
+            const bool deformed = !meshData.skin.weights.empty() ||
+                                  !meshData.morphTargets.empty();
             AppBase::CreateVertexBuffer(meshData.vertices,
-                                        newMesh->vertexBuffer);
+                                        newMesh->vertexBuffer, deformed);
+            if (deformed) {
+                DeformedMesh mesh;
+                mesh.mesh = uint32_t(m_meshes.size());
+                mesh.data = meshData;
+                if (!meshData.morphTargets.empty()) {
+                    mesh.morphWeights.assign(meshData.morphTargets.size(), 0.0f);
+                    mesh.morphRanges = MorphedRanges(meshData);
+                    mesh.morphed = meshData.vertices;
+                }
+                m_deformedMeshes.push_back(std::move(mesh));
+            }
             newMesh->m_indexCount = UINT(meshData.indices.size());
+            newMesh->bounds = meshData.bounds;
+            newMesh->meshlets = meshData.meshlets;
+            newMesh->meshletSpheres.Resize(meshData.meshlets.size());
+            for (size_t i = 0; i < meshData.meshlets.size(); i++)
+                newMesh->meshletSpheres.Set(i, meshData.meshlets[i].center,
+                                            meshData.meshlets[i].radius);
+            m_instances.SetMeshBounds(uint32_t(m_meshes.size()), meshData.bounds);
             AppBase::CreateIndexBuffer(meshData.indices, newMesh->indexBuffer);
 
-            if (!meshData.baseColorFilename.empty()) {
+            if (meshData.baseColorImage) {
+                AppBase::CreateTexture(*meshData.baseColorImage, "baseColor",
+                                       newMesh->baseColorTex,
+                                       newMesh->baseColorSRV, true);
+            } else if (!meshData.baseColorFilename.empty()) {
                 AppBase::CreateTexture(meshData.baseColorFilename,
                                        newMesh->baseColorTex,
                                        newMesh->baseColorSRV, true);
             }
 
-            if (!meshData.normalFilename.empty()) {
+            if (meshData.normalImage) {
+                AppBase::CreateTexture(*meshData.normalImage, "normal",
+                                       newMesh->normalTex, newMesh->normalSRV, false,
+                                       true);
+            } else if (!meshData.normalFilename.empty()) {
                 AppBase::CreateTexture(meshData.normalFilename,
-                                       newMesh->normalTex, newMesh->normalSRV, false);
+                                       newMesh->normalTex, newMesh->normalSRV, false,
+                                       true);
             }
 
       std::string ormToUse = meshData.ormFilename;
@@ -110,7 +161,10 @@ namespace hlab {
                     ormToUse.replace(pos, strlen("BaseColor"), "ORM");
             }
 
-            if (!ormToUse.empty() && std::ifstream(ormToUse).good()) {
+            if (meshData.ormImage) {
+                AppBase::CreateTexture(*meshData.ormImage, "orm", newMesh->ormTex,
+                                       newMesh->ormSRV, false);
+            } else if (!ormToUse.empty() && std::ifstream(ormToUse).good()) {
                 AppBase::CreateTexture(ormToUse, newMesh->ormTex,
                                        newMesh->ormSRV, false);
             }
@@ -118,11 +172,29 @@ namespace hlab {
             newMesh->vertexConstantBuffer = vertexConstantBuffer;
             newMesh->pixelConstantBuffer = pixelConstantBuffer;
 
+            // Meshes sharing all three textures share a material, so
+            // submission sorted by material binds them once.
+            MaterialBinding material;
+            material.srvs[0] = newMesh->baseColorSRV ? newMesh->baseColorSRV.Get()
+                                                     : m_defaultWhiteSRV.Get();
+            material.srvs[1] = newMesh->normalSRV ? newMesh->normalSRV.Get()
+                                                  : m_defaultNormalSRV.Get();
+            material.srvs[2] = newMesh->ormSRV ? newMesh->ormSRV.Get()
+                                               : m_defaultOrmSRV.Get();
+            uint32_t materialIndex = 0;
+            while (materialIndex < m_materials.size() &&
+                   !std::equal(material.srvs, material.srvs + 3,
+                               m_materials[materialIndex].srvs))
+                materialIndex++;
+            if (materialIndex == m_materials.size())
+                m_materials.push_back(material);
+            m_meshMaterials.push_back(materialIndex);
+
             this->m_meshes.push_back(newMesh);
 
-            printf("[Mesh] BC=%s\n", meshData.baseColorFilename.c_str());
-            printf("[Mesh] N =%s\n", meshData.normalFilename.c_str());
-            printf("[Mesh] ORM=%s\n", ormToUse.c_str());
+            LOG_DEBUG(LogCategory::Loader, "Mesh BC=%s N=%s ORM=%s",
+                      meshData.baseColorFilename.c_str(),
+                      meshData.normalFilename.c_str(), ormToUse.c_str());
         }
 
         vector<D3D11_INPUT_ELEMENT_DESC> basicInputElements = {
@@ -140,12 +212,34 @@ namespace hlab {
              (UINT)offsetof(Vertex, bitangent), D3D11_INPUT_PER_VERTEX_DATA, 0}
         };
 
-        AppBase::CreateVertexShaderAndInputLayout(
-            L"BasicVertexShader.hlsl", basicInputElements, m_basicVertexShader,
+        // The basic shader reads its world matrices from slot 1, one
+        // InstanceVertex per instance.
+        vector<D3D11_INPUT_ELEMENT_DESC> instancedInputElements = basicInputElements;
+        for (UINT row = 0; row < 4; row++)
+            instancedInputElements.push_back(
+                {"WORLD", row, DXGI_FORMAT_R32G32B32A32_FLOAT, 1,
+                 UINT(offsetof(InstanceVertex, world) + row * sizeof(Vector4)),
+                 D3D11_INPUT_PER_INSTANCE_DATA, 1});
+        for (UINT row = 0; row < 3; row++)
+            instancedInputElements.push_back(
+                {"INVTRANSPOSE", row, DXGI_FORMAT_R32G32B32A32_FLOAT, 1,
+                 UINT(offsetof(InstanceVertex, normalRows) + row * sizeof(Vector4)),
+                 D3D11_INPUT_PER_INSTANCE_DATA, 1});
+
+        // Shaders are created together at the end, compiling the ones the
+        // asset cache misses in parallel.
+        AppBase::QueueVertexShader(
+            L"BasicVertexShader.hlsl", instancedInputElements, m_basicVertexShader,
             m_basicInputLayout);
 
-        AppBase::CreatePixelShader(L"BasicPixelShader.hlsl",
-                                   m_basicPixelShader);
+        PlaceInstances();
+        PlaceLights();
+        AppBase::CreateConstantBuffer(m_lightClusters.Constants(),
+                                      m_clusterConstantBuffer);
+        AppBase::CreateStructuredBuffer<LightClusters::Range>(
+            LightClusters::kClusterCount, m_clusterRangeBuffer, m_clusterRangeSRV);
+
+        AppBase::QueuePixelShader(L"BasicPixelShader.hlsl", m_basicPixelShader);
 
         m_normalLines = std::make_shared<Mesh>();
 
@@ -176,10 +270,11 @@ namespace hlab {
         AppBase::CreateIndexBuffer(normalIndices, m_normalLines->indexBuffer);
         AppBase::CreateConstantBuffer(m_normalVertexConstantBufferData,
                                       m_normalLines->vertexConstantBuffer);
-        AppBase::CreateVertexShaderAndInputLayout(
+        AppBase::QueueVertexShader(
             L"NormalVertexShader.hlsl", basicInputElements, m_normalVertexShader,
-            m_basicInputLayout);
-        AppBase::CreatePixelShader(L"NormalPixelShader.hlsl", m_normalPixelShader);                                        
+            m_normalInputLayout);
+        AppBase::QueuePixelShader(L"NormalPixelShader.hlsl", m_normalPixelShader);
+        AppBase::CreateQueuedShaders();                                        
         return true;
     }
 
@@ -187,14 +282,13 @@ namespace hlab {
         
         using namespace DirectX;
 
-        m_BasicVertexConstantBufferData.model =
-            Matrix::CreateScale(m_modelScaling) *
-            Matrix::CreateRotationX(m_modelRotation.x) *
-            Matrix::CreateRotationY(m_modelRotation.y) *
-            Matrix::CreateRotationZ(m_modelRotation.z) *
-            Matrix::CreateTranslation(m_modelTranslation);
-        m_BasicVertexConstantBufferData.model =
-            m_BasicVertexConstantBufferData.model.Transpose();
+        // The GUI transform is the root every instance is placed under.
+        const Matrix root = Matrix::CreateScale(m_modelScaling) *
+                            Matrix::CreateRotationX(m_modelRotation.x) *
+                            Matrix::CreateRotationY(m_modelRotation.y) *
+                            Matrix::CreateRotationZ(m_modelRotation.z) *
+                            Matrix::CreateTranslation(m_modelTranslation);
+        m_BasicVertexConstantBufferData.model = root.Transpose();
 
          m_BasicVertexConstantBufferData.invTranspose =
             m_BasicVertexConstantBufferData.model;
@@ -224,11 +318,36 @@ namespace hlab {
          m_BasicVertexConstantBufferData.projection =
              m_BasicVertexConstantBufferData.projection.Transpose();
 
-       for (auto &mesh : m_meshes) {
-             if (mesh) {
-                 AppBase::UpdateBuffer(m_BasicVertexConstantBufferData,
-                                       mesh->vertexConstantBuffer);
+         UpdateDeformedMeshes(dt);
+
+         {
+             CpuTimer timer;
+             m_instances.SetRoot(root);
+             const size_t moved = m_instances.Update();
+             m_pickInstancesStale = m_pickInstancesStale || moved > 0;
+             // Everything moves when the root changes or instances are
+             // placed, otherwise only animated meshes do.
+             if (moved == m_instances.Count()) {
+                 m_spatialIndex.Build(m_instances.WorldBounds());
+             } else if (moved) {
+                 for (uint32_t i = 0; i < uint32_t(m_instances.Count()); i++) {
+                     if (m_instances.Moved(i))
+                         m_spatialIndex.Update(i, m_instances.WorldBounds()[i]);
+                 }
              }
+             m_instanceUpdateMs = timer.ElapsedMs();
+         }
+
+         // The constant buffer holds transposed matrices for HLSL.
+         CullInstances((m_BasicVertexConstantBufferData.projection *
+                        m_BasicVertexConstantBufferData.view)
+                           .Transpose());
+         UpdateInstanceBuffer();
+
+         // Every mesh shares one vertex and one pixel constant buffer.
+         if (!m_meshes.empty()) {
+             AppBase::UpdateBuffer(m_BasicVertexConstantBufferData,
+                                   m_meshes[0]->vertexConstantBuffer);
          }
 
          m_BasicPixelConstantBufferData.material.diffuse =
@@ -247,11 +366,20 @@ namespace hlab {
              }
          }
 
-        for (auto &mesh : m_meshes) {
-             if (mesh) {
-                 AppBase::UpdateBuffer(m_BasicPixelConstantBufferData,
-                                       mesh->pixelConstantBuffer);
-             }
+         m_litInstances = 0;
+         if (m_lightType != 0) {
+             CpuTimer timer;
+             m_spatialIndex.QuerySphere(m_lightFromGUI.position,
+                                        m_lightFromGUI.fallOffEnd,
+                                        [&](uint32_t) { m_litInstances++; });
+             m_lightQueryUs = timer.ElapsedMs() * 1000.0;
+         }
+
+         UpdateLightClusters(root);
+
+        if (!m_meshes.empty()) {
+             AppBase::UpdateBuffer(m_BasicPixelConstantBufferData,
+                                   m_meshes[0]->pixelConstantBuffer);
          }
 
          if (m_drawNormals && m_drawNormalsDirtyFlag) {
@@ -262,6 +390,360 @@ namespace hlab {
          }
     }
 
+    void ExampleApp::SelectOccluders(const vector<MeshData> &meshes) {
+        // The biggest meshes make the best occluders. Their triangles are
+        // rasterized every frame, so the total is capped.
+        const size_t kMaxOccluders = 8;
+        const size_t kMaxOccluderTriangles = 100000;
+
+        vector<size_t> order(meshes.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return meshes[a].bounds.radius > meshes[b].bounds.radius;
+        });
+
+        m_occluders.clear();
+        size_t triangles = 0;
+        for (size_t i : order) {
+            const size_t meshTriangles = meshes[i].indices.size() / 3;
+            // Deformed meshes don't stay where the occluder was captured.
+            if (!meshes[i].skin.weights.empty() ||
+                !meshes[i].morphTargets.empty() ||
+                m_occluders.size() == kMaxOccluders ||
+                triangles + meshTriangles > kMaxOccluderTriangles)
+                continue;
+
+            OccluderMesh occluder;
+            occluder.positions.reserve(meshes[i].vertices.size());
+            for (const auto &v : meshes[i].vertices)
+                occluder.positions.push_back(v.position);
+            occluder.indices = meshes[i].indices;
+            m_occluders.push_back(std::move(occluder));
+            triangles += meshTriangles;
+        }
+
+        m_occlusionBuffer.Resize(320, 256);
+    }
+
+    void ExampleApp::UpdateDeformedMeshes(float dt) {
+        if (m_deformedMeshes.empty())
+            return;
+
+        CpuTimer timer;
+        if (m_playAnimation && !m_clips.empty()) {
+            m_animationTime += dt;
+            SampleCompressedClip(m_clips[0], m_animationTime, m_animation.graph,
+                                 m_pose);
+        }
+        m_animation.graph.UpdateTransforms();
+
+        // The bounds follow the pose, so culling sees where the mesh is.
+        // Morphs only move the vertices in their ranges, so the base
+        // bounds merged with those of the ranges cover the mesh.
+        for (auto &deformed : m_deformedMeshes) {
+            const MeshData &data = deformed.data;
+            const bool skinned = !data.skin.weights.empty();
+            if (!skinned && !deformed.morphsChanged)
+                continue;
+
+            if (deformed.morphsChanged) {
+                deformed.morphedBounds = data.bounds;
+                if (!deformed.morphRanges.empty())
+                    deformed.morphedBounds.Merge(ApplyMorphTargets(
+                        data, deformed.morphWeights.data(), deformed.morphRanges,
+                        deformed.morphed.data()));
+                deformed.morphsChanged = false;
+            }
+            const Vertex *source =
+                deformed.morphed.empty() ? data.vertices.data() : deformed.morphed.data();
+
+            Mesh &mesh = *m_meshes[deformed.mesh];
+            D3D11_MAPPED_SUBRESOURCE mapped;
+            if (FAILED(m_context->Map(mesh.vertexBuffer.Get(), 0,
+                                      D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+                continue;
+            if (skinned) {
+                ComputeJointMatrices(data.skin, m_animation.graph,
+                                     m_animation.root, deformed.joints);
+                mesh.bounds = SkinMesh(data, deformed.joints,
+                                       static_cast<Vertex *>(mapped.pData), source);
+            } else {
+                std::memcpy(mapped.pData, source, data.vertices.size() * sizeof(Vertex));
+                mesh.bounds = deformed.morphedBounds;
+            }
+            m_context->Unmap(mesh.vertexBuffer.Get(), 0);
+            m_instances.SetMeshBounds(deformed.mesh, mesh.bounds);
+            deformed.pickStale = true;
+        }
+        m_deformMs = timer.ElapsedMs();
+    }
+
+    void ExampleApp::PlaceInstances() {
+        // Copies of the model on a grid going away from the camera. The
+        // copy at the origin is the one the occluders were built for.
+        const float kSpacing = 1.5f;
+        const int n = m_instanceGrid;
+        m_instances.Clear();
+        m_instances.Reserve(size_t(n) * n * m_meshes.size());
+        for (int z = 0; z < n; z++) {
+            for (int x = 0; x < n; x++) {
+                const Matrix transform = Matrix::CreateTranslation(
+                    float(x - n / 2) * kSpacing, 0.0f, float(z) * kSpacing);
+                for (uint32_t mesh = 0; mesh < uint32_t(m_meshes.size()); mesh++)
+                    m_instances.Add(mesh, m_meshMaterials[mesh], transform);
+            }
+        }
+
+        m_totalMeshlets = 0;
+        for (const auto &mesh : m_meshes)
+            m_totalMeshlets += mesh->meshlets.size() * size_t(n) * n;
+
+        if (m_instanceBuffer) {
+            D3D11_BUFFER_DESC oldDesc;
+            m_instanceBuffer->GetDesc(&oldDesc);
+            m_gpuMemory.vertexBytes -= oldDesc.ByteWidth;
+        }
+        m_instanceBuffer.Reset();
+        vector<InstanceVertex> slots(std::max<size_t>(m_instances.Count(), 1));
+        AppBase::CreateVertexBuffer(slots, m_instanceBuffer, true);
+    }
+
+    void ExampleApp::PlaceLights() {
+        // Scattered over the instance grid at about the height of the
+        // model, half of them spot lights pointing down. The seed is fixed
+        // so a count always gives the same lights.
+        const float kSpacing = 1.5f;
+        const int n = m_instanceGrid;
+        std::mt19937 rng(7);
+        const auto range = [&](float lo, float hi) {
+            return std::uniform_real_distribution<float>(lo, hi)(rng);
+        };
+
+        m_gridLights.resize(size_t(m_clusteredLightCount));
+        for (Light &light : m_gridLights) {
+            light.position = Vector3(range(-0.5f - n / 2, n - n / 2 - 0.5f) * kSpacing,
+                                     range(-0.5f, 0.5f),
+                                     range(-0.5f, n - 0.5f) * kSpacing);
+            light.strength = Vector3(range(0.1f, 1.0f), range(0.1f, 1.0f),
+                                     range(0.1f, 1.0f));
+            light.fallOffStart = 0.0f;
+            light.fallOffEnd = range(0.3f, 1.0f);
+            if (range(0.0f, 1.0f) < 0.5f) {
+                light.direction = Vector3(range(-0.3f, 0.3f), -1.0f, range(-0.3f, 0.3f));
+                light.direction.Normalize();
+                light.spotPower = range(2.0f, 32.0f);
+            } else {
+                light.spotPower = 0.0f;
+            }
+        }
+    }
+
+    void ExampleApp::UpdateLightClusters(const Matrix &root) {
+        CpuTimer timer;
+        m_sceneLights.clear();
+        if (m_lightType != 0) {
+            Light light = m_lightFromGUI;
+            light.strength = Vector3(1.0f);
+            // A spot power of zero makes it a point light.
+            if (m_lightType == 1)
+                light.spotPower = 0.0f;
+            m_sceneLights.push_back(light);
+        }
+        for (const Light &light : m_gridLights) {
+            Light world = light;
+            world.position = Vector3::Transform(light.position, root);
+            world.direction = Vector3::TransformNormal(light.direction, root);
+            world.direction.Normalize();
+            m_sceneLights.push_back(world);
+        }
+
+        // The constant buffer holds transposed matrices for HLSL.
+        const float width = float(m_screenWidth - m_guiWidth);
+        m_lightClusters.SetProjection(
+            m_BasicVertexConstantBufferData.projection.Transpose(), m_nearZ,
+            m_farZ, float(m_guiWidth), 0.0f, width, float(m_screenHeight));
+        m_lightClusters.Assign(m_sceneLights,
+                               m_BasicVertexConstantBufferData.view.Transpose());
+        m_lightAssignMs = timer.ElapsedMs();
+
+        // Buffers grow by half again when the lists outgrow them.
+        const size_t lights = m_sceneLights.size();
+        if (lights > m_lightCapacity || !m_lightBuffer) {
+            m_lightCapacity = UINT(std::max<size_t>(lights + lights / 2, 64));
+            AppBase::CreateStructuredBuffer<Light>(m_lightCapacity, m_lightBuffer,
+                                                   m_lightSRV);
+        }
+        const size_t indices = m_lightClusters.LightIndices().size();
+        if (indices > m_lightIndexCapacity || !m_lightIndexBuffer) {
+            m_lightIndexCapacity = UINT(std::max<size_t>(indices + indices / 2, 1024));
+            AppBase::CreateStructuredBuffer<uint32_t>(
+                m_lightIndexCapacity, m_lightIndexBuffer, m_lightIndexSRV);
+        }
+
+        AppBase::UpdateStructuredBuffer(m_sceneLights, m_lightBuffer);
+        AppBase::UpdateStructuredBuffer(m_lightClusters.Ranges(),
+                                        m_clusterRangeBuffer);
+        AppBase::UpdateStructuredBuffer(m_lightClusters.LightIndices(),
+                                        m_lightIndexBuffer);
+        AppBase::UpdateBuffer(m_lightClusters.Constants(), m_clusterConstantBuffer);
+    }
+
+    void ExampleApp::CullInstances(const Matrix &viewProj) {
+        CpuTimer cullTimer;
+        m_visibleInstances.clear();
+        m_occludedInstances = 0;
+
+        if (m_useFrustumCulling) {
+            m_instances.Cull(Frustum::FromViewProjection(viewProj),
+                             m_visibleInstances);
+        } else {
+            for (uint32_t i = 0; i < uint32_t(m_instances.Count()); i++)
+                m_visibleInstances.push_back(i);
+        }
+
+        // Occluders are captured in model space, so they are rasterized
+        // under the root only, where the copy at the origin is.
+        if (m_useOcclusionCulling && !m_occluders.empty()) {
+            CpuTimer timer;
+            const Matrix root = m_BasicVertexConstantBufferData.model.Transpose();
+            const size_t candidates = m_visibleInstances.size();
+            m_occlusionBuffer.Rasterize(m_occluders, root * viewProj);
+            m_occlusionBuffer.Cull(m_instances.WorldBounds(), viewProj,
+                                   m_visibleInstances);
+            m_occludedInstances = candidates - m_visibleInstances.size();
+            m_occlusionMs = timer.ElapsedMs();
+        }
+
+        m_instances.SortForSubmission(m_visibleInstances);
+
+        // Meshlets are tested in the model space of each instance, where
+        // they were built. A parallel projection has no eye point to test
+        // the cones against.
+        m_drawRanges.resize(m_visibleInstances.size());
+        const bool cullBackfaces =
+            m_useMeshletBackfaceCulling && m_usePerspectiveProjection;
+        std::atomic<size_t> visibleMeshlets{0};
+        ParallelFor(m_visibleInstances.size(), 16, [&](size_t begin, size_t end) {
+            std::vector<uint32_t> scratch;
+            size_t count = 0;
+            for (size_t i = begin; i < end; i++) {
+                const uint32_t instance = m_visibleInstances[i];
+                const Mesh &mesh = *m_meshes[m_instances.Mesh(instance)];
+                auto &ranges = m_drawRanges[i];
+                if (!m_useMeshletCulling || mesh.meshlets.empty()) {
+                    ranges.assign(1, {0, mesh.m_indexCount});
+                    continue;
+                }
+                const Matrix &world = m_instances.World(instance);
+                const Frustum frustum = Frustum::FromViewProjection(world * viewProj);
+                const Vector3 eye = Vector3::Transform(
+                    m_BasicPixelConstantBufferData.eyeWorld, world.Invert());
+                CullMeshlets(frustum, eye, mesh.meshlets, mesh.meshletSpheres,
+                             cullBackfaces, scratch, ranges);
+                count += scratch.size();
+            }
+            visibleMeshlets += count;
+        });
+        m_visibleMeshlets = visibleMeshlets;
+        m_cullMs = cullTimer.ElapsedMs();
+    }
+
+    void ExampleApp::UpdateInstanceBuffer() {
+        if (m_visibleInstances.empty() || !m_instanceBuffer)
+            return;
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        if (FAILED(m_context->Map(m_instanceBuffer.Get(), 0,
+                                  D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+            return;
+        InstanceVertex *slots = static_cast<InstanceVertex *>(mapped.pData);
+        ParallelFor(m_visibleInstances.size(), 256, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const Matrix &world = m_instances.World(m_visibleInstances[i]);
+                Matrix linear = world;
+                linear.Translation(Vector3(0.0f));
+                const Matrix n = linear.Invert().Transpose();
+
+                InstanceVertex slot;
+                slot.world = world;
+                slot.normalRows[0] = Vector4(n._11, n._12, n._13, 0.0f);
+                slot.normalRows[1] = Vector4(n._21, n._22, n._23, 0.0f);
+                slot.normalRows[2] = Vector4(n._31, n._32, n._33, 0.0f);
+                slots[i] = slot;
+            }
+        });
+        m_context->Unmap(m_instanceBuffer.Get(), 0);
+    }
+
+    void ExampleApp::OnMouseDown(WPARAM btnState, int x, int y) {
+        const float width = float(m_screenWidth - m_guiWidth);
+        const float height = float(m_screenHeight);
+        if (width <= 0.0f || height <= 0.0f || x < m_guiWidth)
+            return;
+
+        const float ndcX = (float(x - m_guiWidth) + 0.5f) / width * 2.0f - 1.0f;
+        const float ndcY = 1.0f - (float(y) + 0.5f) / height * 2.0f;
+
+        // Unproject to a world ray for the picker's instance BVH.
+        const auto &cb = m_BasicVertexConstantBufferData;
+        const Matrix invViewProj = (cb.projection * cb.view).Transpose().Invert();
+        const Vector3 nearPoint =
+            Vector3::Transform(Vector3(ndcX, ndcY, 0.0f), invViewProj);
+        const Vector3 farPoint =
+            Vector3::Transform(Vector3(ndcX, ndcY, 1.0f), invViewProj);
+        const Vector3 direction = farPoint - nearPoint;
+
+        CpuTimer timer;
+        UpdatePicker();
+        Ray ray;
+        ray.origin = nearPoint;
+        ray.direction = direction;
+        ray.tMax = 1.0f; // the far plane
+        m_lastPick = m_picker.IntersectInstances(ray, m_lastPickInstance);
+        m_lastPickUs = timer.ElapsedMs() * 1000.0;
+
+        if (m_lastPick.hit) {
+            LOG_DEBUG(LogCategory::Input,
+                      "Picked instance %u mesh %u triangle %u (%.1f us)",
+                      m_lastPickInstance, m_lastPick.mesh, m_lastPick.triangle,
+                      m_lastPickUs);
+        }
+    }
+
+    void ExampleApp::UpdatePicker() {
+        // Clicks are rarer than frames, so what moved is refit on the next
+        // pick instead of every frame. Skinned vertices only exist in the
+        // vertex buffer and are skinned again here.
+        for (auto &deformed : m_deformedMeshes) {
+            if (!deformed.pickStale)
+                continue;
+            const MeshData &data = deformed.data;
+            const std::vector<Vertex> &source =
+                deformed.morphed.empty() ? data.vertices : deformed.morphed;
+            if (data.skin.weights.empty()) {
+                m_picker.RefitMesh(deformed.mesh, source);
+            } else {
+                m_pickVertices.resize(data.vertices.size());
+                SkinMesh(data, deformed.joints, m_pickVertices.data(), source.data());
+                m_picker.RefitMesh(deformed.mesh, m_pickVertices);
+            }
+            deformed.pickStale = false;
+        }
+
+        if (!m_pickInstancesStale)
+            return;
+        const uint32_t count = uint32_t(m_instances.Count());
+        vector<uint32_t> meshes(count);
+        vector<Matrix> worlds(count);
+        for (uint32_t i = 0; i < count; i++) {
+            meshes[i] = m_instances.Mesh(i);
+            worlds[i] = m_instances.World(i);
+        }
+        m_picker.SetInstances(meshes, worlds, m_instances.WorldBounds());
+        m_pickInstancesStale = false;
+    }
+
     void ExampleApp::Render() {
         
         SetViewport();
@@ -273,69 +755,136 @@ namespace hlab {
         m_context->ClearDepthStencilView(m_depthStencilView.Get(), 
         D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL,
             1.0f, 0);
+        // Every pipeline state call counts as one state change.
         m_context->OMSetRenderTargets(1, m_renderTargetView.GetAddressOf(),
         m_depthStencilView.Get());
+        m_renderCounters.stateChanges++;
         m_context->OMSetDepthStencilState(m_depthStencilState.Get(), 0);
+        m_renderCounters.stateChanges++;
         m_context->VSSetShader(m_basicVertexShader.Get(), 0, 0);
+        m_renderCounters.stateChanges++;
         m_context->PSSetSamplers(0, 1, m_samplerState.GetAddressOf()); 
+        m_renderCounters.stateChanges++;
         m_context->PSSetShader(m_basicPixelShader.Get(), 0, 0);
+        m_renderCounters.stateChanges++;
 
         if (m_drawAsWire) {
             m_context->RSSetState(m_wireRasterizerState.Get());
         } else {
             m_context->RSSetState(m_solidRasterizerState.Get());
         }
+        m_renderCounters.stateChanges++;
 
         UINT stride = sizeof(Vertex);
         UINT offset = 0;
 
-        for (const auto &mesh : m_meshes) {
-            m_context->VSSetConstantBuffers(
-                0, 1, mesh->vertexConstantBuffer.GetAddressOf());
-
-            auto bc = mesh->
-                baseColorSRV ?
-                mesh->baseColorSRV.Get()
-                                         : m_defaultWhiteSRV.Get();
-
-            auto nor = mesh->
-                normalSRV ? mesh->normalSRV.Get()
-                                       : m_defaultNormalSRV.Get();
-
-            auto orm =
-                mesh->ormSRV ? 
-                mesh->ormSRV.Get() : m_defaultOrmSRV.Get();
-
-            ID3D11ShaderResourceView *srvs[3] = {bc, nor, orm};
-            m_context->PSSetShaderResources(0, 3, srvs);
+        m_context->IASetInputLayout(m_basicInputLayout.Get());
+        m_renderCounters.stateChanges++;
+        m_context->IASetPrimitiveTopology(
+            D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        m_renderCounters.stateChanges++;
+
+        if (m_meshes.empty() || !m_instanceBuffer)
+            return;
+
+        m_context->VSSetConstantBuffers(
+            0, 1, m_meshes[0]->vertexConstantBuffer.GetAddressOf());
+        m_renderCounters.stateChanges++;
+        m_context->PSSetConstantBuffers(
+            0, 1, m_meshes[0]->pixelConstantBuffer.GetAddressOf());
+        m_renderCounters.stateChanges++;
+        const UINT instanceStride = sizeof(InstanceVertex);
+        m_context->IASetVertexBuffers(1, 1, m_instanceBuffer.GetAddressOf(),
+                                      &instanceStride, &offset);
+        m_renderCounters.stateChanges++;
+
+        // The clustered lights follow the material textures.
+        ID3D11ShaderResourceView *lightSRVs[3] = {
+            m_lightSRV.Get(), m_clusterRangeSRV.Get(), m_lightIndexSRV.Get()};
+        m_context->PSSetShaderResources(4, 3, lightSRVs);
+        m_renderCounters.stateChanges++;
+        m_context->PSSetConstantBuffers(1, 1,
+                                        m_clusterConstantBuffer.GetAddressOf());
+        m_renderCounters.stateChanges++;
+
+        // The visible list is sorted by material and mesh. Runs of
+        // instances drawing their whole mesh become one instanced draw;
+        // instances with culled meshlets draw their ranges alone.
+        const auto isWhole = [](const std::vector<IndexRange> &ranges,
+                                const Mesh &mesh) {
+            return ranges.size() == 1 && ranges[0].offset == 0 &&
+                   ranges[0].count == mesh.m_indexCount;
+        };
+        uint32_t boundMaterial = UINT32_MAX;
+        uint32_t boundMesh = UINT32_MAX;
+        const size_t visibleCount = m_visibleInstances.size();
+        for (size_t i = 0; i < visibleCount;) {
+            const uint32_t instance = m_visibleInstances[i];
+            const uint32_t meshIndex = m_instances.Mesh(instance);
+            const uint32_t material = m_instances.Material(instance);
+            const Mesh &mesh = *m_meshes[meshIndex];
+            const auto &ranges = m_drawRanges[i];
+
+            size_t next = i + 1;
+            if (isWhole(ranges, mesh)) {
+                while (next < visibleCount &&
+                       m_instances.Mesh(m_visibleInstances[next]) == meshIndex &&
+                       m_instances.Material(m_visibleInstances[next]) == material &&
+                       isWhole(m_drawRanges[next], mesh))
+                    next++;
+            } else if (ranges.empty()) {
+                i = next;
+                continue;
+            }
 
-            m_context->PSSetConstantBuffers(
-                0, 1, mesh->pixelConstantBuffer.GetAddressOf());
+            if (material != boundMaterial) {
+                m_context->PSSetShaderResources(0, 3, m_materials[material].srvs);
+                boundMaterial = material;
+                m_renderCounters.stateChanges++;
+            }
+            if (meshIndex != boundMesh) {
+                m_context->IASetVertexBuffers(0, 1, mesh.vertexBuffer.GetAddressOf(),
+                                              &stride, &offset);
+                m_renderCounters.stateChanges++;
+                m_context->IASetIndexBuffer(mesh.indexBuffer.Get(),
+                                            DXGI_FORMAT_R32_UINT, 0);
+                m_renderCounters.stateChanges++;
+                boundMesh = meshIndex;
+            }
 
-            m_context->IASetInputLayout(m_basicInputLayout.Get());
-            m_context->IASetVertexBuffers(0, 1, mesh->vertexBuffer.GetAddressOf(), 
-            &stride, &offset);
-            m_context->IASetIndexBuffer(mesh->indexBuffer.Get(),
-                                        DXGI_FORMAT_R32_UINT, 0);
-            m_context->IASetPrimitiveTopology(
-            D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-            m_context->DrawIndexed(mesh->m_indexCount, 0, 0);
+            const UINT instances = UINT(next - i);
+            for (const IndexRange &range : ranges) {
+                m_context->DrawIndexedInstanced(range.count, instances,
+                                                range.offset, 0, UINT(i));
+                m_renderCounters.drawCalls++;
+                m_renderCounters.triangles += size_t(range.count / 3) * instances;
+            }
+            i = next;
         }
 
         if (m_drawNormals) {
+            m_context->IASetInputLayout(m_normalInputLayout.Get());
+            m_renderCounters.stateChanges++;
             m_context->VSSetShader(m_normalVertexShader.Get(), 0, 0);
+            m_renderCounters.stateChanges++;
 
             ID3D11Buffer *pptr[2] = {m_meshes[0]->vertexConstantBuffer.Get(),
                                      m_normalLines->vertexConstantBuffer.Get()};
             m_context->VSSetConstantBuffers(0, 2, pptr);
+            m_renderCounters.stateChanges++;
             m_context->PSSetShader(m_normalPixelShader.Get(), 0, 0);
+            m_renderCounters.stateChanges++;
 
             m_context->IASetVertexBuffers(
                 0, 1, m_normalLines->vertexBuffer.GetAddressOf(), &stride, &offset);
+            m_renderCounters.stateChanges++;
             m_context->IASetIndexBuffer(m_normalLines->indexBuffer.Get(),
                 DXGI_FORMAT_R32_UINT, 0);
+            m_renderCounters.stateChanges++;
             m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+            m_renderCounters.stateChanges++;
             m_context->DrawIndexed(m_normalLines->m_indexCount, 0, 0);
+            m_renderCounters.drawCalls++;
         }
     }
 
@@ -346,6 +895,54 @@ namespace hlab {
             m_BasicPixelConstantBufferData.useTexture = useTex ? 1 : 0;
         }
         ImGui::Checkbox("Wireframe", &m_drawAsWire);
+        ImGui::Checkbox("Frustum Culling", &m_useFrustumCulling);
+        if (ImGui::SliderInt("Instance Grid", &m_instanceGrid, 1, 100)) {
+            PlaceInstances();
+            PlaceLights();
+        }
+        ImGui::Text("Visible instances %zu / %zu", m_visibleInstances.size(),
+                    m_instances.Count());
+        ImGui::Text("Update %.2f ms, cull %.2f ms", m_instanceUpdateMs, m_cullMs);
+        ImGui::Checkbox("Occlusion Culling", &m_useOcclusionCulling);
+        if (m_useOcclusionCulling) {
+            ImGui::Text("Occluded %zu, %zu occluder tris, %.2f ms",
+                        m_occludedInstances, m_occlusionBuffer.TriangleCount(),
+                        m_occlusionMs);
+        }
+        ImGui::Checkbox("Meshlet Culling", &m_useMeshletCulling);
+        if (m_useMeshletCulling) {
+            ImGui::Checkbox("Meshlet Backface Culling",
+                            &m_useMeshletBackfaceCulling);
+            ImGui::Text("Meshlets in frustum %zu / %zu", m_visibleMeshlets,
+                        m_totalMeshlets);
+        }
+        if (!m_deformedMeshes.empty()) {
+            ImGui::Checkbox("Play Animation", &m_playAnimation);
+            ImGui::Text("Deformed %zu meshes, %.2f ms", m_deformedMeshes.size(),
+                        m_deformMs);
+            ImGui::Text("%zu clips, %zu KB (raw %zu KB)", m_clips.size(),
+                        m_clipBytes / 1024, m_rawClipBytes / 1024);
+            if (ImGui::CollapsingHeader("Morph Targets")) {
+                int id = 0;
+                for (auto &deformed : m_deformedMeshes) {
+                    for (size_t t = 0; t < deformed.morphWeights.size(); t++) {
+                        const std::string &name = deformed.data.morphTargets[t].name;
+                        ImGui::PushID(id++);
+                        if (ImGui::SliderFloat(name.empty() ? "target" : name.c_str(),
+                                               &deformed.morphWeights[t], 0.0f, 1.0f))
+                            deformed.morphsChanged = true;
+                        ImGui::PopID();
+                    }
+                }
+            }
+        }
+        if (m_lastPick.hit) {
+            ImGui::Text("Picked instance %u mesh %u tri %u uv (%.2f, %.2f) %.1f us",
+                        m_lastPickInstance, m_lastPick.mesh, m_lastPick.triangle,
+                        m_lastPick.u, m_lastPick.v, m_lastPickUs);
+        } else {
+            ImGui::Text("Picked none (%.1f us)", m_lastPickUs);
+        }
         ImGui::Checkbox("Draw Normals", &m_drawNormals);
         if (ImGui::SliderFloat("Normal scale",
                                &m_normalVertexConstantBufferData.scale, 0.0f,
@@ -378,6 +975,15 @@ namespace hlab {
                            0.0f, 10.0f);
         ImGui::SliderFloat("Light spotPower", &m_lightFromGUI.spotPower,
                            1.0f, 512.0f);
+        if (m_lightType != 0) {
+            ImGui::Text("Light reaches %zu instances (%.1f us)", m_litInstances,
+                        m_lightQueryUs);
+        }
+        if (ImGui::SliderInt("Clustered Lights", &m_clusteredLightCount, 0, 1024))
+            PlaceLights();
+        ImGui::Text("%zu lights, %zu cluster entries, %.2f ms",
+                    m_sceneLights.size(), m_lightClusters.LightIndices().size(),
+                    m_lightAssignMs);
     }
 
    
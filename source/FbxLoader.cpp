@@ -0,0 +1,1082 @@
+#include "FbxLoader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+#include "Hash.h"
+#include "Logger.h"
+#include "MappedIOSystem.h"
+#include "MeshOptimizer.h"
+#include "Parallel.h"
+#include "stb_image.h"
+
+namespace hlab {
+
+	namespace {
+
+    using DirectX::SimpleMath::Matrix;
+
+    const uint32_t kNone = 0xffffffffu;
+    const size_t kMaxInflateRatio = 1032;
+
+    template <typename T> T ReadValue(const uint8_t *p) {
+        T v;
+        std::memcpy(&v, p, sizeof(T));
+        return v;
+    }
+
+    struct Property {
+        char type = 0;
+        const uint8_t *data = nullptr;
+        uint32_t size = 0; // bytes for strings, elements for arrays
+    };
+
+    // Records in file order. The children of a node are the records
+    // between it and end. Node 0 is a synthetic root.
+    struct Node {
+        std::string_view name;
+        uint32_t firstProperty = 0;
+        uint32_t propertyCount = 0;
+        uint32_t end = 0;
+    };
+
+    class Document {
+      public:
+        bool Parse(const uint8_t *data, size_t size);
+
+        const Node &operator[](uint32_t i) const { return m_nodes[i]; }
+
+        uint32_t Child(uint32_t parent, std::string_view name) const {
+            for (uint32_t i = parent + 1; i < m_nodes[parent].end; i = m_nodes[i].end) {
+                if (m_nodes[i].name == name)
+                    return i;
+            }
+            return kNone;
+        }
+
+        template <typename F> void ForEachChild(uint32_t parent, F &&f) const {
+            for (uint32_t i = parent + 1; i < m_nodes[parent].end; i = m_nodes[i].end)
+                f(i);
+        }
+
+        const Property *Prop(uint32_t node, uint32_t i) const {
+            return i < m_nodes[node].propertyCount
+                       ? &m_properties[m_nodes[node].firstProperty + i]
+                       : nullptr;
+        }
+
+        std::string_view String(uint32_t node, uint32_t i) const {
+            const Property *p = Prop(node, i);
+            if (!p || (p->type != 'S' && p->type != 'R'))
+                return std::string_view();
+            return std::string_view(reinterpret_cast<const char *>(p->data), p->size);
+        }
+
+        int64_t Int(uint32_t node, uint32_t i) const {
+            const Property *p = Prop(node, i);
+            if (!p)
+                return 0;
+            switch (p->type) {
+            case 'C':
+                return p->data[0];
+            case 'Y':
+                return ReadValue<int16_t>(p->data);
+            case 'I':
+                return ReadValue<int32_t>(p->data);
+            case 'L':
+                return ReadValue<int64_t>(p->data);
+            case 'F':
+                return int64_t(ReadValue<float>(p->data));
+            case 'D':
+                return int64_t(ReadValue<double>(p->data));
+            }
+            return 0;
+        }
+
+        double Number(uint32_t node, uint32_t i) const {
+            const Property *p = Prop(node, i);
+            if (p && p->type == 'F')
+                return ReadValue<float>(p->data);
+            if (p && p->type == 'D')
+                return ReadValue<double>(p->data);
+            return double(Int(node, i));
+        }
+
+      private:
+        bool ParseList(size_t &offset, size_t end, int depth);
+        bool ParseProperty(size_t &offset, size_t end);
+
+        const uint8_t *m_data = nullptr;
+        size_t m_size = 0;
+        bool m_wide = false; // 64-bit record headers from 7.5 on
+        std::vector<Node> m_nodes;
+        std::vector<Property> m_properties;
+    };
+
+    bool Document::Parse(const uint8_t *data, size_t size) {
+        static const char kMagic[] = "Kaydara FBX Binary  ";
+        if (size < 27 || std::memcmp(data, kMagic, 20) != 0 || data[20] != 0)
+            return false;
+
+        const uint32_t version = ReadValue<uint32_t>(data + 23);
+        if (version < 7000)
+            return false;
+
+        m_data = data;
+        m_size = size;
+        m_wide = version >= 7500;
+        m_nodes.assign(1, Node());
+
+        size_t offset = 27;
+        if (!ParseList(offset, size, 0))
+            return false;
+        m_nodes[0].end = uint32_t(m_nodes.size());
+        return true;
+    }
+
+    bool Document::ParseList(size_t &offset, size_t end, int depth) {
+        if (depth > 64)
+            return false;
+
+        const size_t headerSize = m_wide ? 25 : 13;
+        while (offset + headerSize <= end) {
+            const uint8_t *p = m_data + offset;
+            uint64_t recordEnd, propertyCount, propertyBytes;
+            uint8_t nameLength;
+            if (m_wide) {
+                recordEnd = ReadValue<uint64_t>(p);
+                propertyCount = ReadValue<uint64_t>(p + 8);
+                propertyBytes = ReadValue<uint64_t>(p + 16);
+                nameLength = p[24];
+            } else {
+                recordEnd = ReadValue<uint32_t>(p);
+                propertyCount = ReadValue<uint32_t>(p + 4);
+                propertyBytes = ReadValue<uint32_t>(p + 8);
+                nameLength = p[12];
+            }
+
+            // A null record closes the list.
+            if (recordEnd == 0) {
+                offset += headerSize;
+                return true;
+            }
+
+            offset += headerSize;
+            if (recordEnd > end || offset + nameLength + propertyBytes > recordEnd)
+                return false;
+
+            const uint32_t index = uint32_t(m_nodes.size());
+            Node node;
+            node.name = std::string_view(reinterpret_cast<const char *>(m_data + offset),
+                                         nameLength);
+            node.firstProperty = uint32_t(m_properties.size());
+            node.propertyCount = uint32_t(propertyCount);
+            m_nodes.push_back(node);
+            offset += nameLength;
+
+            const size_t propertiesEnd = offset + size_t(propertyBytes);
+            for (uint64_t i = 0; i < propertyCount; i++) {
+                if (!ParseProperty(offset, propertiesEnd))
+                    return false;
+            }
+            offset = propertiesEnd;
+
+            if (offset < recordEnd && !ParseList(offset, size_t(recordEnd), depth + 1))
+                return false;
+            offset = size_t(recordEnd);
+            m_nodes[index].end = uint32_t(m_nodes.size());
+        }
+
+        // The top level may run into the footer without a null record.
+        return depth == 0;
+    }
+
+    bool Document::ParseProperty(size_t &offset, size_t end) {
+        if (offset >= end)
+            return false;
+
+        Property prop;
+        prop.type = char(m_data[offset++]);
+        prop.data = m_data + offset;
+
+        size_t bytes;
+        switch (prop.type) {
+        case 'C':
+            bytes = 1;
+            break;
+        case 'Y':
+            bytes = 2;
+            break;
+        case 'I':
+        case 'F':
+            bytes = 4;
+            break;
+        case 'D':
+        case 'L':
+            bytes = 8;
+            break;
+        case 'S':
+        case 'R':
+            if (offset + 4 > end)
+                return false;
+            prop.size = ReadValue<uint32_t>(prop.data);
+            prop.data += 4;
+            bytes = 4 + size_t(prop.size);
+            break;
+        case 'f':
+        case 'd':
+        case 'l':
+        case 'i':
+        case 'b':
+            // length, encoding, compressed length, payload
+            if (offset + 12 > end)
+                return false;
+            prop.size = ReadValue<uint32_t>(prop.data);
+            bytes = 12 + size_t(ReadValue<uint32_t>(prop.data + 8));
+            break;
+        default:
+            return false;
+        }
+
+        if (offset + bytes > end)
+            return false;
+        offset += bytes;
+        m_properties.push_back(prop);
+        return true;
+    }
+
+    // Decoded array property. Values keep the file's element type.
+    struct Array {
+        char type = 0;
+        size_t count = 0;
+        std::vector<uint8_t> bytes;
+
+        double Double(size_t i) const {
+            const uint8_t *p = bytes.data();
+            switch (type) {
+            case 'd':
+                return ReadValue<double>(p + i * 8);
+            case 'f':
+                return ReadValue<float>(p + i * 4);
+            case 'i':
+                return ReadValue<int32_t>(p + i * 4);
+            case 'l':
+                return double(ReadValue<int64_t>(p + i * 8));
+            }
+            return p[i];
+        }
+
+        int64_t Int(size_t i) const {
+            const uint8_t *p = bytes.data();
+            switch (type) {
+            case 'i':
+                return ReadValue<int32_t>(p + i * 4);
+            case 'l':
+                return ReadValue<int64_t>(p + i * 8);
+            case 'd':
+                return int64_t(ReadValue<double>(p + i * 8));
+            case 'f':
+                return int64_t(ReadValue<float>(p + i * 4));
+            }
+            return p[i];
+        }
+    };
+
+    bool DecodeArray(const Property &prop, Array &out) {
+        size_t elementSize;
+        switch (prop.type) {
+        case 'd':
+        case 'l':
+            elementSize = 8;
+            break;
+        case 'f':
+        case 'i':
+            elementSize = 4;
+            break;
+        case 'b':
+            elementSize = 1;
+            break;
+        default:
+            return false;
+        }
+
+        const uint32_t encoding = ReadValue<uint32_t>(prop.data + 4);
+        const uint32_t compressed = ReadValue<uint32_t>(prop.data + 8);
+        const uint8_t *payload = prop.data + 12;
+
+        // The header counts are unchecked, so bound the output by what the
+        // payload can hold before allocating: raw arrays exactly, deflate
+        // streams by zlib's best ratio of about 1032:1.
+        const size_t bytes = size_t(prop.size) * elementSize;
+        if (encoding == 0 && bytes != compressed)
+            return false;
+        if (encoding == 1 && bytes > size_t(compressed) * kMaxInflateRatio)
+            return false;
+        if (encoding > 1)
+            return false;
+
+        out.type = prop.type;
+        out.count = prop.size;
+        out.bytes.resize(bytes);
+        if (out.bytes.empty())
+            return true;
+
+        if (encoding == 0) {
+            std::memcpy(out.bytes.data(), payload, compressed);
+            return true;
+        }
+        if (out.bytes.size() <= size_t(INT32_MAX)) {
+            const int decoded = stbi_zlib_decode_buffer(
+                reinterpret_cast<char *>(out.bytes.data()), int(out.bytes.size()),
+                reinterpret_cast<const char *>(payload), int(compressed));
+            return decoded == int(out.bytes.size());
+        }
+        return false;
+    }
+
+    enum class Mapping { None, PolygonVertex, ControlPoint, Polygon, AllSame, Unsupported };
+
+    struct Layer {
+        Mapping mapping = Mapping::None;
+        Array values;
+        Array indices;
+        bool indexed = false;
+
+        bool Present() const { return mapping != Mapping::None; }
+
+        // Element index for a polygon corner, or kNone.
+        size_t Element(size_t corner, size_t polygon, size_t controlPoint) const {
+            size_t i;
+            switch (mapping) {
+            case Mapping::PolygonVertex:
+                i = corner;
+                break;
+            case Mapping::ControlPoint:
+                i = controlPoint;
+                break;
+            case Mapping::Polygon:
+                i = polygon;
+                break;
+            case Mapping::AllSame:
+                i = 0;
+                break;
+            default:
+                return kNone;
+            }
+            if (indexed) {
+                if (i >= indices.count)
+                    return kNone;
+                const int64_t index = indices.Int(i);
+                return index < 0 ? kNone : size_t(index);
+            }
+            return i;
+        }
+    };
+
+    struct Geometry {
+        Array vertices;
+        Array polygons;
+        Layer normals;
+        Layer uvs;
+        Layer tangents;
+        Layer binormals;
+        Layer materials;
+    };
+
+    struct DecodeJob {
+        const Property *prop;
+        Array *out;
+    };
+
+    Mapping ParseMapping(std::string_view s) {
+        if (s == "ByPolygonVertex")
+            return Mapping::PolygonVertex;
+        if (s == "ByVertex" || s == "ByVertice" || s == "ByControlPoint")
+            return Mapping::ControlPoint;
+        if (s == "ByPolygon")
+            return Mapping::Polygon;
+        if (s == "AllSame")
+            return Mapping::AllSame;
+        return Mapping::Unsupported;
+    }
+
+    void SetupLayer(const Document &doc, uint32_t geometry, std::string_view element,
+                    std::string_view valuesName, std::string_view indexName,
+                    Layer &layer, std::vector<DecodeJob> &jobs) {
+        const uint32_t node = doc.Child(geometry, element);
+        if (node == kNone)
+            return;
+
+        const uint32_t values = doc.Child(node, valuesName);
+        if (values == kNone || !doc.Prop(values, 0))
+            return;
+
+        const uint32_t mapping = doc.Child(node, "MappingInformationType");
+        const uint32_t reference = doc.Child(node, "ReferenceInformationType");
+        layer.mapping = mapping == kNone ? Mapping::AllSame
+                                         : ParseMapping(doc.String(mapping, 0));
+
+        const std::string_view referenceType =
+            reference == kNone ? std::string_view() : doc.String(reference, 0);
+        const uint32_t index = indexName.empty() ? kNone : doc.Child(node, indexName);
+        layer.indexed = (referenceType == "IndexToDirect" || referenceType == "Index") &&
+                        index != kNone && doc.Prop(index, 0);
+
+        jobs.push_back({doc.Prop(values, 0), &layer.values});
+        if (layer.indexed)
+            jobs.push_back({doc.Prop(index, 0), &layer.indices});
+    }
+
+    Vector3 PropertyVector(const Document &doc, uint32_t props, uint32_t defaults,
+                           std::string_view name, const Vector3 &fallback) {
+        for (uint32_t list : {props, defaults}) {
+            if (list == kNone)
+                continue;
+            uint32_t found = kNone;
+            doc.ForEachChild(list, [&](uint32_t p) {
+                if (found == kNone && doc.String(p, 0) == name)
+                    found = p;
+            });
+            if (found != kNone)
+                return Vector3(float(doc.Number(found, 4)), float(doc.Number(found, 5)),
+                               float(doc.Number(found, 6)));
+        }
+        return fallback;
+    }
+
+    int64_t PropertyInt(const Document &doc, uint32_t props, uint32_t defaults,
+                        std::string_view name, int64_t fallback) {
+        for (uint32_t list : {props, defaults}) {
+            if (list == kNone)
+                continue;
+            uint32_t found = kNone;
+            doc.ForEachChild(list, [&](uint32_t p) {
+                if (found == kNone && doc.String(p, 0) == name)
+                    found = p;
+            });
+            if (found != kNone)
+                return doc.Int(found, 4);
+        }
+        return fallback;
+    }
+
+    // Row-vector rotation for FBX Euler angles in degrees. The order names
+    // the axis applied first, as in Assimp's converter.
+    Matrix EulerRotation(const Vector3 &degrees, int64_t order) {
+        const float k = 3.14159265358979f / 180.0f;
+        const Matrix x = Matrix::CreateRotationX(degrees.x * k);
+        const Matrix y = Matrix::CreateRotationY(degrees.y * k);
+        const Matrix z = Matrix::CreateRotationZ(degrees.z * k);
+        switch (order) {
+        case 1: // XZY
+            return x * z * y;
+        case 2: // YZX
+            return y * z * x;
+        case 3: // YXZ
+            return y * x * z;
+        case 4: // ZXY
+            return z * x * y;
+        case 5: // ZYX
+            return z * y * x;
+        default: // XYZ, spheric XYZ
+            return x * y * z;
+        }
+    }
+
+    // The FBX node transform
+    //   T * Roff * Rp * Rpre * R * Rpost^-1 * Rp^-1 * Soff * Sp * S * Sp^-1
+    // written for row vectors.
+    Matrix NodeTransform(const Document &doc, uint32_t props, uint32_t defaults) {
+        const Vector3 zero(0.0f);
+        auto vec = [&](std::string_view name, const Vector3 &fallback) {
+            return PropertyVector(doc, props, defaults, name, fallback);
+        };
+
+        const Vector3 rotationPivot = vec("RotationPivot", zero);
+        const Vector3 scalingPivot = vec("ScalingPivot", zero);
+
+        return Matrix::CreateTranslation(-scalingPivot) *
+               Matrix::CreateScale(vec("Lcl Scaling", Vector3(1.0f))) *
+               Matrix::CreateTranslation(scalingPivot) *
+               Matrix::CreateTranslation(vec("ScalingOffset", zero)) *
+               Matrix::CreateTranslation(-rotationPivot) *
+               EulerRotation(vec("PostRotation", zero), 0).Transpose() *
+               EulerRotation(vec("Lcl Rotation", zero),
+                             PropertyInt(doc, props, defaults, "RotationOrder", 0)) *
+               EulerRotation(vec("PreRotation", zero), 0) *
+               Matrix::CreateTranslation(rotationPivot) *
+               Matrix::CreateTranslation(vec("RotationOffset", zero)) *
+               Matrix::CreateTranslation(vec("Lcl Translation", zero));
+    }
+
+    // Applies to the node's geometry only, not to its children.
+    Matrix GeometricTransform(const Document &doc, uint32_t props) {
+        const Vector3 zero(0.0f);
+        return Matrix::CreateScale(
+                   PropertyVector(doc, props, kNone, "GeometricScaling", Vector3(1.0f))) *
+               EulerRotation(PropertyVector(doc, props, kNone, "GeometricRotation", zero), 0) *
+               Matrix::CreateTranslation(
+                   PropertyVector(doc, props, kNone, "GeometricTranslation", zero));
+    }
+
+    std::string ObjectName(std::string_view name) {
+        // Binary names are "Name\0\1Class".
+        const size_t separator = name.find(std::string_view("\0\1", 2));
+        return std::string(name.substr(0, separator));
+    }
+
+    struct Instance {
+        uint32_t geometry;
+        Matrix transform;
+        std::vector<int> materials;
+    };
+
+    float Canonical(double v) { return float(v) + 0.0f; } // -0 joins with 0
+
+    // Ear clipping for polygons with more than four corners, like Assimp's
+    // Triangulate: the outline is projected onto the plane of its Newell
+    // normal and the first convex corner with no other corner inside its
+    // triangle is cut off until three are left. Degenerate outlines cut
+    // the current corner anyway. Ties can pick other diagonals than
+    // Assimp. Emits indices into points in their original winding.
+    void EarClip(const std::vector<Vector3> &points, std::vector<uint32_t> &ring,
+                 std::vector<uint32_t> &out) {
+        const size_t n = points.size();
+        Vector3 normal(0.0f);
+        for (size_t i = 0; i < n; i++) {
+            const Vector3 &a = points[i];
+            const Vector3 &b = points[(i + 1) % n];
+            normal.x += (a.y - b.y) * (a.z + b.z);
+            normal.y += (a.z - b.z) * (a.x + b.x);
+            normal.z += (a.x - b.x) * (a.y + b.y);
+        }
+
+        // Drop the dominant axis, keeping the outline counter-clockwise.
+        const float ax = std::abs(normal.x), ay = std::abs(normal.y),
+                    az = std::abs(normal.z);
+        int u = 0, v = 1;
+        float sign = normal.z;
+        if (ax >= ay && ax >= az) {
+            u = 1, v = 2, sign = normal.x;
+        } else if (ay >= az) {
+            u = 2, v = 0, sign = normal.y;
+        }
+        auto at = [&](uint32_t i) {
+            const float *p = &points[i].x;
+            return Vector2(p[u], sign < 0.0f ? -p[v] : p[v]);
+        };
+        auto cross = [](const Vector2 &o, const Vector2 &a, const Vector2 &b) {
+            return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+        };
+
+        ring.resize(n);
+        for (size_t i = 0; i < n; i++)
+            ring[i] = uint32_t(i);
+
+        size_t remaining = n;
+        size_t i = 0;
+        size_t misses = 0;
+        while (remaining > 3) {
+            const uint32_t prev = ring[(i + remaining - 1) % remaining];
+            const uint32_t curr = ring[i];
+            const uint32_t next = ring[(i + 1) % remaining];
+            const Vector2 a = at(prev), b = at(curr), c = at(next);
+
+            bool ear = cross(a, b, c) > 0.0f;
+            for (size_t k = 0; ear && k < remaining; k++) {
+                const uint32_t other = ring[k];
+                if (other == prev || other == curr || other == next)
+                    continue;
+                const Vector2 p = at(other);
+                ear = !(cross(a, b, p) >= 0.0f && cross(b, c, p) >= 0.0f &&
+                        cross(c, a, p) >= 0.0f);
+            }
+
+            if (ear || misses >= remaining) {
+                out.push_back(prev);
+                out.push_back(curr);
+                out.push_back(next);
+                ring.erase(ring.begin() + i);
+                remaining--;
+                if (i == remaining)
+                    i = 0;
+                misses = 0;
+            } else {
+                i = (i + 1) % remaining;
+                misses++;
+            }
+        }
+        out.push_back(ring[0]);
+        out.push_back(ring[1]);
+        out.push_back(ring[2]);
+    }
+
+    class MeshBuilder {
+      public:
+        MeshBuilder(const Geometry &geometry, const std::vector<Vector3> &smoothNormals)
+            : m_g(geometry), m_smoothNormals(smoothNormals) {}
+
+        void Build(const Instance &instance, std::vector<MeshData> &meshes,
+                   std::vector<int> &materials);
+
+      private:
+        Vertex Corner(size_t corner, size_t polygon, size_t controlPoint) const;
+        uint32_t Emit(const Vertex &v, MeshData &mesh);
+
+        const Geometry &m_g;
+        const std::vector<Vector3> &m_smoothNormals;
+        bool m_hasTangents = false;
+
+        std::vector<uint32_t> m_table;
+        std::vector<uint64_t> m_hashes;
+    };
+
+    Vertex MeshBuilder::Corner(size_t corner, size_t polygon, size_t cp) const {
+        const Array &positions = m_g.vertices;
+        Vertex v{};
+        v.position = Vector3(Canonical(positions.Double(cp * 3)),
+                             Canonical(positions.Double(cp * 3 + 1)),
+                             Canonical(positions.Double(cp * 3 + 2)));
+
+        auto read3 = [&](const Layer &layer, Vector3 &out) {
+            const size_t e = layer.Element(corner, polygon, cp);
+            if (e == kNone || e * 3 + 2 >= layer.values.count)
+                return false;
+            out = Vector3(Canonical(layer.values.Double(e * 3)),
+                          Canonical(layer.values.Double(e * 3 + 1)),
+                          Canonical(layer.values.Double(e * 3 + 2)));
+            return true;
+        };
+
+        if (!read3(m_g.normals, v.normal) && cp < m_smoothNormals.size())
+            v.normal = m_smoothNormals[cp];
+
+        const size_t uv = m_g.uvs.Element(corner, polygon, cp);
+        if (uv != kNone && uv * 2 + 1 < m_g.uvs.values.count)
+            v.texcoord = Vector2(Canonical(m_g.uvs.values.Double(uv * 2)),
+                                 Canonical(m_g.uvs.values.Double(uv * 2 + 1)));
+
+        if (m_hasTangents && read3(m_g.tangents, v.tangent)) {
+            if (!read3(m_g.binormals, v.bitangent))
+                v.bitangent = v.normal.Cross(v.tangent);
+        }
+        return v;
+    }
+
+    // JoinIdenticalVertices: vertices keep first-use order.
+    uint32_t MeshBuilder::Emit(const Vertex &v, MeshData &mesh) {
+        const uint64_t hash = HashBytes(&v, sizeof(Vertex));
+        const size_t mask = m_table.size() - 1;
+        for (size_t slot = size_t(hash) & mask;; slot = (slot + 1) & mask) {
+            const uint32_t index = m_table[slot];
+            if (index == kNone) {
+                m_table[slot] = uint32_t(mesh.vertices.size());
+                m_hashes.push_back(hash);
+                mesh.vertices.push_back(v);
+                return m_table[slot];
+            }
+            if (m_hashes[index] == hash &&
+                std::memcmp(&mesh.vertices[index], &v, sizeof(Vertex)) == 0)
+                return index;
+        }
+    }
+
+    void MeshBuilder::Build(const Instance &instance, std::vector<MeshData> &meshes,
+                            std::vector<int> &materials) {
+        const Array &polygons = m_g.polygons;
+        const Array &positions = m_g.vertices;
+        const size_t controlPoints = positions.count / 3;
+        const bool hasUVs = m_g.uvs.Present();
+        m_hasTangents = hasUVs && m_g.tangents.Present();
+
+        // Polygon starts; the last index of a polygon is stored as ~index.
+        std::vector<uint32_t> starts;
+        starts.reserve(polygons.count / 3 + 1);
+        starts.push_back(0);
+        for (size_t i = 0; i < polygons.count; i++) {
+            if (polygons.Int(i) < 0)
+                starts.push_back(uint32_t(i + 1));
+        }
+        const size_t polygonCount = starts.size() - 1;
+
+        std::vector<int> polygonMaterial(polygonCount, 0);
+        if (m_g.materials.Present()) {
+            for (size_t p = 0; p < polygonCount; p++) {
+                const size_t e = m_g.materials.Element(0, p, 0);
+                polygonMaterial[p] =
+                    e < m_g.materials.values.count ? int(m_g.materials.values.Int(e)) : 0;
+            }
+        }
+        std::vector<int> used = polygonMaterial;
+        std::sort(used.begin(), used.end());
+        used.erase(std::unique(used.begin(), used.end()), used.end());
+
+        auto controlPoint = [&](size_t corner) {
+            const int64_t index = polygons.Int(corner);
+            return size_t(index < 0 ? ~index : index);
+        };
+        auto position = [&](size_t cp) {
+            return Vector3(float(positions.Double(cp * 3)), float(positions.Double(cp * 3 + 1)),
+                           float(positions.Double(cp * 3 + 2)));
+        };
+
+        // One mesh per material, in material order like Assimp.
+        for (const int material : used) {
+            MeshData mesh;
+            std::vector<uint32_t> triangles; // original winding
+            std::vector<uint32_t> corners;
+            std::vector<Vector3> outline;
+            std::vector<uint32_t> ring, clipped;
+
+            size_t cornerCount = 0;
+            for (size_t p = 0; p < polygonCount; p++) {
+                if (polygonMaterial[p] == material)
+                    cornerCount += starts[p + 1] - starts[p];
+            }
+            size_t tableSize = 64;
+            while (tableSize < cornerCount * 2)
+                tableSize *= 2;
+            m_table.assign(tableSize, kNone);
+            m_hashes.clear();
+            mesh.vertices.reserve(cornerCount);
+            triangles.reserve(cornerCount * 3);
+
+            for (size_t p = 0; p < polygonCount; p++) {
+                if (polygonMaterial[p] != material)
+                    continue;
+                const size_t first = starts[p];
+                const size_t n = starts[p + 1] - first;
+                if (n < 3)
+                    continue;
+
+                corners.resize(n);
+                bool valid = true;
+                for (size_t k = 0; k < n; k++) {
+                    const size_t cp = controlPoint(first + k);
+                    if (cp >= controlPoints) {
+                        valid = false;
+                        break;
+                    }
+                    corners[k] = Emit(Corner(first + k, p, cp), mesh);
+                }
+                if (!valid)
+                    continue;
+
+                if (n == 4) {
+                    // Assimp's Triangulate: fan from the concave corner if
+                    // there is one.
+                    size_t start = 0;
+                    for (size_t i = 0; i < 4; i++) {
+                        const Vector3 v = position(controlPoint(first + i));
+                        Vector3 left = position(controlPoint(first + (i + 3) % 4)) - v;
+                        Vector3 diag = position(controlPoint(first + (i + 2) % 4)) - v;
+                        Vector3 right = position(controlPoint(first + (i + 1) % 4)) - v;
+                        left.Normalize();
+                        diag.Normalize();
+                        right.Normalize();
+                        const float angle =
+                            std::acos(std::clamp(left.Dot(diag), -1.0f, 1.0f)) +
+                            std::acos(std::clamp(right.Dot(diag), -1.0f, 1.0f));
+                        if (angle > 3.14159265f) {
+                            start = i;
+                            break;
+                        }
+                    }
+                    const uint32_t q[3] = {corners[start], corners[(start + 1) % 4],
+                                           corners[(start + 2) % 4]};
+                    const uint32_t r[3] = {corners[start], corners[(start + 2) % 4],
+                                           corners[(start + 3) % 4]};
+                    triangles.insert(triangles.end(), q, q + 3);
+                    triangles.insert(triangles.end(), r, r + 3);
+                } else if (n == 3) {
+                    triangles.insert(triangles.end(), corners.begin(), corners.end());
+                } else {
+                    outline.resize(n);
+                    for (size_t k = 0; k < n; k++)
+                        outline[k] = position(controlPoint(first + k));
+                    clipped.clear();
+                    EarClip(outline, ring, clipped);
+                    for (const uint32_t k : clipped)
+                        triangles.push_back(corners[k]);
+                }
+            }
+
+            if (mesh.vertices.empty())
+                continue;
+
+            // MakeLeftHanded, FlipUVs and FlipWindingOrder. Assimp runs them
+            // before CalcTangentSpace, so computed tangents see their result.
+            for (auto &v : mesh.vertices) {
+                v.position.z = -v.position.z;
+                v.normal.z = -v.normal.z;
+                v.tangent.z = -v.tangent.z;
+                v.bitangent.z = -v.bitangent.z;
+                if (hasUVs)
+                    v.texcoord.y = 1.0f - v.texcoord.y;
+            }
+
+            mesh.indices.resize(triangles.size());
+            for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+                mesh.indices[i] = triangles[i + 2];
+                mesh.indices[i + 1] = triangles[i + 1];
+                mesh.indices[i + 2] = triangles[i];
+            }
+
+            if (hasUVs && !m_hasTangents)
+                ComputeTangents(mesh);
+
+            // The node transform goes to positions only, as in
+            // ModelLoader::ProcessNode, mirrored like Assimp converts it.
+            const Matrix mirror = Matrix::CreateScale(Vector3(1.0f, 1.0f, -1.0f));
+            const Matrix transform = mirror * instance.transform * mirror;
+            for (auto &v : mesh.vertices) {
+                v.position = Vector3::Transform(v.position, transform);
+                if (!hasUVs) {
+                    v.tangent = Vector3(1.0f, 0.0f, 0.0f);
+                    v.bitangent = Vector3(0.0f, 1.0f, 0.0f);
+                }
+            }
+
+            meshes.push_back(std::move(mesh));
+            materials.push_back(material >= 0 && size_t(material) < instance.materials.size()
+                                    ? instance.materials[material]
+                                    : -1);
+        }
+    }
+
+    // GenSmoothNormals for geometry without normals: normalized face
+    // normals summed per control point.
+    std::vector<Vector3> SmoothNormals(const Geometry &g) {
+        const size_t controlPoints = g.vertices.count / 3;
+        std::vector<Vector3> normals(controlPoints, Vector3(0.0f));
+        auto position = [&](size_t cp) {
+            return Vector3(float(g.vertices.Double(cp * 3)), float(g.vertices.Double(cp * 3 + 1)),
+                           float(g.vertices.Double(cp * 3 + 2)));
+        };
+
+        size_t first = 0;
+        for (size_t i = 0; i < g.polygons.count; i++) {
+            if (g.polygons.Int(i) >= 0)
+                continue;
+            for (size_t k = first + 1; k + 1 <= i; k++) {
+                size_t cp[3] = {size_t(g.polygons.Int(first)), size_t(g.polygons.Int(k)),
+                                size_t(g.polygons.Int(k + 1))};
+                for (auto &c : cp)
+                    c = int64_t(c) < 0 ? ~c : c;
+                if (cp[0] >= controlPoints || cp[1] >= controlPoints ||
+                    cp[2] >= controlPoints)
+                    continue;
+                Vector3 n = (position(cp[1]) - position(cp[0]))
+                                .Cross(position(cp[2]) - position(cp[0]));
+                if (n.LengthSquared() == 0.0f)
+                    continue;
+                n.Normalize();
+                for (size_t c : cp)
+                    normals[c] += n;
+            }
+            first = i + 1;
+        }
+        for (auto &n : normals)
+            n.Normalize();
+        return normals;
+    }
+	}
+
+    bool FbxLoader::Load(const std::string &filename) {
+        meshes.clear();
+        meshMaterials.clear();
+        materialNames.clear();
+
+        MappedIOSystem io;
+        std::unique_ptr<Assimp::IOStream> stream(io.Open(filename.c_str(), "rb"));
+        if (!stream)
+            return false;
+        const uint8_t *data = static_cast<MappedIOStream *>(stream.get())->Data();
+
+        Document doc;
+        if (!data || !doc.Parse(data, stream->FileSize()))
+            return false;
+
+        const uint32_t objects = doc.Child(0, "Objects");
+        const uint32_t connections = doc.Child(0, "Connections");
+        if (objects == kNone || connections == kNone)
+            return false;
+
+        // Model property defaults from the FbxNode template.
+        uint32_t modelDefaults = kNone;
+        if (const uint32_t definitions = doc.Child(0, "Definitions"); definitions != kNone) {
+            doc.ForEachChild(definitions, [&](uint32_t type) {
+                if (doc[type].name != "ObjectType" || doc.String(type, 0) != "Model")
+                    return;
+                const uint32_t templ = doc.Child(type, "PropertyTemplate");
+                if (templ != kNone)
+                    modelDefaults = doc.Child(templ, "Properties70");
+            });
+        }
+
+        std::unordered_map<int64_t, uint32_t> objectNodes;
+        bool supported = true;
+        doc.ForEachChild(objects, [&](uint32_t node) {
+            const std::string_view name = doc[node].name;
+            if (name == "Deformer" || name == "AnimationCurveNode" ||
+                (name == "Geometry" && doc.String(node, 2) != "Mesh"))
+                supported = false;
+            objectNodes[doc.Int(node, 0)] = node;
+        });
+        if (!supported) {
+            LOG_DEBUG(LogCategory::Loader, "FBX fast path: deformers, animation or "
+                                           "non-mesh geometry, using Assimp for %s",
+                      filename.c_str());
+            return false;
+        }
+
+        std::unordered_map<int64_t, std::vector<int64_t>> children;
+        doc.ForEachChild(connections, [&](uint32_t c) {
+            if (doc[c].name == "C" && doc.String(c, 0) == "OO")
+                children[doc.Int(c, 2)].push_back(doc.Int(c, 1));
+        });
+
+        auto object = [&](int64_t id) {
+            auto it = objectNodes.find(id);
+            return it == objectNodes.end() ? kNone : it->second;
+        };
+
+        // Walk the model hierarchy from the scene root (id 0).
+        std::vector<Instance> instances;
+        std::unordered_map<int64_t, int> materialIndex;
+        std::vector<uint32_t> geometryNodes;
+        std::unordered_map<uint32_t, size_t> geometrySlot;
+
+        auto visit = [&](auto &&self, int64_t parent, const Matrix &parentWorld,
+                         int depth) -> void {
+            auto it = children.find(parent);
+            if (it == children.end() || depth > 256)
+                return;
+            for (const int64_t id : it->second) {
+                const uint32_t model = object(id);
+                if (model == kNone || doc[model].name != "Model")
+                    continue;
+
+                const uint32_t props = doc.Child(model, "Properties70");
+                const Matrix world = NodeTransform(doc, props, modelDefaults) * parentWorld;
+
+                Instance instance;
+                instance.transform = GeometricTransform(doc, props) * world;
+                std::vector<uint32_t> geometries;
+                auto owned = children.find(id);
+                if (owned != children.end()) {
+                    for (const int64_t childId : owned->second) {
+                        const uint32_t child = object(childId);
+                        if (child == kNone)
+                            continue;
+                        if (doc[child].name == "Material") {
+                            auto [entry, added] = materialIndex.try_emplace(
+                                childId, int(materialNames.size()));
+                            if (added)
+                                materialNames.push_back(ObjectName(doc.String(child, 1)));
+                            instance.materials.push_back(entry->second);
+                        } else if (doc[child].name == "Geometry") {
+                            geometries.push_back(child);
+                        }
+                    }
+                }
+                for (const uint32_t geometry : geometries) {
+                    if (geometrySlot.try_emplace(geometry, geometryNodes.size()).second)
+                        geometryNodes.push_back(geometry);
+                    instance.geometry = uint32_t(geometrySlot[geometry]);
+                    instances.push_back(instance);
+                }
+
+                self(self, id, world, depth + 1);
+            }
+        };
+        visit(visit, 0, Matrix(), 0);
+
+        // Decompress every array the meshes need in parallel.
+        std::vector<Geometry> geometries(geometryNodes.size());
+        std::vector<DecodeJob> jobs;
+        for (size_t i = 0; i < geometryNodes.size(); i++) {
+            const uint32_t node = geometryNodes[i];
+            Geometry &g = geometries[i];
+            const uint32_t vertices = doc.Child(node, "Vertices");
+            const uint32_t polygons = doc.Child(node, "PolygonVertexIndex");
+            if (vertices == kNone || polygons == kNone || !doc.Prop(vertices, 0) ||
+                !doc.Prop(polygons, 0))
+                return false;
+            jobs.push_back({doc.Prop(vertices, 0), &g.vertices});
+            jobs.push_back({doc.Prop(polygons, 0), &g.polygons});
+
+            SetupLayer(doc, node, "LayerElementNormal", "Normals", "NormalsIndex",
+                       g.normals, jobs);
+            SetupLayer(doc, node, "LayerElementUV", "UV", "UVIndex", g.uvs, jobs);
+            SetupLayer(doc, node, "LayerElementTangent", "Tangents", "TangentsIndex",
+                       g.tangents, jobs);
+            SetupLayer(doc, node, "LayerElementBinormal", "Binormals",
+                       "BinormalsIndex", g.binormals, jobs);
+            SetupLayer(doc, node, "LayerElementMaterial", "Materials", "", g.materials,
+                       jobs);
+
+            if (g.normals.mapping == Mapping::Unsupported ||
+                g.uvs.mapping == Mapping::Unsupported ||
+                g.materials.mapping == Mapping::Unsupported ||
+                g.materials.mapping == Mapping::PolygonVertex ||
+                g.materials.mapping == Mapping::ControlPoint) {
+                LOG_DEBUG(LogCategory::Loader,
+                          "FBX fast path: unsupported layer mapping in %s",
+                          filename.c_str());
+                return false;
+            }
+            // Assimp drops tangents it can't read, then computes them.
+            if (g.tangents.mapping == Mapping::Unsupported)
+                g.tangents = Layer();
+            if (g.binormals.mapping == Mapping::Unsupported)
+                g.binormals = Layer();
+        }
+
+        std::vector<char> decoded(jobs.size(), 0);
+        ParallelFor(jobs.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                decoded[i] = DecodeArray(*jobs[i].prop, *jobs[i].out);
+        });
+        if (std::find(decoded.begin(), decoded.end(), 0) != decoded.end()) {
+            LOG_WARN(LogCategory::Loader, "FBX fast path: cannot decode arrays in %s",
+                     filename.c_str());
+            return false;
+        }
+
+        std::vector<std::vector<Vector3>> smoothNormals(geometries.size());
+        ParallelFor(geometries.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                if (!geometries[i].normals.Present())
+                    smoothNormals[i] = SmoothNormals(geometries[i]);
+            }
+        });
+
+        // Instances are independent, build them in parallel and keep the
+        // traversal order.
+        std::vector<std::vector<MeshData>> built(instances.size());
+        std::vector<std::vector<int>> builtMaterials(instances.size());
+        ParallelFor(instances.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const uint32_t g = instances[i].geometry;
+                MeshBuilder builder(geometries[g], smoothNormals[g]);
+                builder.Build(instances[i], built[i], builtMaterials[i]);
+            }
+        });
+
+        for (size_t i = 0; i < instances.size(); i++) {
+            for (size_t m = 0; m < built[i].size(); m++) {
+                if (!geometries[instances[i].geometry].uvs.Present())
+                    LOG_WARN(LogCategory::Loader, "mesh has NO UV0. materialIndex=%d",
+                             builtMaterials[i][m]);
+                meshes.push_back(std::move(built[i][m]));
+                meshMaterials.push_back(builtMaterials[i][m]);
+            }
+        }
+        return true;
+    }
+}
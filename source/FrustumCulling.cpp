@@ -0,0 +1,123 @@
+#include "FrustumCulling.h"
+
+#include <xmmintrin.h>
+
+namespace hlab {
+
+	Frustum Frustum::FromViewProjection(const Matrix &m) {
+        // Gribb/Hartmann with D3D clip space (0 <= z <= w).
+        const Vector4 c0(m._11, m._21, m._31, m._41);
+        const Vector4 c1(m._12, m._22, m._32, m._42);
+        const Vector4 c2(m._13, m._23, m._33, m._43);
+        const Vector4 c3(m._14, m._24, m._34, m._44);
+
+        Frustum f;
+        f.planes[0] = c3 + c0;
+        f.planes[1] = c3 - c0;
+        f.planes[2] = c3 + c1;
+        f.planes[3] = c3 - c1;
+        f.planes[4] = c2;
+        f.planes[5] = c3 - c2;
+
+        for (auto &p : f.planes) {
+            const float len = Vector3(p.x, p.y, p.z).Length();
+            if (len > 0.0f)
+                p = p / len;
+        }
+        return f;
+	}
+
+    void SphereSoA::Resize(size_t n) {
+        count = n;
+        const size_t padded = (n + 3) & ~size_t(3);
+        x.assign(padded, 0.0f);
+        y.assign(padded, 0.0f);
+        z.assign(padded, 0.0f);
+        // Padding lanes get a negative radius so they never pass.
+        r.assign(padded, -1e30f);
+    }
+
+    void SphereSoA::Set(size_t i, const Vector3 &center, float radius) {
+        x[i] = center.x;
+        y[i] = center.y;
+        z[i] = center.z;
+        r[i] = radius;
+    }
+
+    void CullSpheres(const Frustum &frustum, const SphereSoA &spheres,
+                     std::vector<uint32_t> &visible) {
+        CullSpheres(frustum, spheres, 0, spheres.x.size(), visible);
+    }
+
+    void CullSpheres(const Frustum &frustum, const SphereSoA &spheres,
+                     size_t begin, size_t end, std::vector<uint32_t> &visible) {
+        __m128 px[6], py[6], pz[6], pw[6];
+        for (int p = 0; p < 6; p++) {
+            px[p] = _mm_set1_ps(frustum.planes[p].x);
+            py[p] = _mm_set1_ps(frustum.planes[p].y);
+            pz[p] = _mm_set1_ps(frustum.planes[p].z);
+            pw[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+
+        for (size_t i = begin; i < end; i += 4) {
+            const __m128 x = _mm_loadu_ps(&spheres.x[i]);
+            const __m128 y = _mm_loadu_ps(&spheres.y[i]);
+            const __m128 z = _mm_loadu_ps(&spheres.z[i]);
+            const __m128 r = _mm_loadu_ps(&spheres.r[i]);
+            const __m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+
+            __m128 inside = _mm_cmpge_ps(r, _mm_setzero_ps());
+            for (int p = 0; p < 6; p++) {
+                __m128 d = _mm_add_ps(_mm_mul_ps(x, px[p]), pw[p]);
+                d = _mm_add_ps(d, _mm_mul_ps(y, py[p]));
+                d = _mm_add_ps(d, _mm_mul_ps(z, pz[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            while (mask) {
+                const int lane = mask & -mask;
+                const uint32_t index = uint32_t(i) + (lane == 1   ? 0
+                                                      : lane == 2 ? 1
+                                                      : lane == 4 ? 2
+                                                                  : 3);
+                visible.push_back(index);
+                mask &= mask - 1;
+            }
+        }
+    }
+
+    void CullMeshlets(const Frustum &frustum, const Vector3 &eye,
+                      const std::vector<Meshlet> &meshlets,
+                      const SphereSoA &spheres, bool cullBackfaces,
+                      std::vector<uint32_t> &visible,
+                      std::vector<IndexRange> &ranges) {
+        visible.clear();
+        ranges.clear();
+        CullSpheres(frustum, spheres, visible);
+
+        for (uint32_t i : visible) {
+            const Meshlet &m = meshlets[i];
+
+            // Every triangle faces away when the direction from the eye to
+            // any point of the sphere is within 90 degrees minus the cone
+            // half-angle of the axis. coneCutoff is the sine of that angle.
+            if (cullBackfaces && m.coneCutoff <= 1.0f) {
+                const Vector3 d = m.center - eye;
+                if (d.Dot(m.coneAxis) >=
+                    m.coneCutoff * (d.Length() + m.radius) + m.radius)
+                    continue;
+            }
+
+            const uint32_t count = m.triangleCount * 3;
+            if (!ranges.empty()) {
+                IndexRange &last = ranges.back();
+                if (m.indexOffset - (last.offset + last.count) <= kMaxRangeGap) {
+                    last.count = m.indexOffset + count - last.offset;
+                    continue;
+                }
+            }
+            ranges.push_back({m.indexOffset, count});
+        }
+    }
+}
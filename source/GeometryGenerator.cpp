@@ -1,5 +1,6 @@
 #include "GeometryGenerator.h"
 
+#include "Logger.h"
 #include "ModelLoader.h"
 
 namespace hlab {
@@ -461,27 +462,43 @@ namespace hlab {
     }
 
     vector<MeshData> GeometryGenerator::ReadFromFile(std::string basePath,
-        std::string filename) {
+        std::string filename, LoaderTimings *timings,
+        ModelAnimation *animation) {
 
         using namespace DirectX;
 
         ModelLoader modelLoader;
         modelLoader.Load(basePath, filename);
-        vector<MeshData> &meshes = modelLoader.meshes;
 
-        Vector3 vmin(1000, 1000, 1000);
-        Vector3 vmax(-1000, -1000, -1000);
-        for (auto &mesh : meshes) {
-            for (auto &v : mesh.vertices) {
-                vmin.x = XMMin(vmin.x, v.position.x);
-                vmin.y = XMMin(vmin.y, v.position.y);
-                vmin.z = XMMin(vmin.z, v.position.z);
-                vmax.x = XMMax(vmax.x, v.position.x);
-                vmax.y = XMMax(vmax.y, v.position.y);
-                vmax.z = XMMax(vmax.z, v.position.z);
-            }
+        // The app has no view-dependent paging, so a streamed model is
+        // brought in whole, over the budget if it has to be.
+        const size_t chunkCount = modelLoader.chunkFile.Chunks().size();
+        if (modelLoader.residentChunks < chunkCount) {
+            LOG_WARN(LogCategory::Loader,
+                     "paging in the %zu chunks of %s over the memory budget, %zu were resident",
+                     chunkCount, filename.c_str(), modelLoader.residentChunks);
+            modelLoader.PageInChunks(UINT64_MAX);
+        }
+        vector<MeshData> meshes = std::move(modelLoader.meshes);
+
+        CpuTimer normalizeTimer;
+
+        // Empty and failed loads still report what the loader spent.
+        if (meshes.empty()) {
+            if (timings)
+                *timings = modelLoader.timings;
+            return meshes;
         }
 
+        // The loader already computed per-mesh bounds, so the scene box is
+        // their union rather than another pass over every vertex.
+        MeshBounds sceneBounds = meshes[0].bounds;
+        for (const auto &mesh : meshes)
+            sceneBounds.Merge(mesh.bounds);
+
+        const Vector3 vmin = sceneBounds.aabbMin;
+        const Vector3 vmax = sceneBounds.aabbMax;
+
         float dx = vmax.x - vmin.x, dy = vmax.y - vmin.y, dz = vmax.z - vmin.z;
         float dl = XMMax(XMMax(dx, dy), dz);
         float cx = (vmax.x + vmin.x) * 0.5f, cy = (vmax.y + vmin.y) * 0.5f,
@@ -495,6 +512,41 @@ namespace hlab {
             }
         }
 
+        const Matrix normalize = Matrix::CreateTranslation(-cx, -cy, -cz) *
+                                 Matrix::CreateScale(1.0f / dl);
+        for (auto &mesh : meshes) {
+            mesh.bounds = mesh.bounds.Transformed(normalize);
+            // The scale is uniform, so the normal cones stay as they are.
+            for (auto &meshlet : mesh.meshlets) {
+                meshlet.center = Vector3::Transform(meshlet.center, normalize);
+                meshlet.radius /= dl;
+            }
+        }
+
+        // Skinning starts from the normalized vertices and ends in the
+        // joints' model space, so the normalization moves to both ends.
+        const Matrix denormalize = normalize.Invert();
+        for (auto &mesh : meshes) {
+            for (auto &inverseBind : mesh.skin.inverseBind)
+                inverseBind = denormalize * inverseBind;
+            for (auto &target : mesh.morphTargets) {
+                for (auto &d : target.deltas)
+                    d.position /= dl;
+            }
+        }
+        if (animation) {
+            animation->graph = std::move(modelLoader.sceneGraph);
+            animation->clips = std::move(modelLoader.clips);
+            animation->root = normalize;
+        }
+
+        if (timings) {
+            *timings = modelLoader.timings;
+            timings->normalizeMs = normalizeTimer.ElapsedMs();
+            timings->normalizeAllocs = normalizeTimer.Allocations();
+            timings->totalMs += timings->normalizeMs;
+        }
+
         return meshes;
     }
     }
\ No newline at end of file
@@ -0,0 +1,949 @@
+#include "GltfLoader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string_view>
+
+#include "Logger.h"
+#include "MappedIOSystem.h"
+#include "MeshOptimizer.h"
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    using DirectX::SimpleMath::Matrix;
+    using DirectX::SimpleMath::Quaternion;
+
+    const uint32_t kNone = 0xffffffffu;
+
+    enum class JsonType : uint8_t { Null, Bool, Number, String, Array, Object };
+
+    // Values in document order. The children of an array or object are
+    // the values between it and end. Strings keep their escapes.
+    struct JsonValue {
+        JsonType type = JsonType::Null;
+        std::string_view key; // member name inside an object
+        std::string_view text;
+        double number = 0.0;
+        uint32_t end = 0;
+    };
+
+    class Json {
+      public:
+        bool Parse(const char *text, size_t size) {
+            m_p = text;
+            m_end = text + size;
+            m_values.clear();
+            return ParseValue(std::string_view(), 0) && (SkipSpace(), m_p == m_end);
+        }
+
+        const JsonValue &operator[](uint32_t i) const { return m_values[i]; }
+
+        uint32_t Member(uint32_t object, std::string_view key) const {
+            if (object == kNone || m_values[object].type != JsonType::Object)
+                return kNone;
+            for (uint32_t i = object + 1; i < m_values[object].end; i = m_values[i].end) {
+                if (m_values[i].key == key)
+                    return i;
+            }
+            return kNone;
+        }
+
+        std::vector<uint32_t> Elements(uint32_t array) const {
+            std::vector<uint32_t> out;
+            if (array == kNone || m_values[array].type != JsonType::Array)
+                return out;
+            for (uint32_t i = array + 1; i < m_values[array].end; i = m_values[i].end)
+                out.push_back(i);
+            return out;
+        }
+
+        double Number(uint32_t object, std::string_view key, double fallback) const {
+            const uint32_t v = Member(object, key);
+            return v != kNone && m_values[v].type == JsonType::Number ? m_values[v].number
+                                                                     : fallback;
+        }
+
+        int64_t Int(uint32_t object, std::string_view key, int64_t fallback) const {
+            return int64_t(Number(object, key, double(fallback)));
+        }
+
+        std::string String(uint32_t object, std::string_view key) const {
+            const uint32_t v = Member(object, key);
+            if (v == kNone || m_values[v].type != JsonType::String)
+                return std::string();
+            return Unescape(m_values[v].text);
+        }
+
+        // Reads up to count numbers of an array member into out.
+        size_t Numbers(uint32_t object, std::string_view key, float *out,
+                       size_t count) const {
+            const uint32_t array = Member(object, key);
+            size_t n = 0;
+            for (uint32_t i : Elements(array)) {
+                if (n == count || m_values[i].type != JsonType::Number)
+                    break;
+                out[n++] = float(m_values[i].number);
+            }
+            return n;
+        }
+
+      private:
+        void SkipSpace() {
+            while (m_p < m_end &&
+                   (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r'))
+                m_p++;
+        }
+
+        bool ParseString(std::string_view &out) {
+            if (m_p >= m_end || *m_p != '"')
+                return false;
+            const char *start = ++m_p;
+            while (m_p < m_end && *m_p != '"') {
+                if (*m_p == '\\')
+                    m_p++;
+                m_p++;
+            }
+            if (m_p >= m_end)
+                return false;
+            out = std::string_view(start, size_t(m_p - start));
+            m_p++;
+            return true;
+        }
+
+        bool ParseValue(std::string_view key, int depth) {
+            SkipSpace();
+            if (m_p >= m_end || depth > 128)
+                return false;
+
+            const uint32_t index = uint32_t(m_values.size());
+            m_values.emplace_back();
+            m_values[index].key = key;
+
+            const char c = *m_p;
+            if (c == '{' || c == '[') {
+                const bool object = c == '{';
+                m_values[index].type = object ? JsonType::Object : JsonType::Array;
+                m_p++;
+                SkipSpace();
+                if (m_p < m_end && *m_p == (object ? '}' : ']')) {
+                    m_p++;
+                } else {
+                    for (;;) {
+                        std::string_view memberKey;
+                        if (object) {
+                            SkipSpace();
+                            if (!ParseString(memberKey))
+                                return false;
+                            SkipSpace();
+                            if (m_p >= m_end || *m_p++ != ':')
+                                return false;
+                        }
+                        if (!ParseValue(memberKey, depth + 1))
+                            return false;
+                        SkipSpace();
+                        if (m_p >= m_end)
+                            return false;
+                        if (*m_p == ',') {
+                            m_p++;
+                            continue;
+                        }
+                        if (*m_p++ != (object ? '}' : ']'))
+                            return false;
+                        break;
+                    }
+                }
+            } else if (c == '"') {
+                m_values[index].type = JsonType::String;
+                if (!ParseString(m_values[index].text))
+                    return false;
+            } else if (c == 't' || c == 'f' || c == 'n') {
+                const std::string_view word = c == 't' ? "true" : c == 'f' ? "false" : "null";
+                if (size_t(m_end - m_p) < word.size() ||
+                    std::string_view(m_p, word.size()) != word)
+                    return false;
+                m_values[index].type = c == 'n' ? JsonType::Null : JsonType::Bool;
+                m_values[index].number = c == 't' ? 1.0 : 0.0;
+                m_p += word.size();
+            } else {
+                // strtod needs a terminator, numbers are short.
+                char buffer[64];
+                size_t n = 0;
+                while (m_p + n < m_end && n + 1 < sizeof(buffer) &&
+                       std::strchr("+-0123456789.eE", m_p[n]))
+                    n++;
+                if (n == 0)
+                    return false;
+                std::memcpy(buffer, m_p, n);
+                buffer[n] = 0;
+                m_values[index].type = JsonType::Number;
+                m_values[index].number = std::strtod(buffer, nullptr);
+                m_p += n;
+            }
+
+            m_values[index].end = uint32_t(m_values.size());
+            return true;
+        }
+
+        static std::string Unescape(std::string_view s) {
+            std::string out;
+            out.reserve(s.size());
+            for (size_t i = 0; i < s.size(); i++) {
+                if (s[i] != '\\' || i + 1 == s.size()) {
+                    out.push_back(s[i]);
+                    continue;
+                }
+                const char e = s[++i];
+                switch (e) {
+                case 'n':
+                    out.push_back('\n');
+                    break;
+                case 't':
+                    out.push_back('\t');
+                    break;
+                case 'r':
+                    out.push_back('\r');
+                    break;
+                case 'b':
+                    out.push_back('\b');
+                    break;
+                case 'f':
+                    out.push_back('\f');
+                    break;
+                case 'u': {
+                    // Names and URIs only, so code points are written as
+                    // UTF-8 without pairing surrogates.
+                    if (i + 4 >= s.size())
+                        break;
+                    const unsigned cp =
+                        unsigned(std::strtoul(std::string(s.substr(i + 1, 4)).c_str(),
+                                              nullptr, 16));
+                    i += 4;
+                    if (cp < 0x80) {
+                        out.push_back(char(cp));
+                    } else if (cp < 0x800) {
+                        out.push_back(char(0xc0 | (cp >> 6)));
+                        out.push_back(char(0x80 | (cp & 0x3f)));
+                    } else {
+                        out.push_back(char(0xe0 | (cp >> 12)));
+                        out.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+                        out.push_back(char(0x80 | (cp & 0x3f)));
+                    }
+                    break;
+                }
+                default: // " \ /
+                    out.push_back(e);
+                }
+            }
+            return out;
+        }
+
+        const char *m_p = nullptr;
+        const char *m_end = nullptr;
+        std::vector<JsonValue> m_values;
+    };
+
+    struct Span {
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+    };
+
+    // An accessor as a strided view into its buffer.
+    struct Accessor {
+        const uint8_t *data = nullptr;
+        size_t count = 0;
+        size_t stride = 0;
+        int componentType = 0;
+        int components = 0;
+        bool normalized = false;
+
+        float Float(size_t i, int c) const {
+            const uint8_t *p = data + i * stride;
+            switch (componentType) {
+            case 5126: {
+                float v;
+                std::memcpy(&v, p + c * 4, 4);
+                return v;
+            }
+            case 5121:
+                return normalized ? p[c] / 255.0f : float(p[c]);
+            case 5120: {
+                const float v = float(int8_t(p[c]));
+                return normalized ? (std::max)(v / 127.0f, -1.0f) : v;
+            }
+            case 5123: {
+                uint16_t v;
+                std::memcpy(&v, p + c * 2, 2);
+                return normalized ? v / 65535.0f : float(v);
+            }
+            case 5122: {
+                int16_t v;
+                std::memcpy(&v, p + c * 2, 2);
+                return normalized ? (std::max)(v / 32767.0f, -1.0f) : float(v);
+            }
+            case 5125: {
+                uint32_t v;
+                std::memcpy(&v, p + c * 4, 4);
+                return float(v);
+            }
+            }
+            return 0.0f;
+        }
+
+        uint32_t Index(size_t i) const {
+            const uint8_t *p = data + i * stride;
+            if (componentType == 5121)
+                return p[0];
+            if (componentType == 5123) {
+                uint16_t v;
+                std::memcpy(&v, p, 2);
+                return v;
+            }
+            uint32_t v;
+            std::memcpy(&v, p, 4);
+            return v;
+        }
+    };
+
+    int ComponentSize(int componentType) {
+        switch (componentType) {
+        case 5120:
+        case 5121:
+            return 1;
+        case 5122:
+        case 5123:
+            return 2;
+        case 5125:
+        case 5126:
+            return 4;
+        }
+        return 0;
+    }
+
+    int ComponentCount(std::string_view type) {
+        if (type == "SCALAR")
+            return 1;
+        if (type == "VEC2")
+            return 2;
+        if (type == "VEC3")
+            return 3;
+        if (type == "VEC4")
+            return 4;
+        if (type == "MAT4")
+            return 16;
+        return 0;
+    }
+
+    bool DecodeBase64(std::string_view in, std::vector<uint8_t> &out) {
+        auto value = [](char c) -> int {
+            if (c >= 'A' && c <= 'Z')
+                return c - 'A';
+            if (c >= 'a' && c <= 'z')
+                return c - 'a' + 26;
+            if (c >= '0' && c <= '9')
+                return c - '0' + 52;
+            if (c == '+' || c == '-')
+                return 62;
+            if (c == '/' || c == '_')
+                return 63;
+            return -1;
+        };
+        out.clear();
+        out.reserve(in.size() / 4 * 3);
+        uint32_t bits = 0;
+        int count = 0;
+        for (char c : in) {
+            if (c == '=')
+                break;
+            const int v = value(c);
+            if (v < 0)
+                return false;
+            bits = (bits << 6) | uint32_t(v);
+            if (++count == 4) {
+                out.push_back(uint8_t(bits >> 16));
+                out.push_back(uint8_t(bits >> 8));
+                out.push_back(uint8_t(bits));
+                bits = 0;
+                count = 0;
+            }
+        }
+        if (count == 2) {
+            out.push_back(uint8_t(bits >> 4));
+        } else if (count == 3) {
+            out.push_back(uint8_t(bits >> 10));
+            out.push_back(uint8_t(bits >> 2));
+        }
+        return count != 1;
+    }
+
+    std::string DecodeUri(const std::string &uri) {
+        std::string out;
+        for (size_t i = 0; i < uri.size(); i++) {
+            if (uri[i] == '%' && i + 2 < uri.size()) {
+                out.push_back(char(std::strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16)));
+                i += 2;
+            } else {
+                out.push_back(uri[i]);
+            }
+        }
+        return out;
+    }
+
+    // Bytes of a "data:...;base64," URI.
+    bool DecodeDataUri(const std::string &uri, std::vector<uint8_t> &out) {
+        const size_t comma = uri.find(',');
+        if (uri.compare(0, 5, "data:") != 0 || comma == std::string::npos ||
+            uri.rfind(";base64", comma) == std::string::npos)
+            return false;
+        return DecodeBase64(std::string_view(uri).substr(comma + 1), out);
+    }
+
+    struct Primitive {
+        Matrix world;
+        uint32_t value; // JSON primitive object
+        int material;
+    };
+
+    enum class Slot { BaseColor, Normal, Orm };
+
+    struct ImageJob {
+        uint32_t image;
+        bool roughnessToRed;
+        std::shared_ptr<ImageData> result;
+    };
+
+    class Reader {
+      public:
+        bool Load(const std::string &filename, GltfLoader &out);
+
+      private:
+        bool OpenBuffers();
+        bool ReadAccessor(uint32_t index, Accessor &out) const;
+        Span ImageBytes(uint32_t image, std::vector<uint8_t> &storage) const;
+        void VisitNode(uint32_t node, const Matrix &parent, int depth);
+        bool BuildPrimitive(const Primitive &primitive, MeshData &mesh) const;
+        void ResolveTextures(std::vector<MeshData> &meshes);
+
+        Json m_json;
+        std::filesystem::path m_directory;
+        MappedIOSystem m_io;
+        std::vector<std::unique_ptr<Assimp::IOStream>> m_streams;
+        Span m_binChunk;
+
+        std::vector<Span> m_buffers;
+        std::vector<std::vector<uint8_t>> m_decodedBuffers;
+        std::vector<uint32_t> m_bufferViews, m_accessors, m_meshes, m_nodes;
+        std::vector<uint32_t> m_materials, m_textures, m_images;
+        std::vector<Primitive> m_primitives;
+        bool m_supported = true;
+    };
+
+    bool Reader::OpenBuffers() {
+        const std::vector<uint32_t> buffers = m_json.Elements(m_json.Member(0, "buffers"));
+        m_buffers.resize(buffers.size());
+        m_decodedBuffers.resize(buffers.size());
+        for (size_t i = 0; i < buffers.size(); i++) {
+            const std::string uri = m_json.String(buffers[i], "uri");
+            const size_t length = size_t(m_json.Int(buffers[i], "byteLength", 0));
+            Span span;
+            if (uri.empty()) {
+                // GLB-stored buffer, only valid as the first one.
+                if (i != 0 || !m_binChunk.data)
+                    return false;
+                span = m_binChunk;
+            } else if (uri.compare(0, 5, "data:") == 0) {
+                if (!DecodeDataUri(uri, m_decodedBuffers[i]))
+                    return false;
+                span = {m_decodedBuffers[i].data(), m_decodedBuffers[i].size()};
+            } else {
+                const std::string path = (m_directory / DecodeUri(uri)).string();
+                std::unique_ptr<Assimp::IOStream> stream(m_io.Open(path.c_str(), "rb"));
+                if (!stream)
+                    return false;
+                span = {static_cast<MappedIOStream *>(stream.get())->Data(),
+                        stream->FileSize()};
+                m_streams.push_back(std::move(stream));
+            }
+            if (span.size < length)
+                return false;
+            m_buffers[i] = {span.data, length};
+        }
+        return true;
+    }
+
+    bool Reader::ReadAccessor(uint32_t index, Accessor &out) const {
+        if (index >= m_accessors.size())
+            return false;
+        const uint32_t accessor = m_accessors[index];
+        if (m_json.Member(accessor, "sparse") != kNone)
+            return false;
+
+        out.componentType = int(m_json.Int(accessor, "componentType", 0));
+        out.components =
+            ComponentCount(m_json[m_json.Member(accessor, "type")].text);
+        out.count = size_t(m_json.Int(accessor, "count", 0));
+        out.normalized = m_json.Number(accessor, "normalized", 0.0) != 0.0;
+        const size_t elementSize = size_t(ComponentSize(out.componentType)) * out.components;
+
+        const size_t view = size_t(m_json.Int(accessor, "bufferView", -1));
+        if (elementSize == 0 || view >= m_bufferViews.size())
+            return false;
+
+        const uint32_t viewValue = m_bufferViews[view];
+        const size_t buffer = size_t(m_json.Int(viewValue, "buffer", -1));
+        const size_t viewOffset = size_t(m_json.Int(viewValue, "byteOffset", 0));
+        const size_t viewLength = size_t(m_json.Int(viewValue, "byteLength", 0));
+        const size_t offset = size_t(m_json.Int(accessor, "byteOffset", 0));
+        out.stride = size_t(m_json.Int(viewValue, "byteStride", 0));
+        if (out.stride == 0)
+            out.stride = elementSize;
+
+        // Every size is from the file, so compare without overflowing.
+        if (buffer >= m_buffers.size() || viewOffset > m_buffers[buffer].size ||
+            viewLength > m_buffers[buffer].size - viewOffset)
+            return false;
+        if (offset > viewLength)
+            return false;
+        if (out.count > 0 &&
+            (elementSize > viewLength - offset ||
+             out.count > (viewLength - offset - elementSize) / out.stride + 1))
+            return false;
+
+        out.data = m_buffers[buffer].data + viewOffset + offset;
+        return true;
+    }
+
+    Span Reader::ImageBytes(uint32_t image, std::vector<uint8_t> &storage) const {
+        const std::string uri = m_json.String(image, "uri");
+        if (!uri.empty()) {
+            if (DecodeDataUri(uri, storage))
+                return {storage.data(), storage.size()};
+            return Span();
+        }
+        const size_t view = size_t(m_json.Int(image, "bufferView", -1));
+        if (view >= m_bufferViews.size())
+            return Span();
+        const uint32_t viewValue = m_bufferViews[view];
+        const size_t buffer = size_t(m_json.Int(viewValue, "buffer", -1));
+        const size_t offset = size_t(m_json.Int(viewValue, "byteOffset", 0));
+        const size_t length = size_t(m_json.Int(viewValue, "byteLength", 0));
+        if (buffer >= m_buffers.size() || offset + length > m_buffers[buffer].size)
+            return Span();
+        return {m_buffers[buffer].data + offset, length};
+    }
+
+    Matrix LocalTransform(const Json &json, uint32_t node) {
+        float m[16];
+        if (json.Numbers(node, "matrix", m, 16) == 16) {
+            // Column-major column-vector storage reads as the row-vector
+            // matrix.
+            Matrix out;
+            std::memcpy(&out._11, m, sizeof(m));
+            return out;
+        }
+
+        float t[3] = {0.0f, 0.0f, 0.0f};
+        float r[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        float s[3] = {1.0f, 1.0f, 1.0f};
+        json.Numbers(node, "translation", t, 3);
+        json.Numbers(node, "rotation", r, 4);
+        json.Numbers(node, "scale", s, 3);
+        return Matrix::CreateScale(Vector3(s[0], s[1], s[2])) *
+               Matrix::CreateFromQuaternion(Quaternion(r[0], r[1], r[2], r[3])) *
+               Matrix::CreateTranslation(Vector3(t[0], t[1], t[2]));
+    }
+
+    void Reader::VisitNode(uint32_t index, const Matrix &parent, int depth) {
+        if (index >= m_nodes.size() || depth > 256)
+            return;
+        const uint32_t node = m_nodes[index];
+        if (m_json.Member(node, "skin") != kNone)
+            m_supported = false;
+
+        const Matrix world = LocalTransform(m_json, node) * parent;
+
+        const size_t mesh = size_t(m_json.Int(node, "mesh", -1));
+        if (mesh < m_meshes.size()) {
+            for (uint32_t primitive :
+                 m_json.Elements(m_json.Member(m_meshes[mesh], "primitives"))) {
+                if (m_json.Member(primitive, "targets") != kNone)
+                    m_supported = false;
+                m_primitives.push_back(
+                    {world, primitive, int(m_json.Int(primitive, "material", -1))});
+            }
+        }
+
+        for (uint32_t child : m_json.Elements(m_json.Member(node, "children")))
+            VisitNode(uint32_t(m_json[child].number), world, depth + 1);
+    }
+
+    bool Reader::BuildPrimitive(const Primitive &primitive, MeshData &mesh) const {
+        const int mode = int(m_json.Int(primitive.value, "mode", 4));
+        if (mode != 4 && mode != 5 && mode != 6) {
+            LOG_DEBUG(LogCategory::Loader, "glTF: skipping point/line primitive");
+            return false;
+        }
+
+        const uint32_t attributes = m_json.Member(primitive.value, "attributes");
+        auto attribute = [&](std::string_view name, Accessor &out, int minComponents) {
+            const uint32_t v = m_json.Member(attributes, name);
+            return v != kNone && ReadAccessor(uint32_t(m_json[v].number), out) &&
+                   out.components >= minComponents;
+        };
+
+        Accessor positions, normals, uvs, tangents;
+        if (!attribute("POSITION", positions, 3) || positions.count == 0)
+            return false;
+        const size_t count = positions.count;
+        const bool hasNormals = attribute("NORMAL", normals, 3) && normals.count == count;
+        const bool hasUVs = attribute("TEXCOORD_0", uvs, 2) && uvs.count == count;
+        const bool hasTangents = hasUVs && hasNormals &&
+                                 attribute("TANGENT", tangents, 4) &&
+                                 tangents.count == count;
+        if (!hasUVs)
+            LOG_WARN(LogCategory::Loader, "mesh has NO UV0. materialIndex=%d",
+                     primitive.material);
+
+        // Triangle list in file winding.
+        std::vector<uint32_t> triangles;
+        Accessor indices;
+        const bool indexed = m_json.Member(primitive.value, "indices") != kNone;
+        if (indexed &&
+            (!ReadAccessor(uint32_t(m_json.Int(primitive.value, "indices", -1)), indices) ||
+             indices.components != 1 || indices.componentType == 5126))
+            return false;
+        const size_t corners = indexed ? indices.count : count;
+        auto corner = [&](size_t i) { return indexed ? indices.Index(i) : uint32_t(i); };
+
+        if (mode == 4) {
+            triangles.resize(corners / 3 * 3);
+            if (indexed && indices.componentType == 5125 && indices.stride == 4) {
+                std::memcpy(triangles.data(), indices.data, triangles.size() * 4);
+            } else {
+                for (size_t i = 0; i < triangles.size(); i++)
+                    triangles[i] = corner(i);
+            }
+        } else {
+            triangles.reserve(corners > 2 ? (corners - 2) * 3 : 0);
+            for (size_t i = 2; i < corners; i++) {
+                uint32_t a = mode == 6 ? corner(0) : corner(i - 2);
+                uint32_t b = corner(i - 1);
+                const uint32_t c = corner(i);
+                if (mode == 5 && (i & 1))
+                    std::swap(a, b); // keep strip winding consistent
+                triangles.insert(triangles.end(), {a, b, c});
+            }
+        }
+        for (uint32_t index : triangles) {
+            if (index >= count) {
+                LOG_WARN(LogCategory::Loader, "glTF: index %u out of range", index);
+                return false;
+            }
+        }
+        if (triangles.empty())
+            return false;
+
+        std::vector<Vertex> &vertices = mesh.vertices;
+        vertices.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            Vertex &v = vertices[i];
+            v.position = Vector3(positions.Float(i, 0), positions.Float(i, 1),
+                                 positions.Float(i, 2));
+            if (hasNormals)
+                v.normal =
+                    Vector3(normals.Float(i, 0), normals.Float(i, 1), normals.Float(i, 2));
+            if (hasUVs)
+                v.texcoord = Vector2(uvs.Float(i, 0), uvs.Float(i, 1));
+            if (hasTangents) {
+                v.tangent = Vector3(tangents.Float(i, 0), tangents.Float(i, 1),
+                                    tangents.Float(i, 2));
+                v.bitangent = v.normal.Cross(v.tangent) * tangents.Float(i, 3);
+            }
+        }
+
+        // GenSmoothNormals for primitives without NORMAL.
+        if (!hasNormals) {
+            for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+                Vertex &a = vertices[triangles[i]];
+                Vertex &b = vertices[triangles[i + 1]];
+                Vertex &c = vertices[triangles[i + 2]];
+                Vector3 n = (b.position - a.position).Cross(c.position - a.position);
+                n.Normalize();
+                a.normal += n;
+                b.normal += n;
+                c.normal += n;
+            }
+            for (auto &v : vertices)
+                v.normal.Normalize();
+        }
+
+        // MakeLeftHanded and FlipWindingOrder, which Assimp runs before
+        // CalcTangentSpace. glTF UVs already start at the top left, where
+        // Assimp's flip on import followed by FlipUVs ends up.
+        for (auto &v : vertices) {
+            v.position.z = -v.position.z;
+            v.normal.z = -v.normal.z;
+            v.tangent.z = -v.tangent.z;
+            v.bitangent.z = -v.bitangent.z;
+        }
+
+        mesh.indices.resize(triangles.size());
+        for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+            mesh.indices[i] = triangles[i + 2];
+            mesh.indices[i + 1] = triangles[i + 1];
+            mesh.indices[i + 2] = triangles[i];
+        }
+
+        if (hasUVs && !hasTangents)
+            ComputeTangents(mesh);
+
+        // Positions only, as in ModelLoader::ProcessNode.
+        const Matrix mirror = Matrix::CreateScale(Vector3(1.0f, 1.0f, -1.0f));
+        const Matrix transform = mirror * primitive.world * mirror;
+        for (auto &v : vertices) {
+            v.position = Vector3::Transform(v.position, transform);
+            if (!hasUVs) {
+                v.tangent = Vector3(1.0f, 0.0f, 0.0f);
+                v.bitangent = Vector3(0.0f, 1.0f, 0.0f);
+            }
+        }
+        return true;
+    }
+
+    // Fills the texture slots of every mesh, decoding the images that have
+    // to be in memory once each and in parallel.
+    void Reader::ResolveTextures(std::vector<MeshData> &meshes) {
+        auto imageOf = [&](uint32_t textureInfo) -> uint32_t {
+            const size_t texture = size_t(m_json.Int(textureInfo, "index", -1));
+            if (textureInfo == kNone || texture >= m_textures.size() ||
+                m_json.Int(textureInfo, "texCoord", 0) != 0)
+                return kNone;
+            const size_t image = size_t(m_json.Int(m_textures[texture], "source", -1));
+            return image < m_images.size() ? uint32_t(image) : kNone;
+        };
+
+        std::vector<ImageJob> jobs;
+        std::map<std::pair<uint32_t, bool>, size_t> jobIndex;
+        struct Assignment {
+            size_t mesh;
+            Slot slot;
+            size_t job;
+        };
+        std::vector<Assignment> assignments;
+
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const int material = m_primitives[m].material;
+            if (material < 0 || size_t(material) >= m_materials.size())
+                continue;
+            const uint32_t value = m_materials[material];
+            const uint32_t pbr = m_json.Member(value, "pbrMetallicRoughness");
+            const std::pair<Slot, uint32_t> slots[] = {
+                {Slot::BaseColor, imageOf(m_json.Member(pbr, "baseColorTexture"))},
+                {Slot::Normal, imageOf(m_json.Member(value, "normalTexture"))},
+                {Slot::Orm, imageOf(m_json.Member(pbr, "metallicRoughnessTexture"))}};
+
+            for (const auto &[slot, image] : slots) {
+                if (image == kNone)
+                    continue;
+                const std::string uri = m_json.String(m_images[image], "uri");
+                const bool external = !uri.empty() && uri.compare(0, 5, "data:") != 0;
+
+                // BasicPixelShader reads roughness from red, glTF stores it
+                // in green, so that map is always decoded and swizzled.
+                if (external && slot != Slot::Orm) {
+                    const std::string path = (m_directory / DecodeUri(uri)).string();
+                    (slot == Slot::BaseColor ? meshes[m].baseColorFilename
+                                             : meshes[m].normalFilename) = path;
+                    continue;
+                }
+
+                const bool swizzle = slot == Slot::Orm;
+                auto [it, added] = jobIndex.try_emplace({image, swizzle}, jobs.size());
+                if (added)
+                    jobs.push_back({image, swizzle, nullptr});
+                assignments.push_back({m, slot, it->second});
+            }
+        }
+
+        ParallelFor(jobs.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                ImageJob &job = jobs[i];
+                const uint32_t image = m_images[job.image];
+                auto decoded = std::make_shared<ImageData>();
+
+                std::vector<uint8_t> storage;
+                const std::string uri = m_json.String(image, "uri");
+                bool ok;
+                if (!uri.empty() && uri.compare(0, 5, "data:") != 0) {
+                    ok = LoadImageRGBA((m_directory / DecodeUri(uri)).string(), *decoded);
+                } else {
+                    const Span bytes = ImageBytes(image, storage);
+                    ok = bytes.data &&
+                         LoadImageRGBAFromMemory(bytes.data, bytes.size, *decoded);
+                }
+                if (!ok)
+                    continue;
+
+                if (job.roughnessToRed) {
+                    for (size_t p = 0; p < decoded->pixels.size(); p += 4)
+                        decoded->pixels[p] = decoded->pixels[p + 1];
+                }
+                job.result = std::move(decoded);
+            }
+        });
+
+        for (const auto &a : assignments) {
+            const auto &image = jobs[a.job].result;
+            if (!image)
+                continue;
+            MeshData &mesh = meshes[a.mesh];
+            (a.slot == Slot::BaseColor ? mesh.baseColorImage
+             : a.slot == Slot::Normal  ? mesh.normalImage
+                                       : mesh.ormImage) = image;
+        }
+    }
+
+    bool Reader::Load(const std::string &filename, GltfLoader &out) {
+        std::unique_ptr<Assimp::IOStream> stream(m_io.Open(filename.c_str(), "rb"));
+        if (!stream)
+            return false;
+        const uint8_t *data = static_cast<MappedIOStream *>(stream.get())->Data();
+        const size_t size = stream->FileSize();
+        m_streams.push_back(std::move(stream));
+        m_directory = std::filesystem::path(filename).parent_path();
+        if (!data)
+            return false;
+
+        // GLB: header, JSON chunk, optional BIN chunk.
+        const char *jsonText = reinterpret_cast<const char *>(data);
+        size_t jsonSize = size;
+        uint32_t header[3] = {0, 0, 0};
+        if (size >= 12)
+            std::memcpy(header, data, 12);
+        if (header[0] == 0x46546C67) { // "glTF"
+            if (header[1] != 2 || header[2] > size)
+                return false;
+            size_t offset = 12;
+            jsonText = nullptr;
+            while (offset + 8 <= header[2]) {
+                uint32_t chunk[2];
+                std::memcpy(chunk, data + offset, 8);
+                offset += 8;
+                if (offset + chunk[0] > header[2])
+                    return false;
+                if (chunk[1] == 0x4E4F534A && !jsonText) {
+                    jsonText = reinterpret_cast<const char *>(data + offset);
+                    jsonSize = chunk[0];
+                } else if (chunk[1] == 0x004E4942 && !m_binChunk.data) {
+                    m_binChunk = {data + offset, chunk[0]};
+                }
+                offset += (size_t(chunk[0]) + 3) & ~size_t(3);
+            }
+            if (!jsonText)
+                return false;
+        }
+
+        // Trailing padding in the JSON chunk is spaces.
+        if (!m_json.Parse(jsonText, jsonSize) || m_json[0].type != JsonType::Object)
+            return false;
+
+        const uint32_t asset = m_json.Member(0, "asset");
+        if (m_json.String(asset, "version").compare(0, 1, "2") != 0)
+            return false;
+
+        for (uint32_t e : m_json.Elements(m_json.Member(0, "extensionsRequired"))) {
+            const std::string_view name = m_json[e].text;
+            if (name != "KHR_mesh_quantization") {
+                LOG_DEBUG(LogCategory::Loader, "glTF fast path: %.*s required, "
+                                               "using Assimp for %s",
+                          int(name.size()), name.data(), filename.c_str());
+                return false;
+            }
+        }
+
+        m_bufferViews = m_json.Elements(m_json.Member(0, "bufferViews"));
+        m_accessors = m_json.Elements(m_json.Member(0, "accessors"));
+        m_meshes = m_json.Elements(m_json.Member(0, "meshes"));
+        m_nodes = m_json.Elements(m_json.Member(0, "nodes"));
+        m_materials = m_json.Elements(m_json.Member(0, "materials"));
+        m_textures = m_json.Elements(m_json.Member(0, "textures"));
+        m_images = m_json.Elements(m_json.Member(0, "images"));
+        if (!m_json.Elements(m_json.Member(0, "animations")).empty())
+            m_supported = false;
+        if (!OpenBuffers())
+            return false;
+
+        // The default scene, or every root node without one.
+        std::vector<uint32_t> roots;
+        const std::vector<uint32_t> scenes = m_json.Elements(m_json.Member(0, "scenes"));
+        const size_t scene = size_t(m_json.Int(0, "scene", 0));
+        if (scene < scenes.size()) {
+            for (uint32_t v : m_json.Elements(m_json.Member(scenes[scene], "nodes")))
+                roots.push_back(uint32_t(m_json[v].number));
+        } else {
+            std::vector<bool> isChild(m_nodes.size(), false);
+            for (uint32_t node : m_nodes) {
+                for (uint32_t v : m_json.Elements(m_json.Member(node, "children"))) {
+                    if (size_t(m_json[v].number) < isChild.size())
+                        isChild[size_t(m_json[v].number)] = true;
+                }
+            }
+            for (uint32_t i = 0; i < m_nodes.size(); i++) {
+                if (!isChild[i])
+                    roots.push_back(i);
+            }
+        }
+        for (uint32_t root : roots)
+            VisitNode(root, Matrix(), 0);
+
+        if (!m_supported) {
+            LOG_DEBUG(LogCategory::Loader, "glTF fast path: skins, morph targets "
+                                           "or animations, using Assimp for %s",
+                      filename.c_str());
+            return false;
+        }
+
+        std::vector<MeshData> meshes(m_primitives.size());
+        std::vector<char> built(m_primitives.size(), 0);
+        ParallelFor(m_primitives.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                built[i] = BuildPrimitive(m_primitives[i], meshes[i]);
+        });
+        ResolveTextures(meshes);
+
+        for (uint32_t material : m_materials)
+            out.materialNames.push_back(m_json.String(material, "name"));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            if (!built[i])
+                continue;
+            const int material = m_primitives[i].material;
+            out.meshes.push_back(std::move(meshes[i]));
+            out.meshMaterials.push_back(
+                material >= 0 && size_t(material) < m_materials.size() ? material : -1);
+        }
+        return true;
+    }
+	}
+
+    bool GltfLoader::Load(const std::string &filename) {
+        meshes.clear();
+        meshMaterials.clear();
+        materialNames.clear();
+
+        Reader reader;
+        if (reader.Load(filename, *this))
+            return true;
+
+        meshes.clear();
+        meshMaterials.clear();
+        materialNames.clear();
+        return false;
+    }
+}
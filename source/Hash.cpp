@@ -0,0 +1,155 @@
+#include "Hash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace hlab {
+
+	namespace {
+
+    const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+    const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+    const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+    inline uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    inline uint64_t Read64(const uint8_t *p) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    }
+
+    inline uint32_t Read32(const uint8_t *p) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+    inline uint64_t Round(uint64_t acc, uint64_t input) {
+        acc += input * kPrime2;
+        acc = Rotl(acc, 31);
+        return acc * kPrime1;
+    }
+
+    inline uint64_t MergeRound(uint64_t acc, uint64_t value) {
+        acc ^= Round(0, value);
+        return acc * kPrime1 + kPrime4;
+    }
+    }
+
+    Hasher64::Hasher64(uint64_t seed) : m_seed(seed) {
+        m_acc[0] = seed + kPrime1 + kPrime2;
+        m_acc[1] = seed + kPrime2;
+        m_acc[2] = seed;
+        m_acc[3] = seed - kPrime1;
+    }
+
+    void Hasher64::Update(const void *data, size_t size) {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        m_total += size;
+
+        if (m_buffered + size < 32) {
+            std::memcpy(m_buffer + m_buffered, p, size);
+            m_buffered += size;
+            return;
+        }
+
+        if (m_buffered > 0) {
+            const size_t fill = 32 - m_buffered;
+            std::memcpy(m_buffer + m_buffered, p, fill);
+            for (int i = 0; i < 4; i++)
+                m_acc[i] = Round(m_acc[i], Read64(m_buffer + i * 8));
+            p += fill;
+            size -= fill;
+            m_buffered = 0;
+        }
+
+        // Four independent lanes keep the multipliers busy in parallel.
+        uint64_t a0 = m_acc[0], a1 = m_acc[1], a2 = m_acc[2], a3 = m_acc[3];
+        while (size >= 32) {
+            a0 = Round(a0, Read64(p));
+            a1 = Round(a1, Read64(p + 8));
+            a2 = Round(a2, Read64(p + 16));
+            a3 = Round(a3, Read64(p + 24));
+            p += 32;
+            size -= 32;
+        }
+        m_acc[0] = a0, m_acc[1] = a1, m_acc[2] = a2, m_acc[3] = a3;
+
+        std::memcpy(m_buffer, p, size);
+        m_buffered = size;
+    }
+
+    uint64_t Hasher64::Digest() const {
+        uint64_t h;
+        if (m_total >= 32) {
+            h = Rotl(m_acc[0], 1) + Rotl(m_acc[1], 7) + Rotl(m_acc[2], 12) +
+                Rotl(m_acc[3], 18);
+            for (int i = 0; i < 4; i++)
+                h = MergeRound(h, m_acc[i]);
+        } else {
+            h = m_seed + kPrime5;
+        }
+        h += m_total;
+
+        const uint8_t *p = m_buffer;
+        size_t size = m_buffered;
+        while (size >= 8) {
+            h ^= Round(0, Read64(p));
+            h = Rotl(h, 27) * kPrime1 + kPrime4;
+            p += 8;
+            size -= 8;
+        }
+        if (size >= 4) {
+            h ^= uint64_t(Read32(p)) * kPrime1;
+            h = Rotl(h, 23) * kPrime2 + kPrime3;
+            p += 4;
+            size -= 4;
+        }
+        while (size > 0) {
+            h ^= (*p) * kPrime5;
+            h = Rotl(h, 11) * kPrime1;
+            p++;
+            size--;
+        }
+
+        h ^= h >> 33;
+        h *= kPrime2;
+        h ^= h >> 29;
+        h *= kPrime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    uint64_t HashBytes(const void *data, size_t size, uint64_t seed) {
+        Hasher64 hasher(seed);
+        hasher.Update(data, size);
+        return hasher.Digest();
+    }
+
+    bool HashFile(const std::string &filename, uint64_t &hash) {
+        FILE *file = fopen(filename.c_str(), "rb");
+        if (!file)
+            return false;
+
+        Hasher64 hasher;
+        std::vector<uint8_t> buffer(1 << 20);
+        size_t read;
+        while ((read = fread(buffer.data(), 1, buffer.size(), file)) > 0)
+            hasher.Update(buffer.data(), read);
+        const bool ok = !ferror(file);
+        fclose(file);
+
+        hash = hasher.Digest();
+        return ok;
+    }
+
+    std::string HashToString(uint64_t hash) {
+        char text[17];
+        snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+        return text;
+    }
+}
@@ -0,0 +1,147 @@
+#include "Image.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "Logger.h"
+
+namespace hlab {
+
+	static bool CopyDecoded(unsigned char *img, int width, int height,
+                            ImageData &image) {
+        image.width = width;
+        image.height = height;
+        image.pixels.assign(img, img + size_t(width) * height * 4);
+        stbi_image_free(img);
+        return true;
+	}
+
+    bool LoadImageRGBA(const std::string &filename, ImageData &image) {
+        int width = 0, height = 0, channelsInFile = 0;
+        unsigned char *img = stbi_load(filename.c_str(), &width, &height,
+                                       &channelsInFile, 4);
+        if (!img) {
+            LOG_ERROR(LogCategory::Texture, "stbi_load FAIL: %s (%s)",
+                      filename.c_str(), stbi_failure_reason());
+            return false;
+        }
+        return CopyDecoded(img, width, height, image);
+    }
+
+    bool LoadImageRGBAFromMemory(const uint8_t *data, size_t size,
+                                 ImageData &image) {
+        int width = 0, height = 0, channelsInFile = 0;
+        unsigned char *img = stbi_load_from_memory(
+            data, int(size), &width, &height, &channelsInFile, 4);
+        if (!img) {
+            LOG_ERROR(LogCategory::Texture, "stbi_load_from_memory FAIL: %s",
+                      stbi_failure_reason());
+            return false;
+        }
+        return CopyDecoded(img, width, height, image);
+    }
+
+    static uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size) {
+        static uint32_t table[256];
+        static bool initialized = [] {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                table[n] = c;
+            }
+            return true;
+        }();
+        (void)initialized;
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static void PutBigEndian(std::vector<uint8_t> &out, uint32_t v) {
+        out.push_back(uint8_t(v >> 24));
+        out.push_back(uint8_t(v >> 16));
+        out.push_back(uint8_t(v >> 8));
+        out.push_back(uint8_t(v));
+    }
+
+    static void PutChunk(std::vector<uint8_t> &out, const char *type,
+                         const std::vector<uint8_t> &data) {
+        PutBigEndian(out, uint32_t(data.size()));
+        const size_t typeStart = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        PutBigEndian(out, Crc32(0, &out[typeStart], out.size() - typeStart));
+    }
+
+    bool WritePng(const std::string &filename, const ImageData &image) {
+        if (image.width <= 0 || image.height <= 0 ||
+            image.pixels.size() < size_t(image.width) * image.height * 4)
+            return false;
+
+        std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+        std::vector<uint8_t> header;
+        PutBigEndian(header, uint32_t(image.width));
+        PutBigEndian(header, uint32_t(image.height));
+        header.insert(header.end(), {8, 6, 0, 0, 0}); // 8-bit RGBA
+        PutChunk(png, "IHDR", header);
+
+        // Each scanline is prefixed with filter type 0.
+        const size_t stride = size_t(image.width) * 4;
+        std::vector<uint8_t> raw;
+        raw.reserve((stride + 1) * image.height);
+        for (int y = 0; y < image.height; y++) {
+            raw.push_back(0);
+            const uint8_t *row = &image.pixels[y * stride];
+            raw.insert(raw.end(), row, row + stride);
+        }
+
+        std::vector<uint8_t> zlib;
+        zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+        zlib.push_back(0x78);
+        zlib.push_back(0x01);
+        size_t offset = 0;
+        do {
+            const size_t block = std::min<size_t>(65535, raw.size() - offset);
+            const bool last = offset + block == raw.size();
+            zlib.push_back(last ? 1 : 0);
+            zlib.push_back(uint8_t(block));
+            zlib.push_back(uint8_t(block >> 8));
+            zlib.push_back(uint8_t(~block));
+            zlib.push_back(uint8_t(~block >> 8));
+            zlib.insert(zlib.end(), raw.begin() + offset,
+                        raw.begin() + offset + block);
+            offset += block;
+        } while (offset < raw.size());
+
+        // Adler-32, reduced every 5552 bytes as zlib does.
+        uint32_t a = 1, b = 0;
+        for (size_t i = 0; i < raw.size();) {
+            const size_t end = std::min(raw.size(), i + 5552);
+            for (; i < end; i++) {
+                a += raw[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        PutBigEndian(zlib, (b << 16) | a);
+        PutChunk(png, "IDAT", zlib);
+        PutChunk(png, "IEND", {});
+
+        FILE *file = fopen(filename.c_str(), "wb");
+        if (!file) {
+            LOG_ERROR(LogCategory::Texture, "Cannot write %s", filename.c_str());
+            return false;
+        }
+        const bool ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+        fclose(file);
+        return ok;
+    }
+}
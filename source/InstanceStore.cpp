@@ -0,0 +1,196 @@
+#include "InstanceStore.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    const size_t kUpdateGrain = 1024;
+    // A multiple of four, the lanes CullSpheres loads at a time.
+    const size_t kCullBlock = 4096;
+    const float kPaddingRadius = -1e30f;
+	}
+
+    uint32_t InstanceStore::Add(uint32_t mesh, uint32_t material,
+                                const Matrix &transform) {
+        const uint32_t instance = uint32_t(m_meshes.size());
+        m_meshes.push_back(mesh);
+        m_materials.push_back(material);
+        m_transforms.push_back(transform);
+        m_worlds.push_back(transform);
+        m_worldBounds.emplace_back();
+        m_dirty.push_back(0);
+        m_moved.push_back(0);
+
+        // Grow the spheres four lanes at a time, keeping the padding.
+        SphereSoA &s = m_worldSpheres;
+        if (s.x.size() <= instance) {
+            const size_t padded = s.x.size() + 4;
+            s.x.resize(padded, 0.0f);
+            s.y.resize(padded, 0.0f);
+            s.z.resize(padded, 0.0f);
+            s.r.resize(padded, kPaddingRadius);
+        }
+        s.count = instance + 1;
+
+        SetTransform(instance, transform);
+        return instance;
+    }
+
+    void InstanceStore::Remove(uint32_t instance) {
+        const uint32_t last = uint32_t(m_meshes.size() - 1);
+        if (m_dirty[instance])
+            m_dirtyCount--;
+        if (instance != last) {
+            m_meshes[instance] = m_meshes[last];
+            m_materials[instance] = m_materials[last];
+            m_transforms[instance] = m_transforms[last];
+            m_worlds[instance] = m_worlds[last];
+            m_worldBounds[instance] = m_worldBounds[last];
+            m_dirty[instance] = m_dirty[last];
+            m_moved[instance] = m_moved[last];
+
+            SphereSoA &s = m_worldSpheres;
+            s.x[instance] = s.x[last];
+            s.y[instance] = s.y[last];
+            s.z[instance] = s.z[last];
+            s.r[instance] = s.r[last];
+        }
+        m_meshes.pop_back();
+        m_materials.pop_back();
+        m_transforms.pop_back();
+        m_worlds.pop_back();
+        m_worldBounds.pop_back();
+        m_dirty.pop_back();
+        m_moved.pop_back();
+        m_worldSpheres.r[last] = kPaddingRadius;
+        m_worldSpheres.count = last;
+    }
+
+    void InstanceStore::Clear() {
+        m_meshes.clear();
+        m_materials.clear();
+        m_transforms.clear();
+        m_worlds.clear();
+        m_worldBounds.clear();
+        m_dirty.clear();
+        m_moved.clear();
+        m_worldSpheres.Resize(0);
+        m_dirtyCount = 0;
+        m_allDirty = false;
+    }
+
+    void InstanceStore::Reserve(size_t count) {
+        m_meshes.reserve(count);
+        m_materials.reserve(count);
+        m_transforms.reserve(count);
+        m_worlds.reserve(count);
+        m_worldBounds.reserve(count);
+        m_dirty.reserve(count);
+        m_moved.reserve(count);
+        const size_t padded = (count + 3) & ~size_t(3);
+        m_worldSpheres.x.reserve(padded);
+        m_worldSpheres.y.reserve(padded);
+        m_worldSpheres.z.reserve(padded);
+        m_worldSpheres.r.reserve(padded);
+    }
+
+    void InstanceStore::SetTransform(uint32_t instance, const Matrix &transform) {
+        m_transforms[instance] = transform;
+        if (!m_dirty[instance]) {
+            m_dirty[instance] = 1;
+            m_dirtyCount++;
+        }
+    }
+
+    void InstanceStore::SetRoot(const Matrix &root) {
+        if (root == m_root)
+            return;
+        m_root = root;
+        m_allDirty = true;
+    }
+
+    void InstanceStore::SetMeshBounds(uint32_t mesh, const MeshBounds &bounds) {
+        if (mesh >= m_meshBounds.size()) {
+            m_meshBounds.resize(mesh + 1);
+            m_meshChanged.resize(mesh + 1, 0);
+        }
+        m_meshBounds[mesh] = bounds;
+        m_meshChanged[mesh] = 1;
+        m_anyMeshChanged = true;
+    }
+
+    size_t InstanceStore::Update() {
+        std::fill(m_moved.begin(), m_moved.end(), 0);
+        if (m_dirtyCount == 0 && !m_allDirty && !m_anyMeshChanged)
+            return 0;
+
+        const bool all = m_allDirty;
+        const bool meshes = m_anyMeshChanged;
+        std::atomic<size_t> updated{0};
+        ParallelFor(Count(), kUpdateGrain, [&](size_t begin, size_t end) {
+            size_t count = 0;
+            for (size_t i = begin; i < end; i++) {
+                const uint32_t mesh = m_meshes[i];
+                const bool known = mesh < m_meshBounds.size();
+                if (!all && !m_dirty[i] && !(meshes && known && m_meshChanged[mesh]))
+                    continue;
+
+                m_worlds[i] = m_transforms[i] * m_root;
+                const MeshBounds world =
+                    (known ? m_meshBounds[mesh] : MeshBounds()).Transformed(m_worlds[i]);
+                m_worldBounds[i] = world;
+                m_worldSpheres.Set(i, world.center, world.radius);
+                m_dirty[i] = 0;
+                m_moved[i] = 1;
+                count++;
+            }
+            updated += count;
+        });
+
+        std::fill(m_meshChanged.begin(), m_meshChanged.end(), 0);
+        m_anyMeshChanged = false;
+        m_allDirty = false;
+        m_dirtyCount = 0;
+        return updated;
+    }
+
+    void InstanceStore::Cull(const Frustum &frustum,
+                             std::vector<uint32_t> &visible) const {
+        const size_t lanes = m_worldSpheres.x.size();
+        const size_t blocks = (lanes + kCullBlock - 1) / kCullBlock;
+        m_blockVisible.resize(blocks);
+        ParallelFor(blocks, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++) {
+                m_blockVisible[b].clear();
+                CullSpheres(frustum, m_worldSpheres, b * kCullBlock,
+                            std::min(lanes, (b + 1) * kCullBlock),
+                            m_blockVisible[b]);
+            }
+        });
+
+        // Blocks are in index order, so concatenating them compacts the
+        // list without sorting.
+        size_t total = visible.size();
+        for (size_t b = 0; b < blocks; b++)
+            total += m_blockVisible[b].size();
+        visible.reserve(total);
+        for (size_t b = 0; b < blocks; b++)
+            visible.insert(visible.end(), m_blockVisible[b].begin(),
+                           m_blockVisible[b].end());
+    }
+
+    void InstanceStore::SortForSubmission(std::vector<uint32_t> &visible) const {
+        std::sort(visible.begin(), visible.end(), [&](uint32_t a, uint32_t b) {
+            if (m_materials[a] != m_materials[b])
+                return m_materials[a] < m_materials[b];
+            if (m_meshes[a] != m_meshes[b])
+                return m_meshes[a] < m_meshes[b];
+            return a < b;
+        });
+    }
+}
@@ -0,0 +1,205 @@
+#include "Logger.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+
+namespace hlab {
+
+	static const char *LevelName(LogLevel level) {
+        switch (level) {
+        case LogLevel::Trace:
+            return "Trace";
+        case LogLevel::Debug:
+            return "Debug";
+        case LogLevel::Info:
+            return "Info";
+        case LogLevel::Warning:
+            return "Warning";
+        case LogLevel::Error:
+            return "Error";
+        }
+        return "?";
+	}
+
+    static const char *CategoryName(LogCategory category) {
+        switch (category) {
+        case LogCategory::General:
+            return "General";
+        case LogCategory::Input:
+            return "Input";
+        case LogCategory::Loader:
+            return "Loader";
+        case LogCategory::Texture:
+            return "Texture";
+        case LogCategory::Render:
+            return "Render";
+        default:
+            return "?";
+        }
+    }
+
+    static uint64_t NowSeconds() {
+        return uint64_t(std::chrono::duration_cast<std::chrono::seconds>(
+                            std::chrono::steady_clock::now().time_since_epoch())
+                            .count());
+    }
+
+    Logger &Logger::Get() {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger::Logger() {
+        for (size_t i = 0; i < kCapacity; i++)
+            m_entries[i].sequence.store(i, std::memory_order_relaxed);
+
+        SetRateLimit(LogCategory::Input, 20);
+
+        m_sink = std::thread([this]() { SinkLoop(); });
+    }
+
+    Logger::~Logger() {
+        m_running.store(false, std::memory_order_release);
+        if (m_sink.joinable())
+            m_sink.join();
+    }
+
+    void Logger::SetRateLimit(LogCategory category, uint32_t maxPerSecond) {
+        m_rates[size_t(category)].maxPerSecond.store(
+            maxPerSecond, std::memory_order_relaxed);
+    }
+
+    bool Logger::AcquireRate(LogCategory category) {
+        RateState &rate = m_rates[size_t(category)];
+
+        const uint32_t limit = rate.maxPerSecond.load(std::memory_order_relaxed);
+        if (limit == 0)
+            return true;
+
+        // High 32 bits hold the current second, low 32 bits the count in it.
+        const uint64_t now = NowSeconds() & 0xffffffffull;
+        uint64_t current = rate.window.load(std::memory_order_relaxed);
+        for (;;) {
+            const uint64_t second = current >> 32;
+            const uint64_t count = current & 0xffffffffull;
+
+            uint64_t next;
+            if (second == now) {
+                if (count >= limit) {
+                    rate.suppressed.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                next = current + 1;
+            } else {
+                next = (now << 32) | 1;
+            }
+
+            if (rate.window.compare_exchange_weak(current, next,
+                                                  std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+    void Logger::Write(LogLevel level, LogCategory category,
+                       const char *format, ...) {
+        if (!AcquireRate(category))
+            return;
+
+        // Bounded MPSC ring: producers claim a slot by advancing the
+        // enqueue position, the sink releases it by bumping its sequence.
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        Entry *entry = nullptr;
+        for (;;) {
+            entry = &m_entries[pos & (kCapacity - 1)];
+            const size_t seq = entry->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        entry->level = level;
+        entry->category = category;
+
+        va_list args;
+        va_start(args, format);
+        vsnprintf(entry->text, kMaxMessage, format, args);
+        va_end(args);
+
+        entry->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    bool Logger::Drain() {
+        bool wrote = false;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+        for (;;) {
+            Entry &entry = m_entries[pos & (kCapacity - 1)];
+            const size_t seq = entry.sequence.load(std::memory_order_acquire);
+            if (seq != pos + 1)
+                break;
+
+            FILE *out = entry.level >= LogLevel::Warning ? stderr : stdout;
+            fprintf(out, "[%s][%s] %s\n", LevelName(entry.level),
+                    CategoryName(entry.category), entry.text);
+
+            entry.sequence.store(pos + kCapacity, std::memory_order_release);
+            pos++;
+            m_dequeuePos.store(pos, std::memory_order_release);
+            wrote = true;
+        }
+
+        for (size_t i = 0; i < size_t(LogCategory::Count); i++) {
+            const uint64_t suppressed =
+                m_rates[i].suppressed.exchange(0, std::memory_order_relaxed);
+            if (suppressed > 0) {
+                fprintf(stdout, "[Info][%s] %llu messages suppressed\n",
+                        CategoryName(LogCategory(i)),
+                        (unsigned long long)suppressed);
+                wrote = true;
+            }
+        }
+
+        if (wrote) {
+            fflush(stdout);
+            fflush(stderr);
+        }
+        return wrote;
+    }
+
+    void Logger::SinkLoop() {
+        while (m_running.load(std::memory_order_acquire)) {
+            bool wrote;
+            {
+                std::lock_guard<std::mutex> lock(m_drainMutex);
+                wrote = Drain();
+            }
+            if (!wrote)
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        std::lock_guard<std::mutex> lock(m_drainMutex);
+        Drain();
+    }
+
+    void Logger::Flush() {
+        // Only waits on producers still formatting a claimed slot.
+        const size_t target = m_enqueuePos.load(std::memory_order_acquire);
+        while (m_dequeuePos.load(std::memory_order_acquire) < target) {
+            {
+                std::lock_guard<std::mutex> lock(m_drainMutex);
+                Drain();
+            }
+            if (m_dequeuePos.load(std::memory_order_acquire) < target)
+                std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,188 @@
+#include "MappedIOSystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "CacheFormats.h"
+#include "Logger.h"
+
+namespace hlab {
+
+	MappedIOStream::~MappedIOStream() {
+        if (!m_mapped)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(const_cast<uint8_t *>(m_data), m_size);
+#endif
+    }
+
+    bool MappedIOStream::Open(const std::string &filename) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                  nullptr, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size = {};
+        GetFileSizeEx(file, &size);
+        m_size = size_t(size.QuadPart);
+
+        if (m_size > 0) {
+            // The view keeps the mapping alive after both handles close.
+            HANDLE mapping =
+                CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                m_data = static_cast<const uint8_t *>(
+                    MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+            m_mapped = m_data != nullptr;
+        }
+        CloseHandle(file);
+#else
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st = {};
+        fstat(fd, &st);
+        m_size = size_t(st.st_size);
+
+        if (m_size > 0) {
+            void *p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                // Importers read front to back: read ahead aggressively and
+                // drop pages behind the cursor first.
+                madvise(p, m_size, MADV_SEQUENTIAL);
+                m_data = static_cast<const uint8_t *>(p);
+                m_mapped = true;
+            }
+        }
+        close(fd);
+#endif
+
+        // Too large for the address space, or a special file.
+        if (m_size > 0 && !m_mapped) {
+            if (!ReadFileBytes(filename, m_copy))
+                return false;
+            m_data = m_copy.data();
+            m_size = m_copy.size();
+        }
+        return true;
+    }
+
+    size_t MappedIOStream::Read(void *buffer, size_t size, size_t count) {
+        if (size == 0)
+            return 0;
+        // fread semantics: only whole elements are read.
+        const size_t elements = (std::min)(count, (m_size - m_position) / size);
+        std::memcpy(buffer, m_data + m_position, elements * size);
+        m_position += elements * size;
+        return elements;
+    }
+
+    size_t MappedIOStream::Write(const void *, size_t, size_t) { return 0; }
+
+    aiReturn MappedIOStream::Seek(size_t offset, aiOrigin origin) {
+        size_t target;
+        switch (origin) {
+        case aiOrigin_SET:
+            target = offset;
+            break;
+        case aiOrigin_CUR:
+            target = m_position + offset;
+            break;
+        case aiOrigin_END:
+            // Assimp passes the distance back from the end.
+            if (offset > m_size)
+                return aiReturn_FAILURE;
+            target = m_size - offset;
+            break;
+        default:
+            return aiReturn_FAILURE;
+        }
+        if (target > m_size)
+            return aiReturn_FAILURE;
+        m_position = target;
+        return aiReturn_SUCCESS;
+    }
+
+    bool MappedIOSystem::Exists(const char *file) const {
+        std::error_code ec;
+        return std::filesystem::is_regular_file(file, ec);
+    }
+
+    char MappedIOSystem::getOsSeparator() const {
+#ifdef _WIN32
+        return '\\';
+#else
+        return '/';
+#endif
+    }
+
+    Assimp::IOStream *MappedIOSystem::Open(const char *file, const char *mode) {
+        if (std::strchr(mode, 'w') || std::strchr(mode, 'a') ||
+            std::strchr(mode, '+')) {
+            LOG_ERROR(LogCategory::Loader, "MappedIOSystem is read-only: %s (%s)",
+                      file, mode);
+            return nullptr;
+        }
+
+        auto *stream = new MappedIOStream();
+        if (!stream->Open(file)) {
+            delete stream;
+            return nullptr;
+        }
+        return stream;
+    }
+
+    void MappedIOSystem::Close(Assimp::IOStream *file) { delete file; }
+
+    void MappedIOSystem::Prefetch(const std::string &filename) {
+#ifdef _WIN32
+        // The view can go right away, the requested pages still land in
+        // the file cache.
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                  nullptr, OPEN_EXISTING, 0, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+
+        LARGE_INTEGER size = {};
+        GetFileSizeEx(file, &size);
+        HANDLE mapping = size.QuadPart > 0 ? CreateFileMappingA(file, nullptr,
+                                                                PAGE_READONLY, 0,
+                                                                0, nullptr)
+                                           : nullptr;
+        if (mapping) {
+            if (void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) {
+                WIN32_MEMORY_RANGE_ENTRY range = {view, SIZE_T(size.QuadPart)};
+                PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+                UnmapViewOfFile(view);
+            }
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+#elif defined(POSIX_FADV_WILLNEED)
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+#else
+        (void)filename;
+#endif
+    }
+}
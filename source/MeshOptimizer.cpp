@@ -0,0 +1,409 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace hlab {
+
+	namespace {
+
+    const int kCacheSize = 32;
+
+    struct ScoreTable {
+        float cache[kCacheSize + 1];
+        float valence[64];
+
+        ScoreTable() {
+            for (int i = 0; i < kCacheSize; i++) {
+                // The last triangle's vertices get a fixed score so the
+                // strip does not just reuse them.
+                cache[i] = i < 3 ? 0.75f
+                                 : std::pow(1.0f - float(i - 3) /
+                                                       float(kCacheSize - 3),
+                                            1.5f);
+            }
+            cache[kCacheSize] = 0.0f; // not in cache
+            valence[0] = 0.0f;
+            for (int i = 1; i < 64; i++)
+                valence[i] = 2.0f / std::sqrt(float(i));
+        }
+    };
+
+    float VertexScore(const ScoreTable &table, int cachePos, uint32_t remaining) {
+        if (remaining == 0)
+            return -1.0f;
+        return table.cache[cachePos] + table.valence[std::min(remaining, 63u)];
+    }
+    }
+
+    void OptimizeVertexCache(std::vector<uint32_t> &indices,
+                             size_t vertexCount) {
+        const size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0 || vertexCount == 0)
+            return;
+
+        static const ScoreTable table;
+
+        // Vertex to triangle adjacency in CSR form.
+        std::vector<uint32_t> remaining(vertexCount, 0);
+        for (uint32_t v : indices)
+            remaining[v]++;
+        std::vector<uint32_t> offsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] = offsets[v] + remaining[v];
+        std::vector<uint32_t> adjacency(indices.size());
+        {
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t t = 0; t < triangleCount; t++)
+                for (int k = 0; k < 3; k++)
+                    adjacency[fill[indices[t * 3 + k]]++] = uint32_t(t);
+        }
+
+        std::vector<int> cachePos(vertexCount, kCacheSize);
+        std::vector<float> vertexScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+            vertexScore[v] = VertexScore(table, kCacheSize, remaining[v]);
+
+        std::vector<uint8_t> emitted(triangleCount, 0);
+
+        std::vector<uint32_t> output;
+        output.reserve(indices.size());
+
+        uint32_t cache[kCacheSize + 3];
+        int cacheCount = 0;
+        size_t scanCursor = 0;
+        int64_t best = -1;
+
+        for (size_t emittedCount = 0; emittedCount < triangleCount;
+             emittedCount++) {
+            if (best < 0) {
+                // Nothing useful in the cache; take the next unemitted
+                // triangle in input order.
+                while (emitted[scanCursor])
+                    scanCursor++;
+                best = int64_t(scanCursor);
+            }
+
+            const size_t t = size_t(best);
+            emitted[t] = 1;
+
+            uint32_t newCache[kCacheSize + 3];
+            int newCount = 0;
+            for (int k = 0; k < 3; k++) {
+                const uint32_t v = indices[t * 3 + k];
+                output.push_back(v);
+                newCache[newCount++] = v;
+
+                // Drop the triangle from the vertex's adjacency list.
+                uint32_t *begin = &adjacency[offsets[v]];
+                uint32_t *end = begin + remaining[v];
+                *std::find(begin, end, uint32_t(t)) = end[-1];
+                remaining[v]--;
+            }
+            for (int i = 0; i < cacheCount; i++) {
+                const uint32_t v = cache[i];
+                if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+                    newCache[newCount++] = v;
+            }
+            for (int i = kCacheSize; i < newCount; i++)
+                cachePos[newCache[i]] = kCacheSize;
+
+            cacheCount = std::min(newCount, kCacheSize);
+            std::copy(newCache, newCache + cacheCount, cache);
+
+            // Rescore the cached vertices and the triangles they touch.
+            for (int i = 0; i < cacheCount; i++) {
+                const uint32_t v = cache[i];
+                cachePos[v] = i;
+                vertexScore[v] = VertexScore(table, i, remaining[v]);
+            }
+
+            best = -1;
+            float bestScore = -1.0f;
+            for (int i = 0; i < cacheCount; i++) {
+                const uint32_t v = cache[i];
+                for (uint32_t a = 0; a < remaining[v]; a++) {
+                    const uint32_t tri = adjacency[offsets[v] + a];
+                    const float score = vertexScore[indices[tri * 3]] +
+                                        vertexScore[indices[tri * 3 + 1]] +
+                                        vertexScore[indices[tri * 3 + 2]];
+                    if (score > bestScore) {
+                        bestScore = score;
+                        best = int64_t(tri);
+                    }
+                }
+            }
+        }
+
+        indices.swap(output);
+    }
+
+    void OptimizeVertexFetch(MeshData &mesh) {
+        const uint32_t kUnused = 0xffffffffu;
+        std::vector<uint32_t> remap(mesh.vertices.size(), kUnused);
+        std::vector<Vertex> vertices;
+        vertices.reserve(mesh.vertices.size());
+        const bool skinned = !mesh.skin.weights.empty();
+        std::vector<VertexWeights> weights;
+        weights.reserve(skinned ? mesh.vertices.size() : 0);
+
+        for (auto &index : mesh.indices) {
+            if (remap[index] == kUnused) {
+                remap[index] = uint32_t(vertices.size());
+                vertices.push_back(mesh.vertices[index]);
+                if (skinned)
+                    weights.push_back(mesh.skin.weights[index]);
+            }
+            index = remap[index];
+        }
+        mesh.vertices.swap(vertices);
+        if (skinned)
+            mesh.skin.weights.swap(weights);
+
+        for (MorphTarget &target : mesh.morphTargets) {
+            std::vector<std::pair<uint32_t, Vertex>> moved;
+            for (size_t i = 0; i < target.vertices.size(); i++) {
+                const uint32_t v = remap[target.vertices[i]];
+                if (v != kUnused)
+                    moved.push_back({v, target.deltas[i]});
+            }
+            std::sort(moved.begin(), moved.end(),
+                      [](const auto &a, const auto &b) { return a.first < b.first; });
+            target.vertices.clear();
+            target.deltas.clear();
+            for (const auto &m : moved) {
+                target.vertices.push_back(m.first);
+                target.deltas.push_back(m.second);
+            }
+        }
+    }
+
+    float AverageCacheMissRatio(const std::vector<uint32_t> &indices,
+                                size_t vertexCount, int cacheSize) {
+        if (indices.size() < 3)
+            return 0.0f;
+
+        // Timestamps make the FIFO membership test O(1).
+        std::vector<size_t> insertedAt(vertexCount, 0);
+        size_t misses = 0;
+        for (uint32_t v : indices) {
+            if (insertedAt[v] == 0 || misses - insertedAt[v] + 1 > size_t(cacheSize)) {
+                misses++;
+                insertedAt[v] = misses;
+            }
+        }
+        return float(misses) / float(indices.size() / 3);
+    }
+
+    void ComputeTangents(MeshData &mesh) {
+        const std::vector<uint32_t> &triangles = mesh.indices;
+        std::vector<Vector3> tangents(mesh.vertices.size(), Vector3(0.0f));
+        std::vector<Vector3> bitangents(mesh.vertices.size(), Vector3(0.0f));
+
+        for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+            const Vertex &a = mesh.vertices[triangles[i]];
+            const Vertex &b = mesh.vertices[triangles[i + 1]];
+            const Vertex &c = mesh.vertices[triangles[i + 2]];
+
+            const Vector3 v = b.position - a.position;
+            const Vector3 w = c.position - a.position;
+            float sx = b.texcoord.x - a.texcoord.x, sy = b.texcoord.y - a.texcoord.y;
+            float tx = c.texcoord.x - a.texcoord.x, ty = c.texcoord.y - a.texcoord.y;
+            const float direction = (tx * sy - ty * sx) < 0.0f ? -1.0f : 1.0f;
+            if (sx * ty - sy * tx == 0.0f) {
+                sx = 0.0f;
+                sy = 1.0f;
+                tx = 1.0f;
+                ty = 0.0f;
+            }
+            const Vector3 tangent = (w * sy - v * ty) * direction;
+            const Vector3 bitangent = (w * sx - v * tx) * direction;
+
+            for (int k = 0; k < 3; k++) {
+                const uint32_t index = triangles[i + k];
+                const Vector3 &n = mesh.vertices[index].normal;
+                Vector3 t = tangent - n * tangent.Dot(n);
+                Vector3 bt = bitangent - n * bitangent.Dot(n);
+                t.Normalize();
+                bt.Normalize();
+                tangents[index] += t;
+                bitangents[index] += bt;
+            }
+        }
+
+        for (size_t i = 0; i < mesh.vertices.size(); i++) {
+            tangents[i].Normalize();
+            bitangents[i].Normalize();
+            mesh.vertices[i].tangent = tangents[i];
+            mesh.vertices[i].bitangent = bitangents[i];
+        }
+    }
+
+    void BuildMeshlets(MeshData &mesh) {
+        mesh.meshlets.clear();
+        const std::vector<uint32_t> &indices = mesh.indices;
+        const size_t triangleCount = indices.size() / 3;
+        const size_t vertexCount = mesh.vertices.size();
+        if (triangleCount == 0 || vertexCount == 0)
+            return;
+
+        // Vertex to triangle adjacency in CSR form.
+        std::vector<uint32_t> offsets(vertexCount + 1, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            offsets[indices[i] + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+        std::vector<uint32_t> adjacency(triangleCount * 3);
+        {
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t t = 0; t < triangleCount; t++)
+                for (int k = 0; k < 3; k++)
+                    adjacency[fill[indices[t * 3 + k]]++] = uint32_t(t);
+        }
+
+        auto position = [&](size_t t, int k) -> const Vector3 & {
+            return mesh.vertices[indices[t * 3 + k]].position;
+        };
+        auto centroid = [&](size_t t) {
+            return (position(t, 0) + position(t, 1) + position(t, 2)) / 3.0f;
+        };
+
+        // Stamps hold the meshlet that last took the vertex or listed the
+        // triangle as a candidate, so nothing is cleared between meshlets.
+        const uint32_t kNone = 0xffffffffu;
+        std::vector<uint32_t> vertexStamp(vertexCount, kNone);
+        std::vector<uint32_t> candidateStamp(triangleCount, kNone);
+        std::vector<uint8_t> emitted(triangleCount, 0);
+        std::vector<uint32_t> candidates;
+        std::vector<Vector3> normals;
+        std::vector<uint32_t> output;
+        output.reserve(indices.size());
+        size_t scanCursor = 0;
+
+        while (output.size() < indices.size()) {
+            const uint32_t id = uint32_t(mesh.meshlets.size());
+            Meshlet meshlet;
+            meshlet.indexOffset = uint32_t(output.size());
+            Vector3 centroidSum(0.0f);
+            Vector3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+            candidates.clear();
+
+            while (emitted[scanCursor])
+                scanCursor++;
+            int64_t next = int64_t(scanCursor);
+
+            while (next >= 0) {
+                const size_t t = size_t(next);
+                emitted[t] = 1;
+                meshlet.triangleCount++;
+                centroidSum += centroid(t);
+                for (int k = 0; k < 3; k++) {
+                    const uint32_t v = indices[t * 3 + k];
+                    output.push_back(v);
+                    boxMin = Vector3::Min(boxMin, mesh.vertices[v].position);
+                    boxMax = Vector3::Max(boxMax, mesh.vertices[v].position);
+                    if (vertexStamp[v] == id)
+                        continue;
+                    vertexStamp[v] = id;
+                    meshlet.vertexCount++;
+                    for (uint32_t a = offsets[v]; a < offsets[v + 1]; a++) {
+                        const uint32_t tri = adjacency[a];
+                        if (!emitted[tri] && candidateStamp[tri] != id) {
+                            candidateStamp[tri] = id;
+                            candidates.push_back(tri);
+                        }
+                    }
+                }
+                if (meshlet.triangleCount == kMaxMeshletTriangles)
+                    break;
+
+                // Fewest new vertices first, then closest to the centroid.
+                const Vector3 center = centroidSum / float(meshlet.triangleCount);
+                next = -1;
+                uint32_t bestNew = 4;
+                float bestDistance = FLT_MAX;
+                size_t kept = 0;
+                for (uint32_t tri : candidates) {
+                    if (emitted[tri])
+                        continue;
+                    candidates[kept++] = tri;
+                    uint32_t added = 0;
+                    for (int k = 0; k < 3; k++)
+                        added += vertexStamp[indices[tri * 3 + k]] != id;
+                    if (meshlet.vertexCount + added > kMaxMeshletVertices ||
+                        added > bestNew)
+                        continue;
+                    const float distance = Vector3::DistanceSquared(centroid(tri), center);
+                    if (added < bestNew || distance < bestDistance) {
+                        bestNew = added;
+                        bestDistance = distance;
+                        next = int64_t(tri);
+                    }
+                }
+                candidates.resize(kept);
+                if (next >= 0 || !candidates.empty())
+                    continue;
+
+                // The connected piece ran out. Unwelded or split geometry
+                // keeps filling the meshlet with the next triangle in
+                // order as long as it lies close to what is there.
+                while (scanCursor < triangleCount && emitted[scanCursor])
+                    scanCursor++;
+                if (scanCursor == triangleCount ||
+                    meshlet.vertexCount + 3 > kMaxMeshletVertices)
+                    break;
+                const Vector3 half = (boxMax - boxMin) * 0.5f;
+                const Vector3 lo = boxMin - half, hi = boxMax + half;
+                const Vector3 c = centroid(scanCursor);
+                if (c.x >= lo.x && c.y >= lo.y && c.z >= lo.z && c.x <= hi.x &&
+                    c.y <= hi.y && c.z <= hi.z)
+                    next = int64_t(scanCursor);
+            }
+
+            // Bounding sphere around the box center.
+            meshlet.center = (boxMin + boxMax) * 0.5f;
+            float radiusSquared = 0.0f;
+            const size_t end = output.size();
+            for (size_t i = meshlet.indexOffset; i < end; i++)
+                radiusSquared = std::max(
+                    radiusSquared, Vector3::DistanceSquared(
+                                       mesh.vertices[output[i]].position, meshlet.center));
+            meshlet.radius = std::sqrt(radiusSquared);
+
+            // Normal cone from the face normals, which point the same way
+            // as the vertex normals with this winding. Degenerate triangles
+            // face nowhere and are left out.
+            normals.clear();
+            Vector3 axis(0.0f);
+            for (size_t i = meshlet.indexOffset; i < end; i += 3) {
+                const Vector3 &a = mesh.vertices[output[i]].position;
+                const Vector3 &b = mesh.vertices[output[i + 1]].position;
+                const Vector3 &c = mesh.vertices[output[i + 2]].position;
+                Vector3 n = (b - a).Cross(c - a);
+                const float length = n.Length();
+                if (length == 0.0f)
+                    continue;
+                n /= length;
+                normals.push_back(n);
+                axis += n;
+            }
+            const float axisLength = axis.Length();
+            if (axisLength > 0.0f) {
+                axis /= axisLength;
+                float minDot = 1.0f;
+                for (const Vector3 &n : normals)
+                    minDot = std::min(minDot, n.Dot(axis));
+                meshlet.coneAxis = axis;
+                // sin of the cone half-angle, or never culled when the
+                // normals span more than a hemisphere.
+                if (minDot > 0.0f)
+                    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+            }
+
+            mesh.meshlets.push_back(meshlet);
+        }
+
+        mesh.indices.swap(output);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,538 @@
+#include "MeshStreamer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+#include "CacheFormats.h"
+#include "Hash.h"
+#include "Logger.h"
+#include "MeshOptimizer.h"
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    const uint32_t kChunkMagic = 0x4b434c48; // "HLCK"
+    const size_t kHeaderBytes = 32;
+    // Working memory of a chunk being built, per triangle: the spilled
+    // corners, the welded vertices and indices and the weld table.
+    const uint64_t kChunkBytesPerTriangle = 320;
+    const size_t kAddBatchTriangles = size_t(1) << 16;
+
+    void WriteU32(std::ostream &out, uint32_t v) {
+        out.write(reinterpret_cast<const char *>(&v), 4);
+    }
+    void WriteU64(std::ostream &out, uint64_t v) {
+        out.write(reinterpret_cast<const char *>(&v), 8);
+    }
+    void WriteString(std::ostream &out, const std::string &s) {
+        WriteU32(out, uint32_t(s.size()));
+        out.write(s.data(), std::streamsize(s.size()));
+    }
+
+    bool ReadU32(std::istream &in, uint32_t &v) {
+        return bool(in.read(reinterpret_cast<char *>(&v), 4));
+    }
+    bool ReadU64(std::istream &in, uint64_t &v) {
+        return bool(in.read(reinterpret_cast<char *>(&v), 8));
+    }
+    bool ReadString(std::istream &in, std::string &s) {
+        uint32_t size;
+        if (!ReadU32(in, size) || size > (1u << 16))
+            return false;
+        s.resize(size);
+        return bool(in.read(s.data(), size));
+    }
+
+    inline bool IsZero(const Vector3 &v) { return v.x == 0.0f && v.y == 0.0f && v.z == 0.0f; }
+
+    // Welds the corners into mesh and fills in what the source left out.
+    void BuildChunk(const std::vector<StreamCorner> &corners, const MeshPart &part,
+                    MeshData &mesh) {
+        mesh.vertices.clear();
+        mesh.indices.clear();
+        mesh.indices.reserve(corners.size());
+
+        size_t capacity = 16;
+        while (capacity < corners.size() * 2)
+            capacity <<= 1;
+        const size_t mask = capacity - 1;
+        std::vector<uint32_t> table(capacity, 0); // vertex index + 1
+        std::vector<const StreamCorner *> unique;
+        bool missingNormals = false;
+
+        for (const StreamCorner &corner : corners) {
+            for (size_t slot = HashBytes(&corner, sizeof(corner)) & mask;;
+                 slot = (slot + 1) & mask) {
+                const uint32_t entry = table[slot];
+                if (entry == 0) {
+                    unique.push_back(&corner);
+                    table[slot] = uint32_t(unique.size());
+                    mesh.indices.push_back(uint32_t(unique.size() - 1));
+                    missingNormals |= IsZero(corner.normal);
+                    break;
+                }
+                if (std::memcmp(unique[entry - 1], &corner, sizeof(corner)) == 0) {
+                    mesh.indices.push_back(entry - 1);
+                    break;
+                }
+            }
+        }
+
+        mesh.vertices.resize(unique.size());
+        for (size_t i = 0; i < unique.size(); i++) {
+            Vertex &v = mesh.vertices[i];
+            v = Vertex{};
+            v.position = unique[i]->position;
+            v.normal = unique[i]->normal;
+            v.texcoord = unique[i]->texcoord;
+        }
+
+        // Smooth normals shared by every vertex at the same position, like
+        // GenSmoothNormals. Only vertices without a normal take them.
+        if (missingNormals) {
+            std::fill(table.begin(), table.end(), 0);
+            std::vector<uint32_t> group(mesh.vertices.size());
+            std::vector<Vector3> accum;
+            for (size_t i = 0; i < mesh.vertices.size(); i++) {
+                const Vector3 &p = mesh.vertices[i].position;
+                for (size_t slot = HashBytes(&p, sizeof(p)) & mask;; slot = (slot + 1) & mask) {
+                    const uint32_t entry = table[slot];
+                    if (entry == 0) {
+                        accum.push_back(Vector3(0.0f));
+                        table[slot] = uint32_t(i + 1);
+                        group[i] = uint32_t(accum.size() - 1);
+                        break;
+                    }
+                    if (std::memcmp(&mesh.vertices[entry - 1].position, &p, sizeof(p)) == 0) {
+                        group[i] = group[entry - 1];
+                        break;
+                    }
+                }
+            }
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                const uint32_t i0 = mesh.indices[i], i1 = mesh.indices[i + 1],
+                               i2 = mesh.indices[i + 2];
+                const Vector3 &p0 = mesh.vertices[i0].position;
+                Vector3 n = (mesh.vertices[i1].position - p0).Cross(mesh.vertices[i2].position - p0);
+                n.Normalize();
+                accum[group[i0]] += n;
+                accum[group[i1]] += n;
+                accum[group[i2]] += n;
+            }
+            for (size_t i = 0; i < mesh.vertices.size(); i++) {
+                Vertex &v = mesh.vertices[i];
+                if (IsZero(v.normal)) {
+                    v.normal = accum[group[i]];
+                    v.normal.Normalize();
+                }
+            }
+        }
+
+        if (part.hasTexcoords) {
+            ComputeTangents(mesh);
+        } else {
+            for (auto &v : mesh.vertices) {
+                v.tangent = Vector3(1.0f, 0.0f, 0.0f);
+                v.bitangent = Vector3(0.0f, 1.0f, 0.0f);
+            }
+        }
+        mesh.bounds = ComputeBounds(mesh.vertices);
+        BuildMeshlets(mesh);
+    }
+	}
+
+    std::string TemporaryPath(const std::string &tag) {
+        static std::atomic<uint64_t> counter{0};
+        const size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+        std::error_code ec;
+        const std::filesystem::path directory = std::filesystem::temp_directory_path(ec);
+        return (directory / ("hlab_" + tag + "_" + std::to_string(thread) + "_" +
+                             std::to_string(counter.fetch_add(1)) + ".tmp"))
+            .string();
+    }
+
+    MeshStreamer::MeshStreamer(const MeshBounds &bounds, uint64_t triangleHint,
+                               uint64_t memoryBudget)
+        : m_origin(bounds.aabbMin),
+          m_budget(std::max<uint64_t>(memoryBudget, uint64_t(64) << 20)) {
+        // Finish builds a chunk per thread within half the budget.
+        const uint64_t workers = ThreadPool::Get().ThreadCount();
+        m_chunkTriangles = size_t(std::clamp<uint64_t>(
+            m_budget / 2 / (workers * kChunkBytesPerTriangle), 1 << 12, 1 << 20));
+
+        // About two cells per chunk of triangles. Axes much thinner than the
+        // largest one, such as the depth of a facade scan, get one cell.
+        const double cells = std::clamp(
+            double(triangleHint) * 2.0 / double(m_chunkTriangles), 1.0, 32768.0);
+        const Vector3 size = bounds.aabbMax - bounds.aabbMin;
+        const float extent[3] = {size.x, size.y, size.z};
+        const float largest = (std::max)({extent[0], extent[1], extent[2], 1e-20f});
+        double volume = 1.0;
+        int axes = 0;
+        for (float e : extent) {
+            if (e > largest * 1e-3f) {
+                volume *= e;
+                axes++;
+            }
+        }
+        const double cellSize = std::pow(volume / cells, 1.0 / std::max(axes, 1));
+        float inverse[3];
+        for (int i = 0; i < 3; i++) {
+            if (extent[i] > largest * 1e-3f)
+                m_dims[i] = uint32_t(std::clamp(std::ceil(extent[i] / cellSize), 1.0, 1024.0));
+            inverse[i] = float(m_dims[i]) / std::max(extent[i], 1e-20f);
+        }
+        m_inverseCellSize = Vector3(inverse[0], inverse[1], inverse[2]);
+    }
+
+    MeshStreamer::~MeshStreamer() {
+        if (m_spill.is_open())
+            m_spill.close();
+        if (!m_spillPath.empty()) {
+            std::error_code ec;
+            std::filesystem::remove(m_spillPath, ec);
+        }
+    }
+
+    uint32_t MeshStreamer::AddPart(const MeshPart &part) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_parts.push_back(part);
+        return uint32_t(m_parts.size() - 1);
+    }
+
+    uint32_t MeshStreamer::CellOf(const StreamCorner *triangle) const {
+        const Vector3 centroid =
+            (triangle[0].position + triangle[1].position + triangle[2].position) / 3.0f;
+        const Vector3 f = (centroid - m_origin) * m_inverseCellSize;
+        const float axis[3] = {f.x, f.y, f.z};
+        uint32_t cell[3];
+        for (int i = 0; i < 3; i++) {
+            // Also catches NaN.
+            cell[i] = axis[i] >= 0.0f ? std::min(uint32_t(axis[i]), m_dims[i] - 1) : 0;
+        }
+        return (cell[2] * m_dims[1] + cell[1]) * m_dims[0] + cell[0];
+    }
+
+    void MeshStreamer::AddTriangles(uint32_t part, const StreamCorner *corners,
+                                    size_t triangleCount) {
+        if (triangleCount == 0)
+            return;
+
+        std::vector<uint32_t> cells(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+            cells[t] = CellOf(corners + t * 3);
+
+        const uint64_t cellCount = uint64_t(m_dims[0]) * m_dims[1] * m_dims[2];
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<StreamCorner> *bin = nullptr;
+        uint64_t binKey = ~uint64_t(0);
+        for (size_t t = 0; t < triangleCount; t++) {
+            const uint64_t key = part * cellCount + cells[t];
+            if (key != binKey) {
+                bin = &m_bins[key];
+                binKey = key;
+            }
+            bin->insert(bin->end(), corners + t * 3, corners + t * 3 + 3);
+        }
+        m_bufferedBytes += triangleCount * 3 * sizeof(StreamCorner);
+        if (m_bufferedBytes > m_budget / 4)
+            Spill();
+    }
+
+    void MeshStreamer::AddMesh(uint32_t part, const MeshData &mesh) {
+        std::vector<StreamCorner> corners;
+        const size_t triangles = mesh.indices.size() / 3;
+        for (size_t first = 0; first < triangles; first += kAddBatchTriangles) {
+            const size_t count = std::min(kAddBatchTriangles, triangles - first);
+            corners.resize(count * 3);
+            for (size_t i = 0; i < count * 3; i++) {
+                const Vertex &v = mesh.vertices[mesh.indices[first * 3 + i]];
+                corners[i] = {v.position, v.normal, v.texcoord};
+            }
+            AddTriangles(part, corners.data(), count);
+        }
+    }
+
+    // Appends every bin to the spill file. The caller holds m_mutex.
+    void MeshStreamer::Spill() {
+        if (!m_failed && !m_spill.is_open()) {
+            m_spillPath = TemporaryPath("stream");
+            m_spill.open(m_spillPath, std::ios::binary | std::ios::trunc);
+            if (!m_spill) {
+                LOG_ERROR(LogCategory::Loader, "Cannot create %s", m_spillPath.c_str());
+                m_failed = true;
+            }
+        }
+        if (!m_failed) {
+            for (const auto &[key, corners] : m_bins) {
+                m_spill.write(reinterpret_cast<const char *>(corners.data()),
+                              std::streamsize(corners.size() * sizeof(StreamCorner)));
+                m_blocks.push_back({key, m_spilledCorners, corners.size()});
+                m_spilledCorners += corners.size();
+            }
+            if (!m_spill) {
+                LOG_ERROR(LogCategory::Loader, "Cannot write %s", m_spillPath.c_str());
+                m_failed = true;
+            }
+        }
+        m_bins.clear();
+        m_bufferedBytes = 0;
+    }
+
+    bool MeshStreamer::Finish(const std::string &filename) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_spill.is_open()) {
+            m_spill.close();
+            m_failed |= m_spill.fail();
+        }
+        if (m_failed)
+            return false;
+
+        // Every bin's spilled blocks in append order, then what is still
+        // in memory.
+        std::vector<uint64_t> bins;
+        std::unordered_map<uint64_t, std::vector<size_t>> blocksOf;
+        for (size_t i = 0; i < m_blocks.size(); i++) {
+            auto &list = blocksOf[m_blocks[i].bin];
+            if (list.empty())
+                bins.push_back(m_blocks[i].bin);
+            list.push_back(i);
+        }
+        for (const auto &[key, corners] : m_bins) {
+            if (blocksOf.find(key) == blocksOf.end())
+                bins.push_back(key);
+        }
+        std::sort(bins.begin(), bins.end());
+
+        const std::string temp = filename + ".part";
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(filename).parent_path(), ec);
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            LOG_ERROR(LogCategory::Loader, "Cannot create %s", temp.c_str());
+            return false;
+        }
+        const char header[kHeaderBytes] = {};
+        out.write(header, kHeaderBytes);
+        uint64_t offset = kHeaderBytes;
+
+        struct Output {
+            uint64_t bin;
+            uint32_t slice;
+            ChunkInfo info;
+        };
+        std::vector<Output> outputs;
+        std::mutex outMutex;
+        std::atomic<bool> readFailed{false};
+
+        const uint64_t cellCount = uint64_t(m_dims[0]) * m_dims[1] * m_dims[2];
+        const size_t limit = m_chunkTriangles * 3;
+        ParallelFor(bins.size(), 1, [&](size_t begin, size_t end) {
+            std::ifstream spill;
+            if (m_spilledCorners > 0)
+                spill.open(m_spillPath, std::ios::binary);
+            std::vector<StreamCorner> slice;
+            MeshData mesh;
+
+            for (size_t b = begin; b < end; b++) {
+                const uint64_t bin = bins[b];
+                const uint32_t part = uint32_t(bin / cellCount);
+                uint32_t sliceIndex = 0;
+
+                auto flush = [&]() {
+                    BuildChunk(slice, m_parts[part], mesh);
+                    slice.clear();
+
+                    std::lock_guard<std::mutex> outLock(outMutex);
+                    ChunkInfo info;
+                    info.bounds = mesh.bounds;
+                    info.offset = offset;
+                    info.vertexCount = uint32_t(mesh.vertices.size());
+                    info.indexCount = uint32_t(mesh.indices.size());
+                    info.meshletCount = uint32_t(mesh.meshlets.size());
+                    info.part = part;
+                    out.write(reinterpret_cast<const char *>(mesh.vertices.data()),
+                              std::streamsize(mesh.vertices.size() * sizeof(Vertex)));
+                    out.write(reinterpret_cast<const char *>(mesh.indices.data()),
+                              std::streamsize(mesh.indices.size() * sizeof(uint32_t)));
+                    out.write(reinterpret_cast<const char *>(mesh.meshlets.data()),
+                              std::streamsize(mesh.meshlets.size() * sizeof(Meshlet)));
+                    offset += mesh.vertices.size() * sizeof(Vertex) +
+                              mesh.indices.size() * sizeof(uint32_t) +
+                              mesh.meshlets.size() * sizeof(Meshlet);
+                    outputs.push_back({bin, sliceIndex++, info});
+                };
+
+                // Corners are taken in whole triangles, limit is a multiple of 3.
+                auto append = [&](auto &&read, uint64_t count) {
+                    while (count > 0) {
+                        const size_t n = size_t(std::min<uint64_t>(count, limit - slice.size()));
+                        const size_t old = slice.size();
+                        slice.resize(old + n);
+                        read(slice.data() + old, n);
+                        count -= n;
+                        if (slice.size() == limit)
+                            flush();
+                    }
+                };
+
+                if (auto it = blocksOf.find(bin); it != blocksOf.end()) {
+                    for (size_t i : it->second) {
+                        const Block &block = m_blocks[i];
+                        spill.seekg(std::streamoff(block.offset * sizeof(StreamCorner)));
+                        append([&](StreamCorner *dst, size_t n) {
+                                   if (!spill.read(reinterpret_cast<char *>(dst),
+                                                   std::streamsize(n * sizeof(StreamCorner))))
+                                       readFailed = true;
+                               },
+                               block.count);
+                    }
+                }
+                if (auto it = m_bins.find(bin); it != m_bins.end()) {
+                    const StreamCorner *src = it->second.data();
+                    append([&](StreamCorner *dst, size_t n) {
+                               std::copy(src, src + n, dst);
+                               src += n;
+                           },
+                           it->second.size());
+                }
+                if (!slice.empty())
+                    flush();
+            }
+        });
+
+        // The table follows the bin order, so it doesn't depend on which
+        // thread finished first.
+        std::sort(outputs.begin(), outputs.end(), [](const Output &a, const Output &b) {
+            return a.bin != b.bin ? a.bin < b.bin : a.slice < b.slice;
+        });
+
+        const uint64_t tableOffset = offset;
+        for (const auto &part : m_parts) {
+            WriteString(out, part.material);
+            WriteString(out, part.baseColorFilename);
+            WriteString(out, part.normalFilename);
+            WriteString(out, part.ormFilename);
+            WriteU32(out, part.hasTexcoords ? 1 : 0);
+        }
+        for (const auto &output : outputs) {
+            const ChunkInfo &info = output.info;
+            out.write(reinterpret_cast<const char *>(&info.bounds), sizeof(MeshBounds));
+            WriteU64(out, info.offset);
+            WriteU32(out, info.vertexCount);
+            WriteU32(out, info.indexCount);
+            WriteU32(out, info.meshletCount);
+            WriteU32(out, info.part);
+        }
+
+        out.seekp(0);
+        WriteU32(out, kChunkMagic);
+        WriteU32(out, kChunkFileVersion);
+        WriteU32(out, uint32_t(sizeof(Vertex)));
+        WriteU32(out, uint32_t(m_parts.size()));
+        WriteU64(out, outputs.size());
+        WriteU64(out, tableOffset);
+        out.close();
+
+        if (readFailed || out.fail()) {
+            LOG_ERROR(LogCategory::Loader, "Cannot write %s", filename.c_str());
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+        std::filesystem::rename(temp, filename, ec);
+        if (ec) {
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    bool ChunkFile::Open(const std::string &filename) {
+        m_filename.clear();
+        m_chunks.clear();
+        m_parts.clear();
+
+        std::ifstream in(filename, std::ios::binary);
+        std::error_code ec;
+        const uint64_t fileSize = std::filesystem::file_size(filename, ec);
+        uint32_t magic, version, vertexSize, partCount;
+        uint64_t chunkCount, tableOffset;
+        if (!in || ec || !ReadU32(in, magic) || magic != kChunkMagic ||
+            !ReadU32(in, version) || version != kChunkFileVersion ||
+            !ReadU32(in, vertexSize) || vertexSize != sizeof(Vertex) ||
+            !ReadU32(in, partCount) || !ReadU64(in, chunkCount) ||
+            !ReadU64(in, tableOffset) || tableOffset > fileSize ||
+            chunkCount > fileSize / (sizeof(MeshBounds) + 24))
+            return false;
+
+        in.seekg(std::streamoff(tableOffset));
+        m_parts.resize(partCount);
+        for (auto &part : m_parts) {
+            uint32_t hasTexcoords;
+            if (!ReadString(in, part.material) || !ReadString(in, part.baseColorFilename) ||
+                !ReadString(in, part.normalFilename) || !ReadString(in, part.ormFilename) ||
+                !ReadU32(in, hasTexcoords))
+                return false;
+            part.hasTexcoords = hasTexcoords != 0;
+        }
+        m_chunks.resize(size_t(chunkCount));
+        for (auto &chunk : m_chunks) {
+            if (!in.read(reinterpret_cast<char *>(&chunk.bounds), sizeof(MeshBounds)) ||
+                !ReadU64(in, chunk.offset) || !ReadU32(in, chunk.vertexCount) ||
+                !ReadU32(in, chunk.indexCount) || !ReadU32(in, chunk.meshletCount) ||
+                !ReadU32(in, chunk.part) || chunk.part >= partCount ||
+                chunk.offset + uint64_t(chunk.vertexCount) * sizeof(Vertex) +
+                        uint64_t(chunk.indexCount) * sizeof(uint32_t) +
+                        uint64_t(chunk.meshletCount) * sizeof(Meshlet) >
+                    tableOffset) {
+                m_chunks.clear();
+                m_parts.clear();
+                return false;
+            }
+        }
+        m_filename = filename;
+        return true;
+    }
+
+    bool ChunkFile::LoadChunk(size_t index, MeshData &mesh) const {
+        if (index >= m_chunks.size())
+            return false;
+        const ChunkInfo &chunk = m_chunks[index];
+        std::ifstream in(m_filename, std::ios::binary);
+        if (!in.seekg(std::streamoff(chunk.offset)))
+            return false;
+
+        mesh.vertices.resize(chunk.vertexCount);
+        mesh.indices.resize(chunk.indexCount);
+        mesh.meshlets.resize(chunk.meshletCount);
+        if (!in.read(reinterpret_cast<char *>(mesh.vertices.data()),
+                     std::streamsize(mesh.vertices.size() * sizeof(Vertex))) ||
+            !in.read(reinterpret_cast<char *>(mesh.indices.data()),
+                     std::streamsize(mesh.indices.size() * sizeof(uint32_t))) ||
+            !in.read(reinterpret_cast<char *>(mesh.meshlets.data()),
+                     std::streamsize(mesh.meshlets.size() * sizeof(Meshlet))))
+            return false;
+        for (uint32_t i : mesh.indices) {
+            if (i >= chunk.vertexCount)
+                return false;
+        }
+        for (const Meshlet &m : mesh.meshlets) {
+            if (uint64_t(m.indexOffset) + uint64_t(m.triangleCount) * 3 > chunk.indexCount)
+                return false;
+        }
+
+        const MeshPart &part = m_parts[chunk.part];
+        mesh.bounds = chunk.bounds;
+        mesh.baseColorFilename = part.baseColorFilename;
+        mesh.normalFilename = part.normalFilename;
+        mesh.ormFilename = part.ormFilename;
+        return true;
+    }
+}
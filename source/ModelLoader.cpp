@@ -1,6 +1,20 @@
 #include "ModelLoader.h"
 
+#include <algorithm>
 #include <filesystem>
+#include <memory_resource>
+#include <set>
+#include <unordered_map>
+
+#include "AssetCache.h"
+#include "FbxLoader.h"
+#include "GltfLoader.h"
+#include "Hash.h"
+#include "Logger.h"
+#include "MappedIOSystem.h"
+#include "MeshOptimizer.h"
+#include "ObjLoader.h"
+#include "Parallel.h"
 
 namespace fs = std::filesystem;
 
@@ -107,11 +121,8 @@ static std::string FindBaseColorForMaterial(const std::string &modelFullPath,
 }
 
 static std::string FindTextureForMaterialByKeyword(
-    const std::string &modelFullPath, int materialIndex,
-    const std::string &materialName, const std::vector<std::string> &keywords) {
-
-    namespace fs = std::filesystem;
-    fs::path dir = fs::path(modelFullPath).parent_path();
+    const std::vector<hlab::ModelLoader::TextureCandidate> &candidates,
+    const std::string &materialName, const char *keyword) {
 
     auto contains = [](const std::string &a, const std::string &b) {
         return a.find(b) != std::string::npos;
@@ -119,133 +130,766 @@ static std::string FindTextureForMaterialByKeyword(
 
     std::string matIdxKey = ToLower(materialName);
 
-    std::string best;
-    std::string firstAny;
+    const std::string *firstAny = nullptr;
 
-    for (auto &p : fs::directory_iterator(dir)) {
-        if (!p.is_regular_file())
+    for (const auto &c : candidates) {
+        if (!contains(c.lowerName, keyword))
             continue;
 
-        std::string ext = ToLower(p.path().extension().string());
-        if (ext != ".png" && ext != ".jpg")
-            continue;
+        if (!firstAny)
+            firstAny = &c.path;
 
-        std::string name = ToLower(p.path().filename().string());
+        if (contains(c.lowerName, matIdxKey))
+            return c.path;
+    }
+
+    return firstAny ? *firstAny : std::string();
+}
+
+static DirectX::SimpleMath::Matrix ToMatrix(const aiMatrix4x4 &a) {
+    DirectX::SimpleMath::Matrix m;
+    const ai_real *temp = &a.a1;
+    float *mTemp = &m._11;
+    for (int t = 0; t < 16; t++)
+        mTemp[t] = float(temp[t]);
+    return m.Transpose();
+}
+
+// Keeps the hlab::kMaxInfluences strongest bones of each vertex. Vertices
+// without bones get one extra joint with an empty name, which
+// ProcessNode ties to the mesh's own node.
+static void ImportSkin(const aiMesh *mesh, hlab::MeshSkin &skin) {
+    if (!mesh->HasBones())
+        return;
+    if (mesh->mNumBones >= 0xffff) {
+        LOG_WARN(hlab::LogCategory::Loader, "too many bones (%u), skin ignored",
+                 mesh->mNumBones);
+        return;
+    }
 
-        bool ok = true;
-        for (auto &k : keywords) {
-            if (!contains(name, ToLower(k))) {
-                ok = false;
-                break;
+    skin.weights.assign(mesh->mNumVertices, hlab::VertexWeights());
+    skin.jointNames.reserve(mesh->mNumBones + 1);
+    skin.inverseBind.reserve(mesh->mNumBones + 1);
+    for (unsigned int b = 0; b < mesh->mNumBones; b++) {
+        const aiBone *bone = mesh->mBones[b];
+        skin.jointNames.push_back(bone->mName.C_Str());
+        skin.inverseBind.push_back(ToMatrix(bone->mOffsetMatrix));
+        for (unsigned int w = 0; w < bone->mNumWeights; w++) {
+            const aiVertexWeight &weight = bone->mWeights[w];
+            if (weight.mVertexId >= mesh->mNumVertices || !(weight.mWeight > 0.0f))
+                continue;
+            hlab::VertexWeights &vertex = skin.weights[weight.mVertexId];
+            int weakest = 0;
+            for (int k = 1; k < hlab::kMaxInfluences; k++) {
+                if (vertex.weights[k] < vertex.weights[weakest])
+                    weakest = k;
+            }
+            if (weight.mWeight > vertex.weights[weakest]) {
+                vertex.joints[weakest] = uint16_t(b);
+                vertex.weights[weakest] = weight.mWeight;
             }
         }
-        if (!ok)
+    }
+
+    uint16_t unbound = 0xffff;
+    for (auto &vertex : skin.weights) {
+        float sum = 0.0f;
+        for (float w : vertex.weights)
+            sum += w;
+        if (sum > 0.0f) {
+            for (float &w : vertex.weights)
+                w /= sum;
             continue;
+        }
+        if (unbound == 0xffff) {
+            unbound = uint16_t(skin.jointNames.size());
+            skin.jointNames.push_back("");
+            skin.inverseBind.push_back(DirectX::SimpleMath::Matrix::Identity);
+        }
+        vertex.joints[0] = unbound;
+        vertex.weights[0] = 1.0f;
+    }
+}
 
-        if (firstAny.empty())
-            firstAny = p.path().string();
+// Keeps the vertices each of Assimp's anim meshes moves, as differences
+// to the base vertices.
+static void ImportMorphTargets(const aiMesh *mesh,
+                               const std::vector<hlab::Vertex> &base,
+                               std::vector<hlab::MorphTarget> &targets) {
+    const float kEpsilon = 1e-6f;
+    auto delta = [](const aiVector3D *values, unsigned int i,
+                    const DirectX::SimpleMath::Vector3 &from) {
+        if (!values)
+            return DirectX::SimpleMath::Vector3(0.0f);
+        return DirectX::SimpleMath::Vector3(values[i].x, values[i].y,
+                                            values[i].z) -
+               from;
+    };
 
-        if (contains(name, matIdxKey)) {
-            best = p.path().string();
-            break;
+    for (unsigned int a = 0; a < mesh->mNumAnimMeshes; a++) {
+        const aiAnimMesh *anim = mesh->mAnimMeshes[a];
+        if (!anim || anim->mNumVertices != base.size())
+            continue;
+
+        hlab::MorphTarget target;
+        target.name = anim->mName.C_Str();
+        for (unsigned int i = 0; i < anim->mNumVertices; i++) {
+            hlab::Vertex d{};
+            d.position = delta(anim->mVertices, i, base[i].position);
+            d.normal = delta(anim->mNormals, i, base[i].normal);
+            d.tangent = delta(anim->mTangents, i, base[i].tangent);
+            d.bitangent = delta(anim->mBitangents, i, base[i].bitangent);
+            const float *f = &d.position.x;
+            if (std::none_of(f, f + sizeof(d) / sizeof(float),
+                             [&](float x) { return std::fabs(x) > kEpsilon; }))
+                continue;
+            target.vertices.push_back(i);
+            target.deltas.push_back(d);
         }
+        targets.push_back(std::move(target));
     }
+}
 
-    return !best.empty() ? best : firstAny;
+// Textures are decoded right after the load, so their reads can overlap it.
+static void PrefetchTextures(const std::vector<hlab::MeshData> &meshes) {
+    std::set<std::string> textures;
+    for (const auto &m : meshes) {
+        for (const auto *name :
+             {&m.baseColorFilename, &m.normalFilename, &m.ormFilename}) {
+            if (!name->empty() && textures.insert(*name).second)
+                hlab::MappedIOSystem::Prefetch(*name);
+        }
+    }
 }
 
 namespace hlab {
 
 using namespace DirectX::SimpleMath;
 
+const unsigned int ModelLoader::kImportFlags;
+
+bool ModelLoader::useMappedIO = true;
+bool ModelLoader::useFbxFastPath = true;
+bool ModelLoader::useGltfFastPath = true;
+bool ModelLoader::useObjFastPath = true;
+uint64_t ModelLoader::memoryBudget = uint64_t(2048) << 20;
+
 void ModelLoader::Load(std::string basePath, std::string filename) {
 
     this->basePath = basePath;
+    this->timings = LoaderTimings();
+    this->recordNodes = false;
+    this->cacheKey = 0;
+    this->chunkFile = ChunkFile();
+    this->residentChunks = 0;
 
-    Assimp::Importer importer;
+    CpuTimer totalTimer;
 
     std::filesystem::path fullPath =
         std::filesystem::path(this->basePath) / filename;
 
     this->modelFullPath = fullPath;
 
-    const aiScene *pScene = importer.ReadFile(
+    this->textureCandidates.clear();
+    std::error_code ec;
+    for (auto &p : fs::directory_iterator(fullPath.parent_path(), ec)) {
+        if (!p.is_regular_file())
+            continue;
+
+        std::string ext = ToLower(p.path().extension().string());
+
+        // Side files the importer opens next (OBJ materials, glTF buffers).
+        if (useMappedIO && (ext == ".mtl" || ext == ".bin"))
+            MappedIOSystem::Prefetch(p.path().string());
+
+        if (ext != ".png" && ext != ".jpg")
+            continue;
+
+        this->textureCandidates.push_back(
+            {ToLower(p.path().filename().string()), p.path().string()});
+    }
+
+    // The result depends on the source bytes, the import flags and the
+    // textures next to the model that materials resolve to.
+    AssetCache &cache = AssetCache::Get();
+    const size_t firstMesh = this->meshes.size();
+    uint64_t cacheKey = 0;
+    uint64_t sourceHash = 0;
+    if (this->useCache && !this->keepHierarchy && cache.Enabled() &&
+        HashFile(fullPath.string(), sourceHash)) {
+        Hasher64 hasher;
+        hasher.UpdateValue(kMeshCacheVersion);
+        hasher.UpdateValue(kImportFlags);
+        hasher.UpdateValue(useFbxFastPath);
+        hasher.UpdateValue(useGltfFastPath);
+        hasher.UpdateValue(useObjFastPath);
+        hasher.UpdateValue(sourceHash);
+        for (const auto &candidate : this->textureCandidates) {
+            hasher.UpdateValue(candidate.path.size());
+            hasher.Update(candidate.path);
+        }
+        cacheKey = hasher.Digest();
+
+        CpuTimer cacheTimer;
+        if (cache.LoadMeshes(cacheKey, this->meshes)) {
+            this->timings.readFileMs = cacheTimer.ElapsedMs();
+            this->timings.readFileAllocs = cacheTimer.Allocations();
+            this->timings.cacheHit = true;
+            this->cacheKey = cacheKey;
+            this->timings.meshCount = this->meshes.size();
+            for (const auto &m : this->meshes) {
+                this->timings.vertexCount += m.vertices.size();
+                this->timings.indexCount += m.indices.size();
+            }
+            this->timings.totalMs = totalTimer.ElapsedMs();
+            if (useMappedIO)
+                PrefetchTextures(this->meshes);
+            return;
+        }
+    }
+
+    // Models over the memory budget are kept as chunk files, either one
+    // from an earlier load or a new one streamed from an OBJ, which the
+    // fast path holds at about three times its size.
+    const std::string extension = ToLower(fullPath.extension().string());
+    std::error_code sizeError;
+    const uint64_t sourceBytes = fs::file_size(fullPath, sizeError);
+    CpuTimer chunkTimer;
+    bool chunked = cacheKey != 0 &&
+                   this->chunkFile.Open(cache.ChunkFilePath(cacheKey).string());
+    this->timings.cacheHit = chunked;
+    if (!chunked && useObjFastPath && !this->keepHierarchy &&
+        extension == ".obj" && !sizeError && sourceBytes * 3 > memoryBudget)
+        chunked = LoadStreamed(fullPath.string(), cacheKey);
+    if (chunked) {
+        this->timings.readFileMs = chunkTimer.ElapsedMs();
+        this->timings.readFileAllocs = chunkTimer.Allocations();
+        this->timings.streamed = true;
+        this->timings.chunkCount = this->chunkFile.Chunks().size();
+
+        CpuTimer pageTimer;
+        PageInChunks(memoryBudget);
+        this->timings.processNodeMs = pageTimer.ElapsedMs();
+        this->timings.processNodeAllocs = pageTimer.Allocations();
+        this->timings.meshCount = this->meshes.size();
+        for (const auto &m : this->meshes) {
+            this->timings.vertexCount += m.vertices.size();
+            this->timings.indexCount += m.indices.size();
+        }
+        this->timings.totalMs = totalTimer.ElapsedMs();
+        if (useMappedIO)
+            PrefetchTextures(this->meshes);
+        return;
+    }
+
+    const bool native = !this->keepHierarchy;
+    const bool nativeFbx = native && useFbxFastPath && extension == ".fbx" &&
+                           LoadNativeFbx(fullPath.string());
+    const bool nativeGltf = native && !nativeFbx && useGltfFastPath &&
+                            (extension == ".glb" || extension == ".gltf") &&
+                            LoadNativeGltf(fullPath.string());
+    const bool nativeObj = native && useObjFastPath && extension == ".obj" &&
+                           LoadNativeObj(fullPath.string());
+    if (!nativeFbx && !nativeGltf && !nativeObj &&
+        !LoadWithAssimp(fullPath.string()))
+        return;
+    this->timings.nativeFbx = nativeFbx;
+    this->timings.nativeGltf = nativeGltf;
+    this->timings.nativeObj = nativeObj;
+
+    if (useMappedIO)
+        PrefetchTextures(this->meshes);
+
+    CpuTimer normalsTimer;
 
-        fullPath.string(),
-        aiProcess_Triangulate | aiProcess_ConvertToLeftHanded |
-            aiProcess_FlipUVs | aiProcess_GenSmoothNormals |
-            aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices);
+    size_t maxVertices = 0;
+    for (const auto &m : this->meshes)
+        maxVertices = std::max(maxVertices, m.vertices.size());
+
+    // Transient per-load buffers live in one arena sized up front and are
+    // released together when Load returns. xyz accumulates face normals,
+    // w counts the faces touching the vertex.
+    std::pmr::monotonic_buffer_resource arena(
+        std::max<size_t>(maxVertices * sizeof(Vector4) + 64, 1024));
+    std::pmr::vector<Vector4> accum(&arena);
+    accum.reserve(maxVertices);
+
+    for (auto &m : this->meshes) {
+
+        accum.assign(m.vertices.size(), Vector4(0.0f));
+
+        for (size_t i = 0; i + 2 < m.indices.size(); i += 3) {
+
+            const uint32_t idx0 = m.indices[i];
+            const uint32_t idx1 = m.indices[i + 1];
+            const uint32_t idx2 = m.indices[i + 2];
+
+            const Vector3 &p0 = m.vertices[idx0].position;
+            const Vector3 &p1 = m.vertices[idx1].position;
+            const Vector3 &p2 = m.vertices[idx2].position;
+
+            const Vector3 n = (p1 - p0).Cross(p2 - p0);
+            const Vector4 faceNormal(n.x, n.y, n.z, 1.0f);
+
+            accum[idx0] += faceNormal;
+            accum[idx1] += faceNormal;
+            accum[idx2] += faceNormal;
+        }
+
+        for (size_t i = 0; i < m.vertices.size(); i++) {
+            const Vector4 &a = accum[i];
+            if (a.w > 0.0f) {
+                m.vertices[i].normal = Vector3(a.x, a.y, a.z) / a.w;
+                m.vertices[i].normal.Normalize();
+            }
+        }
+    }
+    this->timings.normalsMs = normalsTimer.ElapsedMs();
+
+    for (auto &m : this->meshes)
+        m.bounds = ComputeBounds(m.vertices);
+    this->timings.normalsAllocs = normalsTimer.Allocations();
+
+    // Neither the cache nor chunk files store skins, morph targets and
+    // clips.
+    bool deformed = false;
+    for (size_t i = firstMesh; i < this->meshes.size(); i++)
+        deformed = deformed || !this->meshes[i].skin.weights.empty() ||
+                   !this->meshes[i].morphTargets.empty();
+    if (deformed || this->recordNodes)
+        cacheKey = 0;
+
+    uint64_t loadedBytes = 0;
+    for (size_t i = firstMesh; i < this->meshes.size(); i++)
+        loadedBytes += this->meshes[i].vertices.size() * sizeof(Vertex) +
+                       this->meshes[i].indices.size() * sizeof(uint32_t);
+    if (loadedBytes > memoryBudget && !this->keepHierarchy && !deformed &&
+        SpillToChunks(firstMesh, cacheKey)) {
+        this->timings.streamed = true;
+        this->timings.chunkCount = this->chunkFile.Chunks().size();
+        cacheKey = 0; // the chunk file is the cache entry
+    }
+
+    // Chunks come with their meshlets. Skinned and morphed meshes move
+    // every frame, so their meshlet bounds would be stale.
+    CpuTimer meshletsTimer;
+    ParallelFor(this->meshes.size() - firstMesh, 1, [&](size_t begin, size_t end) {
+        for (size_t i = firstMesh + begin; i < firstMesh + end; i++) {
+            if (this->meshes[i].meshlets.empty() &&
+                this->meshes[i].skin.weights.empty() &&
+                this->meshes[i].morphTargets.empty())
+                BuildMeshlets(this->meshes[i]);
+        }
+    });
+    this->timings.meshletsMs = meshletsTimer.ElapsedMs();
+    this->timings.meshletsAllocs = meshletsTimer.Allocations();
+
+    this->timings.meshCount = this->meshes.size();
+    for (const auto &m : this->meshes) {
+        this->timings.vertexCount += m.vertices.size();
+        this->timings.indexCount += m.indices.size();
+    }
+
+    // Decoded images are not part of the cache format.
+    for (size_t i = firstMesh; i < this->meshes.size(); i++) {
+        const MeshData &m = this->meshes[i];
+        if (m.baseColorImage || m.normalImage || m.ormImage)
+            cacheKey = 0;
+    }
+
+    if (cacheKey != 0) {
+        if (firstMesh == 0)
+            cache.StoreMeshes(cacheKey, this->meshes);
+        else
+            cache.StoreMeshes(cacheKey,
+                              std::vector<MeshData>(this->meshes.begin() + firstMesh,
+                                                    this->meshes.end()));
+    }
+    this->cacheKey = cacheKey;
+    this->timings.totalMs = totalTimer.ElapsedMs();
+}
+
+bool ModelLoader::LoadWithAssimp(const std::string &path) {
+    Assimp::Importer importer;
+    if (useMappedIO)
+        importer.SetIOHandler(new MappedIOSystem());
+
+    CpuTimer readTimer;
+    const aiScene *pScene = importer.ReadFile(path, kImportFlags);
 
     if (!pScene || !pScene->mRootNode ||
         (pScene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) {
-        std::cerr << "[Assimp] ReadFile failed: " << importer.GetErrorString()
-                  << "\n";
-        return;
+        LOG_ERROR(LogCategory::Loader, "Assimp ReadFile failed: %s",
+                  importer.GetErrorString());
+        return false;
     }
+    this->timings.readFileMs = readTimer.ElapsedMs();
+    this->timings.readFileAllocs = readTimer.Allocations();
 
+    CpuTimer nodeTimer;
+    this->materialTextures.assign(pScene->mNumMaterials, MaterialTextures());
+    this->meshes.reserve(this->meshes.size() + pScene->mNumMeshes);
     DirectX::SimpleMath::Matrix tr = DirectX::SimpleMath::Matrix::Identity;
+    bool skinned = false;
+    for (unsigned int i = 0; i < pScene->mNumMeshes; i++)
+        skinned = skinned || pScene->mMeshes[i]->HasBones();
+    this->recordNodes = skinned || pScene->mNumAnimations > 0;
+    if (this->keepHierarchy) {
+        this->sceneGraph.meshNodes.resize(this->meshes.size(),
+                                          SceneGraph::kNoParent);
+    }
+    const size_t firstMesh = this->meshes.size();
+    const size_t firstNode = this->sceneGraph.NodeCount();
     ProcessNode(pScene->mRootNode, pScene, tr);
+    if (this->keepHierarchy || this->recordNodes) {
+        this->sceneGraph.UpdateTransforms();
+        ImportAnimations(pScene, firstMesh, firstNode);
+    }
+    this->timings.processNodeMs = nodeTimer.ElapsedMs();
+    this->timings.processNodeAllocs = nodeTimer.Allocations();
+    return true;
+}
 
-    for (auto &m : this->meshes) {
+// Resolves the joints of the meshes from firstMesh on and converts the
+// clips, both against the nodes from firstNode on.
+void ModelLoader::ImportAnimations(const aiScene *scene, size_t firstMesh,
+                                   size_t firstNode) {
+    std::unordered_map<std::string, uint32_t> nodes;
+    for (size_t n = this->sceneGraph.NodeCount(); n-- > firstNode;)
+        nodes[this->sceneGraph.Name(uint32_t(n))] = uint32_t(n);
+
+    for (size_t i = firstMesh; i < this->meshes.size(); i++) {
+        MeshSkin &skin = this->meshes[i].skin;
+        for (size_t j = 0; j < skin.jointNames.size(); j++) {
+            if (skin.jointNames[j].empty())
+                continue;
+            auto found = nodes.find(skin.jointNames[j]);
+            if (found != nodes.end())
+                skin.jointNodes[j] = found->second;
+            else
+                LOG_WARN(LogCategory::Loader, "bone without node: %s",
+                         skin.jointNames[j].c_str());
+        }
+    }
 
-        vector<Vector3> normalsTemp(m.vertices.size(), Vector3(0.0f));
-        vector<float> weightsTemp(m.vertices.size(), 0.0f);
+    for (unsigned int a = 0; a < scene->mNumAnimations; a++) {
+        const aiAnimation *animation = scene->mAnimations[a];
+        const double ticksPerSecond =
+            animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+
+        AnimationClip clip;
+        clip.name = animation->mName.C_Str();
+        clip.duration = float(animation->mDuration / ticksPerSecond);
+        for (unsigned int c = 0; c < animation->mNumChannels; c++) {
+            const aiNodeAnim *source = animation->mChannels[c];
+            auto found = nodes.find(source->mNodeName.C_Str());
+            if (found == nodes.end())
+                continue;
+
+            NodeChannel channel;
+            channel.node = found->second;
+            for (unsigned int k = 0; k < source->mNumPositionKeys; k++) {
+                const aiVectorKey &key = source->mPositionKeys[k];
+                channel.positions.push_back(
+                    {float(key.mTime / ticksPerSecond),
+                     Vector3(key.mValue.x, key.mValue.y, key.mValue.z)});
+            }
+            for (unsigned int k = 0; k < source->mNumRotationKeys; k++) {
+                const aiQuatKey &key = source->mRotationKeys[k];
+                channel.rotations.push_back(
+                    {float(key.mTime / ticksPerSecond),
+                     Quaternion(key.mValue.x, key.mValue.y, key.mValue.z,
+                                key.mValue.w)});
+            }
+            for (unsigned int k = 0; k < source->mNumScalingKeys; k++) {
+                const aiVectorKey &key = source->mScalingKeys[k];
+                channel.scales.push_back(
+                    {float(key.mTime / ticksPerSecond),
+                     Vector3(key.mValue.x, key.mValue.y, key.mValue.z)});
+            }
 
-        for (int i = 0; i < m.indices.size(); i += 3) {
+            // Components without keys hold the node's bind pose.
+            if (channel.positions.empty() || channel.rotations.empty() ||
+                channel.scales.empty()) {
+                Matrix local = this->sceneGraph.Local(channel.node);
+                Vector3 scale, position;
+                Quaternion rotation;
+                local.Decompose(scale, rotation, position);
+                if (channel.positions.empty())
+                    channel.positions.push_back({0.0f, position});
+                if (channel.rotations.empty())
+                    channel.rotations.push_back({0.0f, rotation});
+                if (channel.scales.empty())
+                    channel.scales.push_back({0.0f, scale});
+            }
+            clip.channels.push_back(std::move(channel));
+        }
+        this->clips.push_back(std::move(clip));
+    }
+}
 
-            int idx0 = m.indices[i];
-            int idx1 = m.indices[i + 1];
-            int idx2 = m.indices[i + 2];
+bool ModelLoader::LoadNativeFbx(const std::string &path) {
+    CpuTimer readTimer;
+    FbxLoader fbx;
+    if (!fbx.Load(path))
+        return false;
+    this->timings.readFileMs = readTimer.ElapsedMs();
+    this->timings.readFileAllocs = readTimer.Allocations();
+
+    CpuTimer nodeTimer;
+    AddNativeMeshes(fbx.meshes, fbx.meshMaterials, fbx.materialNames);
+    this->timings.processNodeMs = nodeTimer.ElapsedMs();
+    this->timings.processNodeAllocs = nodeTimer.Allocations();
+    return true;
+}
 
-            auto v0 = m.vertices[idx0];
-            auto v1 = m.vertices[idx1];
-            auto v2 = m.vertices[idx2];
+bool ModelLoader::LoadNativeGltf(const std::string &path) {
+    CpuTimer readTimer;
+    GltfLoader gltf;
+    if (!gltf.Load(path))
+        return false;
+    this->timings.readFileMs = readTimer.ElapsedMs();
+    this->timings.readFileAllocs = readTimer.Allocations();
+
+    CpuTimer nodeTimer;
+    AddNativeMeshes(gltf.meshes, gltf.meshMaterials, gltf.materialNames);
+    this->timings.processNodeMs = nodeTimer.ElapsedMs();
+    this->timings.processNodeAllocs = nodeTimer.Allocations();
+    return true;
+}
 
-            auto faceNormal =
-                (v1.position - v0.position).Cross(v2.position - v0.position);
+bool ModelLoader::LoadNativeObj(const std::string &path) {
+    CpuTimer readTimer;
+    ObjLoader obj;
+    if (!obj.Load(path))
+        return false;
+    this->timings.readFileMs = readTimer.ElapsedMs();
+    this->timings.readFileAllocs = readTimer.Allocations();
+
+    CpuTimer nodeTimer;
+    AddNativeMeshes(obj.meshes, obj.meshMaterials, obj.materialNames);
+    this->timings.processNodeMs = nodeTimer.ElapsedMs();
+    this->timings.processNodeAllocs = nodeTimer.Allocations();
+    return true;
+}
 
-            normalsTemp[idx0] += faceNormal;
-            normalsTemp[idx1] += faceNormal;
-            normalsTemp[idx2] += faceNormal;
-            weightsTemp[idx0] += 1.0f;
-            weightsTemp[idx1] += 1.0f;
-            weightsTemp[idx2] += 1.0f;
+static std::string ChunkFilePath(const std::string &path, uint64_t cacheKey) {
+    if (cacheKey != 0)
+        return hlab::AssetCache::Get().ChunkFilePath(cacheKey).string();
+    // Without the cache, models of the same name in different folders
+    // still get their own file.
+    std::error_code ec;
+    const std::string absolute = fs::absolute(path, ec).string();
+    return (fs::temp_directory_path(ec) /
+            (fs::path(path).stem().string() + "_" +
+             hlab::HashToString(hlab::HashBytes(absolute.data(), absolute.size())) +
+             ".hlchunks"))
+        .string();
+}
+
+bool ModelLoader::LoadStreamed(const std::string &path, uint64_t cacheKey) {
+    const std::string chunkPath = ChunkFilePath(path, cacheKey);
+    ObjLoader obj;
+    return obj.Stream(path, chunkPath, memoryBudget) &&
+           this->chunkFile.Open(chunkPath);
+}
+
+// Moves the meshes loaded from firstMesh on into a chunk file, one part
+// per mesh. Decoded images have no place in the file, so those models stay
+// as they are, and so does everything if the file can't be written.
+bool ModelLoader::SpillToChunks(size_t firstMesh, uint64_t cacheKey) {
+    MeshBounds bounds = this->meshes[firstMesh].bounds;
+    uint64_t triangles = 0;
+    for (size_t i = firstMesh; i < this->meshes.size(); i++) {
+        const MeshData &m = this->meshes[i];
+        if (m.baseColorImage || m.normalImage || m.ormImage) {
+            LOG_WARN(LogCategory::Loader,
+                     "over the memory budget, but embedded textures keep %s resident",
+                     this->modelFullPath.string().c_str());
+            return false;
         }
+        bounds.Merge(m.bounds);
+        triangles += m.indices.size() / 3;
+    }
 
-        for (int i = 0; i < m.vertices.size(); i++) {
-            if (weightsTemp[i] > 0.0f) {
-                m.vertices[i].normal = normalsTemp[i] / weightsTemp[i];
-                m.vertices[i].normal.Normalize();
+    MeshStreamer streamer(bounds, triangles, memoryBudget);
+    for (size_t i = firstMesh; i < this->meshes.size(); i++) {
+        const MeshData &m = this->meshes[i];
+        MeshPart part;
+        part.baseColorFilename = m.baseColorFilename;
+        part.normalFilename = m.normalFilename;
+        part.ormFilename = m.ormFilename;
+        part.hasTexcoords = true;
+        streamer.AddMesh(streamer.AddPart(part), m);
+    }
+
+    const std::string chunkPath =
+        ChunkFilePath(this->modelFullPath.string(), cacheKey);
+    if (!streamer.Finish(chunkPath) || !this->chunkFile.Open(chunkPath)) {
+        LOG_ERROR(LogCategory::Loader, "cannot write chunk file %s",
+                  chunkPath.c_str());
+        this->chunkFile = ChunkFile();
+        return false;
+    }
+    this->meshes.resize(firstMesh);
+    PageInChunks(memoryBudget);
+    return true;
+}
+
+// Loads the chunks after the resident ones in file order, which follows
+// the grid and keeps the resident part in one piece, until budget bytes
+// are used up. At least one chunk is loaded if any are left.
+void ModelLoader::PageInChunks(uint64_t budget) {
+    const std::vector<ChunkInfo> &chunks = this->chunkFile.Chunks();
+    const std::vector<MeshPart> &parts = this->chunkFile.Parts();
+    const size_t resident = this->residentChunks;
+
+    uint64_t bytes = 0;
+    size_t last = resident;
+    for (; last < chunks.size(); last++) {
+        const uint64_t chunkBytes = chunks[last].vertexCount * sizeof(Vertex) +
+                                    chunks[last].indexCount * sizeof(uint32_t) +
+                                    chunks[last].meshletCount * sizeof(Meshlet);
+        if (last > resident && bytes + chunkBytes > budget)
+            break;
+        bytes += chunkBytes;
+    }
+
+    const size_t count = last - resident;
+    const size_t first = this->meshes.size();
+    this->meshes.resize(first + count);
+    ParallelFor(count, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (!this->chunkFile.LoadChunk(resident + i, this->meshes[first + i])) {
+                LOG_WARN(LogCategory::Loader, "cannot read chunk %zu of %s",
+                         resident + i, this->chunkFile.Filename().c_str());
+                this->meshes[first + i] = MeshData();
             }
         }
+    });
+    this->residentChunks = last;
+    if (last < chunks.size()) {
+        LOG_WARN(LogCategory::Loader,
+                 "%zu of %zu chunks of %s resident, the rest is over the memory budget",
+                 last, chunks.size(), this->chunkFile.Filename().c_str());
+    }
+
+    // Parts named by an OBJ without MTL maps get the name-based lookup.
+    if (resident == 0)
+        this->materialTextures.assign(parts.size(), MaterialTextures());
+    for (size_t i = 0; i < count; i++) {
+        MeshData &mesh = this->meshes[first + i];
+        const uint32_t part = chunks[resident + i].part;
+        if (!parts[part].material.empty() && mesh.baseColorFilename.empty() &&
+            mesh.normalFilename.empty())
+            ResolveMaterialTextures(part, parts[part].material, mesh);
     }
 }
 
-void ModelLoader::ProcessNode(aiNode *node, const aiScene *scene, Matrix tr) {
+// The native loaders already apply the node transforms and the import
+// flags, so only the checks and texture lookup from ProcessMesh are left.
+void ModelLoader::AddNativeMeshes(std::vector<MeshData> &loaded,
+                                  const std::vector<int> &materials,
+                                  const std::vector<std::string> &materialNames) {
+    this->materialTextures.assign(materialNames.size(), MaterialTextures());
+    this->meshes.reserve(this->meshes.size() + loaded.size());
+    for (size_t i = 0; i < loaded.size(); i++) {
+        MeshData &mesh = loaded[i];
+        // Size is left to the memory budget in Load.
+        if (mesh.indices.size() < 3) {
+            LOG_WARN(LogCategory::Loader, "mesh without faces");
+            this->meshes.push_back(MeshData());
+            continue;
+        }
 
-    Matrix m;
-    ai_real *temp = &node->mTransformation.a1;
-    float *mTemp = &m._11;
+        // Textures named by the file win over the name-based lookup.
+        const bool hasTextures =
+            !mesh.baseColorFilename.empty() || !mesh.normalFilename.empty() ||
+            mesh.baseColorImage || mesh.normalImage || mesh.ormImage;
+        const int material = materials[i];
+        if (material >= 0 && !hasTextures)
+            ResolveMaterialTextures(unsigned(material), materialNames[material],
+                                    mesh);
+        this->meshes.push_back(std::move(mesh));
+    }
+}
 
-    for (int t = 0; t < 16; t++) {
-        mTemp[t] = float(temp[t]);
+void ModelLoader::ResolveMaterialTextures(unsigned int materialIndex,
+                                          const std::string &materialName,
+                                          MeshData &mesh) {
+    if (materialIndex >= this->materialTextures.size())
+        return;
+
+    MaterialTextures &textures = this->materialTextures[materialIndex];
+    if (!textures.resolved) {
+        textures.baseColor = FindTextureForMaterialByKeyword(
+            this->textureCandidates, materialName, "basecolor");
+        textures.normal = FindTextureForMaterialByKeyword(
+            this->textureCandidates, materialName, "normal");
+        textures.orm = FindTextureForMaterialByKeyword(
+            this->textureCandidates, materialName, "roughness");
+        textures.resolved = true;
     }
-    m = m.Transpose() * tr;
 
-    for (UINT i = 0; i < node->mNumMeshes; i++) {
+    mesh.baseColorFilename = textures.baseColor;
+    mesh.normalFilename = textures.normal;
+    mesh.ormFilename = textures.orm;
+}
+
+void ModelLoader::ProcessNode(aiNode *node, const aiScene *scene, Matrix tr,
+                              uint32_t parent) {
+
+    Matrix m = ToMatrix(node->mTransformation);
+
+    // With the hierarchy kept, the node owns its transform and tr stays
+    // the identity.
+    uint32_t graphNode = SceneGraph::kNoParent;
+    if (this->keepHierarchy || this->recordNodes)
+        graphNode = this->sceneGraph.AddNode(node->mName.C_Str(), parent, m);
+    if (!this->keepHierarchy)
+        m = m * tr;
+
+    for (unsigned int i = 0; i < node->mNumMeshes; i++) {
 
         aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
         auto newMesh = this->ProcessMesh(mesh, scene);
 
-        for (auto &v : newMesh.vertices) {
-            v.position = DirectX::SimpleMath::Vector3::Transform(v.position, m);
+        // The joints are resolved by name once all nodes exist.
+        MeshSkin &skin = newMesh.skin;
+        skin.jointNodes.assign(skin.jointNames.size(), SceneGraph::kNoParent);
+        for (size_t j = 0; j < skin.jointNames.size(); j++) {
+            if (skin.jointNames[j].empty())
+                skin.jointNodes[j] = graphNode;
+        }
+
+        // Skinned vertices end up in model space through their joints.
+        if (this->keepHierarchy) {
+            this->sceneGraph.meshNodes.push_back(
+                skin.weights.empty() ? graphNode : SceneGraph::kNoParent);
+        } else {
+            for (auto &v : newMesh.vertices) {
+                v.position =
+                    DirectX::SimpleMath::Vector3::Transform(v.position, m);
+            }
+            if (!skin.inverseBind.empty()) {
+                const Matrix unbake = m.Invert();
+                for (auto &inverseBind : skin.inverseBind)
+                    inverseBind = unbake * inverseBind;
+            }
+            for (auto &target : newMesh.morphTargets) {
+                for (auto &d : target.deltas) {
+                    d.position = Vector3::TransformNormal(d.position, m);
+                    d.normal = Vector3::TransformNormal(d.normal, m);
+                }
+            }
         }
 
-        meshes.push_back(newMesh);
+        meshes.push_back(std::move(newMesh));
     }
 
-    for (UINT i = 0; i < node->mNumChildren; i++) {
-        this->ProcessNode(node->mChildren[i], scene, m);
+    for (unsigned int i = 0; i < node->mNumChildren; i++) {
+        this->ProcessNode(node->mChildren[i], scene,
+                          this->keepHierarchy ? tr : m, graphNode);
     }
 }
 
@@ -257,29 +901,24 @@ MeshData ModelLoader::ProcessMesh(aiMesh *mesh, const aiScene *scene) {
         return newMesh;
 
     if (!mesh->HasTextureCoords(0)) {
-        std::cout << "[Assimp] mesh has NO UV0. materialIndex="
-                  << mesh->mMaterialIndex << "\n";
+        LOG_WARN(LogCategory::Loader, "mesh has NO UV0. materialIndex=%u",
+                 mesh->mMaterialIndex);
     }
 
-    if (mesh->mNumVertices == 0 || mesh->mNumVertices > 5'000'000) {
-        std::cout << "[Assimp] suspicious vertex count: " << mesh->mNumVertices
-                  << "\n";
+    // Size is left to the memory budget in Load.
+    if (mesh->mNumVertices == 0 || mesh->mNumFaces == 0) {
+        LOG_WARN(LogCategory::Loader, "empty mesh. materialIndex=%u",
+                 mesh->mMaterialIndex);
         return newMesh;
     }
-    if (mesh->mNumFaces == 0 || mesh->mNumFaces > 10'000'000) {
-        std::cout << "[Assimp] suspicious face count: " << mesh->mNumFaces
-                  << "\n";
-        return newMesh;
-    }
-
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
 
+    std::vector<Vertex> &vertices = newMesh.vertices;
+    std::vector<uint32_t> &indices = newMesh.indices;
 
     vertices.reserve(mesh->mNumVertices);
     indices.reserve((size_t)mesh->mNumFaces * 3);
 
-    for (UINT i = 0; i < mesh->mNumVertices; i++) {
+    for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
 
         Vertex vertex{};
 
@@ -323,31 +962,19 @@ MeshData ModelLoader::ProcessMesh(aiMesh *mesh, const aiScene *scene) {
         vertices.push_back(vertex);
     }
 
-    for (UINT i = 0; i < mesh->mNumFaces; i++) {
-        aiFace face = mesh->mFaces[i];
-        for (UINT j = 0; j < face.mNumIndices; j++)
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+        const aiFace &face = mesh->mFaces[i];
+        for (unsigned int j = 0; j < face.mNumIndices; j++)
             indices.push_back(face.mIndices[j]);
     }
 
-    newMesh.vertices = std::move(vertices);
-    newMesh.indices = std::move(indices);
+    ImportSkin(mesh, newMesh.skin);
+    ImportMorphTargets(mesh, vertices, newMesh.morphTargets);
 
-    if (mesh->mMaterialIndex >= 0) {
+    if (mesh->mMaterialIndex < this->materialTextures.size()) {
         aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-
-        std::string matName = material->GetName().C_Str();
-
-        newMesh.baseColorFilename = FindTextureForMaterialByKeyword(
-            this->modelFullPath.string(), (int)mesh->mMaterialIndex, matName,
-            {"basecolor"});
-
-        newMesh.normalFilename = FindTextureForMaterialByKeyword(
-            this->modelFullPath.string(), (int)mesh->mMaterialIndex, matName,
-            {"normal"});
-
-        newMesh.ormFilename = FindTextureForMaterialByKeyword(
-            this->modelFullPath.string(), (int)mesh->mMaterialIndex, matName,
-            {"roughness"});
+        ResolveMaterialTextures(mesh->mMaterialIndex,
+                                material->GetName().C_Str(), newMesh);
     }
 
         if (newMesh.ormFilename.empty()) 
@@ -0,0 +1,118 @@
+#include "Morphing.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    const uint32_t kMorphBatch = 1024;
+
+    static_assert(sizeof(Vertex) == 14 * sizeof(float), "Vertex layout");
+
+    // out += weight * delta over all 14 floats. The texcoord of the delta
+    // is zero.
+    inline void AddDelta(Vertex &out, const Vertex &delta, __m128 weight) {
+        float *d = &out.position.x;
+        const float *s = &delta.position.x;
+        for (int k = 0; k < 12; k += 4)
+            _mm_storeu_ps(d + k, _mm_add_ps(_mm_loadu_ps(d + k),
+                                            _mm_mul_ps(weight, _mm_loadu_ps(s + k))));
+        const float w = _mm_cvtss_f32(weight);
+        d[12] += w * s[12];
+        d[13] += w * s[13];
+    }
+	}
+
+    std::vector<VertexRange> MorphedRanges(const MeshData &mesh, uint32_t gap) {
+        std::vector<uint8_t> moved(mesh.vertices.size(), 0);
+        for (const MorphTarget &target : mesh.morphTargets) {
+            for (uint32_t v : target.vertices) {
+                if (v < moved.size())
+                    moved[v] = 1;
+            }
+        }
+
+        std::vector<VertexRange> ranges;
+        for (uint32_t v = 0; v < uint32_t(moved.size()); v++) {
+            if (!moved[v])
+                continue;
+            if (!ranges.empty() && v - ranges.back().end < gap)
+                ranges.back().end = v + 1;
+            else
+                ranges.push_back({v, v + 1});
+        }
+        return ranges;
+    }
+
+    MeshBounds ApplyMorphTargets(const MeshData &mesh, const float *weights,
+                                 const std::vector<VertexRange> &ranges,
+                                 Vertex *out) {
+        std::vector<uint32_t> active;
+        for (uint32_t t = 0; t < uint32_t(mesh.morphTargets.size()); t++) {
+            if (weights[t] != 0.0f)
+                active.push_back(t);
+        }
+
+        std::vector<VertexRange> batches;
+        for (const VertexRange &range : ranges) {
+            for (uint32_t b = range.begin; b < range.end; b += kMorphBatch)
+                batches.push_back({b, std::min(range.end, b + kMorphBatch)});
+        }
+
+        struct Box {
+            Vector3 min = Vector3(FLT_MAX);
+            Vector3 max = Vector3(-FLT_MAX);
+        };
+        std::vector<Box> boxes(batches.size());
+        ParallelFor(batches.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++) {
+                const VertexRange batch = batches[b];
+                std::memcpy(out + batch.begin, mesh.vertices.data() + batch.begin,
+                            (batch.end - batch.begin) * sizeof(Vertex));
+
+                for (uint32_t t : active) {
+                    const MorphTarget &target = mesh.morphTargets[t];
+                    const __m128 weight = _mm_set1_ps(weights[t]);
+                    auto it = std::lower_bound(target.vertices.begin(),
+                                               target.vertices.end(), batch.begin);
+                    for (; it != target.vertices.end() && *it < batch.end; ++it)
+                        AddDelta(out[*it], target.deltas[it - target.vertices.begin()],
+                                 weight);
+                }
+
+                Box &box = boxes[b];
+                for (uint32_t v = batch.begin; v < batch.end; v++) {
+                    Vertex &vertex = out[v];
+                    if (!active.empty()) {
+                        vertex.normal.Normalize();
+                        vertex.tangent.Normalize();
+                        vertex.bitangent.Normalize();
+                    }
+                    box.min = Vector3::Min(box.min, vertex.position);
+                    box.max = Vector3::Max(box.max, vertex.position);
+                }
+            }
+        });
+
+        MeshBounds bounds;
+        if (boxes.empty())
+            return bounds;
+        Box total;
+        for (const Box &box : boxes) {
+            total.min = Vector3::Min(total.min, box.min);
+            total.max = Vector3::Max(total.max, box.max);
+        }
+        bounds.aabbMin = total.min;
+        bounds.aabbMax = total.max;
+        bounds.center = (total.min + total.max) * 0.5f;
+        bounds.radius = (total.max - bounds.center).Length();
+        return bounds;
+    }
+}
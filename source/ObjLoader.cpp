@@ -0,0 +1,1067 @@
+#include "ObjLoader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+#include "Logger.h"
+#include "MappedIOSystem.h"
+#include "MeshOptimizer.h"
+#include "MeshStreamer.h"
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    const int32_t kMissing = INT32_MIN;
+    const size_t kMinChunkBytes = size_t(1) << 20;
+    const size_t kMaxStreamChunkBytes = size_t(64) << 20;
+    // Corners per weld shard and per scatter block of a large mesh.
+    const size_t kShardCorners = size_t(1) << 16;
+    const int kMaxShardBits = 6;
+
+    // One face corner. Positive OBJ indices are stored 0-based and global,
+    // negative ones relative to the chunk until the merge rebases them.
+    struct Corner {
+        int32_t v, t, n;
+    };
+
+    enum RelativeBits : uint8_t { kRelativeV = 1, kRelativeT = 2, kRelativeN = 4 };
+
+    struct GroupEvent {
+        uint32_t face; // first chunk-local face it applies to
+        bool material; // usemtl, otherwise o or g
+        std::string name;
+    };
+
+    struct Chunk {
+        const char *begin = nullptr;
+        const char *end = nullptr;
+
+        std::vector<float> positions; // xyz
+        std::vector<float> uvs;       // uv
+        std::vector<float> normals;   // xyz
+        std::vector<Corner> corners;
+        std::vector<uint8_t> relative; // RelativeBits per corner, empty if none
+        std::vector<uint32_t> faceStarts;
+        std::vector<GroupEvent> events;
+        std::vector<std::string> mtllibs;
+        bool ok = true;
+    };
+
+    struct Segment {
+        size_t faceBegin, faceEnd;
+        std::string material;
+    };
+
+    // The merged file.
+    struct Model {
+        std::vector<float> positions, uvs, normals;
+        std::vector<Corner> corners;
+        std::vector<size_t> faceStarts; // one past the last face too
+        std::vector<Segment> segments;
+        std::vector<std::string> mtllibs;
+    };
+
+    struct MaterialMaps {
+        std::string baseColor;
+        std::string normal;
+        std::string orm;
+    };
+
+    inline bool IsSpace(char c) { return c == ' ' || c == '\t'; }
+
+    inline const char *SkipSpace(const char *p, const char *end) {
+        while (p < end && IsSpace(*p))
+            p++;
+        return p;
+    }
+
+    std::string_view Trim(const char *p, const char *end) {
+        p = SkipSpace(p, end);
+        while (end > p && (IsSpace(end[-1]) || end[-1] == '\r'))
+            end--;
+        return std::string_view(p, size_t(end - p));
+    }
+
+    const char *ParseFloat(const char *p, const char *end, float &value) {
+        p = SkipSpace(p, end);
+        if (p < end && *p == '+')
+            p++;
+        const auto result = std::from_chars(p, end, value);
+        if (result.ec == std::errc::result_out_of_range)
+            value = 0.0f; // denormals, which Assimp reads as zero too
+        else if (result.ec != std::errc())
+            return nullptr;
+        return result.ptr;
+    }
+
+    const char *ParseIndex(const char *p, const char *end, int32_t &value) {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        const char *digits = p;
+        int64_t v = 0;
+        while (p < end && unsigned(*p - '0') < 10) {
+            v = v * 10 + (*p++ - '0');
+            if (v > INT32_MAX)
+                return nullptr;
+        }
+        if (p == digits)
+            return nullptr;
+        value = negative ? -int32_t(v) : int32_t(v);
+        return p;
+    }
+
+    // 1-based or negative OBJ index to the Corner convention. Zero is not
+    // a valid OBJ index.
+    inline bool ResolveIndex(int32_t index, size_t count, uint8_t bit,
+                             int32_t &out, uint8_t &relative) {
+        if (index > 0) {
+            out = index - 1;
+        } else if (index < 0) {
+            out = int32_t(int64_t(count) + index);
+            relative |= bit;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool ParseFace(const char *p, const char *end, Chunk &chunk) {
+        const size_t first = chunk.corners.size();
+        while (true) {
+            p = SkipSpace(p, end);
+            if (p == end)
+                break;
+
+            Corner c = {kMissing, kMissing, kMissing};
+            uint8_t relative = 0;
+            int32_t index;
+            if (!(p = ParseIndex(p, end, index)) ||
+                !ResolveIndex(index, chunk.positions.size() / 3, kRelativeV, c.v,
+                              relative))
+                return false;
+            if (p < end && *p == '/') {
+                p++;
+                if (p < end && *p != '/') {
+                    if (!(p = ParseIndex(p, end, index)) ||
+                        !ResolveIndex(index, chunk.uvs.size() / 2, kRelativeT, c.t,
+                                      relative))
+                        return false;
+                }
+                if (p < end && *p == '/') {
+                    p++;
+                    if (!(p = ParseIndex(p, end, index)) ||
+                        !ResolveIndex(index, chunk.normals.size() / 3, kRelativeN,
+                                      c.n, relative))
+                        return false;
+                }
+            }
+            if (p < end && !IsSpace(*p))
+                return false;
+
+            chunk.corners.push_back(c);
+            if (relative || !chunk.relative.empty()) {
+                chunk.relative.resize(chunk.corners.size(), 0);
+                chunk.relative.back() = relative;
+            }
+        }
+        // Points and lines have no triangles; Assimp drops them as well.
+        if (chunk.corners.size() - first < 3) {
+            chunk.corners.resize(first);
+            return true;
+        }
+        chunk.faceStarts.push_back(uint32_t(first));
+        return true;
+    }
+
+    bool ParseLine(const char *p, const char *end, Chunk &chunk) {
+        p = SkipSpace(p, end);
+        if (p == end)
+            return true;
+
+        // Keyword and the rest of the line.
+        const char *keyEnd = p;
+        while (keyEnd < end && !IsSpace(*keyEnd))
+            keyEnd++;
+        const std::string_view key(p, size_t(keyEnd - p));
+        const char *rest = keyEnd;
+
+        float value[3];
+        if (key == "v") {
+            for (int i = 0; i < 3; i++) {
+                if (!(rest = ParseFloat(rest, end, value[i])))
+                    return false;
+            }
+            chunk.positions.insert(chunk.positions.end(), value, value + 3);
+        } else if (key == "vt") {
+            if (!(rest = ParseFloat(rest, end, value[0])))
+                return false;
+            if (SkipSpace(rest, end) == end || !ParseFloat(rest, end, value[1]))
+                value[1] = 0.0f;
+            chunk.uvs.insert(chunk.uvs.end(), value, value + 2);
+        } else if (key == "vn") {
+            for (int i = 0; i < 3; i++) {
+                if (!(rest = ParseFloat(rest, end, value[i])))
+                    return false;
+            }
+            chunk.normals.insert(chunk.normals.end(), value, value + 3);
+        } else if (key == "f") {
+            return ParseFace(rest, end, chunk);
+        } else if (key == "o" || key == "g" || key == "usemtl") {
+            const uint32_t face = uint32_t(chunk.faceStarts.size());
+            chunk.events.push_back({face, key == "usemtl", std::string(Trim(rest, end))});
+        } else if (key == "mtllib") {
+            chunk.mtllibs.emplace_back(Trim(rest, end));
+        }
+        // Comments, smoothing groups, lines and the rest don't affect meshes.
+        return true;
+    }
+
+    // Ends the chunk starting at p after the first newline past target bytes.
+    const char *ChunkEnd(const char *p, const char *fileEnd, size_t target) {
+        const char *next = p + std::min(target, size_t(fileEnd - p));
+        if (next < fileEnd) {
+            const char *eol = static_cast<const char *>(
+                std::memchr(next, '\n', size_t(fileEnd - next)));
+            next = eol ? eol + 1 : fileEnd;
+        }
+        return next;
+    }
+
+    void ParseChunk(Chunk &chunk) {
+        // Rough reservations from typical line lengths avoid most regrowth.
+        const size_t bytes = size_t(chunk.end - chunk.begin);
+        chunk.positions.reserve(bytes / 32 * 3);
+        chunk.corners.reserve(bytes / 16);
+        chunk.faceStarts.reserve(bytes / 48);
+
+        const char *p = chunk.begin;
+        while (p < chunk.end) {
+            const char *eol = static_cast<const char *>(
+                std::memchr(p, '\n', size_t(chunk.end - p)));
+            if (!eol)
+                eol = chunk.end;
+            const char *lineEnd = eol;
+            if (lineEnd > p && lineEnd[-1] == '\r')
+                lineEnd--;
+            if (!ParseLine(p, lineEnd, chunk)) {
+                chunk.ok = false;
+                return;
+            }
+            p = eol + 1;
+        }
+    }
+
+    // A new mesh starts at every o, g and usemtl, as in Assimp's
+    // ObjFileParser, and empty ones are dropped. start is the first face of
+    // the open segment.
+    void AddSegments(Chunk &chunk, size_t faceBase, std::string &material, size_t &start,
+                     std::vector<Segment> &segments) {
+        for (auto &event : chunk.events) {
+            const size_t face = faceBase + event.face;
+            if (face > start)
+                segments.push_back({start, face, material});
+            start = face;
+            if (event.material)
+                material = std::move(event.name);
+        }
+    }
+
+    // Appends the chunks to one model in parallel, rebasing relative indices
+    // and checking every index against the final attribute counts.
+    bool MergeChunks(std::vector<Chunk> &chunks, Model &model) {
+        const size_t count = chunks.size();
+        std::vector<size_t> positionBase(count + 1, 0), uvBase(count + 1, 0),
+            normalBase(count + 1, 0), cornerBase(count + 1, 0), faceBase(count + 1, 0);
+        for (size_t i = 0; i < count; i++) {
+            positionBase[i + 1] = positionBase[i] + chunks[i].positions.size() / 3;
+            uvBase[i + 1] = uvBase[i] + chunks[i].uvs.size() / 2;
+            normalBase[i + 1] = normalBase[i] + chunks[i].normals.size() / 3;
+            cornerBase[i + 1] = cornerBase[i] + chunks[i].corners.size();
+            faceBase[i + 1] = faceBase[i] + chunks[i].faceStarts.size();
+        }
+        if (positionBase[count] > size_t(INT32_MAX) || uvBase[count] > size_t(INT32_MAX) ||
+            normalBase[count] > size_t(INT32_MAX))
+            return false;
+
+        model.positions.resize(positionBase[count] * 3);
+        model.uvs.resize(uvBase[count] * 2);
+        model.normals.resize(normalBase[count] * 3);
+        model.corners.resize(cornerBase[count]);
+        model.faceStarts.resize(faceBase[count] + 1);
+        model.faceStarts.back() = cornerBase[count];
+
+        std::vector<char> valid(count, 1);
+        ParallelFor(count, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                Chunk &chunk = chunks[i];
+                std::copy(chunk.positions.begin(), chunk.positions.end(),
+                          model.positions.begin() + positionBase[i] * 3);
+                std::copy(chunk.uvs.begin(), chunk.uvs.end(),
+                          model.uvs.begin() + uvBase[i] * 2);
+                std::copy(chunk.normals.begin(), chunk.normals.end(),
+                          model.normals.begin() + normalBase[i] * 3);
+
+                auto rebase = [](int32_t index, bool relative, size_t base,
+                                 size_t total, int32_t &out) {
+                    if (index == kMissing) {
+                        out = kMissing;
+                        return true;
+                    }
+                    const int64_t global = int64_t(index) + (relative ? int64_t(base) : 0);
+                    out = int32_t(global);
+                    return global >= 0 && global < int64_t(total);
+                };
+
+                Corner *out = model.corners.data() + cornerBase[i];
+                for (size_t c = 0; c < chunk.corners.size(); c++) {
+                    const Corner &in = chunk.corners[c];
+                    const uint8_t relative = c < chunk.relative.size() ? chunk.relative[c] : 0;
+                    if (!rebase(in.v, relative & kRelativeV, positionBase[i],
+                                positionBase[count], out[c].v) ||
+                        !rebase(in.t, relative & kRelativeT, uvBase[i], uvBase[count],
+                                out[c].t) ||
+                        !rebase(in.n, relative & kRelativeN, normalBase[i],
+                                normalBase[count], out[c].n))
+                        valid[i] = 0;
+                }
+                for (size_t f = 0; f < chunk.faceStarts.size(); f++)
+                    model.faceStarts[faceBase[i] + f] = cornerBase[i] + chunk.faceStarts[f];
+
+                // The chunk's copy is no longer needed.
+                chunk.positions = std::vector<float>();
+                chunk.uvs = std::vector<float>();
+                chunk.normals = std::vector<float>();
+                chunk.corners = std::vector<Corner>();
+                chunk.relative = std::vector<uint8_t>();
+                chunk.faceStarts = std::vector<uint32_t>();
+            }
+        });
+        if (std::find(valid.begin(), valid.end(), 0) != valid.end())
+            return false;
+
+        std::string material;
+        size_t start = 0;
+        for (size_t i = 0; i < count; i++) {
+            AddSegments(chunks[i], faceBase[i], material, start, model.segments);
+            for (auto &lib : chunks[i].mtllibs)
+                model.mtllibs.push_back(std::move(lib));
+        }
+        if (faceBase[count] > start)
+            model.segments.push_back({start, faceBase[count], material});
+        return true;
+    }
+
+    inline uint32_t HashCorner(const Corner &c) {
+        uint64_t h = uint64_t(uint32_t(c.v)) * 0x9E3779B97F4A7C15ull;
+        h ^= uint64_t(uint32_t(c.t)) * 0xC2B2AE3D27D4EB4Full;
+        h ^= uint64_t(uint32_t(c.n)) * 0x165667B19E3779F9ull;
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 32;
+        return uint32_t(h);
+    }
+
+    inline bool SameCorner(const Corner &a, const Corner &b) {
+        return a.v == b.v && a.t == b.t && a.n == b.n;
+    }
+
+    // Welds the listed corners with an open-addressing table sized for the
+    // worst case, so it never grows. remap gets the index into unique.
+    void WeldCorners(const Corner *corners, const uint32_t *hashes, const uint32_t *order,
+                     size_t count, uint32_t *remap, std::vector<Corner> &unique) {
+        size_t capacity = 16;
+        while (capacity < count * 2)
+            capacity <<= 1;
+        const size_t mask = capacity - 1;
+        std::vector<uint32_t> table(capacity, 0); // unique index + 1
+        unique.clear();
+
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t c = order ? order[i] : uint32_t(i);
+            const Corner &corner = corners[c];
+            for (size_t slot = hashes[c] & mask;; slot = (slot + 1) & mask) {
+                const uint32_t entry = table[slot];
+                if (entry == 0) {
+                    unique.push_back(corner);
+                    table[slot] = uint32_t(unique.size());
+                    remap[c] = uint32_t(unique.size() - 1);
+                    break;
+                }
+                if (SameCorner(unique[entry - 1], corner)) {
+                    remap[c] = entry - 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Assimp's TriangulateProcess starts a quad at its concave corner.
+    int QuadStart(const float *positions, const Corner *face) {
+        for (int i = 0; i < 4; i++) {
+            auto position = [&](int k) {
+                const float *p = positions + size_t(face[k % 4].v) * 3;
+                return Vector3(p[0], p[1], p[2]);
+            };
+            const Vector3 v = position(i);
+            Vector3 left = position(i + 3) - v;
+            Vector3 diag = position(i + 2) - v;
+            Vector3 right = position(i + 1) - v;
+            left.Normalize();
+            diag.Normalize();
+            right.Normalize();
+            const float angle = std::acos(std::clamp(left.Dot(diag), -1.0f, 1.0f)) +
+                                std::acos(std::clamp(right.Dot(diag), -1.0f, 1.0f));
+            if (angle > 3.14159265f)
+                return i;
+        }
+        return 0;
+    }
+
+    size_t TriangleCount(const Model &model, size_t face) {
+        return model.faceStarts[face + 1] - model.faceStarts[face] - 2;
+    }
+
+    void BuildMesh(const Model &model, const Segment &segment, MeshData &mesh) {
+        const size_t cornerBegin = model.faceStarts[segment.faceBegin];
+        const size_t cornerCount = model.faceStarts[segment.faceEnd] - cornerBegin;
+        const Corner *corners = model.corners.data() + cornerBegin;
+
+        std::vector<uint32_t> hashes(cornerCount);
+        ParallelFor(cornerCount, kShardCorners, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++)
+                hashes[c] = HashCorner(corners[c]);
+        });
+
+        // Large meshes are split by the top hash bits into shards that weld
+        // independently. The shard count depends only on the corner count,
+        // so the vertex order is the same for any number of threads.
+        int shardBits = 0;
+        while (shardBits < kMaxShardBits && (kShardCorners << shardBits) < cornerCount)
+            shardBits++;
+        const size_t shards = size_t(1) << shardBits;
+
+        std::vector<uint32_t> remap(cornerCount);
+        std::vector<std::vector<Corner>> unique(shards);
+        std::vector<uint32_t> order;
+        std::vector<size_t> shardStart(shards + 1, 0);
+        if (shards == 1) {
+            WeldCorners(corners, hashes.data(), nullptr, cornerCount, remap.data(), unique[0]);
+            shardStart[1] = cornerCount;
+        } else {
+            // Stable counting sort of the corners by shard.
+            auto shardOf = [&](size_t c) { return hashes[c] >> (32 - shardBits); };
+            const size_t blocks = (cornerCount + kShardCorners - 1) / kShardCorners;
+            std::vector<size_t> offsets(blocks * shards, 0);
+            ParallelFor(blocks, 1, [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; b++) {
+                    const size_t last = std::min(cornerCount, (b + 1) * kShardCorners);
+                    for (size_t c = b * kShardCorners; c < last; c++)
+                        offsets[b * shards + shardOf(c)]++;
+                }
+            });
+            size_t running = 0;
+            for (size_t s = 0; s < shards; s++) {
+                shardStart[s] = running;
+                for (size_t b = 0; b < blocks; b++) {
+                    const size_t n = offsets[b * shards + s];
+                    offsets[b * shards + s] = running;
+                    running += n;
+                }
+            }
+            shardStart[shards] = running;
+
+            order.resize(cornerCount);
+            ParallelFor(blocks, 1, [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; b++) {
+                    const size_t last = std::min(cornerCount, (b + 1) * kShardCorners);
+                    for (size_t c = b * kShardCorners; c < last; c++)
+                        order[offsets[b * shards + shardOf(c)]++] = uint32_t(c);
+                }
+            });
+
+            ParallelFor(shards, 1, [&](size_t begin, size_t end) {
+                for (size_t s = begin; s < end; s++)
+                    WeldCorners(corners, hashes.data(), order.data() + shardStart[s],
+                                shardStart[s + 1] - shardStart[s], remap.data(), unique[s]);
+            });
+        }
+        hashes = std::vector<uint32_t>();
+
+        std::vector<size_t> vertexBase(shards + 1, 0);
+        for (size_t s = 0; s < shards; s++)
+            vertexBase[s + 1] = vertexBase[s] + unique[s].size();
+        if (shards > 1) {
+            ParallelFor(shards, 1, [&](size_t begin, size_t end) {
+                for (size_t s = begin; s < end; s++) {
+                    for (size_t i = shardStart[s]; i < shardStart[s + 1]; i++)
+                        remap[order[i]] += uint32_t(vertexBase[s]);
+                }
+            });
+        }
+
+        // Vertices, converted like MakeLeftHanded and FlipUVs.
+        std::vector<Vertex> &vertices = mesh.vertices;
+        vertices.resize(vertexBase[shards]);
+        std::vector<char> shardHasUVs(shards, 0), shardMissingNormals(shards, 0);
+        ParallelFor(shards, 1, [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; s++) {
+                Vertex *out = vertices.data() + vertexBase[s];
+                for (size_t i = 0; i < unique[s].size(); i++) {
+                    const Corner &c = unique[s][i];
+                    Vertex v{};
+                    const float *p = &model.positions[size_t(c.v) * 3];
+                    v.position = Vector3(p[0], p[1], -p[2]);
+                    if (c.n != kMissing) {
+                        const float *n = &model.normals[size_t(c.n) * 3];
+                        v.normal = Vector3(n[0], n[1], -n[2]);
+                    } else {
+                        shardMissingNormals[s] = 1;
+                    }
+                    if (c.t != kMissing) {
+                        const float *t = &model.uvs[size_t(c.t) * 2];
+                        v.texcoord = Vector2(t[0], 1.0f - t[1]);
+                        shardHasUVs[s] = 1;
+                    }
+                    out[i] = v;
+                }
+            }
+        });
+
+        // Triangles with reversed winding. Quads follow Assimp, larger
+        // polygons are fanned.
+        const size_t faceCount = segment.faceEnd - segment.faceBegin;
+        const size_t faceBlock = kShardCorners / 4;
+        const size_t faceBlocks = (faceCount + faceBlock - 1) / faceBlock;
+        std::vector<size_t> triangleBase(faceBlocks + 1, 0);
+        ParallelFor(faceBlocks, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++) {
+                const size_t last = std::min(faceCount, (b + 1) * faceBlock);
+                for (size_t f = b * faceBlock; f < last; f++)
+                    triangleBase[b + 1] += TriangleCount(model, segment.faceBegin + f);
+            }
+        });
+        for (size_t b = 0; b < faceBlocks; b++)
+            triangleBase[b + 1] += triangleBase[b];
+
+        mesh.indices.resize(triangleBase[faceBlocks] * 3);
+        ParallelFor(faceBlocks, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++) {
+                uint32_t *out = mesh.indices.data() + triangleBase[b] * 3;
+                auto emit = [&](size_t a, size_t c1, size_t c2) {
+                    *out++ = remap[c2];
+                    *out++ = remap[c1];
+                    *out++ = remap[a];
+                };
+                const size_t last = std::min(faceCount, (b + 1) * faceBlock);
+                for (size_t f = b * faceBlock; f < last; f++) {
+                    const size_t first = model.faceStarts[segment.faceBegin + f] - cornerBegin;
+                    const size_t n = TriangleCount(model, segment.faceBegin + f) + 2;
+                    if (n == 4) {
+                        const size_t s = size_t(QuadStart(model.positions.data(), corners + first));
+                        emit(first + s, first + (s + 1) % 4, first + (s + 2) % 4);
+                        emit(first + s, first + (s + 2) % 4, first + (s + 3) % 4);
+                    } else {
+                        for (size_t k = 1; k + 1 < n; k++)
+                            emit(first, first + k, first + k + 1);
+                    }
+                }
+            }
+        });
+
+        // Smooth normals by position index for corners without vn, like
+        // GenSmoothNormals on the converted mesh.
+        if (std::find(shardMissingNormals.begin(), shardMissingNormals.end(), 1) !=
+            shardMissingNormals.end()) {
+            int32_t minV = INT32_MAX, maxV = 0;
+            for (const auto &shard : unique) {
+                for (const Corner &c : shard) {
+                    minV = std::min(minV, c.v);
+                    maxV = std::max(maxV, c.v);
+                }
+            }
+            std::vector<Vector3> accum(size_t(maxV - minV) + 1, Vector3(0.0f));
+            std::vector<int32_t> positionOf(vertices.size());
+            for (size_t s = 0; s < shards; s++) {
+                for (size_t i = 0; i < unique[s].size(); i++)
+                    positionOf[vertexBase[s] + i] = unique[s][i].v - minV;
+            }
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                const uint32_t i0 = mesh.indices[i], i1 = mesh.indices[i + 1],
+                               i2 = mesh.indices[i + 2];
+                const Vector3 &p0 = vertices[i0].position;
+                Vector3 n = (vertices[i1].position - p0).Cross(vertices[i2].position - p0);
+                n.Normalize();
+                accum[positionOf[i0]] += n;
+                accum[positionOf[i1]] += n;
+                accum[positionOf[i2]] += n;
+            }
+            for (size_t s = 0; s < shards; s++) {
+                for (size_t i = 0; i < unique[s].size(); i++) {
+                    if (unique[s][i].n != kMissing)
+                        continue;
+                    Vertex &v = vertices[vertexBase[s] + i];
+                    v.normal = accum[positionOf[vertexBase[s] + i]];
+                    v.normal.Normalize();
+                }
+            }
+        }
+
+        if (std::find(shardHasUVs.begin(), shardHasUVs.end(), 1) != shardHasUVs.end()) {
+            ComputeTangents(mesh);
+        } else {
+            for (auto &v : vertices) {
+                v.tangent = Vector3(1.0f, 0.0f, 0.0f);
+                v.bitangent = Vector3(0.0f, 1.0f, 0.0f);
+            }
+        }
+    }
+
+    // The texture path is the last token when options like -bm or -s come
+    // first, otherwise the whole value so names may contain spaces.
+    std::string TexturePath(std::string_view value, const std::filesystem::path &directory) {
+        if (!value.empty() && value[0] == '-') {
+            const size_t space = value.find_last_of(" \t");
+            value = space == std::string_view::npos ? std::string_view() : value.substr(space + 1);
+        }
+        if (value.empty())
+            return std::string();
+        std::string name(value);
+        std::replace(name.begin(), name.end(), '\\', '/');
+
+        // Exporters often leave absolute paths from another machine; the
+        // name lookup in ModelLoader handles those better.
+        const std::filesystem::path path = directory / std::filesystem::path(name);
+        std::error_code ec;
+        return std::filesystem::is_regular_file(path, ec) ? path.string() : std::string();
+    }
+
+    void ReadMtl(const std::filesystem::path &path,
+                 std::unordered_map<std::string, MaterialMaps> &maps,
+                 std::vector<std::string> &order) {
+        std::ifstream file(path);
+        if (!file) {
+            LOG_WARN(LogCategory::Loader, "OBJ: cannot open material library %s",
+                     path.string().c_str());
+            return;
+        }
+
+        const std::filesystem::path directory = path.parent_path();
+        MaterialMaps *current = nullptr;
+        std::string line;
+        while (std::getline(file, line)) {
+            const char *begin = line.data();
+            const char *end = begin + line.size();
+            const char *p = SkipSpace(begin, end);
+            const char *keyEnd = p;
+            while (keyEnd < end && !IsSpace(*keyEnd))
+                keyEnd++;
+            std::string key(p, keyEnd);
+            std::transform(key.begin(), key.end(), key.begin(),
+                           [](unsigned char c) { return char(std::tolower(c)); });
+            const std::string_view value = Trim(keyEnd, end);
+
+            if (key == "newmtl") {
+                const std::string name(value);
+                if (maps.find(name) == maps.end())
+                    order.push_back(name);
+                current = &maps[name];
+            } else if (!current) {
+                continue;
+            } else if (key == "map_kd") {
+                current->baseColor = TexturePath(value, directory);
+            } else if (key == "norm" || key == "map_bump" || key == "bump") {
+                current->normal = TexturePath(value, directory);
+            } else if (key == "map_pr") {
+                current->orm = TexturePath(value, directory);
+            }
+        }
+    }
+
+    // Written once by Stream's first pass, then mapped or read back.
+    struct SpillFile {
+        std::string path = TemporaryPath("obj");
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+
+        ~SpillFile() {
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+
+        template <typename T> void Write(const std::vector<T> &values) {
+            out.write(reinterpret_cast<const char *>(values.data()),
+                      std::streamsize(values.size() * sizeof(T)));
+        }
+    };
+	}
+
+    bool ObjLoader::Load(const std::string &filename) {
+        meshes.clear();
+        meshMaterials.clear();
+        materialNames.clear();
+
+        MappedIOSystem io;
+        std::unique_ptr<Assimp::IOStream> stream(io.Open(filename.c_str(), "rb"));
+        if (!stream)
+            return false;
+        const char *data =
+            reinterpret_cast<const char *>(static_cast<MappedIOStream *>(stream.get())->Data());
+        const size_t size = stream->FileSize();
+        if (!data || size == 0)
+            return false;
+
+        // Line-aligned chunks, several per thread so uneven ones balance.
+        const size_t target = std::max(
+            kMinChunkBytes, size / (size_t(ThreadPool::Get().ThreadCount()) * 8));
+        std::vector<Chunk> chunks;
+        const char *fileEnd = data + size;
+        for (const char *p = data; p < fileEnd;) {
+            const char *next = ChunkEnd(p, fileEnd, target);
+            chunks.emplace_back();
+            chunks.back().begin = p;
+            chunks.back().end = next;
+            p = next;
+        }
+
+        ParallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                ParseChunk(chunks[i]);
+        });
+        for (const auto &chunk : chunks) {
+            if (!chunk.ok) {
+                LOG_DEBUG(LogCategory::Loader, "OBJ fast path: unsupported syntax, "
+                                               "using Assimp for %s",
+                          filename.c_str());
+                return false;
+            }
+        }
+
+        Model model;
+        if (!MergeChunks(chunks, model)) {
+            LOG_DEBUG(LogCategory::Loader, "OBJ fast path: bad face index, "
+                                           "using Assimp for %s",
+                      filename.c_str());
+            return false;
+        }
+        chunks.clear();
+        stream.reset();
+        if (model.segments.empty())
+            return false;
+
+        std::vector<MeshData> built(model.segments.size());
+        ParallelFor(model.segments.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                BuildMesh(model, model.segments[i], built[i]);
+        });
+
+        const std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+        std::unordered_map<std::string, MaterialMaps> maps;
+        for (const auto &lib : model.mtllibs)
+            ReadMtl(directory / lib, maps, materialNames);
+
+        // Faces before any usemtl get Assimp's default material.
+        std::unordered_map<std::string, int> materialIndex;
+        for (size_t i = 0; i < materialNames.size(); i++)
+            materialIndex.emplace(materialNames[i], int(i));
+        for (size_t i = 0; i < built.size(); i++) {
+            const std::string &name = model.segments[i].material.empty()
+                                          ? std::string("DefaultMaterial")
+                                          : model.segments[i].material;
+            auto [it, added] = materialIndex.try_emplace(name, int(materialNames.size()));
+            if (added)
+                materialNames.push_back(name);
+
+            MeshData &mesh = built[i];
+            if (auto found = maps.find(name); found != maps.end()) {
+                mesh.baseColorFilename = found->second.baseColor;
+                mesh.normalFilename = found->second.normal;
+                mesh.ormFilename = found->second.orm;
+            }
+            meshes.push_back(std::move(mesh));
+            meshMaterials.push_back(it->second);
+        }
+        return true;
+    }
+
+    bool ObjLoader::Stream(const std::string &filename, const std::string &chunkFile,
+                           uint64_t memoryBudget) {
+        meshes.clear();
+        meshMaterials.clear();
+        materialNames.clear();
+
+        MappedIOSystem io;
+        std::unique_ptr<Assimp::IOStream> stream(io.Open(filename.c_str(), "rb"));
+        if (!stream)
+            return false;
+        const char *data =
+            reinterpret_cast<const char *>(static_cast<MappedIOStream *>(stream.get())->Data());
+        const size_t size = stream->FileSize();
+        if (!data || size == 0)
+            return false;
+
+        // First pass: a window of chunks is parsed in parallel, then its
+        // attributes, corners and face sizes are appended to spill files.
+        // A parsed chunk takes about three times its text.
+        const size_t windowChunks = size_t(ThreadPool::Get().ThreadCount()) * 2;
+        const size_t target = size_t(std::clamp<uint64_t>(
+            memoryBudget / 4 / (windowChunks * 3), kMinChunkBytes, kMaxStreamChunkBytes));
+
+        SpillFile positions, uvs, normals, corners, faces;
+        for (auto *file : {&positions, &uvs, &normals, &corners, &faces}) {
+            if (!file->out) {
+                LOG_ERROR(LogCategory::Loader, "Cannot create %s", file->path.c_str());
+                return false;
+            }
+        }
+
+        size_t counts[3] = {0, 0, 0}; // positions, uvs, normals
+        size_t faceCount = 0, cornerCount = 0;
+        Vector3 lower(FLT_MAX), upper(-FLT_MAX);
+        std::vector<Segment> segments;
+        std::vector<std::string> mtllibs;
+        std::string material;
+        size_t start = 0;
+
+        const char *fileEnd = data + size;
+        for (const char *p = data; p < fileEnd;) {
+            std::vector<Chunk> chunks;
+            while (chunks.size() < windowChunks && p < fileEnd) {
+                const char *next = ChunkEnd(p, fileEnd, target);
+                chunks.emplace_back();
+                chunks.back().begin = p;
+                chunks.back().end = next;
+                p = next;
+            }
+            ParallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    ParseChunk(chunks[i]);
+            });
+
+            for (auto &chunk : chunks) {
+                if (!chunk.ok) {
+                    LOG_ERROR(LogCategory::Loader, "OBJ: unsupported syntax in %s",
+                              filename.c_str());
+                    return false;
+                }
+                // Out of range results are caught in the second pass.
+                for (size_t c = 0; c < chunk.relative.size(); c++) {
+                    Corner &corner = chunk.corners[c];
+                    const uint8_t relative = chunk.relative[c];
+                    if (relative & kRelativeV)
+                        corner.v = int32_t(int64_t(corner.v) + int64_t(counts[0]));
+                    if (relative & kRelativeT)
+                        corner.t = int32_t(int64_t(corner.t) + int64_t(counts[1]));
+                    if (relative & kRelativeN)
+                        corner.n = int32_t(int64_t(corner.n) + int64_t(counts[2]));
+                }
+                for (size_t i = 0; i < chunk.positions.size(); i += 3) {
+                    const Vector3 v(chunk.positions[i], chunk.positions[i + 1],
+                                    chunk.positions[i + 2]);
+                    lower = Vector3::Min(lower, v);
+                    upper = Vector3::Max(upper, v);
+                }
+
+                std::vector<uint32_t> faceSizes(chunk.faceStarts.size());
+                for (size_t f = 0; f < faceSizes.size(); f++) {
+                    const uint32_t next = f + 1 < faceSizes.size()
+                                              ? chunk.faceStarts[f + 1]
+                                              : uint32_t(chunk.corners.size());
+                    faceSizes[f] = next - chunk.faceStarts[f];
+                }
+                positions.Write(chunk.positions);
+                uvs.Write(chunk.uvs);
+                normals.Write(chunk.normals);
+                corners.Write(chunk.corners);
+                faces.Write(faceSizes);
+
+                AddSegments(chunk, faceCount, material, start, segments);
+                for (auto &lib : chunk.mtllibs)
+                    mtllibs.push_back(std::move(lib));
+
+                counts[0] += chunk.positions.size() / 3;
+                counts[1] += chunk.uvs.size() / 2;
+                counts[2] += chunk.normals.size() / 3;
+                faceCount += faceSizes.size();
+                cornerCount += chunk.corners.size();
+            }
+            if ((std::max)({counts[0], counts[1], counts[2]}) > size_t(INT32_MAX)) {
+                LOG_ERROR(LogCategory::Loader, "OBJ: too many vertices in %s",
+                          filename.c_str());
+                return false;
+            }
+        }
+        if (faceCount > start)
+            segments.push_back({start, faceCount, material});
+        stream.reset();
+
+        for (auto *file : {&positions, &uvs, &normals, &corners, &faces}) {
+            file->out.close();
+            if (file->out.fail()) {
+                LOG_ERROR(LogCategory::Loader, "Cannot write %s", file->path.c_str());
+                return false;
+            }
+        }
+        if (segments.empty())
+            return false;
+
+        // Second pass: the attributes are mapped and the faces read back in
+        // batches, triangulated and converted like BuildMesh does.
+        std::unique_ptr<Assimp::IOStream> mapped[3];
+        const float *attributes[3] = {nullptr, nullptr, nullptr};
+        SpillFile *attributeFiles[3] = {&positions, &uvs, &normals};
+        for (int i = 0; i < 3; i++) {
+            if (counts[i] == 0)
+                continue;
+            mapped[i].reset(io.Open(attributeFiles[i]->path.c_str(), "rb"));
+            if (!mapped[i])
+                return false;
+            attributes[i] = reinterpret_cast<const float *>(
+                static_cast<MappedIOStream *>(mapped[i].get())->Data());
+        }
+        const float *positionData = attributes[0];
+        const float *uvData = attributes[1];
+        const float *normalData = attributes[2];
+        if (!positionData)
+            return false;
+
+        const std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+        std::unordered_map<std::string, MaterialMaps> maps;
+        for (const auto &lib : mtllibs)
+            ReadMtl(directory / lib, maps, materialNames);
+
+        MeshBounds bounds;
+        bounds.aabbMin = Vector3(lower.x, lower.y, -upper.z);
+        bounds.aabbMax = Vector3(upper.x, upper.y, -lower.z);
+        MeshStreamer streamer(bounds, cornerCount - 2 * faceCount, memoryBudget);
+
+        // One part per material, faces before any usemtl get Assimp's
+        // default material.
+        std::unordered_map<std::string, uint32_t> partOf;
+        std::vector<uint32_t> segmentParts;
+        for (const auto &segment : segments) {
+            const std::string name =
+                segment.material.empty() ? std::string("DefaultMaterial") : segment.material;
+            auto [it, added] = partOf.try_emplace(name, 0);
+            if (added) {
+                MeshPart part;
+                part.material = name;
+                if (auto found = maps.find(name); found != maps.end()) {
+                    part.baseColorFilename = found->second.baseColor;
+                    part.normalFilename = found->second.normal;
+                    part.ormFilename = found->second.orm;
+                }
+                part.hasTexcoords = counts[1] > 0;
+                it->second = streamer.AddPart(part);
+            }
+            segmentParts.push_back(it->second);
+        }
+
+        std::ifstream faceIn(faces.path, std::ios::binary);
+        std::ifstream cornerIn(corners.path, std::ios::binary);
+        const size_t batchFaces =
+            size_t(std::clamp<uint64_t>(memoryBudget / 16 / 256, 1 << 14, 1 << 20));
+        std::vector<uint32_t> sizes;
+        std::vector<Corner> batchCorners;
+        std::vector<size_t> cornerStart, triangleStart;
+        std::vector<StreamCorner> triangles;
+        size_t segment = 0;
+
+        auto convert = [&](const Corner &c) {
+            StreamCorner out;
+            const float *p = positionData + size_t(c.v) * 3;
+            out.position = Vector3(p[0], p[1], -p[2]);
+            out.normal = Vector3(0.0f);
+            out.texcoord = Vector2(0.0f);
+            if (c.n != kMissing) {
+                const float *n = normalData + size_t(c.n) * 3;
+                out.normal = Vector3(n[0], n[1], -n[2]);
+            }
+            if (c.t != kMissing) {
+                const float *t = uvData + size_t(c.t) * 2;
+                out.texcoord = Vector2(t[0], 1.0f - t[1]);
+            }
+            return out;
+        };
+        auto valid = [&](const Corner &c) {
+            return c.v >= 0 && size_t(c.v) < counts[0] &&
+                   (c.t == kMissing || (c.t >= 0 && size_t(c.t) < counts[1])) &&
+                   (c.n == kMissing || (c.n >= 0 && size_t(c.n) < counts[2]));
+        };
+
+        for (size_t first = 0; first < faceCount; first += batchFaces) {
+            const size_t n = std::min(batchFaces, faceCount - first);
+            sizes.resize(n);
+            faceIn.read(reinterpret_cast<char *>(sizes.data()),
+                        std::streamsize(n * sizeof(uint32_t)));
+            cornerStart.assign(n + 1, 0);
+            triangleStart.assign(n + 1, 0);
+            for (size_t f = 0; f < n; f++) {
+                cornerStart[f + 1] = cornerStart[f] + sizes[f];
+                triangleStart[f + 1] = triangleStart[f] + sizes[f] - 2;
+            }
+            batchCorners.resize(cornerStart[n]);
+            cornerIn.read(reinterpret_cast<char *>(batchCorners.data()),
+                          std::streamsize(batchCorners.size() * sizeof(Corner)));
+            if (!faceIn || !cornerIn) {
+                LOG_ERROR(LogCategory::Loader, "OBJ: cannot read back spilled faces");
+                return false;
+            }
+
+            triangles.resize(triangleStart[n] * 3);
+            std::atomic<bool> bad{false};
+            ParallelFor(n, 4096, [&](size_t begin, size_t end) {
+                for (size_t f = begin; f < end; f++) {
+                    const Corner *face = batchCorners.data() + cornerStart[f];
+                    const size_t k = sizes[f];
+                    if (!std::all_of(face, face + k, valid)) {
+                        bad = true;
+                        continue;
+                    }
+                    StreamCorner *out = triangles.data() + triangleStart[f] * 3;
+                    auto emit = [&](size_t a, size_t b, size_t c) {
+                        *out++ = convert(face[c]);
+                        *out++ = convert(face[b]);
+                        *out++ = convert(face[a]);
+                    };
+                    if (k == 4) {
+                        const size_t s = size_t(QuadStart(positionData, face));
+                        emit(s, (s + 1) % 4, (s + 2) % 4);
+                        emit(s, (s + 2) % 4, (s + 3) % 4);
+                    } else {
+                        for (size_t i = 1; i + 1 < k; i++)
+                            emit(0, i, i + 1);
+                    }
+                }
+            });
+            if (bad) {
+                LOG_ERROR(LogCategory::Loader, "OBJ: bad face index in %s", filename.c_str());
+                return false;
+            }
+
+            // Segments cover every face, so each run has one part.
+            for (size_t f = 0; f < n;) {
+                while (segments[segment].faceEnd <= first + f)
+                    segment++;
+                const size_t runEnd = std::min(n, segments[segment].faceEnd - first);
+                streamer.AddTriangles(segmentParts[segment],
+                                      triangles.data() + triangleStart[f] * 3,
+                                      triangleStart[runEnd] - triangleStart[f]);
+                f = runEnd;
+            }
+        }
+        return streamer.Finish(chunkFile);
+    }
+}
@@ -0,0 +1,283 @@
+#include "OcclusionCulling.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	void OcclusionBuffer::Resize(int width, int height) {
+        m_tilesX = std::max(1, (width + kTileWidth - 1) / kTileWidth);
+        m_tilesY = std::max(1, (height + kTileHeight - 1) / kTileHeight);
+        m_width = m_tilesX * kTileWidth;
+        m_height = m_tilesY * kTileHeight;
+        m_blocksX = m_width / kBlockSize;
+
+        m_depth.assign(size_t(m_width) * m_height, 1.0f);
+        m_hiz.assign(size_t(m_blocksX) * (m_height / kBlockSize), 1.0f);
+        m_bins.resize(size_t(m_tilesX) * m_tilesY);
+	}
+
+    void OcclusionBuffer::Rasterize(const std::vector<OccluderMesh> &occluders,
+                                    const Matrix &mvp) {
+        m_triangles.clear();
+        for (auto &bin : m_bins)
+            bin.clear();
+
+        const __m128 row0 = _mm_setr_ps(mvp._11, mvp._12, mvp._13, mvp._14);
+        const __m128 row1 = _mm_setr_ps(mvp._21, mvp._22, mvp._23, mvp._24);
+        const __m128 row2 = _mm_setr_ps(mvp._31, mvp._32, mvp._33, mvp._34);
+        const __m128 row3 = _mm_setr_ps(mvp._41, mvp._42, mvp._43, mvp._44);
+
+        const float halfW = 0.5f * float(m_width);
+        const float halfH = 0.5f * float(m_height);
+
+        for (const auto &occluder : occluders) {
+            const size_t vertexCount = occluder.positions.size();
+            m_clip.resize(vertexCount * 4);
+
+            ParallelFor(vertexCount, 4096, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    const Vector3 &p = occluder.positions[i];
+                    __m128 c = _mm_mul_ps(_mm_set1_ps(p.x), row0);
+                    c = _mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(p.y), row1));
+                    c = _mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(p.z), row2));
+                    c = _mm_add_ps(c, row3);
+                    _mm_storeu_ps(&m_clip[i * 4], c);
+                }
+            });
+
+            for (size_t t = 0; t + 2 < occluder.indices.size(); t += 3) {
+                ScreenTriangle tri;
+                bool clipped = false;
+                for (int k = 0; k < 3; k++) {
+                    const float *c = &m_clip[occluder.indices[t + k] * 4];
+                    // Triangles crossing the near plane are dropped, which
+                    // only ever makes the buffer less occluding.
+                    if (c[3] <= 1e-6f || c[2] < 0.0f) {
+                        clipped = true;
+                        break;
+                    }
+                    const float invW = 1.0f / c[3];
+                    tri.x[k] = (c[0] * invW + 1.0f) * halfW;
+                    tri.y[k] = (1.0f - c[1] * invW) * halfH;
+                    tri.z[k] = c[2] * invW;
+                }
+                if (clipped)
+                    continue;
+
+                const float minX = std::min({tri.x[0], tri.x[1], tri.x[2]});
+                const float maxX = std::max({tri.x[0], tri.x[1], tri.x[2]});
+                const float minY = std::min({tri.y[0], tri.y[1], tri.y[2]});
+                const float maxY = std::max({tri.y[0], tri.y[1], tri.y[2]});
+                if (maxX < 0.0f || maxY < 0.0f || minX >= float(m_width) ||
+                    minY >= float(m_height))
+                    continue;
+
+                const float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) -
+                                   (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+                if (std::fabs(area) < 1e-8f)
+                    continue;
+                if (area < 0.0f) {
+                    // Occluders are two-sided; keep one winding for setup.
+                    std::swap(tri.x[1], tri.x[2]);
+                    std::swap(tri.y[1], tri.y[2]);
+                    std::swap(tri.z[1], tri.z[2]);
+                }
+
+                const uint32_t index = uint32_t(m_triangles.size());
+                m_triangles.push_back(tri);
+
+                // Clamped while still float, off-screen vertices can be
+                // far outside the int range.
+                const int tx0 = int(std::max(minX, 0.0f)) / kTileWidth;
+                const int ty0 = int(std::max(minY, 0.0f)) / kTileHeight;
+                const int tx1 = int(std::min(maxX, float(m_width - 1))) / kTileWidth;
+                const int ty1 = int(std::min(maxY, float(m_height - 1))) / kTileHeight;
+                for (int ty = ty0; ty <= ty1; ty++)
+                    for (int tx = tx0; tx <= tx1; tx++)
+                        m_bins[ty * m_tilesX + tx].push_back(index);
+            }
+        }
+
+        ParallelFor(m_bins.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; tile++)
+                RasterizeTile(int(tile));
+        });
+    }
+
+    void OcclusionBuffer::RasterizeTile(int tile) {
+        const int tileX0 = (tile % m_tilesX) * kTileWidth;
+        const int tileY0 = (tile / m_tilesX) * kTileHeight;
+
+        for (int y = tileY0; y < tileY0 + kTileHeight; y++)
+            std::fill_n(&m_depth[size_t(y) * m_width + tileX0], kTileWidth,
+                        1.0f);
+
+        const __m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (uint32_t index : m_bins[tile]) {
+            const ScreenTriangle &tri = m_triangles[index];
+
+            // Edge functions e = a*x + b*y + c, positive inside.
+            float ea[3], eb[3], ec[3];
+            for (int i = 0; i < 3; i++) {
+                const int j = (i + 1) % 3;
+                ea[i] = -(tri.y[j] - tri.y[i]);
+                eb[i] = tri.x[j] - tri.x[i];
+                ec[i] = -eb[i] * tri.y[i] - ea[i] * tri.x[i];
+            }
+
+            // Depth plane from the barycentrics of vertices 1 and 2.
+            const float invArea =
+                1.0f / (ea[0] * tri.x[2] + eb[0] * tri.y[2] + ec[0]);
+            const float dz1 = (tri.z[1] - tri.z[0]) * invArea;
+            const float dz2 = (tri.z[2] - tri.z[0]) * invArea;
+            const float za = ea[2] * dz1 + ea[0] * dz2;
+            const float zb = eb[2] * dz1 + eb[0] * dz2;
+            const float zc = tri.z[0] + ec[2] * dz1 + ec[0] * dz2;
+
+            const float minX = std::min({tri.x[0], tri.x[1], tri.x[2]});
+            const float maxX = std::max({tri.x[0], tri.x[1], tri.x[2]});
+            const float minY = std::min({tri.y[0], tri.y[1], tri.y[2]});
+            const float maxY = std::max({tri.y[0], tri.y[1], tri.y[2]});
+
+            const int x0 = int(std::floor(std::max(minX, float(tileX0)))) & ~3;
+            const int x1 = int(std::ceil(std::min(maxX, float(tileX0 + kTileWidth))));
+            const int y0 = int(std::floor(std::max(minY, float(tileY0))));
+            const int y1 = int(std::ceil(std::min(maxY, float(tileY0 + kTileHeight))));
+
+            const __m128 a0 = _mm_set1_ps(ea[0]), a1 = _mm_set1_ps(ea[1]),
+                         a2 = _mm_set1_ps(ea[2]), az = _mm_set1_ps(za);
+
+            for (int y = y0; y < y1; y++) {
+                const float py = float(y) + 0.5f;
+                const __m128 r0 = _mm_set1_ps(eb[0] * py + ec[0]);
+                const __m128 r1 = _mm_set1_ps(eb[1] * py + ec[1]);
+                const __m128 r2 = _mm_set1_ps(eb[2] * py + ec[2]);
+                const __m128 rz = _mm_set1_ps(zb * py + zc);
+                float *row = &m_depth[size_t(y) * m_width];
+
+                for (int x = x0; x < x1; x += 4) {
+                    const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), laneOffset);
+                    const __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+                    const __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+                    const __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+                    const __m128 inside = _mm_and_ps(
+                        _mm_cmpge_ps(e0, zero),
+                        _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+                    if (!_mm_movemask_ps(inside))
+                        continue;
+
+                    const __m128 z = _mm_add_ps(_mm_mul_ps(az, px), rz);
+                    const __m128 old = _mm_loadu_ps(row + x);
+                    const __m128 nearer = _mm_min_ps(old, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer),
+                                                     _mm_andnot_ps(inside, old)));
+                }
+            }
+        }
+
+        for (int by = tileY0; by < tileY0 + kTileHeight; by += kBlockSize) {
+            for (int bx = tileX0; bx < tileX0 + kTileWidth; bx += kBlockSize) {
+                __m128 farthest = _mm_setzero_ps();
+                for (int y = by; y < by + kBlockSize; y++) {
+                    const float *row = &m_depth[size_t(y) * m_width + bx];
+                    farthest = _mm_max_ps(farthest, _mm_loadu_ps(row));
+                    farthest = _mm_max_ps(farthest, _mm_loadu_ps(row + 4));
+                }
+                alignas(16) float lanes[4];
+                _mm_store_ps(lanes, farthest);
+                m_hiz[(by / kBlockSize) * m_blocksX + bx / kBlockSize] =
+                    std::max(std::max(lanes[0], lanes[1]),
+                             std::max(lanes[2], lanes[3]));
+            }
+        }
+    }
+
+    bool OcclusionBuffer::IsVisible(const MeshBounds &bounds,
+                                    const Matrix &mvp) const {
+        if (m_width == 0)
+            return true;
+
+        float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+        float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+        for (int i = 0; i < 8; i++) {
+            const float px = (i & 1) ? bounds.aabbMax.x : bounds.aabbMin.x;
+            const float py = (i & 2) ? bounds.aabbMax.y : bounds.aabbMin.y;
+            const float pz = (i & 4) ? bounds.aabbMax.z : bounds.aabbMin.z;
+            const float cx = px * mvp._11 + py * mvp._21 + pz * mvp._31 + mvp._41;
+            const float cy = px * mvp._12 + py * mvp._22 + pz * mvp._32 + mvp._42;
+            const float cz = px * mvp._13 + py * mvp._23 + pz * mvp._33 + mvp._43;
+            const float cw = px * mvp._14 + py * mvp._24 + pz * mvp._34 + mvp._44;
+
+            // Boxes touching the near plane cannot be tested reliably.
+            if (cw <= 1e-6f || cz < 0.0f)
+                return true;
+
+            const float invW = 1.0f / cw;
+            const float sx = (cx * invW + 1.0f) * 0.5f * float(m_width);
+            const float sy = (1.0f - cy * invW) * 0.5f * float(m_height);
+            minX = std::min(minX, sx);
+            maxX = std::max(maxX, sx);
+            minY = std::min(minY, sy);
+            maxY = std::max(maxY, sy);
+            minZ = std::min(minZ, cz * invW);
+        }
+
+        // Off-screen boxes are left to frustum culling.
+        if (maxX < 0.0f || maxY < 0.0f || minX >= float(m_width) ||
+            minY >= float(m_height))
+            return true;
+
+        // Clamped before the conversion, like the triangle bounds.
+        const int x0 = int(std::floor(std::max(minX, 0.0f)));
+        const int y0 = int(std::floor(std::max(minY, 0.0f)));
+        const int x1 = int(std::floor(std::min(maxX, float(m_width - 1))));
+        const int y1 = int(std::floor(std::min(maxY, float(m_height - 1))));
+
+        for (int by = y0 / kBlockSize; by <= y1 / kBlockSize; by++) {
+            for (int bx = x0 / kBlockSize; bx <= x1 / kBlockSize; bx++) {
+                if (minZ > m_hiz[by * m_blocksX + bx])
+                    continue;
+
+                // The block has nearer gaps; check the covered pixels.
+                const int px0 = std::max(x0, bx * kBlockSize);
+                const int px1 = std::min(x1, bx * kBlockSize + kBlockSize - 1);
+                const int py0 = std::max(y0, by * kBlockSize);
+                const int py1 = std::min(y1, by * kBlockSize + kBlockSize - 1);
+                for (int y = py0; y <= py1; y++) {
+                    const float *row = &m_depth[size_t(y) * m_width];
+                    for (int x = px0; x <= px1; x++) {
+                        if (minZ <= row[x])
+                            return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    void OcclusionBuffer::Cull(const std::vector<MeshBounds> &bounds,
+                               const Matrix &mvp,
+                               std::vector<uint32_t> &visible) const {
+        m_flags.resize(visible.size());
+        ParallelFor(visible.size(), 16, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                m_flags[i] = IsVisible(bounds[visible[i]], mvp) ? 1 : 0;
+        });
+
+        size_t out = 0;
+        for (size_t i = 0; i < visible.size(); i++) {
+            if (m_flags[i])
+                visible[out++] = visible[i];
+        }
+        visible.resize(out);
+    }
+}
@@ -0,0 +1,98 @@
+#include "Parallel.h"
+
+#include <algorithm>
+
+namespace hlab {
+
+	ThreadPool &ThreadPool::Get() {
+        static ThreadPool pool;
+        return pool;
+	}
+
+    ThreadPool::ThreadPool() {
+        const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 1; i < hw; i++)
+            m_threads.emplace_back([this]() { WorkerLoop(); });
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto &t : m_threads)
+            t.join();
+    }
+
+    bool ThreadPool::RunChunk(Job &job) {
+        const size_t begin = job.next.fetch_add(job.grain);
+        if (begin >= job.count)
+            return false;
+
+        const size_t end = std::min(job.count, begin + job.grain);
+        (*job.fn)(begin, end);
+        job.done.fetch_add(end - begin, std::memory_order_release);
+        return true;
+    }
+
+    void ThreadPool::WorkerLoop() {
+        for (;;) {
+            Job *job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+                if (m_stop)
+                    return;
+
+                job = m_jobs.front();
+                job->users.fetch_add(1);
+
+                // Rotate so several concurrent jobs share the workers.
+                m_jobs.pop_front();
+                if (job->next.load() < job->count)
+                    m_jobs.push_back(job);
+            }
+
+            while (RunChunk(*job)) {
+            }
+
+            job->users.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void ThreadPool::ParallelFor(size_t count, size_t grain,
+                                 const RangeFn &fn) {
+        if (m_threads.empty()) {
+            fn(0, count);
+            return;
+        }
+
+        Job job;
+        job.fn = &fn;
+        job.count = count;
+        job.grain = grain;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(&job);
+        }
+        m_wake.notify_all();
+
+        while (RunChunk(job)) {
+        }
+
+        // Once the job is off the queue no new worker can pick it up, so
+        // it is safe to return when the current users have drained.
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = std::find(m_jobs.begin(), m_jobs.end(), &job);
+            if (it != m_jobs.end())
+                m_jobs.erase(it);
+        }
+
+        while (job.done.load(std::memory_order_acquire) < count ||
+               job.users.load(std::memory_order_acquire) > 0)
+            std::this_thread::yield();
+    }
+}
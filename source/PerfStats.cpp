@@ -0,0 +1,41 @@
+#include "PerfStats.h"
+
+#include <algorithm>
+
+namespace hlab {
+
+    const int FrameStats::kHistorySize;
+
+    static AllocationCounter g_allocationCounter = nullptr;
+
+    void SetAllocationCounter(AllocationCounter counter) {
+        g_allocationCounter = counter;
+    }
+
+    uint64_t CurrentAllocationCount() {
+        return g_allocationCounter ? g_allocationCounter() : 0;
+    }
+
+	void FrameStats::AddFrame(float frameMs, float updateMs, float renderMs) {
+        m_frameMs[m_next] = frameMs;
+        m_next = (m_next + 1) % kHistorySize;
+        m_count = std::min(m_count + 1, kHistorySize);
+
+        m_updateMs = updateMs;
+        m_renderMs = renderMs;
+	}
+
+    float FrameStats::Percentile(float p) const {
+        if (m_count == 0)
+            return 0.0f;
+
+        m_scratch.assign(m_frameMs.begin(), m_frameMs.begin() + m_count);
+
+        size_t k = size_t(p / 100.0f * float(m_count - 1) + 0.5f);
+        k = std::min(k, m_scratch.size() - 1);
+
+        std::nth_element(m_scratch.begin(), m_scratch.begin() + k,
+                         m_scratch.end());
+        return m_scratch[k];
+    }
+}
@@ -0,0 +1,120 @@
+#include "SceneGraph.h"
+
+#include <algorithm>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+    const uint32_t SceneGraph::kNoParent;
+
+	uint32_t SceneGraph::AddNode(const std::string &name, uint32_t parent,
+                                 const Matrix &local) {
+        const uint32_t node = uint32_t(m_parents.size());
+        if (parent != kNoParent && parent >= node)
+            parent = kNoParent;
+
+        m_parents.push_back(parent);
+        m_depths.push_back(parent == kNoParent ? 0 : m_depths[parent] + 1);
+        m_names.push_back(name);
+        m_locals.push_back(local);
+        m_worlds.push_back(local);
+        m_dirty.push_back(0);
+        m_moved.push_back(0);
+        m_levelsValid = false;
+
+        SetLocal(node, local);
+        return node;
+	}
+
+    void SceneGraph::Clear() {
+        m_parents.clear();
+        m_depths.clear();
+        m_names.clear();
+        m_locals.clear();
+        m_worlds.clear();
+        m_dirty.clear();
+        m_moved.clear();
+        m_levelNodes.clear();
+        m_levelOffsets.clear();
+        m_levelsValid = false;
+        m_dirtyCount = 0;
+        m_minDirtyDepth = 0;
+        meshNodes.clear();
+    }
+
+    uint32_t SceneGraph::Find(const std::string &name) const {
+        for (size_t i = 0; i < m_names.size(); i++) {
+            if (m_names[i] == name)
+                return uint32_t(i);
+        }
+        return kNoParent;
+    }
+
+    void SceneGraph::SetLocal(uint32_t node, const Matrix &local) {
+        m_locals[node] = local;
+        if (m_dirty[node])
+            return;
+        m_dirty[node] = 1;
+        m_minDirtyDepth =
+            m_dirtyCount == 0 ? m_depths[node] : std::min(m_minDirtyDepth, m_depths[node]);
+        m_dirtyCount++;
+    }
+
+    // Counting sort by depth. Within a level the nodes keep their order,
+    // so neighbouring siblings stay next to each other in memory.
+    void SceneGraph::BuildLevels() {
+        uint32_t levels = 0;
+        for (uint32_t d : m_depths)
+            levels = std::max(levels, d + 1);
+
+        m_levelOffsets.assign(levels + 1, 0);
+        for (uint32_t d : m_depths)
+            m_levelOffsets[d + 1]++;
+        for (uint32_t d = 0; d < levels; d++)
+            m_levelOffsets[d + 1] += m_levelOffsets[d];
+
+        m_levelNodes.resize(m_depths.size());
+        std::vector<uint32_t> fill(m_levelOffsets.begin(), m_levelOffsets.end() - 1);
+        for (uint32_t i = 0; i < uint32_t(m_depths.size()); i++)
+            m_levelNodes[fill[m_depths[i]]++] = i;
+        m_levelsValid = true;
+    }
+
+    size_t SceneGraph::UpdateTransforms() {
+        std::fill(m_moved.begin(), m_moved.end(), 0);
+        if (m_dirtyCount == 0)
+            return 0;
+        if (!m_levelsValid)
+            BuildLevels();
+
+        // A node moves if it is dirty or its parent moved. Parents are a
+        // level up, so they are final before the level is processed.
+        std::atomic<size_t> updated{0};
+        const uint32_t levels = uint32_t(m_levelOffsets.size() - 1);
+        for (uint32_t d = m_minDirtyDepth; d < levels; d++) {
+            const uint32_t first = m_levelOffsets[d];
+            ParallelFor(m_levelOffsets[d + 1] - first, 256,
+                        [&](size_t begin, size_t end) {
+                            size_t count = 0;
+                            for (size_t k = first + begin; k < first + end; k++) {
+                                const uint32_t node = m_levelNodes[k];
+                                const uint32_t parent = m_parents[node];
+                                const bool parentMoved =
+                                    parent != kNoParent && m_moved[parent];
+                                if (!m_dirty[node] && !parentMoved)
+                                    continue;
+                                m_worlds[node] = parent == kNoParent
+                                                     ? m_locals[node]
+                                                     : m_locals[node] * m_worlds[parent];
+                                m_dirty[node] = 0;
+                                m_moved[node] = 1;
+                                count++;
+                            }
+                            updated += count;
+                        });
+        }
+        m_dirtyCount = 0;
+        return updated;
+    }
+}
@@ -0,0 +1,99 @@
+#include "ShaderCache.h"
+
+#include <cstring>
+#include <filesystem>
+
+#include "CacheFormats.h"
+#include "Hash.h"
+
+namespace hlab {
+
+	namespace {
+
+    namespace fs = std::filesystem;
+
+    // The quoted or bracketed name of an #include line, or empty.
+    std::string IncludeName(const std::string &line) {
+        size_t i = line.find_first_not_of(" \t");
+        if (i == std::string::npos || line[i] != '#')
+            return {};
+        i = line.find_first_not_of(" \t", i + 1);
+        if (i == std::string::npos || line.compare(i, 7, "include") != 0)
+            return {};
+        i = line.find_first_not_of(" \t", i + 7);
+        if (i == std::string::npos || (line[i] != '"' && line[i] != '<'))
+            return {};
+        const size_t end = line.find(line[i] == '"' ? '"' : '>', i + 1);
+        if (end == std::string::npos)
+            return {};
+        return line.substr(i + 1, end - i - 1);
+    }
+
+    bool HashSource(const fs::path &path, const fs::path &root, Hasher64 &hasher,
+                    std::vector<fs::path> &visited) {
+        std::error_code ec;
+        const fs::path canonical = fs::weakly_canonical(path, ec);
+        for (const fs::path &seen : visited) {
+            if (seen == canonical)
+                return true;
+        }
+        visited.push_back(canonical);
+
+        std::vector<uint8_t> bytes;
+        if (!ReadFileBytes(path.string(), bytes))
+            return false;
+        hasher.Update(path.filename().string());
+        hasher.UpdateValue(uint64_t(bytes.size()));
+        hasher.Update(bytes.data(), bytes.size());
+
+        const std::string text(bytes.begin(), bytes.end());
+        size_t begin = 0;
+        while (begin < text.size()) {
+            size_t end = text.find('\n', begin);
+            if (end == std::string::npos)
+                end = text.size();
+            const std::string name = IncludeName(text.substr(begin, end - begin));
+            begin = end + 1;
+            if (name.empty())
+                continue;
+
+            fs::path include = path.parent_path() / name;
+            if (!fs::exists(include, ec))
+                include = root / name;
+            if (!HashSource(include, root, hasher, visited))
+                return false;
+        }
+        return true;
+    }
+	}
+
+    bool ShaderCacheKey(const ShaderDesc &desc, uint64_t &key) {
+        Hasher64 hasher;
+        hasher.UpdateValue(kShaderCacheVersion);
+
+        const fs::path path(desc.filename);
+        std::vector<fs::path> visited;
+        if (!HashSource(path, path.parent_path(), hasher, visited))
+            return false;
+
+        // Lengths keep neighbouring strings from running into each other.
+        const auto updateString = [&](const std::string &s) {
+            hasher.UpdateValue(uint64_t(s.size()));
+            hasher.Update(s);
+        };
+        updateString(desc.entry);
+        updateString(desc.target);
+        hasher.UpdateValue(desc.flags);
+        hasher.UpdateValue(uint64_t(desc.defines.size()));
+        for (const auto &define : desc.defines) {
+            updateString(define.first);
+            updateString(define.second);
+        }
+        key = hasher.Digest();
+        return true;
+    }
+
+    bool IsShaderBytecode(const std::vector<uint8_t> &bytes) {
+        return bytes.size() >= 32 && std::memcmp(bytes.data(), "DXBC", 4) == 0;
+    }
+}
@@ -0,0 +1,142 @@
+#include "Skinning.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    const size_t kSkinBatch = 2048;
+
+    // Vertex as floats: position 0, normal 3, texcoord 6, tangent 8,
+    // bitangent 11.
+    static_assert(sizeof(Vertex) == 14 * sizeof(float), "Vertex layout");
+
+    inline __m128 Transform(__m128 x, __m128 y, __m128 z, const __m128 *rows) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, rows[0]), _mm_mul_ps(y, rows[1])),
+                          _mm_mul_ps(z, rows[2]));
+    }
+
+    // Normalizes the xyz of v. w is garbage and stays garbage.
+    inline __m128 Normalize3(__m128 v) {
+        const __m128 sq = _mm_mul_ps(v, v);
+        const float length2 = _mm_cvtss_f32(sq) +
+                              _mm_cvtss_f32(_mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1))) +
+                              _mm_cvtss_f32(_mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 2, 2, 2)));
+        if (length2 <= 0.0f)
+            return v;
+        return _mm_div_ps(v, _mm_set1_ps(std::sqrt(length2)));
+    }
+
+    // Skins [begin, end) and grows boxMin/boxMax by the positions.
+    void SkinRange(const Vertex *in, const VertexWeights *weights,
+                   size_t begin, size_t end, const Matrix *joints, Vertex *out,
+                   __m128 &boxMin, __m128 &boxMax) {
+        alignas(16) float v[16];
+        for (size_t i = begin; i < end; i++) {
+            const VertexWeights &w = weights[i];
+            __m128 rows[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(),
+                              _mm_setzero_ps()};
+            for (int k = 0; k < kMaxInfluences; k++) {
+                if (w.weights[k] == 0.0f)
+                    continue;
+                const float *m = &joints[w.joints[k]]._11;
+                const __m128 s = _mm_set1_ps(w.weights[k]);
+                for (int r = 0; r < 4; r++)
+                    rows[r] = _mm_add_ps(rows[r], _mm_mul_ps(s, _mm_loadu_ps(m + r * 4)));
+            }
+
+            const float *src = &in[i].position.x;
+            const __m128 p = _mm_add_ps(
+                Transform(_mm_set1_ps(src[0]), _mm_set1_ps(src[1]),
+                          _mm_set1_ps(src[2]), rows),
+                rows[3]);
+            const __m128 n = Normalize3(Transform(_mm_set1_ps(src[3]), _mm_set1_ps(src[4]),
+                                                  _mm_set1_ps(src[5]), rows));
+            const __m128 t = Normalize3(Transform(_mm_set1_ps(src[8]), _mm_set1_ps(src[9]),
+                                                  _mm_set1_ps(src[10]), rows));
+            const __m128 b = Normalize3(Transform(_mm_set1_ps(src[11]), _mm_set1_ps(src[12]),
+                                                  _mm_set1_ps(src[13]), rows));
+            boxMin = _mm_min_ps(boxMin, p);
+            boxMax = _mm_max_ps(boxMax, p);
+
+            // Each store's fourth lane is overwritten by the next one.
+            _mm_store_ps(v, p);
+            _mm_storeu_ps(v + 3, n);
+            v[6] = src[6];
+            v[7] = src[7];
+            _mm_storeu_ps(v + 8, t);
+            _mm_storeu_ps(v + 11, b);
+            std::memcpy(&out[i], v, sizeof(Vertex));
+        }
+    }
+
+    struct Box {
+        __m128 min = _mm_set1_ps(FLT_MAX);
+        __m128 max = _mm_set1_ps(-FLT_MAX);
+    };
+
+    MeshBounds BoundsOf(__m128 boxMin, __m128 boxMax) {
+        alignas(16) float mn[4];
+        alignas(16) float mx[4];
+        _mm_store_ps(mn, boxMin);
+        _mm_store_ps(mx, boxMax);
+        MeshBounds b;
+        if (mn[0] > mx[0])
+            return b;
+        b.aabbMin = Vector3(mn[0], mn[1], mn[2]);
+        b.aabbMax = Vector3(mx[0], mx[1], mx[2]);
+        b.center = (b.aabbMin + b.aabbMax) * 0.5f;
+        b.radius = (b.aabbMax - b.center).Length();
+        return b;
+    }
+	}
+
+    void ComputeJointMatrices(const MeshSkin &skin, const SceneGraph &graph,
+                              const Matrix &root, std::vector<Matrix> &joints) {
+        joints.resize(skin.inverseBind.size());
+        for (size_t j = 0; j < joints.size(); j++) {
+            const uint32_t node =
+                j < skin.jointNodes.size() ? skin.jointNodes[j] : SceneGraph::kNoParent;
+            joints[j] = node < graph.NodeCount()
+                            ? skin.inverseBind[j] * graph.World(node) * root
+                            : root;
+        }
+    }
+
+    MeshBounds SkinVertices(const Vertex *in, const VertexWeights *weights,
+                            size_t count, const Matrix *joints, Vertex *out) {
+        Box box;
+        SkinRange(in, weights, 0, count, joints, out, box.min, box.max);
+        return BoundsOf(box.min, box.max);
+    }
+
+    MeshBounds SkinMesh(const MeshData &mesh, const std::vector<Matrix> &joints,
+                        Vertex *out, const Vertex *source) {
+        if (!source)
+            source = mesh.vertices.data();
+        const size_t count = std::min(mesh.vertices.size(), mesh.skin.weights.size());
+        const size_t batches = (count + kSkinBatch - 1) / kSkinBatch;
+        std::vector<Box> boxes(batches);
+        ParallelFor(batches, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++) {
+                SkinRange(source, mesh.skin.weights.data(),
+                          b * kSkinBatch, std::min(count, (b + 1) * kSkinBatch),
+                          joints.data(), out, boxes[b].min, boxes[b].max);
+            }
+        });
+
+        Box total;
+        for (const Box &box : boxes) {
+            total.min = _mm_min_ps(total.min, box.min);
+            total.max = _mm_max_ps(total.max, box.max);
+        }
+        return BoundsOf(total.min, total.max);
+    }
+}
@@ -0,0 +1,562 @@
+#include "SoftwareRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    const size_t kChunkTriangles = 8192;
+
+    struct Lut {
+        float srgbToLinear[256];
+        uint8_t linearToGamma[4096]; // pow(x, 1 / 2.2) as in the pixel shader
+
+        Lut() {
+            for (int i = 0; i < 256; i++) {
+                const float c = float(i) / 255.0f;
+                srgbToLinear[i] = c <= 0.04045f
+                                      ? c / 12.92f
+                                      : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i < 4096; i++) {
+                const float c = std::pow(float(i) / 4095.0f, 1.0f / 2.2f);
+                linearToGamma[i] = uint8_t(c * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    const Lut &GetLut() {
+        static const Lut lut;
+        return lut;
+    }
+
+    uint8_t ToGamma(float c) {
+        c = std::min(std::max(c, 0.0f), 1.0f);
+        return GetLut().linearToGamma[int(c * 4095.0f + 0.5f)];
+    }
+
+    // Bilinear, wrap addressing, mip 0 only like the GPU textures.
+    Vector4 Sample(const ImageData &image, float u, float v, bool srgb) {
+        const float x = u * float(image.width) - 0.5f;
+        const float y = v * float(image.height) - 0.5f;
+        const float fx = std::floor(x);
+        const float fy = std::floor(y);
+        const float tx = x - fx;
+        const float ty = y - fy;
+
+        auto wrap = [](int i, int n) {
+            i %= n;
+            return i < 0 ? i + n : i;
+        };
+        const int x0 = wrap(int(fx), image.width);
+        const int y0 = wrap(int(fy), image.height);
+        const int x1 = x0 + 1 == image.width ? 0 : x0 + 1;
+        const int y1 = y0 + 1 == image.height ? 0 : y0 + 1;
+
+        const uint8_t *p00 = &image.pixels[(size_t(y0) * image.width + x0) * 4];
+        const uint8_t *p10 = &image.pixels[(size_t(y0) * image.width + x1) * 4];
+        const uint8_t *p01 = &image.pixels[(size_t(y1) * image.width + x0) * 4];
+        const uint8_t *p11 = &image.pixels[(size_t(y1) * image.width + x1) * 4];
+
+        const float *lut = GetLut().srgbToLinear;
+        float out[4];
+        for (int c = 0; c < 4; c++) {
+            float a, b, d, e;
+            if (srgb && c < 3) {
+                a = lut[p00[c]], b = lut[p10[c]], d = lut[p01[c]], e = lut[p11[c]];
+            } else {
+                a = p00[c] / 255.0f, b = p10[c] / 255.0f;
+                d = p01[c] / 255.0f, e = p11[c] / 255.0f;
+            }
+            const float top = a + (b - a) * tx;
+            const float bottom = d + (e - d) * tx;
+            out[c] = top + (bottom - top) * ty;
+        }
+        return Vector4(out[0], out[1], out[2], out[3]);
+    }
+
+    Vector3 BlinnPhong(const Vector3 &lightStrength, const Vector3 &lightVec,
+                       const Vector3 &normal, const Vector3 &toEye,
+                       const Material &mat) {
+        Vector3 halfway = toEye + lightVec;
+        halfway.Normalize();
+        const float hdotn = halfway.Dot(normal);
+        const Vector3 specular =
+            mat.specular * std::pow(std::max(hdotn, 0.0f), mat.shininess);
+
+        return mat.ambient + (mat.diffuse + specular) * lightStrength;
+    }
+
+    float CalcAttenuation(float d, float falloffStart, float falloffEnd) {
+        const float att = (falloffEnd - d) / (falloffEnd - falloffStart);
+        return std::min(std::max(att, 0.0f), 1.0f);
+    }
+
+    Vector3 ComputeDirectionalLight(const Light &L, const Material &mat,
+                                    const Vector3 &normal,
+                                    const Vector3 &toEye) {
+        const Vector3 lightVec = -L.direction;
+        const float ndotl = std::max(lightVec.Dot(normal), 0.0f);
+        return BlinnPhong(L.strength * ndotl, lightVec, normal, toEye, mat);
+    }
+
+    Vector3 ComputePointLight(const Light &L, const Material &mat,
+                              const Vector3 &pos, const Vector3 &normal,
+                              const Vector3 &toEye, bool spot) {
+        Vector3 lightVec = L.position - pos;
+        const float d = lightVec.Length();
+        if (d > L.fallOffEnd)
+            return Vector3(0.0f);
+
+        lightVec /= d;
+        const float ndotl = std::max(lightVec.Dot(normal), 0.0f);
+        Vector3 lightStrength = L.strength * ndotl;
+        lightStrength *= CalcAttenuation(d, L.fallOffStart, L.fallOffEnd);
+
+        if (spot) {
+            lightStrength *= std::pow(std::max(-lightVec.Dot(L.direction), 0.0f),
+                                      L.spotPower);
+        }
+        return BlinnPhong(lightStrength, lightVec, normal, toEye, mat);
+    }
+
+    void TransformRow(const Matrix &m, const float v[4], float out[4]) {
+        for (int c = 0; c < 4; c++)
+            out[c] = v[0] * m.m[0][c] + v[1] * m.m[1][c] + v[2] * m.m[2][c] +
+                     v[3] * m.m[3][c];
+    }
+
+    void NormalizeInPlace(float *v) {
+        const float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (len > 0.0f) {
+            v[0] /= len;
+            v[1] /= len;
+            v[2] /= len;
+        }
+    }
+    }
+
+    void SoftwareRenderer::Resize(int width, int height) {
+        m_width = std::max(1, width);
+        m_height = std::max(1, height);
+        m_tilesX = (m_width + kTileSize - 1) / kTileSize;
+        m_tilesY = (m_height + kTileSize - 1) / kTileSize;
+        m_stride = m_tilesX * kTileSize;
+
+        const size_t padded = size_t(m_stride) * m_tilesY * kTileSize;
+        m_depth.assign(padded, 1.0f);
+        m_color.assign(padded, m_clearColor);
+
+        m_target.width = m_width;
+        m_target.height = m_height;
+        m_target.pixels.assign(size_t(m_width) * m_height * 4, 0);
+    }
+
+    void SoftwareRenderer::Clear(const Vector4 &color) {
+        auto channel = [](float c) {
+            return uint32_t(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+        };
+        m_clearColor = channel(color.x) | channel(color.y) << 8 |
+                       channel(color.z) << 16 | channel(color.w) << 24;
+
+        std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+        std::fill(m_color.begin(), m_color.end(), m_clearColor);
+    }
+
+    void SoftwareRenderer::Draw(const MeshData &mesh,
+                                const SoftwareMaterial &material,
+                                const BasicVertexConstantBuffer &vsConstants,
+                                const BasicPixelConstantBuffer &psConstants) {
+        if (m_drawCount == m_draws.size())
+            m_draws.push_back(std::make_unique<DrawState>());
+        DrawState &draw = *m_draws[m_drawCount];
+        const uint32_t drawIndex = uint32_t(m_drawCount++);
+
+        draw.indices = &mesh.indices;
+        draw.material = material;
+        draw.constants = psConstants;
+
+        // The GPU reads the transposed matrices back as row-vector ones.
+        const Matrix model = vsConstants.model.Transpose();
+        const Matrix invTranspose = vsConstants.invTranspose.Transpose();
+        const Matrix viewProj =
+            vsConstants.view.Transpose() * vsConstants.projection.Transpose();
+
+        draw.vertices.resize(mesh.vertices.size());
+        ParallelFor(mesh.vertices.size(), 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const Vertex &in = mesh.vertices[i];
+                ShadedVertex &out = draw.vertices[i];
+
+                const float pos[4] = {in.position.x, in.position.y,
+                                      in.position.z, 1.0f};
+                float world[4];
+                TransformRow(model, pos, world);
+                TransformRow(viewProj, world, out.clip);
+
+                const float n[4] = {in.normal.x, in.normal.y, in.normal.z, 0.0f};
+                const float t[4] = {in.tangent.x, in.tangent.y, in.tangent.z,
+                                    0.0f};
+                const float b[4] = {in.bitangent.x, in.bitangent.y,
+                                    in.bitangent.z, 0.0f};
+                float tmp[4];
+
+                std::memcpy(out.attr, world, sizeof(float) * 3);
+                TransformRow(invTranspose, n, tmp);
+                NormalizeInPlace(tmp);
+                std::memcpy(out.attr + 3, tmp, sizeof(float) * 3);
+                out.attr[6] = in.texcoord.x;
+                out.attr[7] = in.texcoord.y;
+                TransformRow(invTranspose, t, tmp);
+                NormalizeInPlace(tmp);
+                std::memcpy(out.attr + 8, tmp, sizeof(float) * 3);
+                TransformRow(invTranspose, b, tmp);
+                NormalizeInPlace(tmp);
+                std::memcpy(out.attr + 11, tmp, sizeof(float) * 3);
+            }
+        });
+
+        const size_t triangles = mesh.indices.size() / 3;
+        for (size_t first = 0; first < triangles; first += kChunkTriangles) {
+            if (m_chunkCount == m_chunks.size())
+                m_chunks.push_back(std::make_unique<Chunk>());
+            Chunk &chunk = *m_chunks[m_chunkCount++];
+            chunk.draw = drawIndex;
+            chunk.first = first;
+            chunk.count = std::min(kChunkTriangles, triangles - first);
+        }
+    }
+
+    void SoftwareRenderer::EmitTriangle(Chunk &chunk, const ShadedVertex *a,
+                                        const ShadedVertex *b,
+                                        const ShadedVertex *c) {
+        ScreenTriangle tri;
+        tri.v[0] = a;
+        tri.v[1] = b;
+        tri.v[2] = c;
+        tri.draw = chunk.draw;
+
+        for (int k = 0; k < 3; k++) {
+            const float *clip = tri.v[k]->clip;
+            const float invW = 1.0f / clip[3];
+            tri.x[k] = (clip[0] * invW + 1.0f) * 0.5f * float(m_width);
+            tri.y[k] = (1.0f - clip[1] * invW) * 0.5f * float(m_height);
+            tri.z[k] = clip[2] * invW;
+            tri.invW[k] = invW;
+        }
+
+        const float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) -
+                           (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+        if (area == 0.0f || !std::isfinite(area))
+            return;
+        if (area < 0.0f) {
+            // CULL_NONE; both windings are stored the same way round.
+            std::swap(tri.x[1], tri.x[2]);
+            std::swap(tri.y[1], tri.y[2]);
+            std::swap(tri.z[1], tri.z[2]);
+            std::swap(tri.invW[1], tri.invW[2]);
+            std::swap(tri.v[1], tri.v[2]);
+        }
+
+        const float minX = std::min({tri.x[0], tri.x[1], tri.x[2]});
+        const float maxX = std::max({tri.x[0], tri.x[1], tri.x[2]});
+        const float minY = std::min({tri.y[0], tri.y[1], tri.y[2]});
+        const float maxY = std::max({tri.y[0], tri.y[1], tri.y[2]});
+        if (maxX < 0.0f || maxY < 0.0f || minX >= float(m_width) ||
+            minY >= float(m_height))
+            return;
+
+        const uint32_t index = uint32_t(chunk.triangles.size());
+        chunk.triangles.push_back(tri);
+
+        // Clamped as floats, vertices far off screen don't fit in an int.
+        const int tx0 = int(std::max(minX, 0.0f)) / kTileSize;
+        const int ty0 = int(std::max(minY, 0.0f)) / kTileSize;
+        const int tx1 = int(std::min(maxX, float(m_width - 1))) / kTileSize;
+        const int ty1 = int(std::min(maxY, float(m_height - 1))) / kTileSize;
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+                chunk.bins[ty * m_tilesX + tx].push_back(index);
+    }
+
+    void SoftwareRenderer::SetupChunk(Chunk &chunk) {
+        chunk.triangles.clear();
+        chunk.clipped.clear();
+        chunk.bins.resize(size_t(m_tilesX) * m_tilesY);
+        for (auto &bin : chunk.bins)
+            bin.clear();
+
+        const DrawState &draw = *m_draws[chunk.draw];
+        const auto &indices = *draw.indices;
+
+        for (size_t t = chunk.first; t < chunk.first + chunk.count; t++) {
+            const ShadedVertex *v[3] = {&draw.vertices[indices[t * 3]],
+                                        &draw.vertices[indices[t * 3 + 1]],
+                                        &draw.vertices[indices[t * 3 + 2]]};
+
+            int inside = 0;
+            for (int k = 0; k < 3; k++)
+                inside += v[k]->clip[2] >= 0.0f ? 1 : 0;
+
+            if (inside == 3) {
+                EmitTriangle(chunk, v[0], v[1], v[2]);
+                continue;
+            }
+            if (inside == 0)
+                continue;
+
+            // Clip against the near plane (z >= 0 in D3D clip space). A
+            // triangle gains at most two vertices, and the reserve keeps
+            // the pointers into clipped stable.
+            if (chunk.clipped.capacity() < chunk.count * 2)
+                chunk.clipped.reserve(chunk.count * 2);
+
+            const ShadedVertex *polygon[4];
+            int polygonSize = 0;
+            for (int k = 0; k < 3; k++) {
+                const ShadedVertex *a = v[k];
+                const ShadedVertex *b = v[(k + 1) % 3];
+                const bool aIn = a->clip[2] >= 0.0f;
+                const bool bIn = b->clip[2] >= 0.0f;
+                if (aIn)
+                    polygon[polygonSize++] = a;
+                if (aIn != bIn) {
+                    const float s = a->clip[2] / (a->clip[2] - b->clip[2]);
+                    ShadedVertex mid;
+                    for (int i = 0; i < 4; i++)
+                        mid.clip[i] = a->clip[i] + (b->clip[i] - a->clip[i]) * s;
+                    for (int i = 0; i < kAttributes; i++)
+                        mid.attr[i] = a->attr[i] + (b->attr[i] - a->attr[i]) * s;
+                    chunk.clipped.push_back(mid);
+                    polygon[polygonSize++] = &chunk.clipped.back();
+                }
+            }
+
+            for (int k = 1; k + 1 < polygonSize; k++)
+                EmitTriangle(chunk, polygon[0], polygon[k], polygon[k + 1]);
+        }
+    }
+
+    uint32_t SoftwareRenderer::ShadePixel(const DrawState &draw,
+                                          const float *attr) const {
+        const BasicPixelConstantBuffer &cb = draw.constants;
+
+        const Vector3 posWorld(attr[0], attr[1], attr[2]);
+        Vector3 N(attr[3], attr[4], attr[5]);
+        N.Normalize();
+        Vector3 toEye = cb.eyeWorld - posWorld;
+        toEye.Normalize();
+
+        Vector3 baseColor = cb.material.diffuse;
+        float roughness = 0.5f;
+        const float metallic = 0.0f; // t3 is never bound
+
+        if (cb.useTexture != 0) {
+            const float u = attr[6];
+            const float v = attr[7];
+            const SoftwareMaterial &tex = draw.material;
+
+            baseColor = Vector3(1.0f);
+            if (tex.baseColor) {
+                const Vector4 c = Sample(*tex.baseColor, u, v, true);
+                baseColor = Vector3(c.x, c.y, c.z);
+            }
+
+            // Like DecodeNormalDX, z is rebuilt from x and y.
+            float nx = 0.0f, ny = 0.0f;
+            if (tex.normal) {
+                const Vector4 c = Sample(*tex.normal, u, v, false);
+                nx = c.x * 2.0f - 1.0f;
+                ny = c.y * 2.0f - 1.0f;
+            }
+            const float nz =
+                std::sqrt(std::min(std::max(1.0f - nx * nx - ny * ny, 0.0f), 1.0f));
+            Vector3 nTS(nx, ny, nz);
+            nTS.Normalize();
+            Vector3 T(attr[8], attr[9], attr[10]);
+            Vector3 B(attr[11], attr[12], attr[13]);
+            T.Normalize();
+            B.Normalize();
+            N = T * nTS.x + B * nTS.y + N * nTS.z;
+            N.Normalize();
+
+            roughness = tex.orm ? Sample(*tex.orm, u, v, false).x : 1.0f;
+        }
+
+        Material mat = cb.material;
+        mat.shininess = 256.0f + (2.0f - 256.0f) * roughness;
+        mat.specular = Vector3(0.04f) + (baseColor - Vector3(0.04f)) * metallic;
+        mat.diffuse = baseColor * (1.0f - metallic);
+
+        Vector3 color(0.0f);
+        color += ComputeDirectionalLight(cb.lights[0], mat, N, toEye);
+
+        // Ambient comes once, with the directional light, as in the shader.
+        Material lightMat = mat;
+        lightMat.ambient = Vector3(0.0f);
+        for (const Light &light : m_lights)
+            color += ComputePointLight(light, lightMat, posWorld, N, toEye,
+                                       light.spotPower > 0.0f);
+
+        return uint32_t(ToGamma(color.x)) | uint32_t(ToGamma(color.y)) << 8 |
+               uint32_t(ToGamma(color.z)) << 16 | 0xff000000u;
+    }
+
+    void SoftwareRenderer::RasterizeTile(int tile) {
+        const int tileX0 = (tile % m_tilesX) * kTileSize;
+        const int tileY0 = (tile / m_tilesX) * kTileSize;
+        const int tileX1 = tileX0 + kTileSize;
+        const int tileY1 = std::min(tileY0 + kTileSize, m_height);
+
+        const __m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        alignas(16) float attrLanes[kAttributes][4];
+        float attr[kAttributes];
+
+        for (size_t c = 0; c < m_chunkCount; c++) {
+            const Chunk &chunk = *m_chunks[c];
+            const DrawState &draw = *m_draws[chunk.draw];
+
+            for (uint32_t index : chunk.bins[tile]) {
+                const ScreenTriangle &tri = chunk.triangles[index];
+
+                // Edge i runs from vertex i to i + 1 and is positive inside.
+                // Its value is the unnormalized weight of vertex i + 2.
+                float ea[3], eb[3], ec[3];
+                __m128 topLeft[3];
+                for (int i = 0; i < 3; i++) {
+                    const int j = (i + 1) % 3;
+                    ea[i] = -(tri.y[j] - tri.y[i]);
+                    eb[i] = tri.x[j] - tri.x[i];
+                    ec[i] = -eb[i] * tri.y[i] - ea[i] * tri.x[i];
+                    const bool isTopLeft =
+                        ea[i] > 0.0f || (ea[i] == 0.0f && eb[i] > 0.0f);
+                    topLeft[i] = _mm_castsi128_ps(_mm_set1_epi32(isTopLeft ? -1 : 0));
+                }
+                const float invArea =
+                    1.0f / (ea[0] * tri.x[2] + eb[0] * tri.y[2] + ec[0]);
+
+                const int x0 = int(std::floor(std::max(
+                                   std::min({tri.x[0], tri.x[1], tri.x[2]}),
+                                   float(tileX0)))) & ~3;
+                const int x1 = int(std::ceil(std::min(
+                    std::max({tri.x[0], tri.x[1], tri.x[2]}), float(tileX1))));
+                const int y0 = int(std::floor(std::max(
+                    std::min({tri.y[0], tri.y[1], tri.y[2]}), float(tileY0))));
+                const int y1 = int(std::ceil(std::min(
+                    std::max({tri.y[0], tri.y[1], tri.y[2]}), float(tileY1))));
+
+                const __m128 a0 = _mm_set1_ps(ea[0]), a1 = _mm_set1_ps(ea[1]),
+                             a2 = _mm_set1_ps(ea[2]);
+                const __m128 z0 = _mm_set1_ps(tri.z[0] * invArea);
+                const __m128 z1 = _mm_set1_ps(tri.z[1] * invArea);
+                const __m128 z2 = _mm_set1_ps(tri.z[2] * invArea);
+                const __m128 w0 = _mm_set1_ps(tri.invW[0]);
+                const __m128 w1 = _mm_set1_ps(tri.invW[1]);
+                const __m128 w2 = _mm_set1_ps(tri.invW[2]);
+
+                for (int y = y0; y < y1; y++) {
+                    const float py = float(y) + 0.5f;
+                    const __m128 r0 = _mm_set1_ps(eb[0] * py + ec[0]);
+                    const __m128 r1 = _mm_set1_ps(eb[1] * py + ec[1]);
+                    const __m128 r2 = _mm_set1_ps(eb[2] * py + ec[2]);
+                    float *depthRow = &m_depth[size_t(y) * m_stride];
+                    uint32_t *colorRow = &m_color[size_t(y) * m_stride];
+
+                    for (int x = x0; x < x1; x += 4) {
+                        const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), laneOffset);
+                        const __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+                        const __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+                        const __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+
+                        __m128 mask = _mm_or_ps(
+                            _mm_cmpgt_ps(e0, zero),
+                            _mm_and_ps(_mm_cmpeq_ps(e0, zero), topLeft[0]));
+                        mask = _mm_and_ps(
+                            mask, _mm_or_ps(_mm_cmpgt_ps(e1, zero),
+                                            _mm_and_ps(_mm_cmpeq_ps(e1, zero),
+                                                       topLeft[1])));
+                        mask = _mm_and_ps(
+                            mask, _mm_or_ps(_mm_cmpgt_ps(e2, zero),
+                                            _mm_and_ps(_mm_cmpeq_ps(e2, zero),
+                                                       topLeft[2])));
+                        if (!_mm_movemask_ps(mask))
+                            continue;
+
+                        // e1, e2 and e0 weight vertices 0, 1 and 2.
+                        const __m128 z = _mm_add_ps(
+                            _mm_add_ps(_mm_mul_ps(e1, z0), _mm_mul_ps(e2, z1)),
+                            _mm_mul_ps(e0, z2));
+                        const __m128 oldDepth = _mm_loadu_ps(depthRow + x);
+                        mask = _mm_and_ps(mask, _mm_cmplt_ps(z, oldDepth));
+                        mask = _mm_and_ps(mask, _mm_cmpge_ps(z, zero));
+                        mask = _mm_and_ps(mask, _mm_cmple_ps(z, one));
+                        const int lanes = _mm_movemask_ps(mask);
+                        if (!lanes)
+                            continue;
+
+                        _mm_storeu_ps(depthRow + x,
+                                      _mm_or_ps(_mm_and_ps(mask, z),
+                                                _mm_andnot_ps(mask, oldDepth)));
+
+                        // Perspective-correct weights.
+                        const __m128 b0 = _mm_mul_ps(e1, w0);
+                        const __m128 b1 = _mm_mul_ps(e2, w1);
+                        const __m128 b2 = _mm_mul_ps(e0, w2);
+                        const __m128 invSum =
+                            _mm_div_ps(one, _mm_add_ps(_mm_add_ps(b0, b1), b2));
+                        const __m128 n0 = _mm_mul_ps(b0, invSum);
+                        const __m128 n1 = _mm_mul_ps(b1, invSum);
+                        const __m128 n2 = _mm_mul_ps(b2, invSum);
+
+                        for (int k = 0; k < kAttributes; k++) {
+                            const __m128 v = _mm_add_ps(
+                                _mm_add_ps(
+                                    _mm_mul_ps(n0, _mm_set1_ps(tri.v[0]->attr[k])),
+                                    _mm_mul_ps(n1, _mm_set1_ps(tri.v[1]->attr[k]))),
+                                _mm_mul_ps(n2, _mm_set1_ps(tri.v[2]->attr[k])));
+                            _mm_store_ps(attrLanes[k], v);
+                        }
+
+                        for (int lane = 0; lane < 4; lane++) {
+                            if (!(lanes & (1 << lane)))
+                                continue;
+                            for (int k = 0; k < kAttributes; k++)
+                                attr[k] = attrLanes[k][lane];
+                            colorRow[x + lane] = ShadePixel(draw, attr);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void SoftwareRenderer::Flush() {
+        ParallelFor(m_chunkCount, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++)
+                SetupChunk(*m_chunks[c]);
+        });
+
+        ParallelFor(size_t(m_tilesX) * m_tilesY, 1, [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; tile++)
+                RasterizeTile(int(tile));
+        });
+
+        for (int y = 0; y < m_height; y++) {
+            std::memcpy(&m_target.pixels[size_t(y) * m_width * 4],
+                        &m_color[size_t(y) * m_stride], size_t(m_width) * 4);
+        }
+
+        m_drawCount = 0;
+        m_chunkCount = 0;
+    }
+}
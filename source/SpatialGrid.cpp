@@ -0,0 +1,239 @@
+#include "SpatialGrid.h"
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    // Cell coordinates are packed into 20 bits each.
+    const float kMinCoord = -524288.0f;
+    const float kMaxCoord = 524287.0f;
+
+    // Objects per cell the automatic cell size aims for.
+    const float kObjectsPerCell = 8.0f;
+
+    int CellCoord(float v, float inv) {
+        return int(std::min(std::max(std::floor(v * inv), kMinCoord), kMaxCoord));
+    }
+
+    Aabb ToAabb(const MeshBounds &bounds) {
+        Aabb box;
+        box.min = Vector3::Min(bounds.aabbMin, bounds.aabbMax);
+        box.max = Vector3::Max(bounds.aabbMin, bounds.aabbMax);
+        return box;
+    }
+
+    float HalfExtent(const Aabb &box) {
+        const Vector3 e = box.max - box.min;
+        return 0.5f * std::max(e.x, std::max(e.y, e.z));
+    }
+
+    // Point where three planes meet.
+    Vector3 Intersect(const Vector4 &a, const Vector4 &b, const Vector4 &c) {
+        const Vector3 na(a.x, a.y, a.z), nb(b.x, b.y, b.z), nc(c.x, c.y, c.z);
+        const Vector3 bc = nb.Cross(nc);
+        const float det = na.Dot(bc);
+        if (std::fabs(det) < 1e-12f)
+            return Vector3(0.0f);
+        return (bc * -a.w + nc.Cross(na) * -b.w + na.Cross(nb) * -c.w) / det;
+    }
+	}
+
+    const uint32_t SpatialGrid::kMaxLevels;
+    const uint32_t SpatialGrid::kNone;
+
+    SpatialGrid::SpatialGrid(float cellSize) : m_autoCellSize(cellSize <= 0.0f) {
+        SetCellSize(m_autoCellSize ? 1.0f : cellSize);
+    }
+
+    void SpatialGrid::SetCellSize(float cellSize) {
+        for (uint32_t l = 0; l < kMaxLevels; l++)
+            m_levels[l].size = std::ldexp(cellSize, int(l));
+    }
+
+    SpatialGrid::Placement SpatialGrid::Place(const Aabb &box) const {
+        const float extent = 2.0f * HalfExtent(box);
+        uint32_t level = 0;
+        while (level + 1 < kMaxLevels && m_levels[level].size < extent)
+            level++;
+
+        const float inv = 1.0f / m_levels[level].size;
+        const Vector3 center = box.Center();
+        return {level, CellCoord(center.x, inv), CellCoord(center.y, inv),
+                CellCoord(center.z, inv)};
+    }
+
+    uint64_t SpatialGrid::Key(const Placement &p) {
+        const auto bits = [](int v) { return uint64_t(uint32_t(v + 524288) & 0xfffffu); };
+        return (uint64_t(p.level) << 60) | (bits(p.x) << 40) | (bits(p.y) << 20) |
+               bits(p.z);
+    }
+
+    void SpatialGrid::Reserve(uint32_t id) {
+        if (id < m_objectCells.size())
+            return;
+        m_objectCells.resize(size_t(id) + 1, kNone);
+        m_objectEntries.resize(size_t(id) + 1, kNone);
+    }
+
+    void SpatialGrid::Link(uint32_t id, const Placement &p, const Aabb &box) {
+        Level &level = m_levels[p.level];
+        level.margin = std::max(level.margin, HalfExtent(box));
+
+        const uint64_t key = Key(p);
+        auto it = m_cellMap.find(key);
+        uint32_t index;
+        if (it != m_cellMap.end()) {
+            index = it->second;
+        } else {
+            // Freed cells keep the capacity of their entries.
+            if (!m_freeCells.empty()) {
+                index = m_freeCells.back();
+                m_freeCells.pop_back();
+            } else {
+                index = uint32_t(m_cells.size());
+                m_cells.emplace_back();
+            }
+            Cell &cell = m_cells[index];
+            cell.x = p.x;
+            cell.y = p.y;
+            cell.z = p.z;
+            cell.level = p.level;
+            cell.slot = uint32_t(level.cells.size());
+            level.cells.push_back(index);
+            m_cellMap.emplace(key, index);
+        }
+
+        Cell &cell = m_cells[index];
+        m_objectCells[id] = index;
+        m_objectEntries[id] = uint32_t(cell.entries.size());
+        cell.entries.push_back({box, id});
+        m_count++;
+    }
+
+    void SpatialGrid::Unlink(uint32_t id) {
+        const uint32_t index = m_objectCells[id];
+        Cell &cell = m_cells[index];
+        const uint32_t entry = m_objectEntries[id];
+        cell.entries[entry] = cell.entries.back();
+        m_objectEntries[cell.entries[entry].id] = entry;
+        cell.entries.pop_back();
+        m_objectCells[id] = kNone;
+        m_objectEntries[id] = kNone;
+        m_count--;
+
+        if (!cell.entries.empty())
+            return;
+
+        // Free the emptied cell, moving the level's last cell into its slot.
+        Level &level = m_levels[cell.level];
+        const uint32_t moved = level.cells.back();
+        level.cells[cell.slot] = moved;
+        m_cells[moved].slot = cell.slot;
+        level.cells.pop_back();
+        m_cellMap.erase(Key({cell.level, cell.x, cell.y, cell.z}));
+        m_freeCells.push_back(index);
+    }
+
+    void SpatialGrid::Build(const std::vector<MeshBounds> &bounds) {
+        Clear();
+        const size_t count = bounds.size();
+        if (count == 0)
+            return;
+
+        m_objectCells.assign(count, kNone);
+        m_objectEntries.assign(count, kNone);
+
+        std::vector<Aabb> boxes(count);
+        ParallelFor(count, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                boxes[i] = ToAabb(bounds[i]);
+        });
+
+        // Cells that hold about kObjectsPerCell objects spread evenly over
+        // the scene box, but no smaller than the median object, so most
+        // objects land on the finest level. Thin axes are counted as one
+        // median object deep.
+        if (m_autoCellSize) {
+            std::vector<float> extents(count);
+            Aabb scene;
+            for (size_t i = 0; i < count; i++) {
+                extents[i] = 2.0f * HalfExtent(boxes[i]);
+                scene.Grow(boxes[i].Center());
+            }
+            std::nth_element(extents.begin(), extents.begin() + count / 2,
+                             extents.end());
+            const float median = std::max(extents[count / 2], 1e-3f);
+            const Vector3 size = Vector3::Max(scene.max - scene.min, Vector3(median));
+            const float volume = size.x * size.y * size.z;
+            SetCellSize(std::max(median, std::cbrt(volume * kObjectsPerCell / count)));
+        }
+
+        std::vector<Placement> placements(count);
+        ParallelFor(count, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                placements[i] = Place(boxes[i]);
+        });
+
+        // Linking touches the shared cell table, so it stays serial.
+        m_cellMap.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            Link(uint32_t(i), placements[i], boxes[i]);
+    }
+
+    void SpatialGrid::Clear() {
+        for (Level &level : m_levels) {
+            level.margin = 0.0f;
+            level.cells.clear();
+        }
+        m_cells.clear();
+        m_freeCells.clear();
+        m_cellMap.clear();
+        m_objectCells.clear();
+        m_objectEntries.clear();
+        m_count = 0;
+    }
+
+    void SpatialGrid::Insert(uint32_t id, const MeshBounds &bounds) {
+        Reserve(id);
+        if (m_objectCells[id] != kNone)
+            Unlink(id);
+        const Aabb box = ToAabb(bounds);
+        Link(id, Place(box), box);
+    }
+
+    void SpatialGrid::Update(uint32_t id, const MeshBounds &bounds) {
+        if (!Contains(id)) {
+            Insert(id, bounds);
+            return;
+        }
+
+        const Aabb box = ToAabb(bounds);
+        const Placement p = Place(box);
+        Cell &cell = m_cells[m_objectCells[id]];
+        if (cell.level == p.level && cell.x == p.x && cell.y == p.y && cell.z == p.z) {
+            Level &level = m_levels[p.level];
+            level.margin = std::max(level.margin, HalfExtent(box));
+            cell.entries[m_objectEntries[id]].box = box;
+            return;
+        }
+        Unlink(id);
+        Link(id, p, box);
+    }
+
+    void SpatialGrid::Remove(uint32_t id) {
+        if (Contains(id))
+            Unlink(id);
+    }
+
+    Aabb SpatialGrid::FrustumBounds(const Frustum &frustum) {
+        // Planes are left, right, bottom, top, near, far.
+        const Vector4 *p = frustum.planes;
+        Aabb box;
+        for (int corner = 0; corner < 8; corner++)
+            box.Grow(Intersect(p[corner & 1], p[2 + ((corner >> 1) & 1)],
+                               p[4 + ((corner >> 2) & 1)]));
+        return box;
+    }
+}
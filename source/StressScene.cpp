@@ -0,0 +1,255 @@
+#include "StressScene.h"
+
+#include <assimp/Exporter.hpp>
+#include <assimp/scene.h>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <unordered_map>
+
+#include "GeometryGenerator.h"
+#include "Logger.h"
+
+namespace hlab {
+
+	using namespace DirectX::SimpleMath;
+
+    // std::*_distribution differs between standard libraries, so values are
+    // derived from the raw mt19937 output to stay reproducible everywhere.
+    class SceneRandom {
+      public:
+        explicit SceneRandom(uint32_t seed) : m_engine(seed) {}
+
+        float Next01() { return float(m_engine() >> 8) * (1.0f / 16777216.0f); }
+
+        float Range(float lo, float hi) { return lo + (hi - lo) * Next01(); }
+
+        uint32_t Index(uint32_t count) {
+            return count ? uint32_t(uint64_t(m_engine()) * count >> 32) : 0;
+        }
+
+      private:
+        std::mt19937 m_engine;
+    };
+
+    static MeshData MakeGeometry(uint32_t targetTriangles, SceneRandom &rng) {
+        if (targetTriangles <= 12)
+            return GeometryGenerator::MakeBox();
+
+        if (targetTriangles <= 1024 && rng.Next01() < 0.3f) {
+            const int slices = std::max(3, int(targetTriangles / 2));
+            return GeometryGenerator::MakeCylinder(rng.Range(0.3f, 1.0f),
+                                                   rng.Range(0.3f, 1.0f),
+                                                   rng.Range(0.5f, 2.0f),
+                                                   slices);
+        }
+
+        const int stacks =
+            std::max(2, int(std::sqrt(float(targetTriangles) / 4.0f)));
+        return GeometryGenerator::MakeSphere(rng.Range(0.5f, 1.0f), stacks * 2,
+                                             stacks);
+    }
+
+    size_t StressScene::TriangleCount() const {
+        size_t count = 0;
+        for (const auto &instance : instances)
+            count += geometries[instance.geometry].indices.size() / 3;
+        return count;
+    }
+
+    StressScene StressSceneGenerator::Generate(const StressSceneDesc &desc) {
+        StressScene scene;
+        scene.materialCount = std::max(1, desc.materialCount);
+
+        SceneRandom rng(desc.seed);
+
+        const int meshCount = std::max(1, desc.meshCount);
+        const float ratio = std::min(std::max(desc.instancingRatio, 0.0f), 1.0f);
+        const int uniqueCount =
+            std::max(1, int(std::lround(meshCount * (1.0f - ratio))));
+
+        const float logMin = std::log(float(std::max(1u, desc.minTriangles)));
+        const float logMax = std::log(
+            float(std::max(desc.minTriangles, desc.maxTriangles)));
+
+        scene.geometries.reserve(uniqueCount);
+        for (int i = 0; i < uniqueCount; i++) {
+            const uint32_t target =
+                uint32_t(std::exp(rng.Range(logMin, logMax)) + 0.5f);
+            MeshData geometry = MakeGeometry(target, rng);
+            geometry.bounds = ComputeBounds(geometry.vertices);
+            scene.geometries.push_back(std::move(geometry));
+        }
+
+        scene.instances.reserve(meshCount);
+        for (int i = 0; i < meshCount; i++) {
+            StressInstance instance;
+            instance.geometry =
+                i < uniqueCount ? uint32_t(i) : rng.Index(uint32_t(uniqueCount));
+            instance.material = rng.Index(uint32_t(scene.materialCount));
+
+            const Vector3 position(rng.Range(-desc.extent, desc.extent),
+                                   rng.Range(-desc.extent, desc.extent),
+                                   rng.Range(-desc.extent, desc.extent));
+            instance.transform =
+                Matrix::CreateScale(rng.Range(0.5f, 2.0f)) *
+                Matrix::CreateRotationY(rng.Range(0.0f, DirectX::XM_2PI)) *
+                Matrix::CreateTranslation(position);
+
+            scene.instances.push_back(instance);
+        }
+
+        return scene;
+    }
+
+    std::vector<MeshData>
+    StressSceneGenerator::Flatten(const StressScene &scene) {
+        std::vector<MeshData> meshes;
+        meshes.reserve(scene.instances.size());
+
+        for (const auto &instance : scene.instances) {
+            MeshData mesh = scene.geometries[instance.geometry];
+            for (auto &v : mesh.vertices) {
+                v.position = Vector3::Transform(v.position, instance.transform);
+                v.normal = Vector3::TransformNormal(v.normal, instance.transform);
+                v.normal.Normalize();
+                v.tangent = Vector3::TransformNormal(v.tangent, instance.transform);
+                v.tangent.Normalize();
+                v.bitangent = Vector3::TransformNormal(v.bitangent, instance.transform);
+                v.bitangent.Normalize();
+            }
+            mesh.bounds = ComputeBounds(mesh.vertices);
+            meshes.push_back(std::move(mesh));
+        }
+        return meshes;
+    }
+
+    std::string
+    StressSceneGenerator::FormatIdFromExtension(const std::string &path) {
+        std::string ext = std::filesystem::path(path).extension().string();
+        for (auto &c : ext)
+            c = (char)tolower((unsigned char)c);
+
+        if (ext == ".obj")
+            return "obj";
+        if (ext == ".fbx")
+            return "fbx";
+        if (ext == ".gltf")
+            return "gltf2";
+        if (ext == ".glb")
+            return "glb2";
+        return "";
+    }
+
+    static void ToAiMatrix(const Matrix &m, aiMatrix4x4 &out) {
+        // SimpleMath is row-vector, Assimp column-vector.
+        const Matrix t = m.Transpose();
+        const float *src = &t._11;
+        ai_real *dst = &out.a1;
+        for (int i = 0; i < 16; i++)
+            dst[i] = ai_real(src[i]);
+    }
+
+    // The loader reads files with aiProcess_ConvertToLeftHanded, so the
+    // exported data is converted back to right-handed here.
+    static aiMesh *ToAiMesh(const MeshData &mesh, uint32_t material) {
+        aiMesh *out = new aiMesh();
+        out->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+        out->mMaterialIndex = material;
+        out->mNumVertices = unsigned(mesh.vertices.size());
+        out->mVertices = new aiVector3D[out->mNumVertices];
+        out->mNormals = new aiVector3D[out->mNumVertices];
+        out->mTextureCoords[0] = new aiVector3D[out->mNumVertices];
+        out->mNumUVComponents[0] = 2;
+
+        for (unsigned i = 0; i < out->mNumVertices; i++) {
+            const Vertex &v = mesh.vertices[i];
+            out->mVertices[i] = aiVector3D(v.position.x, v.position.y, -v.position.z);
+            out->mNormals[i] = aiVector3D(v.normal.x, v.normal.y, -v.normal.z);
+            out->mTextureCoords[0][i] =
+                aiVector3D(v.texcoord.x, 1.0f - v.texcoord.y, 0.0f);
+        }
+
+        out->mNumFaces = unsigned(mesh.indices.size() / 3);
+        out->mFaces = new aiFace[out->mNumFaces];
+        for (unsigned i = 0; i < out->mNumFaces; i++) {
+            aiFace &face = out->mFaces[i];
+            face.mNumIndices = 3;
+            face.mIndices = new unsigned int[3];
+            face.mIndices[0] = mesh.indices[i * 3];
+            face.mIndices[1] = mesh.indices[i * 3 + 2];
+            face.mIndices[2] = mesh.indices[i * 3 + 1];
+        }
+        return out;
+    }
+
+    bool StressSceneGenerator::Export(const StressScene &scene,
+                                      const std::string &path,
+                                      const std::string &formatId) {
+        aiScene out;
+
+        out.mNumMaterials = unsigned(scene.materialCount);
+        out.mMaterials = new aiMaterial *[out.mNumMaterials];
+        SceneRandom colors(uint32_t(scene.materialCount));
+        for (unsigned i = 0; i < out.mNumMaterials; i++) {
+            out.mMaterials[i] = new aiMaterial();
+            aiString name;
+            name.Set("stress_material_" + std::to_string(i));
+            out.mMaterials[i]->AddProperty(&name, AI_MATKEY_NAME);
+            aiColor3D diffuse;
+            diffuse.r = colors.Next01();
+            diffuse.g = colors.Next01();
+            diffuse.b = colors.Next01();
+            out.mMaterials[i]->AddProperty(&diffuse, 1, AI_MATKEY_COLOR_DIFFUSE);
+        }
+
+        // Assimp meshes carry their material, so each geometry/material pair
+        // that is actually used becomes one aiMesh shared by its instances.
+        std::unordered_map<uint64_t, unsigned> meshKeys;
+        std::vector<aiMesh *> meshes;
+        std::vector<unsigned> instanceMesh(scene.instances.size());
+        for (size_t i = 0; i < scene.instances.size(); i++) {
+            const auto &instance = scene.instances[i];
+            const uint64_t key =
+                (uint64_t(instance.geometry) << 32) | instance.material;
+
+            const auto inserted = meshKeys.emplace(key, unsigned(meshes.size()));
+            if (inserted.second)
+                meshes.push_back(ToAiMesh(scene.geometries[instance.geometry],
+                                          instance.material));
+            instanceMesh[i] = inserted.first->second;
+        }
+
+        out.mNumMeshes = unsigned(meshes.size());
+        out.mMeshes = new aiMesh *[out.mNumMeshes];
+        std::copy(meshes.begin(), meshes.end(), out.mMeshes);
+
+        out.mRootNode = new aiNode("stress_root");
+        std::vector<aiNode *> children(scene.instances.size());
+        for (size_t i = 0; i < scene.instances.size(); i++) {
+            aiNode *node =
+                new aiNode(("stress_object_" + std::to_string(i)).c_str());
+
+            // Mirror z on both sides so the transform stays right-handed.
+            const Matrix flip = Matrix::CreateScale(1.0f, 1.0f, -1.0f);
+            ToAiMatrix(flip * scene.instances[i].transform * flip,
+                       node->mTransformation);
+
+            node->mNumMeshes = 1;
+            node->mMeshes = new unsigned int[1];
+            node->mMeshes[0] = instanceMesh[i];
+            children[i] = node;
+        }
+        out.mRootNode->addChildren(unsigned(children.size()), children.data());
+
+        Assimp::Exporter exporter;
+        if (exporter.Export(&out, formatId, path) != AI_SUCCESS) {
+            LOG_ERROR(LogCategory::Loader, "Export %s (%s) failed: %s",
+                      path.c_str(), formatId.c_str(),
+                      exporter.GetErrorString());
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,249 @@
+#include "TextureCompress.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Parallel.h"
+
+namespace hlab {
+
+	namespace {
+
+    struct SrgbTable {
+        float toLinear[256];
+
+        SrgbTable() {
+            for (int i = 0; i < 256; i++) {
+                const float c = float(i) / 255.0f;
+                toLinear[i] = c <= 0.04045f
+                                  ? c / 12.92f
+                                  : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+        }
+    };
+
+    uint8_t LinearToSrgb(float c) {
+        c = std::min(std::max(c, 0.0f), 1.0f);
+        const float s = c <= 0.0031308f ? c * 12.92f
+                                        : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        return uint8_t(s * 255.0f + 0.5f);
+    }
+
+    ImageData Downsample(const ImageData &src, bool srgb) {
+        static const SrgbTable table;
+
+        ImageData dst;
+        dst.width = std::max(1, src.width / 2);
+        dst.height = std::max(1, src.height / 2);
+        dst.pixels.resize(size_t(dst.width) * dst.height * 4);
+
+        ParallelFor(dst.height, 64, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) {
+                const int y0 = std::min(int(y) * 2, src.height - 1);
+                const int y1 = std::min(int(y) * 2 + 1, src.height - 1);
+                for (int x = 0; x < dst.width; x++) {
+                    const int x0 = std::min(x * 2, src.width - 1);
+                    const int x1 = std::min(x * 2 + 1, src.width - 1);
+                    const uint8_t *p[4] = {
+                        &src.pixels[(size_t(y0) * src.width + x0) * 4],
+                        &src.pixels[(size_t(y0) * src.width + x1) * 4],
+                        &src.pixels[(size_t(y1) * src.width + x0) * 4],
+                        &src.pixels[(size_t(y1) * src.width + x1) * 4]};
+                    uint8_t *out = &dst.pixels[(y * dst.width + x) * 4];
+
+                    for (int c = 0; c < 4; c++) {
+                        if (srgb && c < 3) {
+                            const float sum = table.toLinear[p[0][c]] +
+                                              table.toLinear[p[1][c]] +
+                                              table.toLinear[p[2][c]] +
+                                              table.toLinear[p[3][c]];
+                            out[c] = LinearToSrgb(sum * 0.25f);
+                        } else {
+                            out[c] = uint8_t(
+                                (p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+                        }
+                    }
+                }
+            }
+        });
+        return dst;
+    }
+
+    void LoadBlock(const ImageData &image, int bx, int by, uint8_t block[16][4]) {
+        for (int y = 0; y < 4; y++) {
+            const int sy = std::min(by * 4 + y, image.height - 1);
+            for (int x = 0; x < 4; x++) {
+                const int sx = std::min(bx * 4 + x, image.width - 1);
+                std::memcpy(block[y * 4 + x],
+                            &image.pixels[(size_t(sy) * image.width + sx) * 4], 4);
+            }
+        }
+    }
+
+    uint16_t To565(const float c[3]) {
+        const int r = int(std::min(std::max(c[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        const int g = int(std::min(std::max(c[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+        const int b = int(std::min(std::max(c[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        return uint16_t((r << 11) | (g << 5) | b);
+    }
+
+    void From565(uint16_t v, float c[3]) {
+        c[0] = float((v >> 11) & 31) * 255.0f / 31.0f;
+        c[1] = float((v >> 5) & 63) * 255.0f / 63.0f;
+        c[2] = float(v & 31) * 255.0f / 31.0f;
+    }
+
+    // Endpoints are the extremes along the block's principal axis, inset
+    // slightly. Each texel then snaps to the nearest palette entry.
+    void EncodeBC1Block(const uint8_t block[16][4], uint8_t *out) {
+        float mean[3] = {0, 0, 0};
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                mean[c] += block[i][c] / 16.0f;
+
+        float cov[6] = {0, 0, 0, 0, 0, 0};
+        for (int i = 0; i < 16; i++) {
+            const float r = block[i][0] - mean[0];
+            const float g = block[i][1] - mean[1];
+            const float b = block[i][2] - mean[2];
+            cov[0] += r * r, cov[1] += r * g, cov[2] += r * b;
+            cov[3] += g * g, cov[4] += g * b, cov[5] += b * b;
+        }
+
+        // A few power iterations find the principal axis.
+        float axis[3] = {1.0f, 1.0f, 1.0f};
+        for (int it = 0; it < 4; it++) {
+            const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+            const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+            const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+            const float len = std::max({std::fabs(x), std::fabs(y), std::fabs(z)});
+            if (len < 1e-6f)
+                break;
+            axis[0] = x / len, axis[1] = y / len, axis[2] = z / len;
+        }
+
+        float minT = 1e30f, maxT = -1e30f;
+        for (int i = 0; i < 16; i++) {
+            const float t = (block[i][0] - mean[0]) * axis[0] +
+                            (block[i][1] - mean[1]) * axis[1] +
+                            (block[i][2] - mean[2]) * axis[2];
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        const float axisLen2 =
+            axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        const float inset = (maxT - minT) / 32.0f;
+        minT = (minT + inset) / std::max(axisLen2, 1e-6f);
+        maxT = (maxT - inset) / std::max(axisLen2, 1e-6f);
+
+        float e0[3], e1[3];
+        for (int c = 0; c < 3; c++) {
+            e0[c] = mean[c] + axis[c] * maxT;
+            e1[c] = mean[c] + axis[c] * minT;
+        }
+
+        uint16_t c0 = To565(e0);
+        uint16_t c1 = To565(e1);
+        if (c0 < c1)
+            std::swap(c0, c1);
+
+        uint32_t indices = 0;
+        if (c0 != c1) {
+            // Four-color mode needs c0 > c1.
+            float palette[4][3];
+            From565(c0, palette[0]);
+            From565(c1, palette[1]);
+            for (int c = 0; c < 3; c++) {
+                palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+            }
+            for (int i = 0; i < 16; i++) {
+                int best = 0;
+                float bestDist = 1e30f;
+                for (int p = 0; p < 4; p++) {
+                    float d = 0.0f;
+                    for (int c = 0; c < 3; c++) {
+                        const float diff = block[i][c] - palette[p][c];
+                        d += diff * diff;
+                    }
+                    if (d < bestDist) {
+                        bestDist = d;
+                        best = p;
+                    }
+                }
+                indices |= uint32_t(best) << (i * 2);
+            }
+        }
+
+        out[0] = uint8_t(c0), out[1] = uint8_t(c0 >> 8);
+        out[2] = uint8_t(c1), out[3] = uint8_t(c1 >> 8);
+        std::memcpy(out + 4, &indices, 4);
+    }
+
+    void EncodeBC4Block(const uint8_t block[16][4], int channel, uint8_t *out) {
+        int lo = 255, hi = 0;
+        for (int i = 0; i < 16; i++) {
+            lo = std::min<int>(lo, block[i][channel]);
+            hi = std::max<int>(hi, block[i][channel]);
+        }
+
+        // Eight-value mode (a0 > a1); a flat block uses index 0 throughout.
+        out[0] = uint8_t(hi);
+        out[1] = uint8_t(lo);
+        uint64_t bits = 0;
+        if (hi > lo) {
+            const float range = float(hi - lo);
+            // Palette order is hi, lo, then six steps from hi towards lo.
+            static const int kOrder[8] = {1, 7, 6, 5, 4, 3, 2, 0};
+            for (int i = 0; i < 16; i++) {
+                const float t = (block[i][channel] - lo) / range * 7.0f;
+                const int step = int(t + 0.5f); // 0 = lo, 7 = hi
+                bits |= uint64_t(kOrder[step]) << (i * 3);
+            }
+        }
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = uint8_t(bits >> (i * 8));
+    }
+
+    template <typename EncodeFn>
+    std::vector<uint8_t> CompressBlocks(const ImageData &image, size_t blockBytes,
+                                        EncodeFn encode) {
+        const int blocksX = (image.width + 3) / 4;
+        const int blocksY = (image.height + 3) / 4;
+        std::vector<uint8_t> out(size_t(blocksX) * blocksY * blockBytes);
+
+        ParallelFor(blocksY, 16, [&](size_t begin, size_t end) {
+            uint8_t block[16][4];
+            for (size_t by = begin; by < end; by++) {
+                for (int bx = 0; bx < blocksX; bx++) {
+                    LoadBlock(image, bx, int(by), block);
+                    encode(block, &out[(by * blocksX + bx) * blockBytes]);
+                }
+            }
+        });
+        return out;
+    }
+    }
+
+    std::vector<ImageData> GenerateMips(const ImageData &image, bool srgb) {
+        std::vector<ImageData> mips;
+        mips.push_back(image);
+        while (mips.back().width > 1 || mips.back().height > 1)
+            mips.push_back(Downsample(mips.back(), srgb));
+        return mips;
+    }
+
+    std::vector<uint8_t> CompressBC1(const ImageData &image) {
+        return CompressBlocks(image, 8, [](const uint8_t block[16][4], uint8_t *out) {
+            EncodeBC1Block(block, out);
+        });
+    }
+
+    std::vector<uint8_t> CompressBC5(const ImageData &image) {
+        return CompressBlocks(image, 16, [](const uint8_t block[16][4], uint8_t *out) {
+            EncodeBC4Block(block, 0, out);
+            EncodeBC4Block(block, 1, out + 8);
+        });
+    }
+}
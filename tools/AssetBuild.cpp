@@ -0,0 +1,591 @@
+// Offline asset build. Every model under the input directories is imported
+// on its own job. Meshes are optimized for the vertex cache, textures get
+// mips and block compression, and the results are written into the asset
+// cache under the keys the app looks up, with a manifest next to them.
+// Models whose source, textures and settings are unchanged since the last
+// run are skipped.
+//
+//   AssetBuild [-j jobs] [-o cachedir] [-f] [-nocompress] input_dir...
+//
+// The cache directory is the app's (see AssetCache.h) unless -o is given.
+// Mesh keys include the texture paths next to the model, so the app hits
+// them when it loads the models from the same absolute paths. -f ignores
+// the manifest and rebuilds everything. Build with tools/CMakeLists.txt,
+// like LoaderBench.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AssetCache.h"
+#include "CacheFormats.h"
+#include "Hash.h"
+#include "Image.h"
+#include "MeshOptimizer.h"
+#include "ModelLoader.h"
+#include "PerfStats.h"
+#include "TextureCompress.h"
+
+namespace {
+
+using namespace hlab;
+namespace fs = std::filesystem;
+
+const uint32_t kBuildVersion = 2;
+const char *kManifestName = "assetbuild_manifest.txt";
+
+enum Stage { Hashing, Import, Resolve, Optimize, Mips, Compress, Write, StageCount };
+const char *kStageNames[StageCount] = {"hash",  "import",   "resolve", "optimize",
+                                       "mips",  "compress", "write"};
+
+enum class TextureRole { BaseColor, Normal, Orm };
+
+struct Options {
+    fs::path outDir; // the asset cache directory
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool force = false;
+    bool compress = true;
+};
+
+struct ManifestEntry {
+    uint64_t sourceHash = 0;
+    uint64_t settingsHash = 0;
+    std::string output; // file name in outDir, empty if nothing is cached
+    std::vector<std::pair<std::string, uint64_t>> dependencies;
+};
+
+class Build {
+  public:
+    explicit Build(const Options &options) : m_options(options) {
+        Hasher64 hasher;
+        hasher.UpdateValue(kBuildVersion);
+        hasher.UpdateValue(kMeshCacheVersion);
+        hasher.UpdateValue(kTextureCacheVersion);
+        hasher.UpdateValue(ModelLoader::kImportFlags);
+        hasher.UpdateValue(ModelLoader::useFbxFastPath);
+        hasher.UpdateValue(ModelLoader::useGltfFastPath);
+        hasher.UpdateValue(ModelLoader::useObjFastPath);
+        hasher.UpdateValue(ModelLoader::memoryBudget);
+        hasher.UpdateValue(options.compress);
+        m_settingsHash = hasher.Digest();
+    }
+
+    void LoadManifest();
+    void SaveManifest();
+    void Run(const std::vector<fs::path> &models);
+    void PrintSummary(double wallMs) const;
+
+    bool HasFailures() const { return m_failed.load() > 0; }
+
+  private:
+    class StageTimer {
+      public:
+        StageTimer(Build &build, Stage stage) : m_build(build), m_stage(stage) {}
+        ~StageTimer() {
+            m_build.m_stageUs[m_stage] += uint64_t(m_timer.ElapsedMs() * 1000.0);
+        }
+
+      private:
+        Build &m_build;
+        Stage m_stage;
+        CpuTimer m_timer;
+    };
+
+    bool IsUpToDate(const std::string &source, uint64_t sourceHash);
+    bool BuildModel(const fs::path &path);
+    std::string BuildTexture(const std::string &path, TextureRole role,
+                             uint64_t &sourceHash);
+    // Images decoded by the loader, such as the ones embedded in a GLB.
+    std::string BuildTexture(const ImageData &image, TextureRole role);
+    bool WriteTexture(const ImageData &image, TextureRole role,
+                      const fs::path &output);
+
+    Options m_options;
+    uint64_t m_settingsHash = 0;
+
+    std::mutex m_manifestMutex;
+    std::map<std::string, ManifestEntry> m_manifest;
+
+    // One build per texture and role, shared by every model that uses it.
+    struct TextureResult {
+        std::string output;
+        uint64_t sourceHash = 0;
+    };
+    std::mutex m_textureMutex;
+    std::map<std::string, std::shared_future<TextureResult>> m_textures;
+
+    std::atomic<uint64_t> m_stageUs[StageCount] = {};
+    std::atomic<int> m_built{0}, m_skipped{0}, m_streamed{0}, m_failed{0};
+    std::atomic<int> m_texturesBuilt{0}, m_texturesReused{0};
+    std::atomic<uint64_t> m_triangles{0};
+    std::atomic<uint64_t> m_missesBefore{0}, m_missesAfter{0};
+};
+
+void Build::LoadManifest() {
+    std::ifstream in(m_options.outDir / kManifestName);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream fields(line);
+        std::string source, sourceHash, settingsHash, output, deps;
+        std::getline(fields, source, '\t');
+        std::getline(fields, sourceHash, '\t');
+        std::getline(fields, settingsHash, '\t');
+        std::getline(fields, output, '\t');
+        std::getline(fields, deps, '\t');
+
+        ManifestEntry entry;
+        entry.sourceHash = strtoull(sourceHash.c_str(), nullptr, 16);
+        entry.settingsHash = strtoull(settingsHash.c_str(), nullptr, 16);
+        entry.output = output;
+
+        std::istringstream depFields(deps);
+        std::string dep;
+        while (std::getline(depFields, dep, ';')) {
+            const size_t bar = dep.rfind('|');
+            if (bar != std::string::npos)
+                entry.dependencies.emplace_back(
+                    dep.substr(0, bar),
+                    strtoull(dep.c_str() + bar + 1, nullptr, 16));
+        }
+        m_manifest[source] = std::move(entry);
+    }
+}
+
+void Build::SaveManifest() {
+    std::string text = "# source\tsource hash\tsettings hash\toutput\t"
+                       "texture|hash;...\n";
+    for (const auto &[source, entry] : m_manifest) {
+        text += source + "\t" + HashToString(entry.sourceHash) + "\t" +
+                HashToString(entry.settingsHash) + "\t" + entry.output + "\t";
+        for (size_t i = 0; i < entry.dependencies.size(); i++) {
+            if (i > 0)
+                text += ";";
+            text += entry.dependencies[i].first + "|" +
+                    HashToString(entry.dependencies[i].second);
+        }
+        text += "\n";
+    }
+    WriteFileAtomic((m_options.outDir / kManifestName).string(), text.data(),
+                    text.size());
+}
+
+bool Build::IsUpToDate(const std::string &source, uint64_t sourceHash) {
+    if (m_options.force)
+        return false;
+
+    ManifestEntry entry;
+    {
+        std::lock_guard<std::mutex> lock(m_manifestMutex);
+        auto it = m_manifest.find(source);
+        if (it == m_manifest.end())
+            return false;
+        entry = it->second;
+    }
+
+    // Entries can have been evicted from the cache since.
+    if (entry.sourceHash != sourceHash || entry.settingsHash != m_settingsHash ||
+        (!entry.output.empty() && !fs::exists(m_options.outDir / entry.output)))
+        return false;
+
+    // Texture edits invalidate the model too.
+    for (const auto &[path, hash] : entry.dependencies) {
+        uint64_t current = 0;
+        StageTimer timer(*this, Hashing);
+        if (!HashFile(path, current) || current != hash)
+            return false;
+    }
+    return true;
+}
+
+std::string Build::BuildTexture(const std::string &path, TextureRole role,
+                                uint64_t &sourceHash) {
+    const std::string key = path + "#" + std::to_string(int(role));
+
+    std::promise<TextureResult> promise;
+    std::shared_future<TextureResult> future;
+    bool owner = false;
+    {
+        std::lock_guard<std::mutex> lock(m_textureMutex);
+        auto it = m_textures.find(key);
+        if (it == m_textures.end()) {
+            future = promise.get_future().share();
+            m_textures.emplace(key, future);
+            owner = true;
+        } else {
+            future = it->second;
+        }
+    }
+
+    if (!owner) {
+        const TextureResult &result = future.get();
+        sourceHash = result.sourceHash;
+        return result.output;
+    }
+
+    TextureResult result;
+    {
+        StageTimer timer(*this, Hashing);
+        if (!HashFile(path, result.sourceHash)) {
+            promise.set_value(result);
+            return std::string();
+        }
+    }
+    sourceHash = result.sourceHash;
+
+    result.output = AssetCache::Get()
+                        .TexturePath(result.sourceHash, role == TextureRole::BaseColor,
+                                     role == TextureRole::Normal)
+                        .string();
+
+    // Outputs are content addressed, so an existing file is already right.
+    if (!m_options.force && fs::exists(result.output)) {
+        m_texturesReused++;
+        promise.set_value(result);
+        return result.output;
+    }
+
+    ImageData image;
+    bool ok;
+    {
+        StageTimer timer(*this, Resolve);
+        ok = LoadImageRGBA(path, image);
+    }
+    if (!ok) {
+        result.output.clear();
+        promise.set_value(result);
+        return std::string();
+    }
+
+    if (!WriteTexture(image, role, result.output))
+        result.output.clear();
+
+    m_texturesBuilt++;
+    promise.set_value(result);
+    return result.output;
+}
+
+std::string Build::BuildTexture(const ImageData &image, TextureRole role) {
+    std::string output;
+    {
+        StageTimer timer(*this, Hashing);
+        output = AssetCache::Get()
+                     .TexturePath(AssetCache::ImageHash(image),
+                                  role == TextureRole::BaseColor,
+                                  role == TextureRole::Normal)
+                     .string();
+    }
+
+    if (!m_options.force && fs::exists(output)) {
+        m_texturesReused++;
+        return output;
+    }
+    if (!WriteTexture(image, role, output))
+        return std::string();
+    m_texturesBuilt++;
+    return output;
+}
+
+bool Build::WriteTexture(const ImageData &image, TextureRole role,
+                         const fs::path &output) {
+    CachedTexture texture;
+    texture.srgb = role == TextureRole::BaseColor;
+
+    std::vector<ImageData> mips;
+    {
+        StageTimer timer(*this, Mips);
+        mips = GenerateMips(image, texture.srgb);
+    }
+    {
+        StageTimer timer(*this, Compress);
+        // D3D11 needs block-compressed top levels in whole blocks, as in
+        // AssetCache::BuildTexture.
+        const bool compress = m_options.compress && image.width % 4 == 0 &&
+                              image.height % 4 == 0;
+        texture.format = !compress                     ? TextureFormat::RGBA8
+                         : role == TextureRole::Normal ? TextureFormat::BC5
+                                                       : TextureFormat::BC1;
+        for (auto &mip : mips) {
+            TextureMip out;
+            out.width = mip.width;
+            out.height = mip.height;
+            if (texture.format == TextureFormat::BC1)
+                out.data = CompressBC1(mip);
+            else if (texture.format == TextureFormat::BC5)
+                out.data = CompressBC5(mip);
+            else
+                out.data = std::move(mip.pixels);
+            texture.mips.push_back(std::move(out));
+        }
+    }
+    StageTimer timer(*this, Write);
+    std::vector<uint8_t> bytes;
+    SerializeTexture(texture, bytes);
+    return WriteFileAtomic(output.string(), bytes.data(), bytes.size());
+}
+
+bool Build::BuildModel(const fs::path &path) {
+    const std::string source = path.string();
+
+    uint64_t sourceHash = 0;
+    {
+        StageTimer timer(*this, Hashing);
+        if (!HashFile(source, sourceHash)) {
+            fprintf(stderr, "cannot read %s\n", source.c_str());
+            return false;
+        }
+    }
+
+    if (IsUpToDate(source, sourceHash)) {
+        m_skipped++;
+        return true;
+    }
+
+    ModelLoader loader;
+    {
+        StageTimer timer(*this, Import);
+        loader.Load(path.parent_path().string(), path.filename().string());
+    }
+    ManifestEntry entry;
+    entry.sourceHash = sourceHash;
+    entry.settingsHash = m_settingsHash;
+
+    // The loader wrote its chunk file into the cache, which is what the app
+    // loads.
+    if (!loader.chunkFile.Chunks().empty()) {
+        printf("%s is over the memory budget and streamed at load time\n",
+               source.c_str());
+        entry.output = fs::path(loader.chunkFile.Filename()).filename().string();
+        std::lock_guard<std::mutex> lock(m_manifestMutex);
+        m_manifest[source] = std::move(entry);
+        m_streamed++;
+        return true;
+    }
+    if (loader.meshes.empty()) {
+        fprintf(stderr, "no meshes in %s\n", source.c_str());
+        return false;
+    }
+
+    // The app creates textures from the names in the meshes, with the same
+    // ORM fallback as ExampleApp::Initialize.
+    std::set<std::string> dependencies;
+    std::map<const ImageData *, std::string> images;
+    for (const auto &mesh : loader.meshes) {
+        std::string orm = mesh.ormFilename;
+        if (orm.empty() && !mesh.baseColorFilename.empty()) {
+            StageTimer timer(*this, Resolve);
+            const auto pos = mesh.baseColorFilename.find("BaseColor");
+            if (pos != std::string::npos) {
+                orm = mesh.baseColorFilename;
+                orm.replace(pos, 9, "ORM");
+                if (!fs::exists(orm))
+                    orm.clear();
+            }
+        }
+
+        const std::pair<const std::string *, TextureRole> textures[] = {
+            {&mesh.baseColorFilename, TextureRole::BaseColor},
+            {&mesh.normalFilename, TextureRole::Normal},
+            {&orm, TextureRole::Orm}};
+        const std::shared_ptr<const ImageData> *decoded[] = {
+            &mesh.baseColorImage, &mesh.normalImage, &mesh.ormImage};
+        for (size_t t = 0; t < 3; t++) {
+            auto [name, role] = textures[t];
+            // Part of the model source, so not a dependency of its own.
+            if (const ImageData *image = decoded[t]->get()) {
+                if (images.find(image) == images.end())
+                    images.emplace(image, BuildTexture(*image, role));
+                continue;
+            }
+            if (name->empty())
+                continue;
+            uint64_t hash = 0;
+            const std::string output = BuildTexture(*name, role, hash);
+            if (!output.empty() && dependencies.insert(*name).second)
+                entry.dependencies.emplace_back(*name, hash);
+        }
+    }
+
+    // Skinned and morphed meshes and decoded images are not cached, so the
+    // app imports such models again and only finds their textures.
+    if (loader.cacheKey == 0) {
+        std::lock_guard<std::mutex> lock(m_manifestMutex);
+        m_manifest[source] = std::move(entry);
+        m_built++;
+        return true;
+    }
+    entry.output =
+        AssetCache::Get().MeshesPath(loader.cacheKey).filename().string();
+
+    {
+        StageTimer timer(*this, Optimize);
+        for (auto &mesh : loader.meshes) {
+            const size_t triangles = mesh.indices.size() / 3;
+            m_triangles += triangles;
+            m_missesBefore += uint64_t(
+                AverageCacheMissRatio(mesh.indices, mesh.vertices.size()) * triangles);
+            OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+            // The loader's meshlets don't survive the reorder.
+            BuildMeshlets(mesh);
+            OptimizeVertexFetch(mesh);
+            m_missesAfter += uint64_t(
+                AverageCacheMissRatio(mesh.indices, mesh.vertices.size()) * triangles);
+        }
+    }
+
+    {
+        StageTimer timer(*this, Write);
+        std::vector<uint8_t> bytes;
+        SerializeMeshes(loader.meshes, bytes);
+        if (!WriteFileAtomic(AssetCache::Get().MeshesPath(loader.cacheKey).string(),
+                             bytes.data(), bytes.size()))
+            return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_manifestMutex);
+        m_manifest[source] = std::move(entry);
+    }
+    m_built++;
+    return true;
+}
+
+void Build::Run(const std::vector<fs::path> &models) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < models.size(); i = next++) {
+            if (!BuildModel(models[i]))
+                m_failed++;
+        }
+    };
+
+    const unsigned jobs =
+        unsigned(std::min<size_t>(m_options.jobs, std::max<size_t>(models.size(), 1)));
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < jobs; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+}
+
+void Build::PrintSummary(double wallMs) const {
+    printf("models: %d built, %d up to date, %d streamed, %d failed\n",
+           m_built.load(), m_skipped.load(), m_streamed.load(), m_failed.load());
+    printf("textures: %d built, %d reused\n", m_texturesBuilt.load(),
+           m_texturesReused.load());
+    if (m_triangles > 0) {
+        printf("vertex cache ACMR: %.3f -> %.3f\n",
+               double(m_missesBefore) / double(m_triangles),
+               double(m_missesAfter) / double(m_triangles));
+    }
+
+    uint64_t totalUs = 0;
+    for (const auto &us : m_stageUs)
+        totalUs += us.load();
+
+    printf("%-10s %10s %7s\n", "stage", "cpu s", "share");
+    for (int s = 0; s < StageCount; s++) {
+        const double seconds = double(m_stageUs[s].load()) / 1e6;
+        printf("%-10s %10.2f %6.1f%%\n", kStageNames[s], seconds,
+               totalUs ? 100.0 * double(m_stageUs[s].load()) / double(totalUs)
+                       : 0.0);
+    }
+    printf("wall %.2f s with %u jobs\n", wallMs / 1000.0, m_options.jobs);
+}
+
+bool IsModelFile(const fs::path &path) {
+    static const std::set<std::string> kExtensions = {
+        ".fbx", ".obj", ".gltf", ".glb", ".dae", ".3ds", ".blend", ".ply"};
+    std::string ext = path.extension().string();
+    for (auto &c : ext)
+        c = char(tolower((unsigned char)c));
+    return kExtensions.count(ext) > 0;
+}
+
+void PrintUsage() {
+    fprintf(stderr, "usage: AssetBuild [-j jobs] [-o outdir] [-f] [-nocompress] "
+                    "input_dir...\n");
+}
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    std::vector<fs::path> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            options.jobs = unsigned(std::max(1, atoi(argv[++i])));
+        } else if (arg == "-o" && i + 1 < argc) {
+            options.outDir = argv[++i];
+        } else if (arg == "-f") {
+            options.force = true;
+        } else if (arg == "-nocompress") {
+            options.compress = false;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage();
+            return 0;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+
+    if (inputs.empty()) {
+        PrintUsage();
+        return 1;
+    }
+
+    // The loader and the texture paths go through the cache directory.
+    AssetCache &cache = AssetCache::Get();
+    if (!options.outDir.empty())
+        cache.SetDirectory(fs::absolute(options.outDir));
+    if (!cache.Enabled()) {
+        fprintf(stderr, "the asset cache is disabled, pass -o cachedir\n");
+        return 1;
+    }
+    options.outDir = cache.Directory();
+    std::error_code ec;
+
+    std::vector<fs::path> models;
+    for (const auto &input : inputs) {
+        if (fs::is_regular_file(input)) {
+            models.push_back(fs::absolute(input));
+            continue;
+        }
+        for (auto it = fs::recursive_directory_iterator(
+                 input, fs::directory_options::skip_permission_denied, ec);
+             it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (it->is_directory() && fs::equivalent(it->path(), options.outDir, ec)) {
+                it.disable_recursion_pending();
+                continue;
+            }
+            if (it->is_regular_file() && IsModelFile(it->path()))
+                models.push_back(fs::absolute(it->path()));
+        }
+    }
+    std::sort(models.begin(), models.end());
+
+    Build build(options);
+    build.LoadManifest();
+
+    CpuTimer wall;
+    build.Run(models);
+    build.SaveManifest();
+    build.PrintSummary(wall.ElapsedMs());
+
+    return build.HasFailures() ? 1 : 0;
+}
@@ -0,0 +1,361 @@
+// Headless ModelLoader benchmark. No window or D3D device is created.
+//
+//   LoaderBench [-n iterations] [-o result.json] [-l list.txt] [-cache]
+//               [-io mmap|stdio] [-fbx native|assimp]
+//               [-gltf native|assimp] [-obj native|assimp] [-budget MB]
+//               model...
+//
+// Every iteration runs the importer. -cache loads through the asset cache
+// instead, so the first iteration fills it and the rest time cache hits.
+// -io picks how Assimp reads the source, memory-mapped by default.
+// -fbx, -gltf and -obj pick the importer for those formats, the native
+// loaders by default.
+// -budget sets ModelLoader::memoryBudget. Larger models are streamed to
+// chunk files and only the chunks within the budget are counted.
+//
+// Build on Linux with tools/CMakeLists.txt, which compiles the sources in
+// source/ except AppBase.cpp, ExampleApp.cpp and main.cpp and links assimp
+// and pthread. DirectXTK's SimpleMath.h and DirectXMath must be on the
+// include path.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "AssetCache.h"
+#include "GeometryGenerator.h"
+#include "Image.h"
+#include "ModelLoader.h"
+#include "PerfStats.h"
+
+static std::atomic<uint64_t> g_allocCount{0};
+static std::atomic<uint64_t> g_allocBytes{0};
+
+void *operator new(size_t size) {
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+using namespace hlab;
+
+struct Sample {
+    LoaderTimings timings;
+    double textureMs = 0.0;
+    double totalMs = 0.0;
+    uint64_t allocCount = 0;
+    uint64_t allocBytes = 0;
+};
+
+struct ModelResult {
+    std::string path;
+    uint64_t fileBytes = 0;
+    size_t textureCount = 0;
+    std::vector<Sample> samples;
+};
+
+struct Stat {
+    double min = 0.0, mean = 0.0, max = 0.0;
+};
+
+template <typename F> Stat Summarize(const std::vector<Sample> &samples, F f) {
+    Stat s;
+    if (samples.empty())
+        return s;
+    s.min = s.max = double(f(samples[0]));
+    for (const auto &sample : samples) {
+        const double v = double(f(sample));
+        s.min = std::min(s.min, v);
+        s.max = std::max(s.max, v);
+        s.mean += v;
+    }
+    s.mean /= double(samples.size());
+    return s;
+}
+
+uint64_t PeakRssKB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return uint64_t(pmc.PeakWorkingSetSize / 1024);
+#else
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return uint64_t(usage.ru_maxrss);
+#endif
+}
+
+Sample RunOnce(const std::filesystem::path &path, size_t &textureCount,
+               LoaderTimings &last) {
+    Sample sample;
+
+    const uint64_t allocCount = g_allocCount.load();
+    const uint64_t allocBytes = g_allocBytes.load();
+    CpuTimer totalTimer;
+
+    auto meshes = GeometryGenerator::ReadFromFile(
+        path.parent_path().string(), path.filename().string(),
+        &sample.timings);
+
+    CpuTimer textureTimer;
+    std::set<std::string> textures;
+    std::set<const ImageData *> images; // decoded by the loader already
+    for (const auto &mesh : meshes) {
+        for (const auto *name : {&mesh.baseColorFilename, &mesh.normalFilename,
+                                 &mesh.ormFilename}) {
+            if (!name->empty())
+                textures.insert(*name);
+        }
+        for (const auto *image :
+             {&mesh.baseColorImage, &mesh.normalImage, &mesh.ormImage}) {
+            if (*image)
+                images.insert(image->get());
+        }
+    }
+    for (const auto &name : textures) {
+        ImageData image;
+        LoadImageRGBA(name, image);
+    }
+    sample.textureMs = textureTimer.ElapsedMs();
+    sample.totalMs = totalTimer.ElapsedMs();
+
+    sample.allocCount = g_allocCount.load() - allocCount;
+    sample.allocBytes = g_allocBytes.load() - allocBytes;
+
+    textureCount = textures.size() + images.size();
+    last = sample.timings;
+    return sample;
+}
+
+void WriteStat(FILE *out, const char *name, const Stat &s, bool comma) {
+    fprintf(out,
+            "        \"%s\": {\"min\": %.3f, \"mean\": %.3f, \"max\": %.3f}%s\n",
+            name, s.min, s.mean, s.max, comma ? "," : "");
+}
+
+std::string Escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+        if ((unsigned char)c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+            out += code;
+            continue;
+        }
+        if (c == '"' || c == '\\')
+            out.push_back('\\');
+        out.push_back(c);
+    }
+    return out;
+}
+
+void WriteJson(FILE *out, const std::vector<ModelResult> &results,
+               int iterations) {
+    fprintf(out, "{\n  \"iterations\": %d,\n  \"peakRssKB\": %llu,\n",
+            iterations, (unsigned long long)PeakRssKB());
+    fprintf(out, "  \"io\": \"%s\",\n  \"cache\": %s,\n",
+            ModelLoader::useMappedIO ? "mmap" : "stdio",
+            AssetCache::Get().Enabled() ? "true" : "false");
+    fprintf(out, "  \"fbx\": \"%s\",\n  \"gltf\": \"%s\",\n  \"obj\": \"%s\",\n",
+            ModelLoader::useFbxFastPath ? "native" : "assimp",
+            ModelLoader::useGltfFastPath ? "native" : "assimp",
+            ModelLoader::useObjFastPath ? "native" : "assimp");
+    fprintf(out, "  \"budgetMB\": %llu,\n",
+            (unsigned long long)(ModelLoader::memoryBudget >> 20));
+    fprintf(out, "  \"models\": [\n");
+
+    for (size_t m = 0; m < results.size(); m++) {
+        const auto &r = results[m];
+        const auto &samples = r.samples;
+        const LoaderTimings &t = samples.back().timings;
+
+        const Stat total = Summarize(samples, [](const Sample &s) {
+            return s.totalMs;
+        });
+        const double seconds = std::max(total.mean, 1e-6) / 1000.0;
+        const double triangles = double(t.indexCount / 3);
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"path\": \"%s\",\n", Escape(r.path).c_str());
+        fprintf(out, "      \"fileBytes\": %llu,\n",
+                (unsigned long long)r.fileBytes);
+        fprintf(out, "      \"importer\": \"%s\",\n",
+                t.cacheHit    ? "cache"
+                : t.streamed  ? "stream"
+                : t.nativeFbx ? "fbx"
+                : t.nativeGltf ? "gltf"
+                : t.nativeObj  ? "obj"
+                               : "assimp");
+        fprintf(out, "      \"meshes\": %zu,\n", t.meshCount);
+        fprintf(out, "      \"chunks\": %zu,\n", t.chunkCount);
+        fprintf(out, "      \"vertices\": %zu,\n", t.vertexCount);
+        fprintf(out, "      \"indices\": %zu,\n", t.indexCount);
+        fprintf(out, "      \"textures\": %zu,\n", r.textureCount);
+        fprintf(out, "      \"stagesMs\": {\n");
+        WriteStat(out, "readFile", Summarize(samples, [](const Sample &s) {
+                      return s.timings.readFileMs;
+                  }), true);
+        WriteStat(out, "processNode", Summarize(samples, [](const Sample &s) {
+                      return s.timings.processNodeMs;
+                  }), true);
+        WriteStat(out, "normals", Summarize(samples, [](const Sample &s) {
+                      return s.timings.normalsMs;
+                  }), true);
+        WriteStat(out, "normalize", Summarize(samples, [](const Sample &s) {
+                      return s.timings.normalizeMs;
+                  }), true);
+        WriteStat(out, "meshlets", Summarize(samples, [](const Sample &s) {
+                      return s.timings.meshletsMs;
+                  }), true);
+        WriteStat(out, "textures", Summarize(samples, [](const Sample &s) {
+                      return s.textureMs;
+                  }), true);
+        WriteStat(out, "total", total, false);
+        fprintf(out, "      },\n");
+
+        const Stat allocCount = Summarize(
+            samples, [](const Sample &s) { return s.allocCount; });
+        const Stat allocBytes = Summarize(
+            samples, [](const Sample &s) { return s.allocBytes; });
+        fprintf(out,
+                "      \"allocations\": {\"count\": %.0f, \"bytes\": %.0f, "
+                "\"readFile\": %llu, \"processNode\": %llu, "
+                "\"normals\": %llu, \"normalize\": %llu, \"meshlets\": %llu},\n",
+                allocCount.mean, allocBytes.mean,
+                (unsigned long long)t.readFileAllocs,
+                (unsigned long long)t.processNodeAllocs,
+                (unsigned long long)t.normalsAllocs,
+                (unsigned long long)t.normalizeAllocs,
+                (unsigned long long)t.meshletsAllocs);
+        fprintf(out, "      \"trianglesPerSec\": %.1f,\n", triangles / seconds);
+        fprintf(out, "      \"mbPerSec\": %.3f\n",
+                double(r.fileBytes) / (1024.0 * 1024.0) / seconds);
+        fprintf(out, "    }%s\n", m + 1 < results.size() ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+}
+
+void PrintUsage() {
+    fprintf(stderr, "usage: LoaderBench [-n iterations] [-o result.json] "
+                    "[-l list.txt] [-cache] [-io mmap|stdio] "
+                    "[-fbx native|assimp] [-gltf native|assimp] "
+                    "[-obj native|assimp] [-budget MB] model...\n");
+}
+}
+
+int main(int argc, char **argv) {
+    int iterations = 5;
+    std::string outPath;
+    std::vector<std::string> models;
+    bool useCache = false;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            iterations = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-o" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (arg == "-l" && i + 1 < argc) {
+            std::ifstream list(argv[++i]);
+            std::string line;
+            while (std::getline(list, line)) {
+                if (!line.empty() && line[0] != '#')
+                    models.push_back(line);
+            }
+        } else if (arg == "-io" && i + 1 < argc) {
+            ModelLoader::useMappedIO = std::string(argv[++i]) != "stdio";
+        } else if (arg == "-fbx" && i + 1 < argc) {
+            ModelLoader::useFbxFastPath = std::string(argv[++i]) != "assimp";
+        } else if (arg == "-gltf" && i + 1 < argc) {
+            ModelLoader::useGltfFastPath = std::string(argv[++i]) != "assimp";
+        } else if (arg == "-obj" && i + 1 < argc) {
+            ModelLoader::useObjFastPath = std::string(argv[++i]) != "assimp";
+        } else if (arg == "-budget" && i + 1 < argc) {
+            ModelLoader::memoryBudget =
+                uint64_t(std::max(1, atoi(argv[++i]))) << 20;
+        } else if (arg == "-cache") {
+            useCache = true;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage();
+            return 0;
+        } else {
+            models.push_back(arg);
+        }
+    }
+
+    if (models.empty()) {
+        PrintUsage();
+        return 1;
+    }
+    if (!useCache)
+        AssetCache::Get().SetDirectory(std::filesystem::path());
+
+    SetAllocationCounter(
+        []() { return g_allocCount.load(std::memory_order_relaxed); });
+
+    std::vector<ModelResult> results;
+    for (const auto &model : models) {
+        const std::filesystem::path path = std::filesystem::absolute(model);
+
+        std::error_code ec;
+        ModelResult result;
+        result.path = path.string();
+        result.fileBytes = std::filesystem::file_size(path, ec);
+        if (ec) {
+            fprintf(stderr, "cannot open %s\n", result.path.c_str());
+            return 1;
+        }
+
+        LoaderTimings last;
+        for (int i = 0; i < iterations; i++)
+            result.samples.push_back(RunOnce(path, result.textureCount, last));
+
+        if (last.meshCount == 0) {
+            fprintf(stderr, "no meshes loaded from %s\n", result.path.c_str());
+            return 1;
+        }
+
+        results.push_back(std::move(result));
+    }
+
+    FILE *out = stdout;
+    if (!outPath.empty()) {
+        out = fopen(outPath.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", outPath.c_str());
+            return 1;
+        }
+    }
+
+    WriteJson(out, results, iterations);
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,308 @@
+// Headless occlusion culling check and benchmark. No window or D3D device
+// is created.
+//
+//   OcclusionBench [-objects N] [-occluders N] [-views N] [-seed N]
+//                  [-width W] [-height H] [-o result.json]
+//
+// Places the objects of a StressSceneGenerator scene and, from random
+// cameras, rasterizes the largest of them into an OcclusionBuffer and
+// culls every object against it. Each view is compared with brute force:
+// a reference depth buffer that tests every pixel center against every
+// occluder triangle in double precision, and a visibility reference that
+// tests every pixel of each object's screen box against that depth. The
+// tool fails if the HiZ test hides an object the reference sees.
+//
+// Build on Linux with tools/CMakeLists.txt, like LoaderBench.
+
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "OcclusionCulling.h"
+#include "PerfStats.h"
+#include "StressScene.h"
+
+namespace {
+
+using namespace hlab;
+using DirectX::SimpleMath::Vector3;
+using DirectX::SimpleMath::Vector4;
+
+struct BenchResult {
+    size_t objects = 0;
+    size_t occluderTriangles = 0;
+    int width = 0;
+    int height = 0;
+    int views = 0;
+    double rasterizeMs = 0.0;   // per view
+    double cullMs = 0.0;        // per view
+    double referenceMs = 0.0;   // per view
+    size_t coverageMismatches = 0; // pixels covered by only one of the two
+    double maxDepthError = 0.0;    // on pixels both cover
+    size_t culled = 0;
+    size_t referenceCulled = 0;
+    size_t wronglyCulled = 0; // culled although the reference sees them
+};
+
+// Depth with the same conventions as OcclusionBuffer: pixel centers,
+// inclusive edges, triangles touching the near plane dropped.
+void ReferenceDepth(const std::vector<OccluderMesh> &occluders,
+                    const Matrix &mvp, int width, int height,
+                    std::vector<float> &depth) {
+    depth.assign(size_t(width) * height, 1.0f);
+    for (const auto &occluder : occluders) {
+        for (size_t t = 0; t + 2 < occluder.indices.size(); t += 3) {
+            double x[3], y[3], z[3];
+            bool clipped = false;
+            for (int k = 0; k < 3; k++) {
+                const Vector3 &p = occluder.positions[occluder.indices[t + k]];
+                const Vector4 c = Vector4::Transform(Vector4(p.x, p.y, p.z, 1.0f), mvp);
+                if (c.w <= 1e-6f || c.z < 0.0f) {
+                    clipped = true;
+                    break;
+                }
+                x[k] = (double(c.x) / c.w + 1.0) * 0.5 * width;
+                y[k] = (1.0 - double(c.y) / c.w) * 0.5 * height;
+                z[k] = double(c.z) / c.w;
+            }
+            if (clipped)
+                continue;
+
+            const double area =
+                (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+            if (std::fabs(area) < 1e-8)
+                continue;
+
+            const int x0 = int(std::max(std::floor(std::min({x[0], x[1], x[2]})), 0.0));
+            const int x1 = int(std::min(std::ceil(std::max({x[0], x[1], x[2]})),
+                                        double(width - 1)));
+            const int y0 = int(std::max(std::floor(std::min({y[0], y[1], y[2]})), 0.0));
+            const int y1 = int(std::min(std::ceil(std::max({y[0], y[1], y[2]})),
+                                        double(height - 1)));
+            for (int py = y0; py <= y1; py++) {
+                for (int px = x0; px <= x1; px++) {
+                    const double cx = px + 0.5, cy = py + 0.5;
+                    double w[3];
+                    for (int i = 0; i < 3; i++) {
+                        const int j = (i + 1) % 3, k = (i + 2) % 3;
+                        w[k] = ((x[j] - x[i]) * (cy - y[i]) -
+                                (y[j] - y[i]) * (cx - x[i])) / area;
+                    }
+                    if (w[0] < 0.0 || w[1] < 0.0 || w[2] < 0.0)
+                        continue;
+                    const float d = float(w[0] * z[0] + w[1] * z[1] + w[2] * z[2]);
+                    float &out = depth[size_t(py) * width + px];
+                    out = std::min(out, d);
+                }
+            }
+        }
+    }
+}
+
+// Visible unless the nearest corner of the box is behind every depth
+// sample its screen rectangle covers.
+bool ReferenceVisible(const MeshBounds &bounds, const Matrix &mvp, int width,
+                      int height, const std::vector<float> &depth) {
+    double minX = DBL_MAX, minY = DBL_MAX, maxX = -DBL_MAX, maxY = -DBL_MAX;
+    float minZ = FLT_MAX;
+    for (int i = 0; i < 8; i++) {
+        const Vector3 p((i & 1) ? bounds.aabbMax.x : bounds.aabbMin.x,
+                        (i & 2) ? bounds.aabbMax.y : bounds.aabbMin.y,
+                        (i & 4) ? bounds.aabbMax.z : bounds.aabbMin.z);
+        const Vector4 c = Vector4::Transform(Vector4(p.x, p.y, p.z, 1.0f), mvp);
+        if (c.w <= 1e-6f || c.z < 0.0f)
+            return true;
+        const double sx = (double(c.x) / c.w + 1.0) * 0.5 * width;
+        const double sy = (1.0 - double(c.y) / c.w) * 0.5 * height;
+        minX = std::min(minX, sx);
+        maxX = std::max(maxX, sx);
+        minY = std::min(minY, sy);
+        maxY = std::max(maxY, sy);
+        minZ = std::min(minZ, c.z / c.w);
+    }
+    if (maxX < 0.0 || maxY < 0.0 || minX >= width || minY >= height)
+        return true;
+
+    const int x0 = int(std::floor(std::max(minX, 0.0)));
+    const int y0 = int(std::floor(std::max(minY, 0.0)));
+    const int x1 = int(std::floor(std::min(maxX, double(width - 1))));
+    const int y1 = int(std::floor(std::min(maxY, double(height - 1))));
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            if (minZ <= depth[size_t(y) * width + x])
+                return true;
+        }
+    }
+    return false;
+}
+
+void WriteJson(FILE *out, const BenchResult &r) {
+    fprintf(out, "{\n  \"objects\": %zu,\n  \"occluderTriangles\": %zu,\n",
+            r.objects, r.occluderTriangles);
+    fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n  \"views\": %d,\n",
+            r.width, r.height, r.views);
+    fprintf(out, "  \"rasterizeMs\": %.4f,\n  \"cullMs\": %.4f,\n", r.rasterizeMs,
+            r.cullMs);
+    fprintf(out, "  \"referenceMs\": %.4f,\n", r.referenceMs);
+    fprintf(out, "  \"depth\": {\"coverageMismatches\": %zu, \"maxError\": %.6f},\n",
+            r.coverageMismatches, r.maxDepthError);
+    fprintf(out,
+            "  \"visibility\": {\"culled\": %zu, \"referenceCulled\": %zu, "
+            "\"wronglyCulled\": %zu}\n}\n",
+            r.culled, r.referenceCulled, r.wronglyCulled);
+}
+
+void PrintUsage() {
+    fprintf(stderr,
+            "usage: OcclusionBench [-objects N] [-occluders N] [-views N] "
+            "[-seed N] [-width W] [-height H] [-o result.json]\n");
+}
+}
+
+int main(int argc, char **argv) {
+    StressSceneDesc desc;
+    desc.meshCount = 2000;
+    desc.maxTriangles = 500;
+    desc.extent = 50.0f;
+    int occluderCount = 32;
+    int views = 20;
+    int width = 320;
+    int height = 180;
+    std::string outPath;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-objects" && hasValue) {
+            desc.meshCount = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-occluders" && hasValue) {
+            occluderCount = std::max(0, atoi(argv[++i]));
+        } else if (arg == "-views" && hasValue) {
+            views = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-seed" && hasValue) {
+            desc.seed = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "-width" && hasValue) {
+            width = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-height" && hasValue) {
+            height = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-o" && hasValue) {
+            outPath = argv[++i];
+        } else {
+            PrintUsage();
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+
+    const StressScene scene = StressSceneGenerator::Generate(desc);
+    const std::vector<MeshData> meshes = StressSceneGenerator::Flatten(scene);
+    std::vector<MeshBounds> bounds(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++)
+        bounds[i] = meshes[i].bounds;
+
+    // The biggest objects occlude, like ExampleApp::SelectOccluders.
+    std::vector<size_t> order(meshes.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return bounds[a].radius > bounds[b].radius;
+    });
+    order.resize(std::min(order.size(), size_t(occluderCount)));
+
+    BenchResult result;
+    result.objects = meshes.size();
+    std::vector<OccluderMesh> occluders;
+    for (size_t i : order) {
+        OccluderMesh occluder;
+        for (const auto &v : meshes[i].vertices)
+            occluder.positions.push_back(v.position);
+        occluder.indices = meshes[i].indices;
+        result.occluderTriangles += occluder.indices.size() / 3;
+        occluders.push_back(std::move(occluder));
+    }
+
+    OcclusionBuffer buffer;
+    buffer.Resize(width, height);
+    result.width = buffer.Width();
+    result.height = buffer.Height();
+    result.views = views;
+
+    std::mt19937 rng(desc.seed);
+    const auto range = [&](float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng);
+    };
+
+    std::vector<float> reference;
+    std::vector<uint32_t> visible;
+    for (int v = 0; v < views; v++) {
+        const Vector3 eye(range(-desc.extent, desc.extent),
+                          range(-desc.extent, desc.extent),
+                          range(-desc.extent, desc.extent));
+        const Matrix view = Matrix::CreateTranslation(-eye) *
+                            Matrix::CreateRotationY(range(0.0f, DirectX::XM_2PI)) *
+                            Matrix::CreateRotationX(range(-0.5f, 0.5f));
+        const Matrix projection = DirectX::XMMatrixPerspectiveFovLH(
+            DirectX::XMConvertToRadians(70.0f), float(width) / float(height), 0.1f,
+            desc.extent * 4.0f);
+        const Matrix viewProj = view * projection;
+
+        CpuTimer rasterizeTimer;
+        buffer.Rasterize(occluders, viewProj);
+        result.rasterizeMs += rasterizeTimer.ElapsedMs() / views;
+
+        visible.resize(bounds.size());
+        for (uint32_t i = 0; i < uint32_t(bounds.size()); i++)
+            visible[i] = i;
+        CpuTimer cullTimer;
+        buffer.Cull(bounds, viewProj, visible);
+        result.cullMs += cullTimer.ElapsedMs() / views;
+
+        CpuTimer referenceTimer;
+        ReferenceDepth(occluders, viewProj, result.width, result.height, reference);
+        result.referenceMs += referenceTimer.ElapsedMs() / views;
+
+        const std::vector<float> &depth = buffer.Depth();
+        for (size_t p = 0; p < depth.size(); p++) {
+            const bool covered = depth[p] < 1.0f;
+            if (covered != (reference[p] < 1.0f)) {
+                result.coverageMismatches++;
+            } else if (covered) {
+                result.maxDepthError = std::max(
+                    result.maxDepthError, double(std::fabs(depth[p] - reference[p])));
+            }
+        }
+
+        // Visible is in index order, so the culled objects are the gaps.
+        size_t next = 0;
+        for (uint32_t i = 0; i < uint32_t(bounds.size()); i++) {
+            const bool kept = next < visible.size() && visible[next] == i;
+            if (kept)
+                next++;
+            const bool seen = ReferenceVisible(bounds[i], viewProj, result.width,
+                                               result.height, reference);
+            result.culled += kept ? 0 : 1;
+            result.referenceCulled += seen ? 0 : 1;
+            result.wronglyCulled += !kept && seen ? 1 : 0;
+        }
+    }
+
+    FILE *out = stdout;
+    if (!outPath.empty()) {
+        out = fopen(outPath.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", outPath.c_str());
+            return 1;
+        }
+    }
+
+    WriteJson(out, result);
+
+    if (out != stdout)
+        fclose(out);
+    return result.wronglyCulled ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+// Headless picking benchmark. No window or D3D device is created.
+//
+//   PickBench [-objects N] [-rays N] [-seed N] [-extent E] [-o result.json]
+//
+// Flattens a StressSceneGenerator scene the way ModelLoader hands meshes to
+// the app, builds a ScenePicker over it and casts rays between random
+// points. Every ray is also tested against every triangle by brute force
+// and the nearest hits are compared. Exits non-zero on any mismatch.
+//
+// Build on Linux with tools/CMakeLists.txt, like LoaderBench.
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Bvh.h"
+#include "PerfStats.h"
+#include "StressScene.h"
+
+namespace {
+
+using namespace hlab;
+
+struct BenchResult {
+    size_t meshes = 0;
+    size_t triangles = 0;
+    double buildMs = 0.0;
+    int rays = 0;
+    double pickMs = 0.0;  // per ray
+    double bruteMs = 0.0; // per ray
+    size_t hits = 0;
+    size_t mismatches = 0;
+};
+
+// Same two-sided Moller-Trumbore as TriangleMeshBvh.
+float IntersectTriangle(const Ray &ray, const Vector3 &p0, const Vector3 &p1,
+                        const Vector3 &p2) {
+    const Vector3 e1 = p1 - p0;
+    const Vector3 e2 = p2 - p0;
+    const Vector3 pv = ray.direction.Cross(e2);
+    const float det = e1.Dot(pv);
+    if (std::fabs(det) < 1e-12f)
+        return FLT_MAX;
+    const float invDet = 1.0f / det;
+    const Vector3 tv = ray.origin - p0;
+    const float u = tv.Dot(pv) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return FLT_MAX;
+    const Vector3 qv = tv.Cross(e1);
+    const float v = ray.direction.Dot(qv) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return FLT_MAX;
+    const float t = e2.Dot(qv) * invDet;
+    return t < 0.0f ? FLT_MAX : t;
+}
+
+float BruteForce(const std::vector<MeshData> &meshes, const Ray &ray) {
+    float nearest = ray.tMax;
+    for (const auto &mesh : meshes) {
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            const float t = IntersectTriangle(
+                ray, mesh.vertices[mesh.indices[i]].position,
+                mesh.vertices[mesh.indices[i + 1]].position,
+                mesh.vertices[mesh.indices[i + 2]].position);
+            nearest = std::min(nearest, t);
+        }
+    }
+    return nearest;
+}
+
+void WriteJson(FILE *out, const BenchResult &r) {
+    fprintf(out, "{\n  \"meshes\": %zu,\n  \"triangles\": %zu,\n", r.meshes,
+            r.triangles);
+    fprintf(out, "  \"buildMs\": %.3f,\n  \"rays\": %d,\n", r.buildMs, r.rays);
+    fprintf(out, "  \"pickMs\": %.5f,\n  \"bruteMs\": %.4f,\n", r.pickMs / r.rays,
+            r.bruteMs / r.rays);
+    fprintf(out, "  \"speedup\": %.1f,\n", r.bruteMs / std::max(r.pickMs, 1e-6));
+    fprintf(out, "  \"hits\": %zu,\n  \"mismatches\": %zu\n}\n", r.hits,
+            r.mismatches);
+}
+
+void PrintUsage() {
+    fprintf(stderr, "usage: PickBench [-objects N] [-rays N] [-seed N] "
+                    "[-extent E] [-o result.json]\n");
+}
+}
+
+int main(int argc, char **argv) {
+    StressSceneDesc desc;
+    desc.meshCount = 500;
+    desc.maxTriangles = 2000;
+    int rays = 200;
+    std::string outPath;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-objects" && hasValue) {
+            desc.meshCount = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-rays" && hasValue) {
+            rays = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-seed" && hasValue) {
+            desc.seed = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "-extent" && hasValue) {
+            desc.extent = float(atof(argv[++i]));
+        } else if (arg == "-o" && hasValue) {
+            outPath = argv[++i];
+        } else {
+            PrintUsage();
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+
+    const std::vector<MeshData> meshes =
+        StressSceneGenerator::Flatten(StressSceneGenerator::Generate(desc));
+
+    BenchResult result;
+    result.meshes = meshes.size();
+    for (const auto &mesh : meshes)
+        result.triangles += mesh.indices.size() / 3;
+    result.rays = rays;
+
+    ScenePicker picker;
+    CpuTimer buildTimer;
+    picker.Build(meshes);
+    result.buildMs = buildTimer.ElapsedMs();
+
+    std::mt19937 rng(desc.seed);
+    const auto range = [&](float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng);
+    };
+    const auto randomPoint = [&]() {
+        return Vector3(range(-desc.extent, desc.extent),
+                       range(-desc.extent, desc.extent),
+                       range(-desc.extent, desc.extent));
+    };
+
+    for (int r = 0; r < rays; r++) {
+        Ray ray;
+        ray.origin = randomPoint();
+        ray.direction = randomPoint() - ray.origin;
+
+        CpuTimer pickTimer;
+        const RayHit hit = picker.Intersect(ray);
+        result.pickMs += pickTimer.ElapsedMs();
+
+        CpuTimer bruteTimer;
+        const float t = BruteForce(meshes, ray);
+        result.bruteMs += bruteTimer.ElapsedMs();
+
+        const bool bruteHit = t < ray.tMax;
+        result.hits += bruteHit ? 1 : 0;
+        if (hit.hit != bruteHit ||
+            (bruteHit && std::fabs(hit.t - t) > 1e-4f * std::max(1.0f, t)))
+            result.mismatches++;
+    }
+
+    FILE *out = stdout;
+    if (!outPath.empty()) {
+        out = fopen(outPath.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", outPath.c_str());
+            return 1;
+        }
+    }
+
+    WriteJson(out, result);
+
+    if (out != stdout)
+        fclose(out);
+    return result.mismatches ? 1 : 0;
+}
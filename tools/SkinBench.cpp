@@ -0,0 +1,335 @@
+// Headless CPU skinning benchmark. No window or D3D device is created.
+//
+//   SkinBench [-n frames] [-dt seconds] [-instances count]
+//             [-precision fraction] [-o result.json] model...
+//
+// Plays the first clip of each model for the given number of frames and
+// times sampling, the transform update and SkinMesh separately. Every
+// frame's output is checked against a scalar reference and the largest
+// position error is reported.
+//
+// Meshes with morph targets get every target weighted each frame and
+// ApplyMorphTargets timed.
+//
+// Every clip is also compressed with CompressClip at the given precision
+// and sampled for the given number of instances per frame, at staggered
+// times, both raw and compressed. Reports the bytes per clip, poses per
+// second and the largest joint position error of the compressed clip.
+//
+// Build on Linux with tools/CMakeLists.txt, like LoaderBench.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "CompressedClip.h"
+#include "GeometryGenerator.h"
+#include "Morphing.h"
+#include "PerfStats.h"
+#include "Skinning.h"
+
+namespace {
+
+using namespace hlab;
+using DirectX::SimpleMath::Vector3;
+
+struct ClipResult {
+    std::string name;
+    size_t rawBytes = 0;
+    size_t compressedBytes = 0;
+    double compressMs = 0.0;
+    double rawPosesPerSec = 0.0;
+    double compressedPosesPerSec = 0.0;
+    float maxError = 0.0f;
+};
+
+struct ModelResult {
+    std::string path;
+    size_t skinnedMeshes = 0;
+    size_t skinnedVertices = 0;
+    size_t joints = 0;
+    size_t clips = 0;
+    double sampleMs = 0.0;
+    double transformsMs = 0.0;
+    double skinMs = 0.0;
+    float maxError = 0.0f;
+    size_t morphedMeshes = 0;
+    size_t morphTargets = 0;
+    size_t morphedVertices = 0; // in the ranges of all meshes
+    double morphMs = 0.0;
+    std::vector<ClipResult> clipResults;
+};
+
+// The straightforward version SkinVertices has to match.
+float MaxReferenceError(const MeshData &mesh, const std::vector<Matrix> &joints,
+                        const std::vector<Vertex> &skinned) {
+    float maxError = 0.0f;
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        const VertexWeights &w = mesh.skin.weights[i];
+        Matrix blend = joints[w.joints[0]] * w.weights[0];
+        for (int k = 1; k < kMaxInfluences; k++)
+            blend += joints[w.joints[k]] * w.weights[k];
+        const Vector3 p = Vector3::Transform(mesh.vertices[i].position, blend);
+        maxError = std::max(maxError, (p - skinned[i].position).Length());
+    }
+    return maxError;
+}
+
+ClipResult BenchClip(const AnimationClip &clip, const SceneGraph &bindPose,
+                     int frames, int instances, float dt,
+                     const ClipCompression &settings) {
+    ClipResult r;
+    r.name = clip.name;
+    r.rawBytes = ClipSizeBytes(clip);
+
+    CpuTimer compressTimer;
+    const CompressedClip compressed = CompressClip(clip, bindPose, settings);
+    r.compressMs = compressTimer.ElapsedMs();
+    r.compressedBytes = compressed.SizeBytes();
+
+    // Instances are spread over the clip so they don't share keys.
+    const float stagger = clip.duration / float(instances);
+    const double poses = double(frames) * instances;
+    SceneGraph graph = bindPose;
+    CpuTimer rawTimer;
+    for (int frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < instances; i++)
+            SampleClip(clip, frame * dt + i * stagger, graph);
+    }
+    r.rawPosesPerSec = poses / (std::max(rawTimer.ElapsedMs(), 1e-6) / 1000.0);
+
+    std::vector<Matrix> scratch;
+    CpuTimer compressedTimer;
+    for (int frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < instances; i++)
+            SampleCompressedClip(compressed, frame * dt + i * stagger, graph, scratch);
+    }
+    r.compressedPosesPerSec =
+        poses / (std::max(compressedTimer.ElapsedMs(), 1e-6) / 1000.0);
+
+    SceneGraph raw = bindPose;
+    for (int frame = 0; frame < frames; frame++) {
+        SampleClip(clip, frame * dt, raw);
+        raw.UpdateTransforms();
+        SampleCompressedClip(compressed, frame * dt, graph, scratch);
+        graph.UpdateTransforms();
+        for (uint32_t n = 0; n < graph.NodeCount(); n++) {
+            r.maxError = std::max(
+                r.maxError,
+                (raw.World(n).Translation() - graph.World(n).Translation()).Length());
+        }
+    }
+    return r;
+}
+
+std::string Escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+        if ((unsigned char)c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+            out += code;
+            continue;
+        }
+        if (c == '"' || c == '\\')
+            out.push_back('\\');
+        out.push_back(c);
+    }
+    return out;
+}
+
+void WriteJson(FILE *out, const std::vector<ModelResult> &results, int frames,
+               int instances) {
+    fprintf(out, "{\n  \"frames\": %d,\n  \"instances\": %d,\n  \"models\": [\n",
+            frames, instances);
+    for (size_t m = 0; m < results.size(); m++) {
+        const ModelResult &r = results[m];
+        const double skinSeconds = std::max(r.skinMs, 1e-6) / 1000.0;
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"path\": \"%s\",\n", Escape(r.path).c_str());
+        fprintf(out, "      \"skinnedMeshes\": %zu,\n", r.skinnedMeshes);
+        fprintf(out, "      \"skinnedVertices\": %zu,\n", r.skinnedVertices);
+        fprintf(out, "      \"joints\": %zu,\n", r.joints);
+        fprintf(out, "      \"clips\": %zu,\n", r.clips);
+        fprintf(out,
+                "      \"frameMs\": {\"sample\": %.4f, \"transforms\": %.4f, "
+                "\"skin\": %.4f},\n",
+                r.sampleMs / frames, r.transformsMs / frames, r.skinMs / frames);
+        fprintf(out, "      \"verticesPerSec\": %.1f,\n",
+                double(r.skinnedVertices) * frames / skinSeconds);
+        fprintf(out, "      \"maxError\": %g,\n", double(r.maxError));
+        fprintf(out,
+                "      \"morph\": {\"meshes\": %zu, \"targets\": %zu, "
+                "\"vertices\": %zu, \"frameMs\": %.4f},\n",
+                r.morphedMeshes, r.morphTargets, r.morphedVertices,
+                r.morphMs / frames);
+        fprintf(out, "      \"clips\": [\n");
+        for (size_t c = 0; c < r.clipResults.size(); c++) {
+            const ClipResult &clip = r.clipResults[c];
+            fprintf(out,
+                    "        {\"name\": \"%s\", \"rawBytes\": %zu, "
+                    "\"compressedBytes\": %zu, \"compressMs\": %.3f, "
+                    "\"rawPosesPerSec\": %.1f, \"compressedPosesPerSec\": %.1f, "
+                    "\"maxJointError\": %g}%s\n",
+                    Escape(clip.name).c_str(), clip.rawBytes, clip.compressedBytes,
+                    clip.compressMs, clip.rawPosesPerSec, clip.compressedPosesPerSec,
+                    double(clip.maxError), c + 1 < r.clipResults.size() ? "," : "");
+        }
+        fprintf(out, "      ]\n");
+        fprintf(out, "    }%s\n", m + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+void PrintUsage() {
+    fprintf(stderr,
+            "usage: SkinBench [-n frames] [-dt seconds] [-instances count] "
+            "[-precision fraction] [-o result.json] model...\n");
+}
+}
+
+int main(int argc, char **argv) {
+    int frames = 600;
+    float dt = 1.0f / 60.0f;
+    int instances = 100;
+    ClipCompression compression;
+    std::string outPath;
+    std::vector<std::string> models;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            frames = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-dt" && i + 1 < argc) {
+            dt = float(atof(argv[++i]));
+        } else if (arg == "-instances" && i + 1 < argc) {
+            instances = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-precision" && i + 1 < argc) {
+            compression.precision = float(atof(argv[++i]));
+        } else if (arg == "-o" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage();
+            return 0;
+        } else {
+            models.push_back(arg);
+        }
+    }
+
+    if (models.empty()) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<ModelResult> results;
+    for (const auto &model : models) {
+        const std::filesystem::path path = std::filesystem::absolute(model);
+        ModelResult result;
+        result.path = path.string();
+
+        ModelAnimation animation;
+        const auto meshes = GeometryGenerator::ReadFromFile(
+            path.parent_path().string(), path.filename().string(), nullptr,
+            &animation);
+
+        std::vector<const MeshData *> skinned;
+        std::vector<const MeshData *> morphed;
+        for (const auto &mesh : meshes) {
+            if (!mesh.morphTargets.empty()) {
+                morphed.push_back(&mesh);
+                result.morphTargets += mesh.morphTargets.size();
+            }
+            if (mesh.skin.weights.empty())
+                continue;
+            skinned.push_back(&mesh);
+            result.skinnedVertices += mesh.vertices.size();
+            result.joints += mesh.skin.inverseBind.size();
+        }
+        result.skinnedMeshes = skinned.size();
+        result.clips = animation.clips.size();
+        result.morphedMeshes = morphed.size();
+        if (skinned.empty() && morphed.empty() && animation.clips.empty()) {
+            fprintf(stderr, "no skinned or morphed meshes or clips in %s\n",
+                    result.path.c_str());
+            return 1;
+        }
+
+        // Before the skinning loop poses the graph.
+        for (const AnimationClip &clip : animation.clips)
+            result.clipResults.push_back(BenchClip(clip, animation.graph, frames,
+                                                   instances, dt, compression));
+
+        std::vector<std::vector<Matrix>> joints(skinned.size());
+        std::vector<std::vector<Vertex>> outputs(skinned.size());
+        for (size_t s = 0; s < skinned.size(); s++)
+            outputs[s].resize(skinned[s]->vertices.size());
+
+        for (int frame = 0; frame < frames; frame++) {
+            CpuTimer sampleTimer;
+            if (!animation.clips.empty())
+                SampleClip(animation.clips[0], frame * dt, animation.graph);
+            result.sampleMs += sampleTimer.ElapsedMs();
+
+            CpuTimer transformsTimer;
+            animation.graph.UpdateTransforms();
+            for (size_t s = 0; s < skinned.size(); s++)
+                ComputeJointMatrices(skinned[s]->skin, animation.graph,
+                                     animation.root, joints[s]);
+            result.transformsMs += transformsTimer.ElapsedMs();
+
+            CpuTimer skinTimer;
+            for (size_t s = 0; s < skinned.size(); s++)
+                SkinMesh(*skinned[s], joints[s], outputs[s].data());
+            result.skinMs += skinTimer.ElapsedMs();
+
+            for (size_t s = 0; s < skinned.size(); s++)
+                result.maxError =
+                    std::max(result.maxError,
+                             MaxReferenceError(*skinned[s], joints[s], outputs[s]));
+        }
+
+        std::vector<std::vector<VertexRange>> ranges(morphed.size());
+        std::vector<std::vector<Vertex>> morphOutputs(morphed.size());
+        for (size_t m = 0; m < morphed.size(); m++) {
+            ranges[m] = MorphedRanges(*morphed[m]);
+            morphOutputs[m] = morphed[m]->vertices;
+            for (const VertexRange &range : ranges[m])
+                result.morphedVertices += range.end - range.begin;
+        }
+        std::vector<float> weights;
+        for (int frame = 0; frame < frames; frame++) {
+            for (size_t m = 0; m < morphed.size(); m++) {
+                weights.resize(morphed[m]->morphTargets.size());
+                for (size_t t = 0; t < weights.size(); t++)
+                    weights[t] = 0.5f + 0.5f * std::sin(frame * dt * 2.0f + float(t));
+
+                CpuTimer morphTimer;
+                ApplyMorphTargets(*morphed[m], weights.data(), ranges[m],
+                                  morphOutputs[m].data());
+                result.morphMs += morphTimer.ElapsedMs();
+            }
+        }
+
+        results.push_back(std::move(result));
+    }
+
+    FILE *out = stdout;
+    if (!outPath.empty()) {
+        out = fopen(outPath.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", outPath.c_str());
+            return 1;
+        }
+    }
+
+    WriteJson(out, results, frames, instances);
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
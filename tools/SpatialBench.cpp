@@ -0,0 +1,312 @@
+// Headless spatial index benchmark. No window or D3D device is created.
+//
+//   SpatialBench [-objects N] [-queries N] [-seed N] [-extent E]
+//                [-radius R] [-moved fraction] [-cell size] [-o result.json]
+//
+// Places the objects of a StressSceneGenerator scene, with bounds computed
+// the way ModelLoader does, and times SpatialGrid against brute force:
+// Build, moving a fraction of the objects per frame with Update, and box,
+// sphere and frustum queries at random places. Every query result is
+// checked against the brute force one. The frustum queries also time
+// CullSpheres over all objects, the per-object culler the app uses.
+//
+// Build on Linux with tools/CMakeLists.txt, like LoaderBench.
+
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "PerfStats.h"
+#include "SpatialGrid.h"
+#include "StressScene.h"
+
+namespace {
+
+using namespace hlab;
+using DirectX::SimpleMath::Vector3;
+
+struct QueryResult {
+    const char *name = "";
+    double gridMs = 0.0;
+    double bruteMs = 0.0;
+    double cullSpheresMs = 0.0; // frustum only
+    size_t results = 0;
+    size_t mismatches = 0;
+};
+
+struct BenchResult {
+    size_t objects = 0;
+    float cellSize = 0.0f;
+    size_t cells = 0;
+    double buildMs = 0.0;
+    size_t movedPerFrame = 0;
+    double updateMs = 0.0; // per frame
+    std::vector<QueryResult> queries;
+};
+
+bool Overlaps(const MeshBounds &b, const Aabb &box) {
+    return b.aabbMin.x <= box.max.x && b.aabbMax.x >= box.min.x &&
+           b.aabbMin.y <= box.max.y && b.aabbMax.y >= box.min.y &&
+           b.aabbMin.z <= box.max.z && b.aabbMax.z >= box.min.z;
+}
+
+bool InSphere(const MeshBounds &b, const Vector3 &center, float radius) {
+    const Vector3 p = Vector3::Max(b.aabbMin, Vector3::Min(center, b.aabbMax));
+    return (p - center).LengthSquared() <= radius * radius;
+}
+
+bool InFrustum(const MeshBounds &b, const Frustum &frustum) {
+    for (const auto &p : frustum.planes) {
+        const float far = p.x * (p.x >= 0.0f ? b.aabbMax.x : b.aabbMin.x) +
+                          p.y * (p.y >= 0.0f ? b.aabbMax.y : b.aabbMin.y) +
+                          p.z * (p.z >= 0.0f ? b.aabbMax.z : b.aabbMin.z) + p.w;
+        if (far < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// Runs query(q, grid results) and brute(q, brute results) for every query
+// and compares the sorted id lists.
+template <typename Query, typename Brute>
+QueryResult BenchQueries(const char *name, int queries, Query &&query,
+                         Brute &&brute) {
+    QueryResult r;
+    r.name = name;
+    std::vector<uint32_t> gridIds;
+    std::vector<uint32_t> bruteIds;
+    for (int q = 0; q < queries; q++) {
+        gridIds.clear();
+        bruteIds.clear();
+
+        CpuTimer gridTimer;
+        query(q, gridIds);
+        r.gridMs += gridTimer.ElapsedMs();
+
+        CpuTimer bruteTimer;
+        brute(q, bruteIds);
+        r.bruteMs += bruteTimer.ElapsedMs();
+
+        std::sort(gridIds.begin(), gridIds.end());
+        if (gridIds != bruteIds)
+            r.mismatches++;
+        r.results += bruteIds.size();
+    }
+    return r;
+}
+
+void WriteJson(FILE *out, const BenchResult &r, int queries) {
+    fprintf(out, "{\n  \"objects\": %zu,\n  \"queries\": %d,\n", r.objects, queries);
+    fprintf(out, "  \"cellSize\": %.3f,\n  \"cells\": %zu,\n", double(r.cellSize),
+            r.cells);
+    fprintf(out, "  \"buildMs\": %.3f,\n", r.buildMs);
+    fprintf(out, "  \"update\": {\"movedPerFrame\": %zu, \"frameMs\": %.4f},\n",
+            r.movedPerFrame, r.updateMs);
+    fprintf(out, "  \"queries\": [\n");
+    for (size_t i = 0; i < r.queries.size(); i++) {
+        const QueryResult &q = r.queries[i];
+        fprintf(out,
+                "    {\"type\": \"%s\", \"gridMs\": %.4f, \"bruteMs\": %.4f, "
+                "\"speedup\": %.2f, \"cullSpheresMs\": %.4f, "
+                "\"resultsPerQuery\": %.1f, \"mismatches\": %zu}%s\n",
+                q.name, q.gridMs / queries, q.bruteMs / queries,
+                q.bruteMs / std::max(q.gridMs, 1e-6), q.cullSpheresMs / queries,
+                double(q.results) / queries, q.mismatches,
+                i + 1 < r.queries.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+void PrintUsage() {
+    fprintf(stderr,
+            "usage: SpatialBench [-objects N] [-queries N] [-seed N] "
+            "[-extent E] [-radius R] [-moved fraction] [-cell size] "
+            "[-o result.json]\n");
+}
+}
+
+int main(int argc, char **argv) {
+    StressSceneDesc desc;
+    desc.meshCount = 100000;
+    desc.maxTriangles = 2000;
+    desc.extent = 500.0f;
+    int queries = 1000;
+    float radius = 0.0f;
+    float moved = 0.1f;
+    float cellSize = 0.0f;
+    std::string outPath;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-objects" && hasValue) {
+            desc.meshCount = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-queries" && hasValue) {
+            queries = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-seed" && hasValue) {
+            desc.seed = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "-extent" && hasValue) {
+            desc.extent = float(atof(argv[++i]));
+        } else if (arg == "-radius" && hasValue) {
+            radius = float(atof(argv[++i]));
+        } else if (arg == "-moved" && hasValue) {
+            moved = std::min(std::max(float(atof(argv[++i])), 0.0f), 1.0f);
+        } else if (arg == "-cell" && hasValue) {
+            cellSize = float(atof(argv[++i]));
+        } else if (arg == "-o" && hasValue) {
+            outPath = argv[++i];
+        } else {
+            PrintUsage();
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+    if (radius <= 0.0f)
+        radius = desc.extent * 0.05f;
+
+    // A few dozen geometries placed many times, like a level built from a
+    // kit of props.
+    desc.instancingRatio = 1.0f - 64.0f / float(desc.meshCount);
+    const StressScene scene = StressSceneGenerator::Generate(desc);
+    std::vector<MeshBounds> bounds(scene.instances.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+        const StressInstance &instance = scene.instances[i];
+        bounds[i] = scene.geometries[instance.geometry].bounds.Transformed(
+            instance.transform);
+    }
+
+    BenchResult result;
+    result.objects = bounds.size();
+
+    SpatialGrid grid(cellSize);
+    const int kBuilds = 5;
+    for (int b = 0; b < kBuilds; b++) {
+        CpuTimer buildTimer;
+        grid.Build(bounds);
+        result.buildMs += buildTimer.ElapsedMs() / kBuilds;
+    }
+    result.cellSize = grid.CellSize();
+    result.cells = grid.CellCount();
+
+    std::mt19937 rng(desc.seed);
+    const auto range = [&](float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng);
+    };
+    const auto randomPoint = [&]() {
+        return Vector3(range(-desc.extent, desc.extent),
+                       range(-desc.extent, desc.extent),
+                       range(-desc.extent, desc.extent));
+    };
+
+    // Objects drift by up to a tenth of the query radius per frame.
+    const int kFrames = 60;
+    const size_t step = moved > 0.0f ? std::max<size_t>(1, size_t(1.0f / moved)) : 0;
+    for (int frame = 0; step && frame < kFrames; frame++) {
+        const float drift = radius * 0.1f;
+        size_t count = 0;
+        CpuTimer updateTimer;
+        for (size_t i = frame % step; i < bounds.size(); i += step) {
+            const Vector3 d(range(-drift, drift), range(-drift, drift),
+                            range(-drift, drift));
+            bounds[i].aabbMin += d;
+            bounds[i].aabbMax += d;
+            bounds[i].center += d;
+            grid.Update(uint32_t(i), bounds[i]);
+            count++;
+        }
+        result.updateMs += updateTimer.ElapsedMs() / kFrames;
+        result.movedPerFrame = count;
+    }
+
+    std::vector<Vector3> centers(queries);
+    std::vector<Aabb> boxes(queries);
+    for (int q = 0; q < queries; q++) {
+        centers[q] = randomPoint();
+        boxes[q].min = centers[q] - Vector3(radius);
+        boxes[q].max = centers[q] + Vector3(radius);
+    }
+
+    result.queries.push_back(BenchQueries(
+        "aabb", queries,
+        [&](int q, std::vector<uint32_t> &ids) {
+            grid.QueryAabb(boxes[q], [&](uint32_t id) { ids.push_back(id); });
+        },
+        [&](int q, std::vector<uint32_t> &ids) {
+            for (uint32_t i = 0; i < uint32_t(bounds.size()); i++) {
+                if (Overlaps(bounds[i], boxes[q]))
+                    ids.push_back(i);
+            }
+        }));
+
+    result.queries.push_back(BenchQueries(
+        "sphere", queries,
+        [&](int q, std::vector<uint32_t> &ids) {
+            grid.QuerySphere(centers[q], radius,
+                             [&](uint32_t id) { ids.push_back(id); });
+        },
+        [&](int q, std::vector<uint32_t> &ids) {
+            for (uint32_t i = 0; i < uint32_t(bounds.size()); i++) {
+                if (InSphere(bounds[i], centers[q], radius))
+                    ids.push_back(i);
+            }
+        }));
+
+    // Cameras looking in random directions, seeing four query radii far.
+    std::vector<Frustum> frustums(queries);
+    for (int q = 0; q < queries; q++) {
+        const Matrix view = Matrix::CreateTranslation(-centers[q]) *
+                            Matrix::CreateRotationY(range(0.0f, DirectX::XM_2PI)) *
+                            Matrix::CreateRotationX(range(-0.5f, 0.5f));
+        const Matrix projection = DirectX::XMMatrixPerspectiveFovLH(
+            DirectX::XMConvertToRadians(70.0f), 16.0f / 9.0f, 0.1f, radius * 4.0f);
+        frustums[q] = Frustum::FromViewProjection(view * projection);
+    }
+    QueryResult frustum = BenchQueries(
+        "frustum", queries,
+        [&](int q, std::vector<uint32_t> &ids) {
+            grid.QueryFrustum(frustums[q], [&](uint32_t id) { ids.push_back(id); });
+        },
+        [&](int q, std::vector<uint32_t> &ids) {
+            const Aabb region = SpatialGrid::FrustumBounds(frustums[q]);
+            for (uint32_t i = 0; i < uint32_t(bounds.size()); i++) {
+                if (Overlaps(bounds[i], region) && InFrustum(bounds[i], frustums[q]))
+                    ids.push_back(i);
+            }
+        });
+    SphereSoA spheres;
+    spheres.Resize(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++)
+        spheres.Set(i, bounds[i].center, bounds[i].radius);
+    std::vector<uint32_t> visible;
+    for (int q = 0; q < queries; q++) {
+        visible.clear();
+        CpuTimer cullTimer;
+        CullSpheres(frustums[q], spheres, visible);
+        frustum.cullSpheresMs += cullTimer.ElapsedMs();
+    }
+    result.queries.push_back(frustum);
+
+    FILE *out = stdout;
+    if (!outPath.empty()) {
+        out = fopen(outPath.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", outPath.c_str());
+            return 1;
+        }
+    }
+
+    WriteJson(out, result, queries);
+
+    if (out != stdout)
+        fclose(out);
+
+    for (const QueryResult &q : result.queries) {
+        if (q.mismatches)
+            return 1;
+    }
+    return 0;
+}
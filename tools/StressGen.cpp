@@ -0,0 +1,53 @@
+// Writes a reproducible synthetic stress scene built from GeometryGenerator
+// primitives. The output format follows the file extension
+// (.obj, .fbx, .gltf, .glb).
+//
+//   StressGen [-seed N] [-meshes N] [-materials N] [-min-tris N]
+//             [-max-tris N] [-instancing R] [-extent E] output
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "StressScene.h"
+
+int main(int argc, char **argv) {
+    hlab::StressSceneDesc desc;
+    std::string outPath;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "-seed" && hasValue)
+            desc.seed = uint32_t(strtoul(argv[++i], nullptr, 10));
+        else if (arg == "-meshes" && hasValue)
+            desc.meshCount = atoi(argv[++i]);
+        else if (arg == "-materials" && hasValue)
+            desc.materialCount = atoi(argv[++i]);
+        else if (arg == "-min-tris" && hasValue)
+            desc.minTriangles = uint32_t(strtoul(argv[++i], nullptr, 10));
+        else if (arg == "-max-tris" && hasValue)
+            desc.maxTriangles = uint32_t(strtoul(argv[++i], nullptr, 10));
+        else if (arg == "-instancing" && hasValue)
+            desc.instancingRatio = float(atof(argv[++i]));
+        else if (arg == "-extent" && hasValue)
+            desc.extent = float(atof(argv[++i]));
+        else
+            outPath = arg;
+    }
+
+    const std::string formatId =
+        hlab::StressSceneGenerator::FormatIdFromExtension(outPath);
+    if (outPath.empty() || formatId.empty()) {
+        fprintf(stderr, "usage: StressGen [options] output.{obj|fbx|gltf|glb}\n");
+        return 1;
+    }
+
+    const hlab::StressScene scene = hlab::StressSceneGenerator::Generate(desc);
+    printf("%zu objects, %zu geometries, %d materials, %zu triangles\n",
+           scene.instances.size(), scene.geometries.size(),
+           scene.materialCount, scene.TriangleCount());
+
+    return hlab::StressSceneGenerator::Export(scene, outPath, formatId) ? 0 : 1;
+}
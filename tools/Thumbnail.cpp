@@ -0,0 +1,203 @@
+// Renders model thumbnails with the software renderer. No window or D3D
+// device is created. The camera, material and light match ExampleApp's
+// startup state.
+//
+//   Thumbnail [-s size] [-o outdir] [-l list.txt] [-notex] model...
+//
+// Each model is written to outdir as <name>_<path hash>.png.
+//
+// Build with tools/CMakeLists.txt, like LoaderBench.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "GeometryGenerator.h"
+#include "Hash.h"
+#include "Image.h"
+#include "Parallel.h"
+#include "PerfStats.h"
+#include "SoftwareRenderer.h"
+
+namespace {
+
+using namespace hlab;
+using DirectX::SimpleMath::Matrix;
+
+void PrintUsage() {
+    fprintf(stderr, "usage: Thumbnail [-s size] [-o outdir] [-l list.txt] "
+                    "[-notex] model...\n");
+}
+
+void SetupConstants(float aspect, bool useTexture,
+                    BasicVertexConstantBuffer &vs,
+                    BasicPixelConstantBuffer &ps) {
+    using namespace DirectX;
+
+    const Matrix model = Matrix::CreateScale(Vector3(1.8f)) *
+                         Matrix::CreateRotationX(-0.286f) *
+                         Matrix::CreateRotationY(0.058f);
+    const Matrix view = Matrix::CreateTranslation(0.0f, 0.0f, 2.0f);
+    const Matrix projection = XMMatrixPerspectiveFovLH(
+        XMConvertToRadians(70.0f), aspect, 0.01f, 100.0f);
+
+    // Same construction and transposes as ExampleApp::Update.
+    vs.model = model.Transpose();
+    vs.invTranspose = vs.model;
+    vs.invTranspose.Translation(Vector3(0.0f));
+    vs.invTranspose = vs.invTranspose.Transpose().Invert();
+    vs.view = view.Transpose();
+    vs.projection = projection.Transpose();
+
+    ps = BasicPixelConstantBuffer();
+    ps.eyeWorld = Vector3::Transform(Vector3(0.0f), view.Invert());
+    ps.useTexture = useTexture ? 1 : 0;
+    ps.material.diffuse = Vector3(0.8f);
+    ps.material.specular = Vector3(1.0f);
+    for (int i = 0; i < MAX_LIGHTS; i++)
+        ps.lights[i].strength = Vector3(i == 0 ? 1.0f : 0.0f);
+}
+
+std::string OrmFor(const MeshData &mesh) {
+    if (!mesh.ormFilename.empty())
+        return mesh.ormFilename;
+    std::string orm = mesh.baseColorFilename;
+    const auto pos = orm.find("BaseColor");
+    if (pos == std::string::npos)
+        return std::string();
+    orm.replace(pos, 9, "ORM");
+    return std::filesystem::exists(orm) ? orm : std::string();
+}
+}
+
+int main(int argc, char **argv) {
+    int size = 256;
+    bool useTexture = true;
+    std::filesystem::path outDir = ".";
+    std::vector<std::string> models;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-s" && i + 1 < argc) {
+            size = std::max(16, atoi(argv[++i]));
+        } else if (arg == "-o" && i + 1 < argc) {
+            outDir = argv[++i];
+        } else if (arg == "-l" && i + 1 < argc) {
+            std::ifstream list(argv[++i]);
+            std::string line;
+            while (std::getline(list, line)) {
+                if (!line.empty() && line[0] != '#')
+                    models.push_back(line);
+            }
+        } else if (arg == "-notex") {
+            useTexture = false;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage();
+            return 0;
+        } else {
+            models.push_back(arg);
+        }
+    }
+
+    if (models.empty()) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(outDir, ec);
+
+    SoftwareRenderer renderer;
+    renderer.Resize(size, size);
+
+    BasicVertexConstantBuffer vsConstants;
+    BasicPixelConstantBuffer psConstants;
+    SetupConstants(1.0f, useTexture, vsConstants, psConstants);
+
+    CpuTimer totalTimer;
+    int written = 0;
+
+    for (const auto &model : models) {
+        const std::filesystem::path path = std::filesystem::absolute(model);
+        CpuTimer timer;
+
+        auto meshes = GeometryGenerator::ReadFromFile(
+            path.parent_path().string(), path.filename().string());
+        if (meshes.empty()) {
+            fprintf(stderr, "no meshes loaded from %s\n", path.string().c_str());
+            continue;
+        }
+        const double loadMs = timer.ElapsedMs();
+
+        // Decode each distinct texture once, in parallel.
+        std::map<std::string, ImageData> textures;
+        std::vector<std::string> orms(meshes.size());
+        if (useTexture) {
+            for (size_t i = 0; i < meshes.size(); i++) {
+                orms[i] = OrmFor(meshes[i]);
+                for (const auto *name : {&meshes[i].baseColorFilename,
+                                         &meshes[i].normalFilename, &orms[i]}) {
+                    if (!name->empty())
+                        textures[*name];
+                }
+            }
+        }
+        std::vector<std::pair<const std::string, ImageData> *> pending;
+        for (auto &entry : textures)
+            pending.push_back(&entry);
+        ParallelFor(pending.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                LoadImageRGBA(pending[i]->first, pending[i]->second);
+        });
+
+        auto find = [&](const std::shared_ptr<const ImageData> &image,
+                        const std::string &name) -> const ImageData * {
+            if (image)
+                return image.get();
+            auto it = textures.find(name);
+            return it == textures.end() || it->second.pixels.empty()
+                       ? nullptr
+                       : &it->second;
+        };
+
+        CpuTimer renderTimer;
+        renderer.Clear(Vector4(0.0f, 0.0f, 0.0f, 1.0f));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            SoftwareMaterial material;
+            material.baseColor =
+                find(meshes[i].baseColorImage, meshes[i].baseColorFilename);
+            material.normal = find(meshes[i].normalImage, meshes[i].normalFilename);
+            material.orm = find(meshes[i].ormImage, orms[i]);
+            renderer.Draw(meshes[i], material, vsConstants, psConstants);
+        }
+        renderer.Flush();
+        const double renderMs = renderTimer.ElapsedMs();
+
+        // Models from different folders can share a name, so the hash of
+        // the full path keeps their thumbnails apart.
+        const std::string source = path.lexically_normal().generic_string();
+        const auto outPath =
+            outDir / (path.stem().string() + "_" +
+                      HashToString(HashBytes(source.data(), source.size())) + ".png");
+        if (!WritePng(outPath.string(), renderer.Target())) {
+            fprintf(stderr, "cannot write %s\n", outPath.string().c_str());
+            continue;
+        }
+        written++;
+
+        printf("%s: load %.1f ms, render %.1f ms, total %.1f ms\n",
+               outPath.string().c_str(), loadMs, renderMs, timer.ElapsedMs());
+    }
+
+    const double seconds = totalTimer.ElapsedMs() / 1000.0;
+    printf("%d thumbnails in %.2f s (%.0f per hour, %u threads)\n", written,
+           seconds, seconds > 0.0 ? written * 3600.0 / seconds : 0.0,
+           ThreadPool::Get().ThreadCount());
+    return written == int(models.size()) ? 0 : 1;
+}